@@ -0,0 +1,488 @@
+/*
+ * fitsio-bench.i --
+ *
+ * Benchmarks for the main input/output routines of the Yorick interface to
+ * CFITSIO library.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2015-2018 Éric Thiébaut (https://github.com/emmt/YFITSIO).
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+/* When run by "make bench" (which sets YFITSIO_BENCH in the environment),
+   the plug-in and "fitsio.i" are taken from the build and source directories
+   rather than from the installed ones and the benchmarks are run with the
+   arguments of the command line (see the end of this file). */
+_fitsio_bench_batch = (batch() && get_env("YFITSIO_BENCH") == "1");
+if (_fitsio_bench_batch) {
+  plug_dir, _(".", plug_dir());
+  include, regsub("[^/]*$", current_include(), "") + "fitsio.i", 1;
+} else if (! is_func(fitsio_open_file)) {
+  include, "fitsio.i", 1;
+}
+
+func fitsio_bench(which, dir=, size=, rows=, hdus=, keys=, repeat=,
+                  nthreads=, out=, keep=)
+/* DOCUMENT fitsio_bench;
+         or fitsio_bench, which, dir=..., size=..., rows=..., out=...;
+
+     Run benchmarks of the main input/output routines of the plug-in on
+     synthetic FITS files and print the results.  Optional argument WHICH is
+     a list of the groups of benchmarks to run among "img" (images of every
+     BITPIX, scaled or not, compressed or not, written by
+     `fitsio_write_img` and read by `fitsio_read_img`), "tbl" (narrow and
+     wide binary tables written by `fitsio_write_col` and read by
+     `fitsio_read_col` and `fitsio_read_cols`) and "hdr" (multi-extension
+     file with many HDUs whose headers are read by `fitsio_read_header` and
+     many files whose primary header is read with or without header-only
+     handles).  All groups are run by default.
+
+     The results are printed (or written in the file whose name is given by
+     keyword OUT) as tab separated values, one line per benchmark with the
+     following columns:
+
+         case      - the name of the synthetic data;
+         entry     - the benchmarked routine and its options;
+         bytes     - the number of bytes of data processed;
+         seconds   - the elapsed time (the best of REPEAT runs);
+         MB/s      - the throughput in megabytes (10^6 bytes) per second;
+         rows/s    - the number of table rows per second;
+         cards/s   - the number of header cards per second;
+         peak_kB   - the peak resident memory during the benchmark.
+
+     Fields which do not apply are set to "-".  The peak resident memory is
+     only available on Linux (it is reset before each benchmark if the
+     system supports it, otherwise it is the peak for the whole process).
+
+     Keywords:
+         DIR      - directory for the synthetic files (default is $TMPDIR or
+                    "/tmp");
+         SIZE     - the length of the sides of the images (default 2048);
+         ROWS     - the number of rows of the tables (default 1000000);
+         HDUS     - the number of HDUs of the multi-extension file and the
+                    number of files whose primary header is read with
+                    header-only handles (default 200);
+         KEYS     - the number of keywords in each of these HDUs (default
+                    100);
+         REPEAT   - the number of runs of each benchmark (default 3);
+         NTHREADS - the number of threads passed to the routines (default is
+                    set by `fitsio_setup`);
+         KEEP     - keep the synthetic files if true.
+
+     From the source directory the benchmarks are run by:
+
+         make bench
+
+     and options can be given as a list of KEY=VALUE words in BENCH_ARGS:
+
+         make bench BENCH_ARGS="img size=4096 nthreads=4"
+
+
+   SEE ALSO: fitsio_read_img, fitsio_write_img, fitsio_read_col,
+             fitsio_read_header, fitsio_setup.
+ */
+{
+  if (is_void(dir)) {
+    dir = get_env("TMPDIR");
+    if (! dir) dir = "/tmp";
+  }
+  if (strpart(dir, 0:0) != "/") dir += "/";
+  if (is_void(size)) size = 2048;
+  if (is_void(rows)) rows = 1000000;
+  if (is_void(hdus)) hdus = 200;
+  if (is_void(keys)) keys = 100;
+  if (is_void(repeat)) repeat = 3;
+  if (is_void(which)) which = ["img", "tbl", "hdr"];
+
+  extern _fitsio_bench_out, _fitsio_bench_repeat, _fitsio_bench_files;
+  _fitsio_bench_out = (is_void(out) ? [] : create(out));
+  _fitsio_bench_repeat = repeat;
+  _fitsio_bench_files = [];
+  _fitsio_bench_print, swrite(format="# yfitsio benchmarks, CFITSIO %.3f",
+                              fitsio_get_version());
+  _fitsio_bench_print, ("case\tentry\tbytes\tseconds\tMB/s\trows/s\t" +
+                        "cards/s\tpeak_kB");
+  for (i = 1; i <= numberof(which); ++i) {
+    if (which(i) == "img") {
+      _fitsio_bench_img, dir, size, nthreads;
+    } else if (which(i) == "tbl") {
+      _fitsio_bench_tbl, dir, rows, nthreads;
+    } else if (which(i) == "hdr") {
+      _fitsio_bench_hdr, dir, hdus, keys;
+    } else {
+      error, "unknown group of benchmarks \"" + which(i) + "\"";
+    }
+  }
+  if (! keep) {
+    for (i = 1; i <= numberof(_fitsio_bench_files); ++i) {
+      remove, _fitsio_bench_files(i);
+    }
+  }
+  if (! is_void(_fitsio_bench_out)) close, _fitsio_bench_out;
+  _fitsio_bench_out = [];
+}
+
+func _fitsio_bench_img(dir, size, nthreads)
+{
+  bitpix = [8, 16, 32, 64, -32, -64];
+  for (i = 1; i <= numberof(bitpix); ++i) {
+    b = bitpix(i);
+    arr = _fitsio_bench_image(b, size);
+    bytes = double(sizeof(arr));
+    for (k = 1; k <= 3; ++k) {
+      /* Variants: plain, scaled (integers only) and tile-compressed. */
+      if (k == 2 && b < 0) continue;
+      name = swrite(format="img%s%d", (b < 0 ? "_f" : "_i"), abs(b)) +
+        ["", "_scaled", "_compressed"](k);
+      path = _fitsio_bench_path(dir, name);
+      compress = (k == 3 ? (b < 0 ? "gzip" : "rice") : []);
+
+      /* Writing. */
+      best = [];
+      for (r = 1; r <= _fitsio_bench_repeat; ++r) {
+        fh = fitsio_create_file("!" + path);
+        fitsio_create_img, fh, b, dimsof(arr), compress=compress;
+        _fitsio_bench_tic;
+        fitsio_write_img, fh, arr, nthreads=nthreads;
+        best = _fitsio_bench_best(best, _fitsio_bench_toc());
+        if (k == 2) {
+          fitsio_write_key, fh, "BSCALE", 2.0, "benchmark scaling";
+          fitsio_write_key, fh, "BZERO", 1.0, "benchmark offset";
+        }
+        fitsio_write_chksum, fh;
+        fitsio_close_file, fh;
+      }
+      _fitsio_bench_report, name, "fitsio_write_img", bytes, best;
+
+      /* Reading by the various paths. */
+      _fitsio_bench_read_img, name, "fitsio_read_img", path, nthreads,
+        bytes, 0, 0;
+      if (k != 3) {
+        _fitsio_bench_read_img, name, "fitsio_read_img,direct=1", path,
+          nthreads, bytes, 1, 0;
+        _fitsio_bench_read_img, name, "fitsio_read_img,chksum=1", path,
+          nthreads, bytes, 0, 1;
+      }
+    }
+  }
+}
+
+func _fitsio_bench_read_img(name, entry, path, nthreads, bytes,
+                            direct, chksum)
+{
+  best = [];
+  for (r = 1; r <= _fitsio_bench_repeat; ++r) {
+    fh = fitsio_open_image(path, direct=direct);
+    _fitsio_bench_tic;
+    arr = fitsio_read_img(fh, chksum=(chksum ? 1n : []),
+                          nthreads=nthreads);
+    best = _fitsio_bench_best(best, _fitsio_bench_toc());
+    arr = [];
+    fitsio_close_file, fh;
+  }
+  _fitsio_bench_report, name, entry, bytes, best;
+}
+
+func _fitsio_bench_tbl(dir, rows, nthreads)
+{
+  for (k = 1; k <= 2; ++k) {
+    if (k == 1) {
+      /* Narrow table: a few scalar columns. */
+      name = "tbl_narrow";
+      ttype = ["ID", "FLUX", "FLAG"];
+      tform = ["1J", "1D", "1I"];
+    } else {
+      /* Wide table: many columns of various types. */
+      name = "tbl_wide";
+      ncols = 64;
+      ttype = swrite(format="COL%d", indgen(ncols));
+      tform = ["1J", "1E", "1D", "1I", "1K", "2E", "4B", "1L"];
+      tform = tform((indgen(ncols) - 1)%numberof(tform) + 1);
+    }
+    cols = _fitsio_bench_columns(tform, rows);
+    bytes = 0.0;
+    for (j = 1; j <= numberof(cols); ++j) {
+      bytes += sizeof(*cols(j));
+    }
+    path = _fitsio_bench_path(dir, name);
+
+    best = [];
+    for (r = 1; r <= _fitsio_bench_repeat; ++r) {
+      fh = fitsio_create_file("!" + path);
+      fitsio_create_tbl, fh, ttype, tform;
+      _fitsio_bench_tic;
+      for (j = 1; j <= numberof(cols); ++j) {
+        fitsio_write_col, fh, j, *cols(j), 1, nthreads=nthreads;
+      }
+      best = _fitsio_bench_best(best, _fitsio_bench_toc());
+      fitsio_close_file, fh;
+    }
+    _fitsio_bench_report, name, "fitsio_write_col", bytes, best, rows=rows;
+
+    best = [];
+    for (r = 1; r <= _fitsio_bench_repeat; ++r) {
+      fh = fitsio_open_table(path);
+      _fitsio_bench_tic;
+      for (j = 1; j <= numberof(cols); ++j) {
+        arr = fitsio_read_col(fh, j);
+      }
+      best = _fitsio_bench_best(best, _fitsio_bench_toc());
+      arr = [];
+      fitsio_close_file, fh;
+    }
+    _fitsio_bench_report, name, "fitsio_read_col", bytes, best, rows=rows;
+
+    best = [];
+    for (r = 1; r <= _fitsio_bench_repeat; ++r) {
+      fh = fitsio_open_table(path);
+      _fitsio_bench_tic;
+      data = fitsio_read_cols(fh);
+      best = _fitsio_bench_best(best, _fitsio_bench_toc());
+      data = [];
+      fitsio_close_file, fh;
+    }
+    _fitsio_bench_report, name, "fitsio_read_cols", bytes, best, rows=rows;
+  }
+}
+
+func _fitsio_bench_hdr(dir, hdus, keys)
+{
+  name = swrite(format="mef_%d_hdus", hdus);
+  path = _fitsio_bench_path(dir, name);
+  fh = fitsio_create_file("!" + path);
+  ncards = 0;
+  for (i = 1; i <= hdus; ++i) {
+    ncards += _fitsio_bench_hdu(fh, keys);
+  }
+  fitsio_close_file, fh;
+
+  best = [];
+  for (r = 1; r <= _fitsio_bench_repeat; ++r) {
+    _fitsio_bench_tic;
+    fh = fitsio_open_file(path);
+    for (i = 1; i <= hdus; ++i) {
+      fitsio_movabs_hdu, fh, i;
+      hdr = fitsio_read_header(fh);
+    }
+    fitsio_close_file, fh;
+    best = _fitsio_bench_best(best, _fitsio_bench_toc());
+  }
+  _fitsio_bench_report, name, "fitsio_read_header", 80.0*ncards,
+    best, cards=ncards;
+
+  /* Header-only handles only give access to the primary header, they are
+     compared to ordinary handles on the primary headers of many files. */
+  name = swrite(format="%d_files", hdus);
+  paths = array(string, hdus);
+  ncards = 0;
+  for (i = 1; i <= hdus; ++i) {
+    paths(i) = _fitsio_bench_path(dir, swrite(format="hdr_%d", i));
+    fh = fitsio_create_file("!" + paths(i));
+    ncards += _fitsio_bench_hdu(fh, keys);
+    fitsio_close_file, fh;
+  }
+  for (header = 0; header <= 1; ++header) {
+    best = [];
+    for (r = 1; r <= _fitsio_bench_repeat; ++r) {
+      _fitsio_bench_tic;
+      for (i = 1; i <= hdus; ++i) {
+        fh = fitsio_open_file(paths(i), header=header);
+        hdr = fitsio_read_header(fh);
+        fitsio_close_file, fh;
+      }
+      best = _fitsio_bench_best(best, _fitsio_bench_toc());
+    }
+    _fitsio_bench_report, name,
+      (header ? "fitsio_read_header,header=1" : "fitsio_read_header"),
+      80.0*ncards, best, cards=ncards;
+  }
+}
+
+/* Append to FH a small image HDU with KEYS keywords and yield its number of
+   header cards. */
+func _fitsio_bench_hdu(fh, keys)
+{
+  fitsio_create_img, fh, -32, 16, 16;
+  for (j = 1; j <= keys; ++j) {
+    key = swrite(format="KEY%d", j);
+    if (j%3 == 0) {
+      fitsio_write_key, fh, key, j, "an integer value";
+    } else if (j%3 == 1) {
+      fitsio_write_key, fh, key, sqrt(j), "a real value";
+    } else {
+      fitsio_write_key, fh, key, swrite(format="value #%d", j),
+        "a string value";
+    }
+  }
+  fitsio_write_img, fh, array(float, 16, 16);
+  return fitsio_get_num_keys(fh);
+}
+
+/* Synthetic image of BITPIX type with values spanning the type range. */
+func _fitsio_bench_image(bitpix, size)
+{
+  x = random(size, size);
+  if (bitpix == 8) return char(255*x);
+  if (bitpix == 16) return short(65535*x - 32768);
+  if (bitpix == 32) return int(4e9*x - 2e9);
+  if (bitpix == 64) return long(4e9*x - 2e9)*long(1e6);
+  if (bitpix == -32) return float(x);
+  return x;
+}
+
+/* Synthetic columns for binary table formats TFORM. */
+func _fitsio_bench_columns(tform, rows)
+{
+  n = numberof(tform);
+  cols = array(pointer, n);
+  for (j = 1; j <= n; ++j) {
+    f = tform(j);
+    repeat = 0;
+    sread, f, format="%d", repeat;
+    code = strpart(f, 0:0);
+    x = (repeat > 1 ? random(repeat, rows) : random(rows));
+    if (code == "B") {
+      cols(j) = &char(255*x);
+    } else if (code == "I") {
+      cols(j) = &short(65535*x - 32768);
+    } else if (code == "J") {
+      cols(j) = &int(4e9*x - 2e9);
+    } else if (code == "K") {
+      cols(j) = &long(4e9*x - 2e9);
+    } else if (code == "E") {
+      cols(j) = &float(x);
+    } else if (code == "L") {
+      cols(j) = &char(x > 0.5);
+    } else {
+      cols(j) = &x;
+    }
+  }
+  return cols;
+}
+
+func _fitsio_bench_path(dir, name)
+{
+  extern _fitsio_bench_files;
+  path = dir + "fitsio-bench-" + name + ".fits";
+  if (noneof(_fitsio_bench_files == path)) {
+    grow, _fitsio_bench_files, path;
+  }
+  return path;
+}
+
+/* Start timing and reset the peak resident memory if possible. */
+func _fitsio_bench_tic
+{
+  extern _fitsio_bench_t;
+  f = open("/proc/self/clear_refs", "w", 1);
+  if (f) {
+    write, f, format="%d\n", 5;
+    close, f;
+  }
+  _fitsio_bench_t = array(double, 3);
+  timer, _fitsio_bench_t;
+}
+
+/* Yield the elapsed time and the peak resident memory (in kB, -1 if
+   unknown) since `_fitsio_bench_tic`. */
+func _fitsio_bench_toc(void)
+{
+  t = array(double, 3);
+  timer, t;
+  rss = -1;
+  f = open("/proc/self/status", "r", 1);
+  if (f) {
+    while ((line = rdline(f))) {
+      if (strpart(line, 1:6) == "VmHWM:") {
+        sread, strpart(line, 7:0), rss;
+        break;
+      }
+    }
+    close, f;
+  }
+  return [t(3), rss];
+}
+
+/* Keep the shortest time and the largest peak memory. */
+func _fitsio_bench_best(best, cur)
+{
+  if (is_void(best)) return cur;
+  return [min(best(1), cur(1)), max(best(2), cur(2))];
+}
+
+func _fitsio_bench_report(name, entry, bytes, best, rows=, cards=)
+{
+  secs = best(1);
+  rate = (secs > 0 ? 1.0/secs : 0.0);
+  line = swrite(format="%s\t%s\t%.0f\t%.6f\t%.3f", name, entry, bytes,
+                secs, 1e-6*bytes*rate);
+  line += (is_void(rows) ? "\t-" : swrite(format="\t%.0f", rows*rate));
+  line += (is_void(cards) ? "\t-" : swrite(format="\t%.0f", cards*rate));
+  line += (best(2) < 0 ? "\t-" : swrite(format="\t%.0f", best(2)));
+  _fitsio_bench_print, line;
+}
+
+func _fitsio_bench_print(line)
+{
+  if (is_void(_fitsio_bench_out)) {
+    write, format="%s\n", line;
+  } else {
+    write, _fitsio_bench_out, format="%s\n", line;
+  }
+}
+
+/* Parse command line arguments (see "make bench"). */
+func _fitsio_bench_main(args)
+{
+  local which, dir, out, size, rows, hdus, keys, repeat, nthreads, keep;
+  for (i = 1; i <= numberof(args); ++i) {
+    arg = args(i);
+    sep = strfind("=", arg);
+    if (sep(2) < 0) {
+      grow, which, arg;
+      continue;
+    }
+    key = strpart(arg, 1:sep(1));
+    val = strpart(arg, sep(2)+1:0);
+    if (key == "dir") {
+      dir = val;
+    } else if (key == "out") {
+      out = val;
+    } else {
+      num = 0;
+      if (sread(val, num) != 1) error, "bad value for option " + key;
+      if (key == "size") size = num;
+      else if (key == "rows") rows = num;
+      else if (key == "hdus") hdus = num;
+      else if (key == "keys") keys = num;
+      else if (key == "repeat") repeat = num;
+      else if (key == "nthreads") nthreads = num;
+      else if (key == "keep") keep = num;
+      else error, "unknown option " + key;
+    }
+  }
+  fitsio_bench, which, dir=dir, size=size, rows=rows, hdus=hdus, keys=keys,
+    repeat=repeat, nthreads=nthreads, out=out, keep=keep;
+}
+
+if (_fitsio_bench_batch) {
+  /* Skip the arguments up to the name of this script. */
+  args = get_argv();
+  k = where(strglob("*fitsio-bench.i", args));
+  _fitsio_bench_main, (numberof(k) && k(0) < numberof(args) ?
+                       args(k(0)+1:0) : []);
+  quit;
+}
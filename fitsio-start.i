@@ -1,10 +1,13 @@
 autoload, "fitsio.i", fitsio_close_file;
+autoload, "fitsio.i", fitsio_col_stats;
 autoload, "fitsio.i", fitsio_copy_cell2image;
 autoload, "fitsio.i", fitsio_copy_file;
 autoload, "fitsio.i", fitsio_copy_hdu;
 autoload, "fitsio.i", fitsio_copy_header;
 autoload, "fitsio.i", fitsio_copy_image2cell;
 autoload, "fitsio.i", fitsio_copy_image_section;
+autoload, "fitsio.i", fitsio_copy_img;
+autoload, "fitsio.i", fitsio_copy_tbl;
 autoload, "fitsio.i", fitsio_create_file;
 autoload, "fitsio.i", fitsio_create_img;
 autoload, "fitsio.i", fitsio_create_tbl;
@@ -27,6 +30,7 @@ autoload, "fitsio.i", fitsio_get_hdu_num;
 autoload, "fitsio.i", fitsio_get_hdu_type;
 autoload, "fitsio.i", fitsio_get_img_dim;
 autoload, "fitsio.i", fitsio_get_img_equivtype;
+autoload, "fitsio.i", fitsio_get_img_scale;
 autoload, "fitsio.i", fitsio_get_img_size;
 autoload, "fitsio.i", fitsio_get_img_type;
 autoload, "fitsio.i", fitsio_get_keyword;
@@ -34,11 +38,14 @@ autoload, "fitsio.i", fitsio_get_num_cols;
 autoload, "fitsio.i", fitsio_get_num_hdus;
 autoload, "fitsio.i", fitsio_get_num_keys;
 autoload, "fitsio.i", fitsio_get_num_rows;
+autoload, "fitsio.i", fitsio_get_stats;
 autoload, "fitsio.i", fitsio_get_value;
 autoload, "fitsio.i", fitsio_get_version;
 autoload, "fitsio.i", fitsio_has_member;
+autoload, "fitsio.i", fitsio_img_stats;
 autoload, "fitsio.i", fitsio_is_handle;
 autoload, "fitsio.i", fitsio_is_open;
+autoload, "fitsio.i", fitsio_iterator;
 autoload, "fitsio.i", fitsio_movabs_hdu;
 autoload, "fitsio.i", fitsio_movnam_hdu;
 autoload, "fitsio.i", fitsio_movrel_hdu;
@@ -46,25 +53,34 @@ autoload, "fitsio.i", fitsio_open_data;
 autoload, "fitsio.i", fitsio_open_file;
 autoload, "fitsio.i", fitsio_open_image;
 autoload, "fitsio.i", fitsio_open_table;
+autoload, "fitsio.i", fitsio_prefetch;
 autoload, "fitsio.i", fitsio_read_all;
 autoload, "fitsio.i", fitsio_read_card;
 autoload, "fitsio.i", fitsio_read_col;
+autoload, "fitsio.i", fitsio_read_cols;
 autoload, "fitsio.i", fitsio_read_data;
 autoload, "fitsio.i", fitsio_read_header;
 autoload, "fitsio.i", fitsio_read_img;
 autoload, "fitsio.i", fitsio_read_key;
+autoload, "fitsio.i", fitsio_read_keys;
+autoload, "fitsio.i", fitsio_read_many;
 autoload, "fitsio.i", fitsio_read_tbl;
 autoload, "fitsio.i", fitsio_read_tdim;
+autoload, "fitsio.i", fitsio_reopen_file;
+autoload, "fitsio.i", fitsio_reset_stats;
 autoload, "fitsio.i", fitsio_setup;
 autoload, "fitsio.i", fitsio_split_card;
+autoload, "fitsio.i", fitsio_stats;
 autoload, "fitsio.i", fitsio_strlower;
 autoload, "fitsio.i", fitsio_strupper;
 autoload, "fitsio.i", fitsio_update_chksum;
 autoload, "fitsio.i", fitsio_update_key;
 autoload, "fitsio.i", fitsio_url_type;
 autoload, "fitsio.i", fitsio_verify_chksum;
+autoload, "fitsio.i", fitsio_view_img;
 autoload, "fitsio.i", fitsio_write_chksum;
 autoload, "fitsio.i", fitsio_write_col;
+autoload, "fitsio.i", fitsio_write_cols;
 autoload, "fitsio.i", fitsio_write_comment;
 autoload, "fitsio.i", fitsio_write_history;
 autoload, "fitsio.i", fitsio_write_img;
@@ -0,0 +1,202 @@
+/*
+ * fitsio-tests.i --
+ *
+ * Tests of the Yorick interface to CFITSIO library.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2015-2018 Éric Thiébaut (https://github.com/emmt/YFITSIO).
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+/* When run by "make check" (which sets YFITSIO_TESTS in the environment),
+   the plug-in and "fitsio.i" are taken from the build and source directories
+   rather than from the installed ones (see the end of this file). */
+_fitsio_tests_batch = (batch() && get_env("YFITSIO_TESTS") == "1");
+if (_fitsio_tests_batch) {
+  plug_dir, _(".", plug_dir());
+  include, regsub("[^/]*$", current_include(), "") + "fitsio.i", 1;
+} else if (! is_func(fitsio_open_file)) {
+  include, "fitsio.i", 1;
+}
+
+func fitsio_tests(dir=, keep=)
+/* DOCUMENT fitsio_tests;
+         or nfailures = fitsio_tests(dir=..., keep=...);
+
+     Run the tests of the plug-in on small synthetic FITS files, print a line
+     for each failed check and a summary.  When called as a function, the
+     number of failed checks is returned; when called as a subroutine, an
+     error is raised if any check failed.
+
+     Keyword DIR is the directory for the synthetic files (default is
+     $TMPDIR or "/tmp").  The files are removed unless keyword KEEP is true.
+
+     From the source directory the tests are run by:
+
+         make check
+
+
+   SEE ALSO: fitsio_bench.
+ */
+{
+  if (is_void(dir)) {
+    dir = get_env("TMPDIR");
+    if (! dir) dir = "/tmp";
+  }
+  if (strpart(dir, 0:0) != "/") dir += "/";
+
+  extern _fitsio_tests_files, _fitsio_tests_count, _fitsio_tests_failures;
+  _fitsio_tests_files = [];
+  _fitsio_tests_count = 0;
+  _fitsio_tests_failures = 0;
+  _fitsio_tests_read_all, dir;
+  _fitsio_tests_read_tbl, dir;
+  if (! keep) {
+    for (i = 1; i <= numberof(_fitsio_tests_files); ++i) {
+      remove, _fitsio_tests_files(i);
+    }
+  }
+  write, format="%d check(s), %d failure(s)\n", _fitsio_tests_count,
+    _fitsio_tests_failures;
+  if (am_subroutine() && _fitsio_tests_failures > 0) {
+    error, "some tests failed";
+  }
+  return _fitsio_tests_failures;
+}
+
+/* `fitsio_read_all` on files with an image extension, a table extension and
+   a mix of both. */
+func _fitsio_tests_read_all(dir)
+{
+  img = short(indgen(12) - 6);
+  img = reform(img, 3, 4);
+  ext = float(indgen(5)*0.5);
+  a = int(indgen(7)*3 - 10);
+  b = double(indgen(7))/8.0;
+
+  path = _fitsio_tests_path(dir, "image_ext");
+  fh = fitsio_create_file("!" + path);
+  fitsio_create_img, fh, 8;
+  fitsio_create_img, fh, 16, dimsof(img);
+  fitsio_write_img, fh, img;
+  fitsio_close_file, fh;
+  obj = fitsio_read_all(path);
+  _fitsio_tests_check, is_void(obj.hdu1.data), "read_all: empty primary";
+  _fitsio_tests_check, _fitsio_tests_same(obj.hdu2.data, img),
+    "read_all: image extension";
+
+  path = _fitsio_tests_path(dir, "table_ext");
+  fh = fitsio_create_file("!" + path);
+  fitsio_create_tbl, fh, ["A", "B"], ["1J", "1D"];
+  fitsio_write_col, fh, 1, a, 1;
+  fitsio_write_col, fh, 2, b, 1;
+  fitsio_close_file, fh;
+  obj = fitsio_read_all(path);
+  _fitsio_tests_check, (_fitsio_tests_same(obj.hdu2.data.A, a) &&
+                        _fitsio_tests_same(obj.hdu2.data.B, b)),
+    "read_all: table extension";
+
+  path = _fitsio_tests_path(dir, "mixed_hdus");
+  fh = fitsio_create_file("!" + path);
+  fitsio_create_img, fh, -32, dimsof(float(img));
+  fitsio_write_img, fh, float(img);
+  fitsio_create_tbl, fh, ["A"], ["1J"];
+  fitsio_write_col, fh, 1, a, 1;
+  fitsio_create_img, fh, -32, dimsof(ext);
+  fitsio_write_img, fh, ext;
+  fitsio_create_tbl, fh, ["B"], ["1D"];
+  fitsio_write_col, fh, 1, b, 1;
+  fitsio_close_file, fh;
+  obj = fitsio_read_all(path);
+  _fitsio_tests_check, _fitsio_tests_same(obj.hdu1.data, float(img)),
+    "read_all: primary image of mixed HDUs";
+  _fitsio_tests_check, _fitsio_tests_same(obj.hdu2.data.A, a),
+    "read_all: first table of mixed HDUs";
+  _fitsio_tests_check, _fitsio_tests_same(obj.hdu3.data, ext),
+    "read_all: image extension of mixed HDUs";
+  _fitsio_tests_check, _fitsio_tests_same(obj.hdu4.data.B, b),
+    "read_all: second table of mixed HDUs";
+}
+
+/* `fitsio_read_tbl` on a table with a column of variable length arrays. */
+func _fitsio_tests_read_tbl(dir)
+{
+  a = int(indgen(7)*3 - 10);
+  v = int(indgen(10));
+  offs = [0, 1, 3, 3, 6, 7, 9, 10];
+
+  path = _fitsio_tests_path(dir, "vla_table");
+  fh = fitsio_create_file("!" + path);
+  fitsio_create_tbl, fh, ["A", "V"], ["1J", "1PJ"];
+  fitsio_write_col, fh, 1, a, 1;
+  fitsio_write_col, fh, 2, v, 1, offsets=offs;
+  fitsio_close_file, fh;
+  fh = fitsio_open_table(path);
+  obj = fitsio_read_tbl(fh);
+  _fitsio_tests_check, (_fitsio_tests_same(obj.A, a) &&
+                        _fitsio_tests_same(obj.V, v)),
+    "read_tbl: all columns with variable length arrays";
+  obj = fitsio_read_tbl(fh, cols=["V", "A"]);
+  _fitsio_tests_check, (_fitsio_tests_same(obj.A, a) &&
+                        _fitsio_tests_same(obj.V, v)),
+    "read_tbl: selected columns with variable length arrays";
+  obj = fitsio_read_tbl(fh, cols=["A"], where="A > 0");
+  _fitsio_tests_check, _fitsio_tests_same(obj.A, a(where(a > 0))),
+    "read_tbl: selected rows";
+  fitsio_close_file, fh;
+}
+
+/* Count a check and report it if CONDITION is false. */
+func _fitsio_tests_check(condition, what)
+{
+  extern _fitsio_tests_count, _fitsio_tests_failures;
+  ++_fitsio_tests_count;
+  if (! condition) {
+    ++_fitsio_tests_failures;
+    write, format="FAILED: %s\n", what;
+  }
+}
+
+/* Check that arrays A and B have the same type, dimensions and values. */
+func _fitsio_tests_same(a, b)
+{
+  if (! is_array(a) || ! is_array(b) || structof(a) != structof(b)) {
+    return 0n;
+  }
+  da = dimsof(a);
+  db = dimsof(b);
+  if (numberof(da) != numberof(db) || anyof(da != db)) {
+    return 0n;
+  }
+  return allof(a == b);
+}
+
+func _fitsio_tests_path(dir, name)
+{
+  extern _fitsio_tests_files;
+  path = dir + "fitsio-tests-" + name + ".fits";
+  if (noneof(_fitsio_tests_files == path)) {
+    grow, _fitsio_tests_files, path;
+  }
+  return path;
+}
+
+if (_fitsio_tests_batch) {
+  if (fitsio_tests() > 0) {
+    error, "some tests failed";
+  }
+  quit;
+}
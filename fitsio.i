@@ -127,6 +127,14 @@ func fitsio_read_all(src, hashtable=, case=, units=, comment=)
      Keyword  HASHTABLE can  be  set  true to  use  Yeti  hash-tables for  the
      structured objects.  By default, a Yorick "group" object is used.
 
+     The file is read in a single pass from the start to the end: the HDUs
+     are visited in order (without counting them first), the header of each
+     HDU is parsed before its data and the data of images and binary tables
+     (but for columns of variable length arrays) are read by large blocks
+     of raw bytes, so that there are no backward seeks (which are costly on
+     network file systems or for compressed files).  If SRC is a FITS
+     handle, the HDUs are read starting at the first one.
+
 
    SEE ALSO: fitsio_open_file, fitsio_read_img, fitsio_read_tbl,
              fitsio_read_all.
@@ -147,10 +155,11 @@ func fitsio_read_all(src, hashtable=, case=, units=, comment=)
   } else if (is_string(src) && is_scalar(src)) {
     fh = fitsio_open_file(src);
   }
-  nhdus = fitsio_get_num_hdus(fh);
-  for (hdu = 1; hdu <= nhdus; ++hdu) {
-    hdutype = fitsio_movabs_hdu(fh, hdu);
-    if (hdu == 1 || hdutype == FITSIO_IMAGE) {
+  hdutype = fitsio_movabs_hdu(fh, 1);
+  for (hdu = 1; hdutype >= 0; ++hdu) {
+    header = fitsio_read_header(fh, hashtable=hashtable, case=case, units=units,
+                                comment=comment);
+    if (hdu == 1 || hdutype == FITSIO_IMAGE_HDU) {
       data = fitsio_read_img(fh);
     } else if (hdutype == FITSIO_BINARY_TBL || hdutype == FITSIO_ASCII_TBL) {
       data = fitsio_read_tbl(fh, hashtable=hashtable, case=case,
@@ -160,15 +169,15 @@ func fitsio_read_all(src, hashtable=, case=, units=, comment=)
       write, format="WARNING: unknown HDU type [hdu=%d, type=%d]\n",
         hdu, hdutype;
     }
-    header = fitsio_read_header(fh, hashtable=hashtable, case=case, units=units,
-                                comment=comment);
     add, obj, swrite(format=child, hdu), create(header = header, data = data);
+    hdutype = fitsio_movrel_hdu(fh, 1);
   }
   return obj;
 }
 
-func fitsio_read_tbl(fh, hashtable=, case=, units=)
+func fitsio_read_tbl(fh, hashtable=, case=, units=, cols=, where=)
 /* DOCUMENT obj = fitsio_read_tbl(fh);
+         or obj = fitsio_read_tbl(fh, cols=cols, where=expr);
 
      Read table stored in current HDU  of FITS handle FH.  The returned object
      has members set according to the names and contents of the columns of the
@@ -191,8 +200,13 @@ func fitsio_read_tbl(fh, hashtable=, case=, units=)
      (requires Yeti  extension, see h_new) intead  of an OXY object  (see save
      and oxy).
 
+     Keywords COLS and  WHERE can be used to only read  some columns and the
+     rows matching a given expression (see `fitsio_read_cols`).  Columns of
+     variable length arrays are read by `fitsio_read_col`, they cannot be
+     combined with WHERE.
 
-   SEE ALSO: fitsio_open_file, fitsio_read_img, fitsio_read_col,
+
+   SEE ALSO: fitsio_open_file, fitsio_read_img, fitsio_read_cols,
              save, oxy, h_new.
  */
 {
@@ -202,8 +216,6 @@ func fitsio_read_tbl(fh, hashtable=, case=, units=)
     error, "keyword UNITS must be void or a scalar non-empty string";
   }
   convert = (case ? (case > 0 ? fitsio_strupper : fitsio_strlower) : noop);
-  names = fitsio_get_colname(fh, "*");
-  ncols = numberof(names);
   if (hashtable) {
     obj = h_new();
     add = h_set;
@@ -211,10 +223,55 @@ func fitsio_read_tbl(fh, hashtable=, case=, units=)
     obj = save();
     add = save;
   }
-  for (col = 1; col <= ncols; ++col) {
+  names = fitsio_get_colname(fh, "*");
+  if (is_void(cols) && is_void(where)) {
+    /* Read all the columns one by one. */
+    ncols = numberof(names);
+    for (col = 1; col <= ncols; ++col) {
+      name = convert(names(col));
+      add, obj, noop(name), fitsio_read_col(fh, col),
+        name + units, fitsio_read_key(fh, swrite(format="TUNIT%d", col),
+                                      def="");
+    }
+    return obj;
+  }
+
+  /* Columns of variable length arrays are not supported by
+     `fitsio_read_cols`, they are read by `fitsio_read_col`. */
+  if (is_void(cols)) {
+    cols = indgen(numberof(names));
+  }
+  ncols = numberof(cols);
+  nums = array(long, ncols);
+  vla = array(int, ncols);
+  sel = [];
+  for (k = 1; k <= ncols; ++k) {
+    col = cols(k);
+    nums(k) = (is_string(col) ? fitsio_get_colnum(fh, col) : col);
+    vla(k) = (fitsio_get_coltype(fh, nums(k))(1) < 0);
+    if (! vla(k)) {
+      grow, sel, nums(k);
+    }
+  }
+  if (anyof(vla) && ! is_void(where)) {
+    error, "keyword WHERE is not supported for variable length arrays";
+  }
+  if (! is_void(sel)) {
+    data = fitsio_read_cols(fh, sel, where=where);
+    cunits = data.units;
+  }
+  j = 0;
+  for (k = 1; k <= ncols; ++k) {
+    col = nums(k);
     name = convert(names(col));
-    add, obj, noop(name), fitsio_read_col(fh, col),
-      name + units, fitsio_read_key(fh, swrite(format="TUNIT%d", col), def="");
+    if (vla(k)) {
+      add, obj, noop(name), fitsio_read_col(fh, col),
+        name + units, fitsio_read_key(fh, swrite(format="TUNIT%d", col),
+                                      def="");
+    } else {
+      ++j;
+      add, obj, noop(name), data(j), name + units, cunits(j);
+    }
   }
   return obj;
 }
@@ -258,8 +315,12 @@ func fitsio_read_header(fh, hashtable=, case=, units=, comment=)
      and oxy).
 
 
+     All the cards are read and parsed  in a single call to `fitsio_read_keys`,
+     repeated keywords  are merged in  vectors as  explained for this latter
+     function.  Cards with a blank keyword are skipped.
+
    SEE ALSO: fitsio_open_file, fitsio_read_img, fitsio_read_col,
-             save, oxy, h_new.
+             fitsio_read_keys, save, oxy, h_new.
  */
 {
   if (is_void(units)) {
@@ -277,43 +338,24 @@ func fitsio_read_header(fh, hashtable=, case=, units=, comment=)
   if (hashtable) {
     obj = h_new();
     add = h_set;
-    exists = h_has;
   } else {
     obj = save();
     add = save;
-    exists = fitsio_has_member;
   }
-  nkeys = fitsio_get_num_keys(fh);
-  null = string(0);
+  kw = fitsio_read_keys(fh);
+  names = kw.names;
+  nkeys = kw.nkeys;
+  commentary = kw.commentary;
   for (k = 1; k <= nkeys; ++k) {
-    card = fitsio_split_card(fitsio_read_card(fh, k));
-    key = fitsio_get_keyword(card);
-    name = convert(key);
-    value = fitsio_get_value(card);
-    if (value == null) {
-      /* Assume commentary keyword. */
-      value = fitsio_get_comment(card);
-      if (exists(obj, name)) {
-        value = grow(obj(noop(name)), value);
-      }
-      add, obj, noop(name), value;
+    name = convert(names(k));
+    if (commentary(k)) {
+      add, obj, noop(name), kw(k);
     } else {
-      /* Non-commentary keyword. */
-      local units_value;
-      comment_value = fitsio_get_comment(card, units_value);
-      comment_name = name + comment;
-      units_name = name + units;
-      if (exists(obj, name)) {
-        value = grow(obj(noop(name)), value);
-        comment_value = grow(obj(noop(comment_name)), comment_value);
-        units_value = grow(obj(noop(units_name)), units_value);
-      }
-      add, obj, noop(name), value,
-        noop(comment_name), comment_value,
-        noop(units_name), units_value;
+      add, obj, noop(name), kw(k),
+        name + comment, kw(k, "comment"),
+        name + units, kw(k, "units");
     }
   }
-  fitsio_read_card, fh, 0;
   return obj;
 }
 
@@ -321,10 +363,10 @@ extern fitsio_open_file;
 extern fitsio_open_data;
 extern fitsio_open_table;
 extern fitsio_open_image;
-/* DOCUMENT fh = fitsio_open_file(path[, mode][, basic=0/1]);
-         or fh = fitsio_open_data(path[, mode]);
-         or fh = fitsio_open_table(path[, mode]);
-         or fh = fitsio_open_image(path[, mode]);
+/* DOCUMENT fh = fitsio_open_file(path[, mode][, basic=0/1][, keywords]);
+         or fh = fitsio_open_data(path[, mode][, keywords]);
+         or fh = fitsio_open_table(path[, mode][, keywords]);
+         or fh = fitsio_open_image(path[, mode][, keywords]);
 
       Open an  existing FITS  file.  Argument  PATH is the  name of  the file.
       Optional argument  MODE can be "r"  for reading or "rw"  for reading and
@@ -337,11 +379,95 @@ extern fitsio_open_image;
       `fitsio_open_file` routine, keyword BASIC can be set true to not use the
       extended file name syntax to interpret PATH.
 
+      For the `fitsio_open_file` routine, keyword HEADER can be set true to
+      open the file in header-only mode (which implies BASIC and MODE = "r").
+      Only the primary header is read, by blocks of 2880 bytes until the END
+      card, and CFITSIO only sees these bytes (as a file in memory).  The
+      keywords and the parameters of the primary HDU can then be queried as
+      usual (e.g., with `fitsio_read_key` or `fitsio_get_img_size`) but not
+      the data nor the other HDUs.  This is much faster than a full open
+      when many files are opened just to read a few keywords.  PATH is not
+      interpreted with the extended file name syntax and
+      `fitsio_file_name` yields "mem://" for such handles.
+      There is no pool of handles: closed handles are not recycled for the
+      next files, since each handle is an object owned by the interpreter and
+      CFITSIO cannot rebind an open file structure to another file.
+
+      For the `fitsio_open_file` routine, keyword INFLATE can be set true to
+      open a gzip'd file in inflate mode (which implies BASIC and MODE =
+      "r"): the file is decompressed in  memory by the plug-in and CFITSIO
+      only sees the decompressed bytes (as a file in memory).  Files made of
+      BGZF blocks (as written by `bgzip`, whose gzip members record their
+      sizes) are decompressed in parallel by NTHREADS threads (keyword
+      NTHREADS, the default is set by `fitsio_setup`), other gzip'd files by
+      a single thread while the compressed bytes are read. Files which are
+      not gzip'd are opened as usual.  If the cache of decompressed files is
+      enabled (see `fitsio_setup`), opening again a file with the same name,
+      size and modification time does not decompress it again.  As for
+      header-only handles, `fitsio_file_name` yields "mem://" for inflated
+      files.
+
+      Keyword PREFETCH can be set with a number of HDUs, say N, to start
+      reading ahead the data of the N HDUs starting at the current one (see
+      `fitsio_prefetch`), which is fast when the images are processed in
+      sequence.
+
+      Keyword BUFSIZE can be set with the size (in bytes, at least 2880) of
+      the blocks of raw bytes read by the plug-in itself when reading images
+      with FH (see `fitsio_read_img`); the default is set by `fitsio_setup`.
+      If keyword DIRECT is true, large images (at least BUFSIZE bytes to
+      read) of a regular file are read directly from the file by aligned
+      blocks of BUFSIZE bytes, bypassing the buffers of CFITSIO and, if the
+      file system supports it (O_DIRECT), the cache of the system.  This is
+      mostly useful on parallel file systems which are much faster with
+      large aligned reads.  The buffers of CFITSIO are shared by all opened
+      files, reading large images by large blocks or directly avoids that
+      the handles evict each others buffers.
+
       The opened file is automatically closed  when FH is no longer referenced
       (thus there is no needs to use fitsio_close_file).
 
 
-   SEE ALSO: fitsio_close_file, fitsio_create_file.
+   SEE ALSO: fitsio_close_file, fitsio_create_file, fitsio_prefetch.
+ */
+
+extern fitsio_prefetch;
+/* DOCUMENT fitsio_prefetch, fh, hdus;
+         or fitsio_prefetch, fh;
+         or fitsio_prefetch, files;
+         or fitsio_prefetch;
+
+      Read data ahead in a background thread.  The first call starts reading
+      the data parts of the image HDUs whose numbers are given by HDUS in
+      FITS handle FH.  The bytes are stored in memory and a subsequent call
+      to `fitsio_read_img` for one of these HDUs (complete array or flat
+      sub-array) converts them without accessing the file, waiting for them
+      if they are not yet available.  The prefetched data of an HDU are used
+      once and then freed.  The second call discards the data prefetched for
+      FH.  Non-image HDUs and HDUs without data are ignored, nothing is done
+      if FH is not a regular file.  Each new call, closing the file or
+      modifying it through FH discard the data prefetched for FH.
+
+      The third call starts reading the whole contents of the files whose
+      names are given by FILES (a string array), so that they are in the
+      cache of the system when opened (e.g., the next files of a sequence of
+      frames).  The last call stops this.
+
+      The background thread only performs plain reads with its own file
+      descriptors, everything else (and the conversion of the values) is done
+      by the main thread.  Example:
+
+        fh = fitsio_open_file(path);
+        n = fitsio_get_num_hdus(fh);
+        fitsio_prefetch, fh, indgen(n);
+        for (hdu = 1; hdu <= n; ++hdu) {
+          fitsio_movabs_hdu, fh, hdu;
+          img = fitsio_read_img(fh);
+          ...
+        }
+
+
+   SEE ALSO: fitsio_open_file, fitsio_read_img.
  */
 
 extern fitsio_create_file;
@@ -361,6 +487,37 @@ extern fitsio_create_file;
    SEE ALSO: fitsio_close_file, fitsio_open_file.
  */
 
+extern fitsio_reopen_file;
+/* DOCUMENT fh2 = fitsio_reopen_file(fh);
+
+      Open another  handle FH2 on the  file of the FITS  handle FH which must
+      have been opened for reading.  This is cheap: the file is not opened
+      again, the two handles share the same CFITSIO file but each has its own
+      current HDU, initially the current HDU of FH.  Hence, different HDUs of
+      the same file can be accessed in turn by the two handles without moving
+      back and forth.  Both handles are read-only; the file is closed when
+      none of them is open.
+
+      Reopening the handle of a regular file also opens a shared system
+      descriptor: from then on, the raw bytes of the images read by these
+      handles are read with `pread`, which does not depend on the position
+      of CFITSIO in the file.
+
+      Thread safety: Yorick and CFITSIO are only called by the main thread,
+      including for reopened handles (which share the buffers of CFITSIO).
+      The worker threads of the plug-in (see keyword NTHREADS) only convert
+      values in memory or read the raw bytes of the file with `pread` on the
+      shared descriptor, at addresses computed by the main thread.  Compiled
+      code working on these handles must follow the same rules: the data of
+      many HDUs of one file can be read in parallel with `pread`, provided
+      all other operations on the handles (moving to an HDU, reading
+      keywords, etc.) stay in the main thread.
+
+      Handles opened in header-only mode cannot be reopened.
+
+   SEE ALSO: fitsio_open_file, fitsio_close_file, fitsio_movabs_hdu.
+ */
+
 extern fitsio_close_file;
 extern fitsio_delete_file;
 /* DOCUMENT fitsio_close_file, fh;
@@ -421,17 +578,23 @@ extern fitsio_movnam_hdu;
      forward or backward from the current HDU.  The third routine moves to the
      (first) HDU which has the specified extension type and EXTNAME and EXTVER
      keyword values (or  HDUNAME and HDUVER keywords).   The HDUTYPE parameter
-     may have a value of FITSIO_IMAGE, FITSIO_ASCII_TBL, FITSIO_BINARY_TBL, or
-     FITSIO_ANY_HDU  where  FITSIO_ANY_HDU means  that  only  the EXTNAME  and
+     may have a value of FITSIO_IMAGE_HDU, FITSIO_ASCII_TBL, FITSIO_BINARY_TBL,
+     or FITSIO_ANY_HDU where FITSIO_ANY_HDU  means that only the EXTNAME and
      EXTVER  values will  be used  to locate  the correct  extension.  If  the
      argument EXTVER  is omitted or 0  then the EXTVER keyword  is ignored and
      the first HDU with a matching EXTNAME (or HDUNAME) keyword will be found.
 
      Upon  success, the  returned value  is the  type of  the new  current HDU
-     (FITSIO_IMAGE, FITSIO_ASCII_TBL,  or FITSIO_BINARY_TBL).  If  no matching
-     HDU is found in  the file then the current HDU  will remain unchanged and
-     -1  is returned  or an  error  is thrown  if  the function  is called  as
-     a subroutine.
+     (FITSIO_IMAGE_HDU, FITSIO_ASCII_TBL, or FITSIO_BINARY_TBL).  If no
+     matching HDU is found in  the file (for instance when moving past the
+     last HDU) then the current HDU will remain unchanged and -1 is returned
+     or an error is thrown if the function is called as a subroutine.
+
+     The first time  a name lookup is  performed on a given  handle, an index
+     of  all  the  HDUs  (with  their  type,  EXTNAME,  EXTVER,  BITPIX  and
+     dimensions)  is built  and kept  in the  handle so  that subsequent  name
+     lookups do not have to  scan the file. The index is discarded whenever
+     the file is modified through the handle.
 
    SEE ALSO: fitsio_open_file, fitsio_get_hdu_type.
  */
@@ -462,7 +625,7 @@ extern fitsio_get_hdu_type;
 /* DOCUMENT fitsio_get_hdu_type(fh);
 
      Return the type of the current HDU  in the FITS file. The possible values
-     for   the  returned   value  are:   FITSIO_IMAGE,  FITSIO_ASCII_TBL,   or
+     for  the returned  value  are: FITSIO_IMAGE_HDU,  FITSIO_ASCII_TBL, or
      FITSIO_BINARY_TBL.
 
    SEE ALSO:fitsio_open_file, fitsio_get_hdu_num, fitsio_get_num_hdus.
@@ -553,6 +716,15 @@ extern fitsio_read_card;
      `fitsio_get_comment` can  be used to split  or parse the contents  of the
      card.
 
+     Keyword names  without wild  cards and  of at most  8 characters  are not
+     searched in the file: the whole header  of the current HDU is read once
+     and indexed  by keyword  name, the  index is kept  in the  handle FH and
+     reused until the  current HDU changes or the file  is modified through
+     FH.  Such lookups do not change the starting position of the searches
+     by CFITSIO.  Keywords which occur more than once in the header are
+     still searched by CFITSIO, from its current position and wrapping
+     around, so that successive calls yield the successive cards.
+
 
    SEE ALSO: fitsio_read_key, fitsio_split_card, fitsio_get_keyword.
 */
@@ -607,7 +779,44 @@ extern fitsio_read_key;
      the returned value will be string(0) and argument UNIT (if supplied) will
      be set to string(0).
 
-   SEE ALSO: fitsio_read_card.
+     Keyword names are looked up  in an index of the header  (as explained for
+     `fitsio_read_card`), so  repeated calls to `fitsio_read_key`  on the same
+     HDU do not rescan the header.
+
+   SEE ALSO: fitsio_read_card, fitsio_read_keys.
+*/
+
+extern fitsio_read_keys;
+/* DOCUMENT kw = fitsio_read_keys(fh);
+
+     Read and parse all the cards of  the header of the current HDU of FITS
+     handle FH in a single call.  The  returned object KW has the following
+     members:
+
+        kw.nkeys      - number of distinct keywords;
+        kw.ncards     - number of cards (not counting "END");
+        kw.names      - names of the distinct keywords (in their order of
+                        first appearance, blank keywords are skipped);
+        kw.commentary - whether the distinct keywords are commentary ones;
+
+     and the values, comments and units of a keyword are given by:
+
+        kw(key)            - yields the value of keyword KEY;
+        kw(key, "comment") - yields the comment of keyword KEY;
+        kw(key, "units")   - yields the units of keyword KEY;
+
+     where KEY is the index of the keyword  in KW.names or its name (case is
+     ignored).  The value of a commentary keyword (like "COMMENT", "HISTORY" or
+     a keyword with  an undefined value) is the text  of its card(s), such
+     keywords  have no  comment nor  units.  For  a repeated  keyword, the
+     result is a vector with one element per card (the values are promoted to
+     a common type as `grow` would).
+
+     The header is read only once  (by `fits_hdr2str`) and indexed by keyword
+     name.  This index is shared with  FH to speed up subsequent calls to
+     `fitsio_read_key` and `fitsio_read_card`.
+
+   SEE ALSO: fitsio_read_header, fitsio_read_key.
 */
 
 extern fitsio_get_keyword;
@@ -748,6 +957,10 @@ extern fitsio_read_img;
 /* DOCUMENT fitsio_read_img(fh);
          or fitsio_read_img(fh, first=..., last=..., incr=...);
          or fitsio_read_img(fh, first=..., number=...);
+         or fitsio_read_img(fh, nthreads=n);
+         or fitsio_read_img(fh, raw=1, type=...);
+         or fitsio_read_img(fh, chksum=1);
+         or fitsio_read_img(fh, out=arr, slice=k);
 
      Read array values from the current HDU  of handle FH.  The current HDU of
      FH must be the primary HDU or a FITS "IMAGE" extension.
@@ -787,15 +1000,209 @@ extern fitsio_read_img;
           }
        }
 
+     If FH has been opened with keyword DIRECT set true, large images are
+     read directly by aligned blocks (see `fitsio_open_file`).
+
+     If the data of the current HDU have been read ahead by
+     `fitsio_prefetch`, the values of the complete array or of a flat
+     sub-array are converted from the prefetched bytes.
+
+     When reading the complete array or a flat sub-array of an uncompressed
+     image, the raw bytes are read by large blocks and converted by the
+     plug-in itself (byte swapping, scaling and detection of undefined
+     values) using vectorized code when the processor supports it.  Keyword
+     NTHREADS can be set with the number of threads to use for converting
+     the values, the conversion of each block is then done in parallel while
+     the next block is being read.  NTHREADS <= 0 means using all available
+     processors.  The default number of threads can be set by
+     `fitsio_setup`.
+
+     For a tile-compressed image, keyword NTHREADS (if greater than one) is
+     used to decompress the tiles in parallel: the compressed HDU is copied
+     in memory and each thread decompresses its share of the tiles.  The
+     peak memory is thus increased by the size of the compressed HDU.  This
+     requires CFITSIO to be built with thread support (reentrant), otherwise
+     the tiles are decompressed by CFITSIO in a single thread.
+
+     When the values are converted by the plug-in itself, undefined elements
+     of the result are NaN for floating-point values and the scaled value of
+     the BLANK keyword for integer values, and the NULL variable, if
+     specified, is set accordingly.
+
+     By default, the values are scaled according to the BSCALE and BZERO
+     keywords and returned in the smallest type able to store the scaled
+     values (e.g., `int` for 16-bit unsigned integers).  If keyword RAW is
+     true, the stored values are returned without scaling in the type given
+     by the BITPIX keyword (e.g., `short` for 16-bit unsigned integers); the
+     scaling parameters can be retrieved by `fitsio_get_img_scale` and the
+     physical values are then given by `bscale*arr + bzero`.  Keyword TYPE
+     can be set with the name of the type of the result ("char", "short",
+     "int", "long", "float" or "double") to override the default type.  As
+     with CFITSIO, an error is thrown if some values cannot be represented
+     in the result type.
+
+     If keyword CHKSUM is true, the checksum of the data unit is verified
+     against the value of the "DATASUM" keyword and an error is thrown if
+     they differ or if there is no such keyword (so that a successful read
+     means that the data have been verified).  This requires to read the
+     complete array.  When the raw bytes are read by the plug-in, they are
+     summed during the same pass; otherwise, the data unit is read again to
+     compute its checksum (see `fitsio_get_chksum`).
+
+     Keyword OUT can be set with a variable whose array is overwritten by the
+     values instead of creating a new array; the array is also returned.  The
+     array must have the type of the result (see keywords RAW and TYPE) and
+     the same dimensions.  If keyword SLICE is also set, the array must have
+     one more trailing dimension and the values are stored in `arr(..,k)`
+     with K the value of SLICE.  This avoids allocating a new array for each
+     image and can be used to fill a stack of images in place:
+
+       cube = array(float, nx, ny, n);
+       for (k = 1; k <= n; ++k) {
+         fitsio_movabs_hdu, fh, k;
+         fitsio_read_img, fh, out=cube, slice=k, type="float";
+       }
+
      This  function  implements  most  of  the  capabilities  of  the  CFITSIO
      functions fits_read_img, fits_read_subset and fits_read_pix.
 
 
-   SEE ALSO: fitsio_open_file, fitsio_write_img, ieee_test.
+   SEE ALSO: fitsio_open_file, fitsio_write_img, fitsio_get_img_scale,
+             fitsio_prefetch, fitsio_get_chksum, fitsio_img_stats, ieee_test.
  */
 
+extern fitsio_img_stats;
+extern fitsio_col_stats;
+/* DOCUMENT st = fitsio_img_stats(fh);
+         or st = fitsio_img_stats(fh, first=..., last=...);
+         or st = fitsio_col_stats(fh, col);
+         or st = fitsio_col_stats(fh, col, firstrow, lastrow);
+
+     Compute summary statistics of the values of the image of the current
+     HDU of FITS handle FH, or of the column COL of its table, without
+     creating an array with all the values.  The result is a vector of
+     doubles:
+
+       st(1) = number of defined values;
+       st(2) = number of undefined values;
+       st(3) = minimum value;
+       st(4) = maximum value;
+       st(5) = mean value;
+       st(6) = standard deviation;
+
+     undefined values being those marked by BLANK (or TNULL) and NaN's.  The
+     last four entries are NaN if there are no defined values.  The values
+     are scaled as by `fitsio_read_img` and `fitsio_read_col` and read by
+     large blocks converted into doubles.  Each block is summarized by
+     NTHREADS threads (keyword NTHREADS, see `fitsio_read_img`) with
+     vectorized reductions while the next one is being read.
+
+     For an image, keywords FIRST and LAST can be set to only consider a
+     rectangular sub-array (with the same conventions as `fitsio_read_img`).
+     For a column, arguments FIRSTROW and LASTROW specify the range of rows
+     (all rows by default).  Only real numerical columns are supported.
+
+     If keyword UPDATE is true, the statistics of all the values are saved
+     in the header (the file must be writable and UPDATE cannot be combined
+     with a sub-array or a range of rows, which is an error): the
+     minimum and the maximum in the "DATAMIN" and "DATAMAX" keywords of an
+     image or in the "TDMINn" and "TDMAXn" keywords of column number n, the
+     other statistics in the string keyword "DATASTAT" or "TSTATn".  When
+     all the values are considered and UPDATE is not set, the statistics
+     found in these keywords are returned without reading the data.  They
+     are not updated when the data are modified, call again with UPDATE=1 to
+     recompute them.
+
+   SEE ALSO: fitsio_read_img, fitsio_read_col, fitsio_read_key.
+ */
+
+extern fitsio_read_many;
+/* DOCUMENT arr = fitsio_read_many(paths);
+         or arr = fitsio_read_many(paths, hdu=..., first=..., last=...);
+
+     Read images with the same dimensions from many FITS files and stack them
+     into a single array.  Argument PATHS is an array of file names, the
+     result has the dimensions of the images and a trailing dimension equal
+     to the number of files: `arr(..,i)` is the image read from `paths(i)`.
+     Nothing is returned if PATHS is empty.
+
+     The file names are not parsed with the "Extended File Name Syntax",
+     which saves time per file.  By default, the image of the first HDU with
+     significant data (the primary HDU or, if it is empty, the next one) is
+     read in each file.  Keyword HDU can be set with the number or the
+     extension name of the HDU to read.
+
+     Keywords FIRST, LAST and INCR can be used to read the same rectangular
+     sub-array of each image, they have the same meaning as for
+     `fitsio_read_img`.  Keyword TYPE has the same meaning as for
+     `fitsio_read_img`; by default, the type of the result is given by the
+     image in the first file.  An error is thrown if the images of the other
+     files do not have the same dimensions.  Values are always scaled.
+
+     Keyword NTHREADS can be set with the number of threads to open and read
+     the files in parallel (each thread has its own handles) which requires
+     CFITSIO to be built with thread support (reentrant), otherwise the files
+     are read one by one whatever NTHREADS.  NTHREADS <= 0 means using all
+     available processors.  The default number of threads can be set by
+     `fitsio_setup`.
+
+
+   SEE ALSO: fitsio_read_img, fitsio_setup.
+ */
+
+extern fitsio_view_img;
+/* DOCUMENT view = fitsio_view_img(fh);
+         or view = fitsio_view_img(fh, first=..., last=..., incr=...);
+         or view = fh();
+
+     Get a view of the image in the current HDU of FITS handle FH.  A view
+     records the HDU and a rectangular section of the image (the complete
+     image by default) but it does not read any pixel until it is indexed.
+     Keywords FIRST, LAST and INCR specify the section as for
+     `fitsio_read_img`.  Calling the FITS handle without arguments, as in
+     the last example, yields a view of the complete image.
+
+     Indexing the view, as in `view(i1, i2, ...)`, returns the corresponding
+     pixels of the section.  Each index can be a scalar, a range, a vector
+     of indices or nil (for all), non-positive indices count from the end as
+     usual in Yorick, and missing trailing indices are the same as nil.  For
+     instance, `view(,j)` reads the J-th row of a 2-D view and `view()`
+     reads the whole section.  The current HDU of FH is left unchanged.
+
+     The pixels are read by segments of image rows (along the first
+     dimension) spanning the section and keyword CACHE (64 by default) sets
+     the number of recently used segments kept in memory, so that exploring
+     a huge image around a given position is fast.  The cache is flushed if
+     the file is modified via FH.
+
+     The members of a view are `view.dims` (the dimensions of the section),
+     `view.first` and `view.incr` (first pixel and increments of the section
+     in the image), `view.hdu` (the HDU number), `view.cache` (the size of
+     the cache) and `view.handle` (the FITS handle).
+
+
+   SEE ALSO: fitsio_read_img, fitsio_iterator.
+ */
+
+extern fitsio_get_img_scale;
+/* DOCUMENT [bscale, bzero] = fitsio_get_img_scale(fh);
+
+     Get the scaling parameters of the current HDU of FH which must be the
+     primary HDU or a FITS "IMAGE" extension.  The physical values of the
+     image are given by `bscale*raw + bzero` where `raw` are the stored
+     values (as read by `fitsio_read_img` with keyword RAW set true).  The
+     default values (1 and 0) are returned if the BSCALE and BZERO keywords
+     are missing.
+
+   SEE ALSO: fitsio_read_img.
+ */
+
+local FITSIO_NOCOMPRESS, FITSIO_RICE_1, FITSIO_GZIP_1, FITSIO_GZIP_2;
+local FITSIO_PLIO_1, FITSIO_HCOMPRESS_1;
 extern fitsio_create_img;
 /* DOCUMENT fitsio_create_img, fh, bitpix, dims, ...;
+         or fitsio_create_img, fh, bitpix, dims, ..., compress=..., tile=...,
+                                quantize=...;
 
      Create a new primary array or  IMAGE extension with a specified data type
      and size.  If the  FITS file is currently empty, then  a primary array is
@@ -803,9 +1210,22 @@ extern fitsio_create_img;
      Remaining arguments  DIMS, ... form the  dimension list of the  image and
      can take any of the form accepted by Yorick array() function.
 
+     Keyword COMPRESS can be set to create a tile-compressed image (stored in
+     a binary table extension, a null primary array is created first if the
+     file is empty).  The value of COMPRESS is the name of the compression
+     algorithm ("rice", "gzip", "gzip2", "plio", "hcompress" or "none"; case
+     is ignored) or the corresponding code (FITSIO_RICE_1, FITSIO_GZIP_1,
+     FITSIO_GZIP_2, FITSIO_PLIO_1, FITSIO_HCOMPRESS_1 or FITSIO_NOCOMPRESS).
+     Keyword TILE can be set with the lengths of the tiles along each axis
+     (by default, each row of the image is a tile).  Keyword QUANTIZE can be
+     set with the quantization level for floating-point images: if positive,
+     the quantization step is the noise level divided by QUANTIZE; if
+     negative, -QUANTIZE is the quantization step.  These settings only
+     apply to the created HDU.
+
      When called as a function, FH is returned.
 
-   SEE ALSO: fitsio_create_file, dimsof, array.
+   SEE ALSO: fitsio_create_file, fitsio_write_img, dimsof, array.
  */
 
 extern fitsio_copy_cell2image;
@@ -840,7 +1260,8 @@ extern fitsio_copy_image2cell;
  */
 
 extern fitsio_write_img;
-/* DOCUMENT fitsio_write_img, fh, arr, first=..., null=...;
+/* DOCUMENT fitsio_write_img, fh, arr, first=..., incr=..., null=...,
+                              nthreads=...;
 
      Write array  values ARR into the  current HDU of handle  FH.  The current
      HDU of FH must be a FITS "IMAGE" extension.
@@ -855,8 +1276,10 @@ extern fitsio_write_img;
      if keyword FIRST is  set with a vector of NAXIS  integers (where NAXIS is
      the value  of the "NAXIS"  FITS key), it  indicates indices of  the first
      element of a rectangular sub-array to  write, the number of dimensions of
-     ARR may be less than NAXIS.  When writing a sub-array the NULL keyword is
-     not supported.
+     ARR may be less than NAXIS.  When writing a sub-array, keyword INCR can
+     be set with a vector of NAXIS strictly positive increments: the element
+     `ARR(i1,i2,...)` is then written at indices `FIRST + INCR*([i1,i2,...] -
+     1)` of the FITS array (by default, the increments are all equal to one).
 
      Keyword NULL can be used to specify  the value of the invalid (or "null")
      elements in ARR.   The routine will substitute the  appropriate FITS null
@@ -865,8 +1288,26 @@ extern fitsio_write_img;
      integer FITS arrays, the FITS null  value is defined by the BLANK keyword
      (an error is returned if the  BLANK keyword doesn't exist).  For floating
      point  FITS arrays  the special  IEEE  NaN (Not-a-Number)  value will  be
-     written into the FITS file.  Keyword NULL cannot be specified for writing
-     a rectangular sub-array (i.e., when keyword FIRST is a list of indices).
+     written into the FITS file.  Keyword NULL can also be specified when
+     writing a rectangular sub-array, possibly with increments, which is
+     useful to mosaic images with masked pixels.
+
+     Unless keyword NULL is specified, the values written into an
+     uncompressed image are converted into raw bytes by the plug-in itself
+     when possible (integer values, possibly with an integer BZERO offset, or
+     floating-point values of the same type as the image).  Keyword NTHREADS
+     can be set with the number of threads for this conversion (see
+     `fitsio_read_img`).  A rectangular sub-array is written by runs of
+     contiguous pixels (whole leading axes are merged), each run being
+     written at once.
+
+     When writing whole layers of tiles (e.g., the complete image) into a
+     freshly created tile-compressed integer image (lossless compression),
+     keyword NTHREADS (if greater than one) is used to compress the tiles in
+     parallel: each thread compresses its share of the tiles into a memory
+     file and the compressed tiles are then copied into the destination
+     (this requires CFITSIO to be built with thread support).  Otherwise, the
+     tiles are compressed by CFITSIO in a single thread.
 
      This   function   implements   writing    via   the   CFITSIO   functions
      fits_write_subset, fits_write_img and fits_write_imgnull.
@@ -888,7 +1329,35 @@ extern fitsio_copy_image_section;
      name  syntax   (see  CFISIO  documentation).    Examples:  "1:100,1:200",
      "1:100:2, 1:*:2", "*, -*".
 
-   SEE ALSO: fitsio_open_file.
+   SEE ALSO: fitsio_open_file, fitsio_copy_img.
+ */
+
+extern fitsio_copy_img;
+/* DOCUMENT fitsio_copy_img, inp, out;
+         or fitsio_copy_img, inp, out, compress=..., tile=..., quantize=...;
+
+     Append to the FITS file of handle OUT a new image HDU with the image in
+     the current HDU of  FITS handle INP.  The new image has the same type,
+     dimensions and keywords (but for those describing the compression and
+     the checksums) as the input one; it becomes the current HDU of OUT.
+     Keywords COMPRESS, TILE and QUANTIZE specify the compression of the new
+     image as for `fitsio_create_img`, hence an image can be compressed,
+     decompressed, re-tiled or recompressed with another algorithm.
+
+     The values are copied without conversion: if neither image is
+     compressed, the raw bytes are copied by large blocks; otherwise, the
+     raw values (without scaling by BSCALE and BZERO, which are copied) are
+     read and written by blocks of complete layers of tiles.  When
+     compressing an integer image (lossless compression) with NTHREADS > 1
+     threads (keyword NTHREADS, see `fitsio_write_img`), the whole image is
+     read and its tiles are compressed in parallel.  To copy a compressed
+     image without changing its compression, `fitsio_copy_hdu` copies the
+     compressed tiles as they are.
+
+     When called as a function, OUT is returned.
+
+
+   SEE ALSO: fitsio_create_img, fitsio_copy_hdu, fitsio_copy_tbl.
  */
 
 /*---------------------------------------------------------------------------*/
@@ -1033,10 +1502,17 @@ extern fitsio_write_col;
 extern fitsio_read_col;
 /* DOCUMENT fitsio_write_col, fh, col, arr;
          or fitsio_write_col, fh, col, arr, firstrow;
+         or fitsio_write_col, fh, col, arr, firstrow, nthreads=n;
+         or fitsio_write_col, fh, col, arr, firstrow, offsets=offs;
 
          or arr = fitsio_read_col(fh, col);
          or arr = fitsio_read_col(fh, col, firstrow);
          or arr = fitsio_read_col(fh, col, firstrow, lastrow);
+         or arr = fitsio_read_col(fh, col, firstrow, lastrow, offsets=offs);
+         or arr = fitsio_read_col(fh, col, firstrow, lastrow, chars=1);
+         or arr = fitsio_read_col(fh, col, firstrow, lastrow, where=expr);
+         or arr = fitsio_read_col(fh, col, rows=idx);
+         or fitsio_read_col, fh, col, firstrow, lastrow, out=arr, slice=k;
 
       The subroutine  `fitsio_write_col` writes the  values of array  ARR into
       the column COL  of the ASCII or  binary table of the current  HDU of the
@@ -1069,10 +1545,230 @@ extern fitsio_read_col;
       Keyword `null`  can be used to  specify the value of  invalid data. This
       value will be substituted by the appropriate FITS null value.
 
+      The cells of string columns are read  by large blocks of rows into a
+      single buffer and trailing spaces are removed; each string is then
+      allocated with its actual length.  If keyword `chars` is true, no
+      string is allocated at all: the result is an array of chars whose
+      leading dimension is the maximum length of the strings, each string
+      being padded with nulls (use `strchar` or `string(&arr(,j))` to
+      convert some of them into strings).  This is much faster and uses much
+      less memory for tables with many rows of strings.
+
+      Keyword `where` can be set with a boolean expression (with the syntax
+      of CFITSIO row filters, e.g. "PHA > 5 && TIME < 1000") to only read the
+      rows (among FIRSTROW to LASTROW) for which the expression is true.
+      The expression is evaluated by CFITSIO while scanning the table and
+      only the values of the matching rows are read and stored in the
+      result, which is [] if no rows match.
+
+      Keyword `rows`  can be set with a  list of row indices (starting  at 1,
+      in any order  and possibly repeated) to only read  these rows; the J-th
+      cell of  the result  is the  one of  row IDX(J).   The indices  are
+      sorted and nearby rows  are read by runs (in increasing  order of rows)
+      rather than with one seek per row.  Keyword `rows` cannot be combined
+      with FIRSTROW, LASTROW or `where`  and is not supported for variable
+      length array columns.
+
+      Keyword `out` can be set with a variable whose array is overwritten by
+      the values (and returned) instead of creating a new array.  The array
+      must have the type and the dimensions of the result or, if keyword
+      `slice` is also set, one more trailing dimension in which case the
+      values are stored in `arr(..,k)` with K the value of `slice`.  Keyword
+      `out` is not supported for string and variable length array columns.
+
+      When writing numerical values into the  cells of a binary table without
+      scaling and  without keyword `null`,  the values are converted  by the
+      plug-in itself and keyword `nthreads` can be set with the number of
+      threads to use (see `fitsio_read_img`).
+
+      Variable length array columns  (with a "P" or "Q"  TFORM) are read as a
+      flat vector of the values of all the rows, keyword OFFSETS can be set
+      with a variable to store the offsets of the rows in this vector: OFFS
+      has one more element than the number of rows read, starts at 0 and the
+      values of the J-th row read are ARR(OFFS(J)+1:OFFS(J+1)).  Empty rows
+      are allowed, ARR is [] if all rows are empty.  The descriptors of the
+      rows are read at once and the heap is read by large contiguous blocks
+      (in increasing order of addresses) rather than with one seek per row.
+      For a variable length column of strings, ARR has one string per row,
+      undefined strings are read as empty strings and NULL is set to [].
+
+      To write a variable length array column, ARR is a flat vector and
+      keyword OFFSETS gives the offsets (with the same conventions as above)
+      of the rows to write starting at FIRSTROW.  If OFFSETS is omitted, all
+      the values of ARR are written in the single row FIRSTROW.  For a
+      variable length column of strings, ARR is an array of strings written
+      one per row and OFFSETS must not be specified.  Variable length array
+      columns are not handled by `fitsio_read_cols` nor `fitsio_write_cols`.
+
 
    SEE ALSO: fits_create_tbl, fits_open_table.
  */
 
+extern fitsio_read_cols;
+/* DOCUMENT data = fitsio_read_cols(fh);
+         or data = fitsio_read_cols(fh, cols);
+         or data = fitsio_read_cols(fh, cols, firstrow);
+         or data = fitsio_read_cols(fh, cols, firstrow, lastrow);
+         or data = fitsio_read_cols(fh, cols, firstrow, lastrow, where=expr);
+         or data = fitsio_read_cols(fh, cols, rows=idx);
+
+     Read several columns of the ASCII or binary table of the current HDU of
+     the FITS handle FH.  Argument COLS is a list of column numbers (starting
+     at 1) or of column names; if omitted or empty, all columns are read.
+     Optional arguments FIRSTROW and LASTROW have the same meaning as for
+     `fitsio_read_col`.
+
+     For a binary table, the numerical and string columns are read in a
+     single pass over the rows: large blocks of rows (at least the number of
+     rows that fits in the buffers of CFITSIO) are read and the values of
+     all columns are extracted and converted at once.  This is much faster
+     than reading the columns one by one with `fitsio_read_col`.  Keyword
+     NTHREADS specifies the number of threads for extracting the numerical
+     columns (see `fitsio_read_img`).  Other columns (logicals, bits, etc.)
+     are read by CFITSIO.  Columns of variable length arrays are not
+     supported (see `fitsio_read_col` and `fitsio_read_tbl`).
+
+     The result is an object such that:
+
+         data(k)     yields the values of the K-th column read (K is an
+                     integer), with the same dimensions and type as given by
+                     `fitsio_read_col`;
+         data(name)  yields the values of the column whose name is NAME
+                     (case is ignored);
+         data.ncols  is the number of columns read;
+         data.names  is the list of column names (value of "TTYPEn");
+         data.units  is the list of column units (value of "TUNITn").
+
+     Undefined values of integer columns are left as stored in the file
+     (after scaling), undefined floating-point values are NaN.  Keyword CHARS
+     has the same meaning as for `fitsio_read_col` for string columns.
+
+     Keyword WHERE can be set with a  boolean expression (see
+     `fitsio_read_col`) to only read the rows of the table for which it is
+     true.  The selection is done in a single scan by CFITSIO, then the
+     blocks of rows with any selected row are read and only the selected
+     rows are extracted; row projection and column projection (argument
+     COLS) are thus both done in C.  If no rows match, all columns are [].
+
+     Keyword ROWS can be set with a list of row indices to only read these
+     rows (see `fitsio_read_col`).  For a binary table, the runs of nearby
+     rows are read once for all the columns and the selected rows are
+     extracted as above, the cells are then moved back in the order of IDX.
+
+
+   SEE ALSO: fitsio_read_col, fitsio_read_tbl, fitsio_write_cols.
+ */
+
+extern fitsio_write_cols;
+/* DOCUMENT fitsio_write_cols, fh, cols, arr1, arr2, ...;
+         or fitsio_write_cols, fh, cols, data;
+
+     Write several columns of the ASCII or binary table of the current HDU of
+     the FITS handle FH.  Argument COLS is a list of column numbers (starting
+     at 1) or of column names; if empty, all columns are written.  There must
+     be as many arrays ARR1, ARR2, etc. as columns, or a single object DATA
+     as returned by `fitsio_read_cols` which provides the arrays.  Each array
+     must be suitable for `fitsio_write_col` and all arrays must have the same
+     number of rows.  For instance, to copy a table:
+
+         fitsio_write_cols, dst, , fitsio_read_cols(src);
+
+     For a binary table, the numerical columns are encoded and written row
+     block by row block in a single pass over the file.  If all the columns
+     of the table are numerical and written, whole rows are written at once.
+     Keyword NTHREADS specifies the number of threads for encoding the
+     values (see `fitsio_read_img`).  Other columns are written by CFITSIO.
+
+     Keyword FIRST can be set with the first row to write (1 by default).  If
+     keyword APPEND is true, the rows are written after the last row
+     previously written in the table.  This is suitable to stream rows to a
+     table: if the table is not at the end of the file, the table is grown by
+     large steps rather than at every call.  The remaining extra rows are
+     removed as soon as the handle is used by another function than
+     `fitsio_write_cols` (e.g., to count the rows, to read or to close the
+     file), which then sees the exact number of rows.
+
+
+   SEE ALSO: fitsio_write_col, fitsio_read_cols, fitsio_copy_tbl.
+ */
+
+extern fitsio_copy_tbl;
+/* DOCUMENT fitsio_copy_tbl, inp, out;
+         or fitsio_copy_tbl, inp, out, cols, firstrow, lastrow, where=expr;
+
+     Append to the FITS file of handle OUT a new table extension with some
+     columns and rows of the ASCII or binary table of the current HDU of FITS
+     handle INP.  Argument COLS is a list of column numbers (starting at 1)
+     or of column names, all columns are copied if omitted or empty; the
+     columns keep their order in the input table.  Optional arguments
+     FIRSTROW and LASTROW give the range of rows to copy, keyword WHERE can
+     be set with an expression to select the rows (see `fitsio_read_cols`).
+     The header of INP is copied (the keywords of the columns which are
+     not copied are removed and the others are renumbered) but for the
+     checksums, the new table becomes the current HDU of OUT.
+
+     The rows are read by large blocks and the bytes of the selected cells
+     are written as they are, without any conversion, in a single pass over
+     the input table.  Columns of variable length arrays cannot be copied.
+
+     When called as a function, OUT is returned.
+
+
+   SEE ALSO: fitsio_read_cols, fitsio_copy_hdu, fitsio_copy_img.
+ */
+
+extern fitsio_iterator;
+/* DOCUMENT it = fitsio_iterator(fh);
+         or it = fitsio_iterator(fh, col);
+
+     Create an iterator to read by successive chunks the planes of the image
+     in the current HDU of FITS handle FH or, if COL is specified, the rows of
+     the column COL (an integer or a string, see `fitsio_read_col`) of the
+     table in the current HDU of FH.  This is suitable to process huge data
+     in constant memory.  The HDU of the iterator is the one which is current
+     when the iterator is created, the current HDU of FH is left unchanged
+     when reading.
+
+     Calling the iterator as a function returns the next chunk, or [] when
+     there are no more planes or rows.  The iterator can be called with an
+     argument to specify the index (starting at 1) of the first plane or row
+     of the chunk to read next.  For instance:
+
+         it = fitsio_iterator(fh, chunk=4);
+         while (! is_void((arr = it()))) {
+           // process planes it.first to it.first + it.number - 1
+         }
+
+     The planes of an image are the sub-arrays along its last dimension.
+     Keyword CHUNK can be set with the number of planes (or rows) per chunk.
+     If CHUNK > 1, the chunks have a trailing dimension for the planes (or
+     rows).  For a table or for an image with one dimension, the default
+     chunk corresponds to about 8 Mb of data; otherwise, planes are delivered
+     one by one.
+
+     Each call returns a new array.  To save allocations, keyword REUSE can
+     be set true to reuse the array storing the values of a complete chunk
+     for the next call (except for strings).  A chunk must then be copied
+     if its values are needed after the next call.
+
+     Keyword NTHREADS specifies the number of threads for converting image
+     values (see `fitsio_read_img`).
+
+     The members of an iterator are:
+
+         it.first   index (starting at 1) of the first plane or row of the last
+                    delivered chunk;
+         it.number  number of planes or rows in the last delivered chunk (0
+                    when all planes or rows have been delivered);
+         it.next    index of the first plane or row of the next chunk;
+         it.total   total number of planes or rows;
+         it.chunk   number of planes or rows per chunk;
+         it.handle  the FITS handle.
+
+
+   SEE ALSO: fitsio_read_img, fitsio_read_col.
+ */
+
 
 /*---------------------------------------------------------------------------*/
 /* MISCELLANEOUS */
@@ -1120,6 +1816,14 @@ extern fitsio_decode_chksum;
      for  the current  HDU without  creating or  modifying the  "CHECKSUM" and
      "DATASUM" keywords.
 
+     The data  unit, which is  usually much larger  than the header,  is read
+     by large blocks whose sums are computed by several threads (while the
+     next block is being read) and combined.   Keyword NTHREADS can be used
+     with `fitsio_write_chksum`, `fitsio_verify_chksum` and `fitsio_get_chksum`
+     to specify the number of threads (see `fitsio_setup`).  The results are
+     the same as those of CFITSIO.  Keyword CHKSUM of `fitsio_read_img` can be
+     used to verify the data of an image while they are read.
+
      The  function  `fitsio_encode_chksum` encodes  a  checksum  value into  a
      16-character string.  If optional argument COMPLM is true then the 32-bit
      sum value will be complemented before encoding.
@@ -1129,7 +1833,7 @@ extern fitsio_decode_chksum;
      then  the 32-bit  sum  value  will be  complemented  after decoding.
 
 
-   SEE ALSO: fitsio_create_file.
+   SEE ALSO: fitsio_create_file, fitsio_read_img, fitsio_setup.
  */
 
 extern fitsio_get_version;
@@ -1144,14 +1848,107 @@ extern fitsio_debug;
 
      Set the verbosity of error messages and return the former setting.
 
-   SEE ALSO: error.
+   SEE ALSO: error, fitsio_stats.
  */
 
+extern fitsio_get_stats;
+extern fitsio_reset_stats;
+func fitsio_stats(fh)
+/* DOCUMENT obj = fitsio_stats(fh);
+         or obj = fitsio_stats();
+         or vec = fitsio_get_stats(fh);
+         or fitsio_reset_stats, fh;
+         or fitsio_reset_stats;
+
+     Get or reset the input/output statistics of FITS handle FH or, if FH is
+     omitted, of all handles since the plug-in was loaded (or since the last
+     call to `fitsio_reset_stats` without arguments).  The result of
+     `fitsio_stats` is an object with the following members:
+
+       obj.bytes_read    - number of bytes read;
+       obj.bytes_written - number of bytes written;
+       obj.reads         - number of read operations;
+       obj.writes        - number of write operations;
+       obj.seeks         - number of moves of the file position by the
+                           plug-in itself;
+       obj.moves         - number of HDU moves;
+       obj.io_time       - seconds spent reading or writing;
+       obj.convert_time  - seconds spent converting values, or waiting for
+                           the threads converting them;
+       obj.hits          - number of hits in the caches of the plug-in
+                           (index of keywords, prefetched data, rows of
+                           image views, decompressed files);
+       obj.misses        - number of misses in these caches;
+       obj.hit_ratio     - hits/(hits + misses), 0 if there were none.
+
+     `fitsio_get_stats` yields the same values (but the ratio) as a vector of
+     doubles in the above order.
+
+     The operations are counted by the plug-in at the level of its own
+     reads and writes: when the plug-in reads or writes the raw bytes, the
+     sizes are those in the file and the I/O and conversion times are
+     measured separately; when CFITSIO does the work, the sizes are those of
+     the values in memory and the whole time is counted as I/O.  The
+     statistics of a handle are those of the operations done on it,
+     directly or through an image view or an iterator; the buffers of
+     CFITSIO itself are not visible.
+
+     Comparing IO_TIME and CONVERT_TIME tells whether a step of processing
+     is limited by the input/output or by the conversion of values (in
+     which case more threads may help).  A detailed log of the events can
+     be written with the TRACE keyword of `fitsio_setup`.
+
+
+   SEE ALSO: fitsio_setup, fitsio_read_img, fitsio_prefetch.
+ */
+{
+  s = fitsio_get_stats(fh);
+  n = s(9) + s(10);
+  return save(bytes_read = s(1), bytes_written = s(2), reads = long(s(3)),
+              writes = long(s(4)), seeks = long(s(5)), moves = long(s(6)),
+              io_time = s(7), convert_time = s(8), hits = long(s(9)),
+              misses = long(s(10)), hit_ratio = (n > 0 ? s(9)/n : 0.0));
+}
+
 extern fitsio_setup;
 /* DOCUMENT fitsio_setup;
+         or fitsio_setup, nthreads=n, bufsize=n;
+         or fitsio_setup, trace=path;
+         or fitsio_setup, gzcache=size;
 
      Initialize internals of the plug-in.
 
-   SEE ALSO: fitsio_open_file.
+     Keyword NTHREADS can be used to set the default number of threads for
+     converting values (see `fitsio_read_img`).  By default, a single thread
+     is used.  NTHREADS <= 0 means using all available processors.  The
+     fastest conversion code for the processor (e.g., AVX2, SSSE3 or NEON
+     instructions) is selected when the plug-in is loaded.
+
+     Keyword BUFSIZE can be used to set the default size (in bytes) of the
+     blocks read by the plug-in itself for images, that is for handles
+     opened without the BUFSIZE keyword (see `fitsio_open_file`).  The
+     default is 8 MB, BUFSIZE = [] restores it.  Note that the number and
+     the size of the buffers of CFITSIO are fixed when CFITSIO is compiled
+     (NIOBUF and IOBUFLEN) and cannot be changed.
+
+     Keyword TRACE can be set with the name of a file where to log every
+     input/output event counted in the statistics (see `fitsio_stats`), "-"
+     for the standard error output, and TRACE = [] or "" to stop logging.
+     The file is opened in append mode and each line has tab separated
+     fields: the time (in seconds) since the start of the log, the event
+     ("read", "write", "convert", "move", "hit" or "miss"), the name of the
+     file, the HDU number, the number of bytes and the duration (in seconds)
+     of the event.
+
+     Keyword GZCACHE can be set with the maximum number of bytes of the
+     cache of the files decompressed by the plug-in (see keyword INFLATE of
+     `fitsio_open_file`), 0 or [] to disable it (the default).  The cache
+     is shared by the whole process, the least recently used files are
+     evicted first (their memory is freed when no handles use them) and
+     the files are identified by their name, size and modification time.
+     Hits and misses in this cache are counted in the statistics (see
+     `fitsio_stats`).
+
+   SEE ALSO: fitsio_open_file, fitsio_stats.
  */
 fitsio_setup;
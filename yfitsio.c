@@ -21,6 +21,11 @@
  * this program. If not, see http://www.gnu.org/licenses/.
  */
 
+/* Needed for O_DIRECT with the GNU C library. */
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -29,8 +34,17 @@
 #include <math.h>
 #include <float.h>
 #include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <fitsio2.h>
+#include <zlib.h>
 
 #include <pstdlib.h>
 #include <play.h>
@@ -48,6 +62,18 @@
 #define TRUE  1
 #define FALSE 0
 
+/* Vectorized conversion kernels are available for x86 processors (SSSE3 and
+   AVX2 versions are selected at run-time) and for 64-bit ARM processors (NEON
+   is always available). */
+#if BYTESWAPPED && (defined(__x86_64__) || defined(__i386__)) && \
+  ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__))
+#  define USE_X86_KERNELS 1
+#  include <immintrin.h>
+#elif BYTESWAPPED && defined(__aarch64__) && defined(__ARM_NEON)
+#  define USE_NEON_KERNELS 1
+#  include <arm_neon.h>
+#endif
+
 #define MAXDIMS 99
 
 PLUG_API void y_error(const char *) __attribute__ ((noreturn));
@@ -89,6 +115,9 @@ static void critical(int clear_errmsg);
    can be the same.   NULL forbidden. */
 static int trim_string(char* dst, const char* src);
 
+/* Compare strings ignoring case. */
+static int same_name(const char* a, const char* b);
+
 /* Retrieve dimension list from arguments of the stack.  IARG_FIRST is the
    first stack element to consider, IARG_LAST is the last one (inclusive and
    such that IARG_FIRST >= IARG_LAST).  MAXDIMS is the maximum number of
@@ -108,13 +137,165 @@ static void yfits_print(void* ptr);
 static void yfits_eval(void* ptr, int argc);
 static void yfits_extract(void* ptr, char* name);
 
+/* Operations implementing the behavior of a FITS iterator. */
+typedef struct _yfits_iterator yfits_iterator;
+static void yfits_iterator_free(void* ptr);
+static void yfits_iterator_print(void* ptr);
+static void yfits_iterator_eval(void* ptr, int argc);
+static void yfits_iterator_extract(void* ptr, char* name);
+
+/* Operations implementing the behavior of FITS image views. */
+typedef struct _yfits_view yfits_view;
+static void yfits_view_free(void* ptr);
+static void yfits_view_print(void* ptr);
+static void yfits_view_eval(void* ptr, int argc);
+static void yfits_view_extract(void* ptr, char* name);
+#define VIEW_CACHE_SIZE 64 /* default number of cached row segments */
+
+/* Operations implementing the behavior of FITS columns. */
+typedef struct _yfits_columns yfits_columns;
+static void yfits_columns_free(void* ptr);
+static void yfits_columns_print(void* ptr);
+static void yfits_columns_eval(void* ptr, int argc);
+static void yfits_columns_extract(void* ptr, char* name);
+
+/* Operations implementing the behavior of FITS keywords. */
+typedef struct _yfits_keywords yfits_keywords;
+static void yfits_keywords_free(void* ptr);
+static void yfits_keywords_print(void* ptr);
+static void yfits_keywords_eval(void* ptr, int argc);
+static void yfits_keywords_extract(void* ptr, char* name);
+
 /* FITS instance functions. */
 typedef struct _yfits_object yfits_object;
 static yfits_object* yfits_push(void);
 static yfits_object* yfits_fetch(int iarg, unsigned int flags);
+
+/* Push a view of the image in the current HDU of a FITS handle (see
+   `fitsio_view_img`). */
+static void push_view(int iarg, yfits_object* obj, const long* fpix,
+                      const long* lpix, const long* ipix, long nslots);
+
+/* Index of the HDUs of a FITS file. */
+#define INDEX_MAXDIMS 9
+typedef struct {
+  LONGLONG headstart;           /* address of the header */
+  LONGLONG datastart;           /* address of the data */
+  LONGLONG dataend;             /* address of the end of the data */
+  long dims[INDEX_MAXDIMS];     /* dimensions (NAXIS1 and NAXIS2 for
+                                   tables) */
+  char extname[FLEN_VALUE];     /* value of EXTNAME (or HDUNAME, "" if
+                                   none) */
+  int type;                     /* type of HDU */
+  int extver;                   /* value of EXTVER (or HDUVER, 1 if none) */
+  int bitpix;                   /* BITPIX for images, 8 for tables */
+  int naxis;                    /* number of dimensions */
+} hdu_entry_t;
+
+/* Get the index of the HDUs of FITS handle OBJ, building it if needed.
+   Returns NULL in case of errors. */
+static const hdu_entry_t* get_hdu_index(yfits_object* obj, int* status);
+
+/* Drop the index of the HDUs of FITS handle OBJ. */
+static void drop_hdu_index(yfits_object* obj);
+
+/* Index of the keywords in the header of an HDU.  Cards with the same
+   keyword name (ignoring case) are chained, distinct names are hashed. */
+typedef struct {
+  char* cards;                  /* all the cards (80 characters each) as given
+                                   by fits_hdr2str */
+  char (*names)[FLEN_KEYWORD];  /* names of the distinct keywords */
+  int* first;                   /* first card of each distinct keyword */
+  int* next;                    /* next card with the same keyword, -1 if
+                                   none */
+  int* chain;                   /* next distinct keyword in the same bucket,
+                                   -1 if none */
+  int* bucket;                  /* first distinct keyword in each bucket, -1
+                                   if none */
+  LONGLONG headstart;           /* address of the header */
+  LONGLONG datastart;           /* address of the data */
+  int ncards;                   /* number of cards (END excluded) */
+  int nkeys;                    /* number of distinct keywords */
+  int nbuckets;                 /* number of buckets (a power of 2) */
+  int nrefs;                    /* number of references */
+} header_index_t;
+
+/* Get the index of the keywords of the current HDU of FITS handle OBJ,
+   building it if needed.  Returns NULL in case of errors. */
+static header_index_t* get_header_index(yfits_object* obj, int* status);
+
+/* Drop the index of the keywords of FITS handle OBJ. */
+static void drop_header_index(yfits_object* obj);
+
+/* Data parts of HDUs (or whole files) read ahead by a background thread (see
+   `fitsio_prefetch`). */
+typedef struct _prefetch prefetch_t;
+
+/* Release prefetch request P, its reader thread stops as soon as possible. */
+static void release_prefetch(prefetch_t* p);
+
+/* Drop the prefetched data of FITS handle OBJ. */
+static void drop_prefetch(yfits_object* obj);
+
+/* Start reading ahead the data of some image HDUs of FITS handle OBJ. */
+static void prefetch_hdus(yfits_object* obj, const long* hdus, long n);
+
+/* Claim the prefetched data part of an HDU of FITS handle OBJ. */
+static char* claim_prefetch(yfits_object* obj, int hdu, LONGLONG datastart,
+                            LONGLONG dataend);
+
+/* Stop accumulating statistics for FITS handle OBJ (when it is destroyed). */
+static void forget_stats(yfits_object* obj);
+
+/* Start logging input/output events in file PATH ("-" for the standard error
+   output), stop if PATH is NULL or empty. */
+static void set_trace(const char* path);
+
+/* Drop the header bytes of the header-only FITS handle OBJ (see
+   `open_header`), its file must have been closed. */
+static void drop_header_bytes(yfits_object* obj);
+
+/* Decompressed contents of a gzip'd file (see `open_inflated`). */
+typedef struct _inflated inflated_t;
+
+/* Open file PATH in inflate mode for FITS handle OBJ. */
+static int open_inflated(yfits_object* obj, const char* path, int nthreads,
+                         int* status);
+
+/* Release the decompressed contents used by FITS handle OBJ, its file must
+   have been closed. */
+static void drop_inflated(yfits_object* obj);
+
+/* Set the maximum number of bytes of the cache of decompressed files. */
+static void set_gzcache(long size);
+
+/* File descriptor shared by a read-only FITS handle and the handles reopened
+   from it (see `fitsio_reopen_file`). */
+typedef struct _shared_fd shared_fd_t;
+
+/* Get the shared descriptor of FITS handle OBJ, -1 if there is none.  If
+   CREATE is true and the handle is a read-only regular file, the descriptor
+   is opened if not yet done. */
+static int shared_descriptor(yfits_object* obj, int create);
+
+/* Release the shared descriptor of FITS handle OBJ. */
+static void drop_descriptor(yfits_object* obj);
+
+/* Read N bytes at OFFSET of file descriptor FD into BUF with `pread`, which
+   does not move the file offset (this can be done by any thread).  Returns
+   FALSE on failure. */
+static int read_at(int fd, void* buf, size_t n, LONGLONG offset);
+
+/* Remove the extra rows reserved for appending to a table of FITS handle OBJ
+   (see `fitsio_write_cols`). */
+static int release_rows(yfits_object* obj, int* status);
 #define MAY_BE_CLOSED  0
 #define NOT_CLOSED 1
 #define CRITICAL       2
+#define MODIFIED       4 /* file will be modified, drop the indexes and the
+                            prefetched data */
+#define APPENDING      8 /* keep the rows reserved for appending (otherwise
+                            they are removed) */
 
 static const char* hdu_type_name(int type);
 
@@ -124,17 +305,415 @@ static int
 get_image_param(fitsfile* fptr, int maxdims, int* bitpix, int* naxis,
                 long dims[], long* number, int* status);
 
+/* Scaling parameters of an image as given by the BSCALE, BZERO and BLANK
+   keywords. */
+typedef struct {
+  double scale;
+  double zero;
+  LONGLONG blank;
+  int has_blank;
+} scaling_t;
+
+/* Get scaling parameters of the current image HDU. */
+static int
+get_image_scaling(fitsfile* fptr, scaling_t* s, int* status);
+
+/* Get the CFITSIO pixel type and the Yorick type YTYPE of the array to read
+   image values of type BITPIX (as given by fits_get_img_equivtype) or column
+   values of type COLTYPE (as given by fits_get_eqcoltype).  Returns -1 if
+   unsupported. */
+static int image_datatype(int bitpix, int* ytype);
+static int column_datatype(int coltype, int* ytype);
+
+/* Get the equivalent type COLTYPE, the maximum length WIDTH of strings and
+   the dimension list DIMS of the values read in NROWS rows of column COLNUM
+   (DIMS has a trailing dimension if NROWS > 1, a cell with a single value is
+   a scalar, the leading dimension of a cell of strings is discarded).
+   Returns the number of values. */
+static long
+get_cell_dims(fitsfile* fptr, int colnum, long nrows, int* coltype,
+              long* width, long dims[]);
+
+/* Push a new array of Yorick type YTYPE and dimension list DIMS and return
+   its address.  Each element of an array of strings is allocated with WIDTH
+   + 1 bytes. */
+static void* push_array(int ytype, long dims[], long width);
+
+/* Push the array given by keyword OUT at position OUT_IARG and return the
+   address where to store values of Yorick type YTYPE and dimension list
+   DIMS.  The array must have the same type and dimensions or, if SLICE is
+   positive, one more trailing dimension whose index is SLICE. */
+static void* push_output(int out_iarg, long slice, int ytype, long dims[]);
+
+/* Push a new array to store strings of at most WIDTH characters with
+   dimension list DIMS: an array of strings (whose elements are NULL) or, if
+   CHARS is true, an array of chars whose leading dimension is WIDTH. */
+static void* push_strings(long dims[], long width, int chars);
+
+/* Read the NUMBER strings of at most WIDTH characters stored in NROWS rows
+   of the string column COLNUM starting at FIRSTROW into ARR (created by
+   `push_strings`).  The raw bytes of the column are read by large blocks
+   of rows.  Trailing spaces are removed, each string is allocated with its
+   actual length or, if CHARS is true, the strings are padded with nulls in
+   the array of chars ARR. */
+static int read_strings(fitsfile* fptr, int colnum, long firstrow,
+                        long nrows, long number, long width, void* arr,
+                        int chars, int* status);
+
+/* Store the strings of at most WIDTH characters in the cells of CELLSIZE
+   bytes at offset TBCOL of the NROWS rows of ROWLEN bytes in ROWS into ARR
+   (created by `push_strings`), starting at the string number OFFSET.  The
+   strings are trimmed as by `read_strings` and the null string SNULL of
+   NULLLEN characters (see `string_length`) is stored as an empty string. */
+static void extract_strings(const char* rows, long rowlen, long nrows,
+                            long tbcol, long cellsize, long width,
+                            const char* snull, long nulllen, int chars,
+                            void* arr, long offset);
+
+/* Get the length of the string of at most WIDTH characters in STR without
+   trailing spaces, 0 if it is the null string SNULL of NULLLEN characters
+   (NULLLEN < 0 if there is none). */
+static long string_length(const char* str, long width, const char* snull,
+                          long nulllen);
+
+/* Select the rows among the NROWS rows starting at FIRSTROW of the current
+   table for which the boolean expression EXPR (with the syntax of CFITSIO
+   row filters) is true.  The expression is evaluated by CFITSIO while
+   scanning the table.  An array of NROWS chars set to 1 for the selected
+   rows is pushed on the stack and stored in FLAGS; if EXPR is NULL or
+   empty, all rows are selected, nothing is pushed and FLAGS is set to NULL.
+   Returns the number of selected rows. */
+static long select_rows(fitsfile* fptr, const char* expr, long firstrow,
+                        long nrows, char** flags);
+
+/* Move the selected rows among NROWS rows of ROWLEN bytes at the beginning
+   of ROWS and return their number.  All rows are selected if FLAGS is
+   NULL. */
+static long compact_rows(char* rows, long rowlen, long nrows,
+                         const char* flags);
+
+/* Check whether any of NROWS rows are selected by FLAGS. */
+static int any_selected(const char* flags, long nrows);
+
+/* Read the NPER values per row of column COLNUM of CFITSIO pixel type
+   DATATYPE for the rows selected by FLAGS (all if NULL) among NROWS rows
+   starting at FIRSTROW into ARR.  Runs of consecutive selected rows are
+   read at once.  For strings, WIDTH and CHARS are as for `read_strings`,
+   for other types NULVAL is the value of undefined elements. */
+static int read_selected(fitsfile* fptr, int datatype, int colnum,
+                         long firstrow, long nrows, const char* flags,
+                         long nper, long width, int chars, void* nulval,
+                         void* arr, int* anynull, int* status);
+
+/* Sort the N row indices ROWS (1-based, at most NROWS) given by keyword ROWS
+   into GATHER of 2*N elements: the pairs of row index and position in ROWS
+   in increasing order of rows (then of positions).  Returns whether ROWS
+   was already in increasing order. */
+static int sort_rows(const long* rows, long n, long nrows, long* gather);
+
+/* Maximum number of bytes read in excess to read two runs of rows at
+   once. */
+#define GATHER_GAP (64L*1024L)
+
+/* Same as `read_selected` but for the N rows given by GATHER (as sorted by
+   `sort_rows`) whose values are stored in ARR at their position in the
+   original list.  Nearby rows are read at once. */
+static int read_gathered(fitsfile* fptr, int datatype, int colnum,
+                         const long* gather, long n, long nper, long width,
+                         int chars, void* nulval, void* arr, int* anynull,
+                         int* status);
+
+/* Move the N cells of CELLSIZE bytes of ARR, stored in the order of the rows
+   in GATHER, to their position in the original list, WORKSPACE must have
+   N*CELLSIZE bytes. */
+static void scatter_cells(void* arr, long n, size_t cellsize,
+                          const long* gather, void* workspace);
+
+/* Get the list of columns of the current HDU specified by argument IARG (all
+   NTOTAL columns if IARG is -1) as integers or names.  The column numbers are
+   stored in COLNUM (of size MAX_COLUMNS) and their number is returned. */
+#define MAX_COLUMNS 999
+static long get_column_list(int iarg, fitsfile* fptr, int ntotal,
+                            int colnum[]);
+
+/* Check that an array of Yorick type TYPE and dimension list DIMS can be
+   written into column COLNUM of the current HDU and return the CFITSIO
+   pixel type of its values.  If NROWS is not NULL, the number of rows
+   corresponding to the array is stored in NROWS. */
+static int get_column_type(fitsfile* fptr, int colnum, int type,
+                           const long dims[], long* nrows);
+
+/* Get the CFITSIO pixel type to write an array of Yorick type TYPE into a
+   column of type COLTYPE. */
+static int array_datatype(int type, int coltype);
+
+/* Get the BITPIX code corresponding to a Yorick type name, 0 if unknown. */
+static int type_bitpix(const char* name);
+/* Get the compression algorithm given by argument IARG as a name (case is
+   ignored) or as an integer code. */
+static int fetch_compression(int iarg);
+
+/* Get the dimensions of the tiles given by argument IARG into TILE and
+   return their number (0 if IARG is nil). */
+static int fetch_tile(int iarg, long tile[]);
+
+/* Get the quantization level given by argument IARG (0 if nil). */
+static float fetch_quantize(int iarg);
+
+/* Create a new image HDU in FPTR with BITPIX and dimensions DIMS (NAXIS
+   first).  If COMPRESS >= NOCOMPRESS, the image is created with this
+   compression and, if specified, the tiles and the quantization level; the
+   compression parameters of FPTR are restored afterwards. */
+static int create_image(fitsfile* fptr, int bitpix, const long dims[],
+                        int compress, int ntile, const long tile[],
+                        float quantize, int* status);
+
+/* Get the BITPIX code of the raw values of a binary table column whose
+   CFITSIO type code is TCODE and store in COUNT the number of such values
+   per element (2 for complexes).  Returns 0 if unsupported. */
+static int column_bitpix(int tcode, int* count);
+
+/* Size (in bytes) of elements of CFITSIO pixel type DATATYPE, 0 if
+   unknown. */
+static size_t type_size(int datatype);
+
+/* Check whether raw FITS values of type BITPIX with scaling parameters S can
+   be converted into CFITSIO pixel type DATATYPE by `convert_values`. */
+static int convertible(int bitpix, int datatype, const scaling_t* s);
+
+/* A function converting N values in SRC into DST with scaling parameters S
+   (see `convert_values` and `encode_values`) and returning whether there
+   are any undefined (or unrepresentable) values. */
+typedef int (*converter_t)(void* dst, const void* src, long n,
+                           const scaling_t* s);
+
+/* Select the type-specialized function converting raw FITS values of type
+   BITPIX into CFITSIO pixel type DATATYPE (or the converse for
+   `select_encoder`) with scaling parameters S.  Returns NULL if the
+   conversion is not possible. */
+static converter_t
+select_converter(int bitpix, int datatype, const scaling_t* s);
+static converter_t
+select_encoder(int bitpix, int datatype, const scaling_t* s);
+
+/* Convert N raw (big-endian) FITS values of type BITPIX in SRC into values
+   of CFITSIO pixel type DATATYPE in DST applying the scaling parameters S.
+   SRC and DST may be the same if both types have the same size.  Undefined
+   values become NaN for floating-point types and the scaled BLANK value for
+   integer types.  Returns TRUE if there are any undefined values. */
+static int
+convert_values(void* dst, int datatype, const void* src, int bitpix, long n,
+               const scaling_t* s);
+
+/* Same as `convert_values` but split the work among NTHREADS threads.  The
+   conversion may be started with `start_conversion` and its result collected
+   later with `pool_wait`.  In that case, SRC, DST and S must remain valid
+   until `pool_wait` returns. */
+static void
+start_conversion(void* dst, int datatype, const void* src, int bitpix,
+                 long n, const scaling_t* s, int nthreads);
+static int
+convert_values_parallel(void* dst, int datatype, const void* src, int bitpix,
+                        long n, const scaling_t* s, int nthreads);
+
+/* Check whether values of CFITSIO pixel type DATATYPE can be converted into
+   raw FITS values of type BITPIX with scaling parameters S by
+   `encode_values`. */
+static int encodable(int bitpix, int datatype, const scaling_t* s);
+
+/* Convert N values of CFITSIO pixel type DATATYPE in SRC into raw
+   (big-endian) FITS values of type BITPIX in DST applying the inverse of the
+   scaling parameters S.  Returns TRUE if any value cannot be represented.
+   Functions `start_encoding` and `encode_values_parallel` are the
+   multi-threaded versions (see `start_conversion`). */
+static int
+encode_values(void* dst, int bitpix, const void* src, int datatype, long n,
+              const scaling_t* s);
+static void
+start_encoding(void* dst, int bitpix, const void* src, int datatype,
+               long n, const scaling_t* s, int nthreads);
+static int
+encode_values_parallel(void* dst, int bitpix, const void* src, int datatype,
+                       long n, const scaling_t* s, int nthreads);
+
+/* Check whether any of the N values of type DATATYPE in SRC cannot be
+   represented once encoded as raw values of type BITPIX with scaling S.
+   The values are encoded by blocks of BLOCKLEN values into WORKSPACE (and
+   discarded) only if their type does not fit into the raw type.  This is
+   used to detect overflows before writing anything. */
+static int
+encoding_overflows(void* workspace, long blocklen, int bitpix,
+                   const void* src, int datatype, long n,
+                   const scaling_t* s, int nthreads);
+
+/* State of a 32-bit ones' complement sum (as defined by the FITS checksum
+   convention) of a stream of bytes.  The bytes may be given in pieces of any
+   size by `chksum_update`, `chksum_value` yields the sum so far. */
+typedef struct {
+  uint64_t sum;     /* sum of the complete words */
+  uint8_t part[4];  /* bytes of the incomplete word */
+  int npart;        /* number of bytes in PART */
+  int done;         /* sum of the whole data unit computed? */
+} chksum_t;
+static void chksum_init(chksum_t* c);
+static void chksum_update(chksum_t* c, const void* src, size_t nbytes);
+static uint32_t chksum_value(const chksum_t* c);
+
+/* Start the summation of N big-endian 32-bit words in SRC by NTHREADS
+   threads.  As for `start_conversion`, the job runs in the thread pool and
+   its result is collected by `finish_checksum`. */
+static void start_checksum(const void* src, long n, int nthreads);
+static uint32_t finish_checksum(void);
+
+/* Summary statistics of a stream of values given in pieces of any size, NaN
+   values being considered as undefined. */
+typedef struct {
+  long count;  /* number of defined values */
+  long nulls;  /* number of undefined values */
+  double min;  /* minimum of the defined values */
+  double max;  /* maximum of the defined values */
+  double mean; /* mean of the defined values */
+  double m2;   /* sum of the squared deviations from the mean */
+} summary_t;
+static void summary_init(summary_t* s);
+
+/* Start the summation of N values in SRC by NTHREADS threads, the result is
+   merged into S by `finish_summary` (as for `start_checksum`, the job runs
+   in the thread pool). */
+static void start_summary(const double* src, long n, int nthreads);
+static void finish_summary(summary_t* s);
+
+/* Push the summary statistics S as a vector of doubles. */
+static void push_summary(const summary_t* s);
+
+/* Save the summary statistics S in the header of the current HDU: the range
+   in the keywords MIN and MAX (DATAMIN and DATAMAX, or TDMINn and TDMAXn),
+   the other statistics in the string keyword STAT (DATASTAT or TSTATn) if
+   they fit in a card.  `load_summary` retrieves them, returning FALSE if
+   any keyword is missing or invalid. */
+static int save_summary(fitsfile* fptr, const char* min, const char* max,
+                        const char* stat, const summary_t* s, int* status);
+static int load_summary(fitsfile* fptr, const char* min, const char* max,
+                        const char* stat, summary_t* s);
+
+/* Compute the sum of the data unit of the current HDU with NTHREADS threads
+   while the data are being read.  The result is the same as the DATASUM of
+   `fits_get_chksum`. */
+static int
+data_checksum(fitsfile* fptr, int nthreads, unsigned long* sum, int* status);
+
+/* Get the value of the DATASUM keyword of the current HDU, returns FALSE if
+   there is no such keyword or in case of errors. */
+static int
+get_datasum_key(fitsfile* fptr, unsigned long* value, int* status);
+
+/* Select the fastest conversion kernels for the processor (only the first
+   call has any effect). */
+static void init_kernels(void);
+
+/* Set the value taken by undefined elements of type DATATYPE when converted
+   by `convert_values`. */
+static void
+set_null_value(scalar_t* null, int datatype, const scaling_t* s);
+
+/* Multi-threading.  Worker threads process memory buffers (or read the data
+   of a file with `read_at`), they never call Yorick and never use the
+   CFITSIO handles of the main thread.  The only exception is if CFITSIO is
+   reentrant (see `fits_is_reentrant`): the tasks of `read_tiles_task`,
+   `write_tiles_task` and `read_many_task` then call CFITSIO on their own
+   handles; otherwise, the tiles are not processed by the workers and the
+   tasks of `read_many_task` are all performed by the main thread (with
+   NTHREADS = 1).  A job consists in
+   NTASKS independent tasks, each task is performed by calling FUNC(CTX, I)
+   with I = 0, 1, ..., NTASKS-1 and the result of the job is the bitwise-or
+   of the values returned by FUNC. */
+#define MAX_THREADS 256
+typedef int task_function(void* ctx, long i);
+static void pool_start(task_function* func, void* ctx, long ntasks,
+                       int nthreads);
+static int pool_wait(void);
+
+/* Default number of threads and function to get the number of threads from
+   the value of a keyword. */
+static int yfits_nthreads = 1;
+static int fetch_nthreads(int iarg);
+
+/* Size of the blocks of raw bytes read or written by the plug-in itself.
+   For images, this is the default which can be changed by `fitsio_setup`
+   and set per FITS handle when opening a file. */
+#define RAW_BLOCK_SIZE (8L*1024L*1024L)
+static long yfits_bufsize = RAW_BLOCK_SIZE;
+static long fetch_bufsize(int iarg);
+
+/* Get a (temporary) workspace of at least SIZE bytes, NULL on failure. */
+static void* get_workspace(size_t size);
+
+/* Input/output statistics.  The counters are updated for every handle and
+   for the "current" handle (the last one fetched by `yfits_fetch` or used by
+   a view or an iterator).  Functions `count_read`, `count_write` and
+   `count_convert` take the time T0 (given by `stats_clock`) at the start of
+   the operation.  Reads through a memory mapping are counted with no time,
+   the time spent in page faults being part of the conversion. */
+typedef struct {
+  double bytes_read;    /* number of bytes read (data or header) */
+  double bytes_written; /* number of bytes written */
+  double io_time;       /* seconds spent reading or writing */
+  double convert_time;  /* seconds spent converting values (or waiting for the
+                           threads doing it) */
+  long reads;           /* number of read operations */
+  long writes;          /* number of write operations */
+  long seeks;           /* number of moves of the file position */
+  long moves;           /* number of HDU moves */
+  long hits;            /* number of hits in the caches of the plug-in */
+  long misses;          /* number of misses */
+} yfits_stats_t;
+static double stats_clock(void);
+static void count_read(double nbytes, double t0);
+static void count_write(double nbytes, double t0);
+static void count_convert(double t0);
+static void count_seek(void);
+static void count_move(void);
+static void count_cache(int hit);
+static yfits_stats_t global_stats;
+static yfits_object* stats_obj = NULL; /* current handle */
+
 /* Fast indexes to common keywords. */
+static long index_of_append = -1L;
 static long index_of_ascii = -1L;
 static long index_of_basic = -1L;
+static long index_of_bufsize = -1L;
+static long index_of_cache = -1L;
 static long index_of_case = -1L;
+static long index_of_chars = -1L;
+static long index_of_chksum = -1L;
+static long index_of_chunk = -1L;
+static long index_of_compress = -1L;
+static long index_of_direct = -1L;
 static long index_of_extname = -1L;
 static long index_of_first = -1L;
+static long index_of_gzcache = -1L;
+static long index_of_hdu = -1L;
+static long index_of_header = -1L;
 static long index_of_incr = -1L;
+static long index_of_inflate = -1L;
 static long index_of_last = -1L;
 static long index_of_null = -1L;
+static long index_of_nthreads = -1L;
 static long index_of_number = -1L;
+static long index_of_offsets = -1L;
+static long index_of_out = -1L;
+static long index_of_prefetch = -1L;
+static long index_of_quantize = -1L;
+static long index_of_raw = -1L;
+static long index_of_reuse = -1L;
+static long index_of_rows = -1L;
+static long index_of_slice = -1L;
+static long index_of_tile = -1L;
+static long index_of_trace = -1L;
 static long index_of_tunit = -1L;
+static long index_of_type = -1L;
+static long index_of_update = -1L;
+static long index_of_where = -1L;
 static long index_of_def = -1L;
 
 /* A static buffer for error messages, file names, etc. */
@@ -155,6 +734,22 @@ yfits_error(int status)
 /* FITS handle instance. */
 struct _yfits_object {
   fitsfile *fptr;
+  hdu_entry_t* hdus; /* index of the HDUs (or NULL) */
+  int nhdus;         /* number of indexed HDUs */
+  header_index_t* header; /* index of the keywords of an HDU (or NULL) */
+  prefetch_t* prefetch; /* data read ahead (or NULL) */
+  long bufsize;     /* size of blocks for reading images, 0 for default */
+  int direct;       /* read large images directly from the file? */
+  unsigned long generation; /* incremented whenever the file may be
+                               modified */
+  void* membuf;     /* header bytes of a header-only handle (or NULL) */
+  size_t memsize;   /* number of header bytes */
+  inflated_t* inflated; /* decompressed contents of a gzip'd file (or
+                           NULL) */
+  shared_fd_t* sfd; /* descriptor shared with reopened handles (or NULL) */
+  long append_rows; /* number of rows in use in HDU APPEND_HDU */
+  int append_hdu;   /* HDU with extra rows reserved for appending, 0 if none */
+  yfits_stats_t stats; /* input/output statistics */
 };
 
 /* FITS handle type. */
@@ -171,51 +766,191 @@ yfits_free(void* ptr)
     /* Close the FITS file.  In case of failure, just print the error messages
        (do not throw an error). */
     int status = 0;
+    if (release_rows(obj, &status) != 0) {
+      fits_report_error(stderr, status);
+      status = 0;
+    }
     obj->fptr = NULL;
     if (fits_close_file(fptr, &status) != 0) {
       fits_report_error(stderr, status);
     }
   }
+  drop_header_bytes(obj);
+  drop_inflated(obj);
+  drop_descriptor(obj);
+  drop_hdu_index(obj);
+  drop_header_index(obj);
+  drop_prefetch(obj);
+  forget_stats(obj);
+}
+
+static int
+release_rows(yfits_object* obj, int* status)
+{
+  fitsfile* fptr = obj->fptr;
+  long nrows;
+  int hdu, type;
+
+  if (fptr != NULL && obj->append_hdu > 0 && *status == 0) {
+    fits_get_hdu_num(fptr, &hdu);
+    if (fits_movabs_hdu(fptr, obj->append_hdu, &type, status) == 0 &&
+        fits_get_num_rows(fptr, &nrows, status) == 0 &&
+        nrows > obj->append_rows) {
+      fits_delete_rows(fptr, obj->append_rows + 1, nrows - obj->append_rows,
+                       status);
+    }
+    if (*status == 0) {
+      fits_movabs_hdu(fptr, hdu, &type, status);
+    }
+    obj->append_hdu = 0;
+  }
+  return *status;
+}
+
+static void
+drop_hdu_index(yfits_object* obj)
+{
+  if (obj->hdus != NULL) {
+    free(obj->hdus);
+    obj->hdus = NULL;
+  }
+  obj->nhdus = 0;
+}
+
+static const hdu_entry_t*
+get_hdu_index(yfits_object* obj, int* status)
+{
+  fitsfile* fptr = obj->fptr;
+  hdu_entry_t* hdus;
+  int hdu, hdu0, nhdus, type, code;
+
+  if (obj->hdus != NULL) {
+    return obj->hdus;
+  }
+  if (fptr == NULL || fits_get_num_hdus(fptr, &nhdus, status) != 0) {
+    return NULL;
+  }
+  if ((hdus = (hdu_entry_t*)malloc((nhdus > 0 ? nhdus : 1)*
+                                   sizeof(hdu_entry_t))) == NULL) {
+    *status = MEMORY_ALLOCATION;
+    return NULL;
+  }
+
+  /* Visit every HDU (this is done once) and restore the current HDU. */
+  fits_get_hdu_num(fptr, &hdu0);
+  for (hdu = 1; hdu <= nhdus; ++hdu) {
+    hdu_entry_t* e = &hdus[hdu-1];
+    if (fits_movabs_hdu(fptr, hdu, &type, status) != 0 ||
+        fits_get_hdu_type(fptr, &e->type, status) != 0 ||
+        fits_get_hduaddrll(fptr, &e->headstart, &e->datastart, &e->dataend,
+                           status) != 0) {
+      break;
+    }
+    if (e->type == IMAGE_HDU) {
+      if (fits_get_img_param(fptr, INDEX_MAXDIMS, &e->bitpix, &e->naxis,
+                             e->dims, status) != 0) {
+        break;
+      }
+    } else {
+      e->bitpix = BYTE_IMG;
+      e->naxis = 2;
+      if (fits_read_key(fptr, TLONG, "NAXIS1", &e->dims[0], NULL,
+                        status) != 0 ||
+          fits_read_key(fptr, TLONG, "NAXIS2", &e->dims[1], NULL,
+                        status) != 0) {
+        break;
+      }
+    }
+    code = 0;
+    if (fits_read_key(fptr, TSTRING, "EXTNAME", e->extname, NULL,
+                      &code) != 0) {
+      code = 0;
+      if (fits_read_key(fptr, TSTRING, "HDUNAME", e->extname, NULL,
+                        &code) != 0) {
+        e->extname[0] = '\0';
+      }
+    }
+    code = 0;
+    if (fits_read_key(fptr, TINT, "EXTVER", &e->extver, NULL, &code) != 0) {
+      code = 0;
+      if (fits_read_key(fptr, TINT, "HDUVER", &e->extver, NULL,
+                        &code) != 0) {
+        e->extver = 1;
+      }
+    }
+  }
+  fits_clear_errmsg();
+  code = 0;
+  fits_movabs_hdu(fptr, hdu0, &type, (*status == 0 ? status : &code));
+  if (*status != 0) {
+    free(hdus);
+    return NULL;
+  }
+  obj->hdus = hdus;
+  obj->nhdus = nhdus;
+  return hdus;
+}
+
+/* Find the first HDU of type TYPE (or any type if ANY_HDU) whose name is
+   EXTNAME and version EXTVER (any version if 0) in the index of OBJ.
+   Returns the HDU number, 0 if not found, -1 on error. */
+static int
+find_hdu(yfits_object* obj, int type, const char* extname, int extver,
+         int* status)
+{
+  const hdu_entry_t* hdus = get_hdu_index(obj, status);
+  int hdu;
+  if (hdus == NULL) {
+    return -1;
+  }
+  for (hdu = 1; hdu <= obj->nhdus; ++hdu) {
+    const hdu_entry_t* e = &hdus[hdu-1];
+    if ((type == ANY_HDU || type == e->type) &&
+        (extver == 0 || extver == e->extver) &&
+        same_name(extname, e->extname)) {
+      return hdu;
+    }
+  }
+  return 0;
 }
 
 static void
 yfits_print(void* ptr)
 {
   yfits_object* obj = (yfits_object*)ptr;
-  fitsfile *fptr = obj->fptr;
-  int number, status = 0;
+  const hdu_entry_t* hdus = NULL;
+  int hdu, k, status = 0;
 
   critical(TRUE);
-  if (fptr != NULL) {
-    fits_get_num_hdus(fptr, &number, &status);
-  } else {
-    number = 0;
+  if (obj->fptr != NULL && (hdus = get_hdu_index(obj, &status)) == NULL) {
+    fits_report_error(stderr, status);
   }
-  sprintf(buffer, "%s with %d HDU", yfits_type.type_name, number);
+  sprintf(buffer, "%s with %d HDU", yfits_type.type_name,
+          (hdus != NULL ? obj->nhdus : 0));
   y_print(buffer, TRUE);
-  if (number >= 1) {
-    int hdu0, hdu, type;
-    fits_get_hdu_num(fptr, &hdu0);
-    for (hdu = 1; hdu <= number; ++hdu) {
-      if (fits_movabs_hdu(fptr, hdu, &type, &status) != 0) {
-        fits_report_error(stderr, status);
-        status = 0;
-        break;
-      }
-      sprintf(buffer, "  HDU[%d] = %s", hdu, hdu_type_name(type));
-      y_print(buffer, TRUE);
+  for (hdu = 1; hdus != NULL && hdu <= obj->nhdus; ++hdu) {
+    const hdu_entry_t* e = &hdus[hdu-1];
+    char* str = buffer;
+    str += sprintf(str, "  HDU[%d] = %s", hdu, hdu_type_name(e->type));
+    for (k = 0; k < e->naxis && k < INDEX_MAXDIMS; ++k) {
+      str += sprintf(str, "%c%ld", (k == 0 ? ' ' : 'x'), e->dims[k]);
     }
-    if (fits_movabs_hdu(fptr, hdu0, &type, &status) != 0) {
-      fits_report_error(stderr, status);
-      status = 0;
+    if (e->extname[0] != '\0') {
+      sprintf(str, " \"%s\"", e->extname);
     }
+    y_print(buffer, TRUE);
   }
 }
 
+/* Calling a FITS handle without arguments yields a view of the image in the
+   current HDU. */
 static void
 yfits_eval(void* ptr, int argc)
 {
-  ypush_nil();
+  if (argc != 0) {
+    y_error("FITS handle can only be called without arguments");
+  }
+  push_view(argc, (yfits_object*)ptr, NULL, NULL, NULL, VIEW_CACHE_SIZE);
 }
 
 static void
@@ -224,6 +959,91 @@ yfits_extract(void* ptr, char* name)
   ypush_nil();
 }
 
+static void
+drop_header_bytes(yfits_object* obj)
+{
+  if (obj->membuf != NULL) {
+    void* buf = obj->membuf;
+    obj->membuf = NULL;
+    obj->memsize = 0;
+    free(buf);
+  }
+}
+
+/* Open file PATH in header-only mode: the primary header is read by blocks
+   of 2880 bytes until the END card and CFITSIO only sees these bytes as a
+   memory file (without the data part).  Keywords and image parameters can
+   be queried as usual, but not the data. */
+static int
+open_header(yfits_object* obj, const char* path, int* status)
+{
+  char* buf;
+  char* ptr;
+  const char* card;
+  size_t size, used, offset;
+  ssize_t nr;
+  int fd, k, found;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    return (*status = FILE_NOT_OPENED);
+  }
+  size = 4*2880;
+  if ((buf = (char*)malloc(size)) == NULL) {
+    close(fd);
+    return (*status = MEMORY_ALLOCATION);
+  }
+  used = 0;
+  found = FALSE;
+  while (! found) {
+    if (used + 2880 > size) {
+      if ((ptr = (char*)realloc(buf, 2*size)) == NULL) {
+        *status = MEMORY_ALLOCATION;
+        break;
+      }
+      buf = ptr;
+      size *= 2;
+    }
+    for (offset = 0; offset < 2880; offset += nr) {
+      nr = read(fd, buf + used + offset, 2880 - offset);
+      if (nr <= 0) {
+        break;
+      }
+    }
+    if (offset < 2880) {
+      *status = (used > 0 ? END_OF_FILE : FILE_NOT_OPENED);
+      break;
+    }
+    for (k = 0; k < 36 && ! found; ++k) {
+      card = buf + used + 80*k;
+      if (card[0] == 'E' && card[1] == 'N' && card[2] == 'D') {
+        found = TRUE;
+        for (offset = 3; offset < 80; ++offset) {
+          if (card[offset] != ' ') {
+            found = FALSE;
+            break;
+          }
+        }
+      }
+    }
+    used += 2880;
+  }
+  close(fd);
+  if (! found) {
+    free(buf);
+    return *status;
+  }
+  obj->membuf = buf;
+  obj->memsize = used;
+  /* A neutral name is given to CFITSIO, PATH may contain brackets or other
+     characters that would be parsed as an extended file name. */
+  if (fits_open_memfile(&obj->fptr, "mem://", READONLY, &obj->membuf,
+                        &obj->memsize, 0, NULL, status) != 0) {
+    obj->fptr = NULL;
+    drop_header_bytes(obj);
+  }
+  return *status;
+}
+
 /* Open an existing data file. */
 static void
 open_file(int argc, int which)
@@ -231,7 +1051,13 @@ open_file(int argc, int which)
   yfits_object* obj;
   char* path = NULL;
   char* mode = NULL;
+  long prefetch = 0; /* number of HDUs to read ahead */
+  long bufsize = 0; /* size of blocks for reading images */
+  int direct = FALSE; /* read large images directly? */
   int basic = FALSE; /* use basic file name syntax? */
+  int header = FALSE; /* only read the primary header? */
+  int inflate = FALSE; /* decompress gzip'd files ourself? */
+  int nthreads = yfits_nthreads; /* number of threads for decompressing */
   int status = 0;
   int iomode = 0;
   int iarg;
@@ -253,6 +1079,18 @@ open_file(int argc, int which)
       --iarg;
       if (which == 0 && index == index_of_basic) {
         basic = yarg_true(iarg);
+      } else if (which == 0 && index == index_of_header) {
+        header = yarg_true(iarg);
+      } else if (which == 0 && index == index_of_inflate) {
+        inflate = yarg_true(iarg);
+      } else if (which == 0 && index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
+      } else if (index == index_of_prefetch) {
+        prefetch = (yarg_nil(iarg) ? 0 : ygets_l(iarg));
+      } else if (index == index_of_bufsize) {
+        bufsize = (yarg_nil(iarg) ? 0 : fetch_bufsize(iarg));
+      } else if (index == index_of_direct) {
+        direct = yarg_true(iarg);
       } else {
         y_error("unsupported keyword");
       }
@@ -266,8 +1104,19 @@ open_file(int argc, int which)
   } else {
     y_error("invalid mode");
   }
+  if (header && iomode != READONLY) {
+    y_error("header-only mode is only possible for reading");
+  }
+  if (inflate && iomode != READONLY) {
+    y_error("inflate mode is only possible for reading");
+  }
+  if (inflate && header) {
+    y_error("header-only and inflate modes are exclusive");
+  }
 
   obj = yfits_push();
+  obj->bufsize = bufsize;
+  obj->direct = direct;
   critical(TRUE);
   if (which == 1) {
     fits_open_data(&obj->fptr, path, iomode, &status);
@@ -275,6 +1124,10 @@ open_file(int argc, int which)
     fits_open_table(&obj->fptr, path, iomode, &status);
   } else if (which == 3) {
     fits_open_image(&obj->fptr, path, iomode, &status);
+  } else if (header) {
+    open_header(obj, path, &status);
+  } else if (inflate) {
+    open_inflated(obj, path, nthreads, &status);
   } else if (basic) {
     fits_open_diskfile(&obj->fptr, path, iomode, &status);
   } else {
@@ -282,6 +1135,9 @@ open_file(int argc, int which)
   }
 
   if (status) yfits_error(status);
+  if (prefetch > 0) {
+    prefetch_hdus(obj, NULL, prefetch);
+  }
 }
 
 void
@@ -362,8 +1218,18 @@ Y_fitsio_close_file(int argc)
   fptr = obj->fptr;
   if (fptr != NULL) {
     int status = 0;
+    if (release_rows(obj, &status) != 0) {
+      yfits_error(status);
+    }
     obj->fptr = NULL;
-    if (fits_close_file(fptr, &status) != 0) {
+    drop_hdu_index(obj);
+    drop_header_index(obj);
+    drop_prefetch(obj);
+    fits_close_file(fptr, &status);
+    drop_header_bytes(obj);
+    drop_inflated(obj);
+    drop_descriptor(obj);
+    if (status != 0) {
       yfits_error(status);
     }
   }
@@ -378,11 +1244,23 @@ Y_fitsio_delete_file(int argc)
 
   if (argc != 1) y_error("expecting exactly one argument");
   obj = yfits_fetch(0, NOT_CLOSED|CRITICAL);
+  if (obj->membuf != NULL) {
+    y_error("cannot delete a file opened in header-only mode");
+  }
+  if (obj->inflated != NULL) {
+    y_error("cannot delete a file opened in inflate mode");
+  }
   fptr = obj->fptr;
   if (fptr != NULL) {
     int status = 0;
     obj->fptr = NULL;
-    if (fits_delete_file(fptr, &status) != 0) {
+    obj->append_hdu = 0;
+    drop_hdu_index(obj);
+    drop_header_index(obj);
+    drop_prefetch(obj);
+    fits_delete_file(fptr, &status);
+    drop_descriptor(obj);
+    if (status != 0) {
       yfits_error(status);
     }
   }
@@ -474,10 +1352,13 @@ Y_fitsio_movabs_hdu(int argc)
   fptr = fetch_fitsfile(1, NOT_CLOSED|CRITICAL);
   number = fetch_int(0);
   if (number <= 0) y_error("invalid HDU number");
+  count_move();
   if (fits_movabs_hdu(fptr, number, &type, &status) != 0) {
-    if (status != BAD_HDU_NUM || yarg_subroutine()) {
+    if ((status != BAD_HDU_NUM && status != END_OF_FILE) ||
+        yarg_subroutine()) {
       yfits_error(status);
     }
+    fits_clear_errmsg();
     type = -1;
   }
   ypush_int(type);
@@ -493,10 +1374,13 @@ Y_fitsio_movrel_hdu(int argc)
   if (argc != 2) y_error("expecting exactly two arguments");
   fptr = fetch_fitsfile(1, NOT_CLOSED|CRITICAL);
   offset = fetch_int(0);
+  count_move();
   if (fits_movrel_hdu(fptr, offset, &type, &status) != 0) {
-    if (status != BAD_HDU_NUM || yarg_subroutine()) {
+    if ((status != BAD_HDU_NUM && status != END_OF_FILE) ||
+        yarg_subroutine()) {
       yfits_error(status);
     }
+    fits_clear_errmsg();
     type = -1;
   }
   ypush_int(type);
@@ -505,13 +1389,15 @@ Y_fitsio_movrel_hdu(int argc)
 void
 Y_fitsio_movnam_hdu(int argc)
 {
+  yfits_object* obj;
   fitsfile* fptr;
   char* extname;
-  int type, extver;
+  int type, extver, hdu, pass, fresh;
   int status = 0;
 
   if (argc < 3 || argc > 4) y_error("expecting 3 or 4 arguments");
-  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
+  obj = yfits_fetch(argc - 1, NOT_CLOSED|CRITICAL);
+  fptr = obj->fptr;
   type = fetch_int(argc - 2);
   extname = ygets_q(argc - 3);
   extver = (argc >= 4 ? fetch_int(argc - 4) : 0);
@@ -519,7 +1405,36 @@ Y_fitsio_movnam_hdu(int argc)
       type != ASCII_TBL && type != ANY_HDU) {
     y_error("bad HDUTYPE");
   }
-  if (fits_movnam_hdu(fptr, type, extname, extver, &status) != 0) {
+
+  /* Use the index of HDUs to directly jump to the HDU.  The index may be out
+     of date if the file has been modified by other means, so the header
+     address is checked and the index is rebuilt if needed. */
+  count_move();
+  fresh = (obj->hdus == NULL);
+  for (pass = 1; pass <= (fresh ? 1 : 2) && status == 0; ++pass) {
+    if (pass == 2) {
+      drop_hdu_index(obj);
+    }
+    hdu = find_hdu(obj, type, extname, extver, &status);
+    if (hdu > 0) {
+      LONGLONG headstart, datastart, dataend;
+      int code = 0, hdutype;
+      if (fits_movabs_hdu(fptr, hdu, &hdutype, &code) == 0 &&
+          fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                             &code) == 0 &&
+          headstart == obj->hdus[hdu-1].headstart) {
+        break;
+      }
+      if (fresh || pass == 2) {
+        status = code;
+      }
+      fits_clear_errmsg();
+    }
+  }
+  if (status == 0 && hdu <= 0) {
+    status = BAD_HDU_NUM;
+  }
+  if (status != 0) {
     if (status != BAD_HDU_NUM || yarg_subroutine()) {
       yfits_error(status);
     }
@@ -533,14 +1448,18 @@ Y_fitsio_movnam_hdu(int argc)
 void
 Y_fitsio_get_num_hdus(int argc)
 {
+  yfits_object* obj;
   fitsfile* fptr;
   int number;
   int status = 0;
 
   if (argc != 1) y_error("expecting exactly one argument");
-  fptr = fetch_fitsfile(0, MAY_BE_CLOSED|CRITICAL);
+  obj = yfits_fetch(0, MAY_BE_CLOSED|CRITICAL);
+  fptr = obj->fptr;
   if (fptr == NULL) {
     number = 0;
+  } else if (obj->hdus != NULL) {
+    number = obj->nhdus;
   } else if (fits_get_num_hdus(fptr, &number, &status) != 0) {
     yfits_error(status);
   }
@@ -583,7 +1502,7 @@ Y_fitsio_copy_file(int argc)
   int status = 0;
   if (argc != 5) y_error("expecting exactly 5 arguments");
   inp = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
-  out = fetch_fitsfile(argc - 2, NOT_CLOSED);
+  out = fetch_fitsfile(argc - 2, NOT_CLOSED|MODIFIED);
   previous = yarg_true(argc - 3);
   current = yarg_true(argc - 4);
   following = yarg_true(argc - 5);
@@ -600,7 +1519,7 @@ Y_fitsio_copy_hdu(int argc)
   int morekeys, status = 0;
   if (argc < 2 || argc > 3) y_error("expecting 2 or 3 arguments");
   inp = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
-  out = fetch_fitsfile(argc - 2, NOT_CLOSED);
+  out = fetch_fitsfile(argc - 2, NOT_CLOSED|MODIFIED);
   morekeys = (argc >= 3 ? fetch_int(argc - 3) : 0);
   fits_copy_hdu(inp, out, morekeys, &status);
   if (status != 0) yfits_error(status);
@@ -615,7 +1534,7 @@ Y_fitsio_copy_header(int argc)
   int status = 0;
   if (argc != 2) y_error("expecting exactly 2 arguments");
   fits_copy_header(fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL),
-                   fetch_fitsfile(argc - 2, NOT_CLOSED), &status);
+                   fetch_fitsfile(argc - 2, NOT_CLOSED|MODIFIED), &status);
   if (status != 0) yfits_error(status);
 }
 
@@ -624,7 +1543,8 @@ Y_fitsio_delete_hdu(int argc)
 {
   int type, status = 0;
   if (argc != 1) y_error("expecting exactly one argument");
-  fits_delete_hdu(fetch_fitsfile(0, NOT_CLOSED|CRITICAL), &type, &status);
+  fits_delete_hdu(fetch_fitsfile(0, NOT_CLOSED|CRITICAL|MODIFIED), &type,
+                  &status);
   if (status != 0) yfits_error(status);
   ypush_int(type);
 }
@@ -665,23 +1585,223 @@ get_key(int iarg, int* keynum, char** keystr)
   return -1;
 }
 
+static unsigned int
+hash_name(const char* name)
+{
+  unsigned int h = 5381;
+  int c;
+  while ((c = (unsigned char)*name++) != '\0') {
+    h = 33*h + toupper(c);
+  }
+  return h;
+}
+
+/* Copy card number I (starting at 0) of the index IDX into CARD (of size
+   FLEN_CARD) with trailing spaces removed. */
+static void
+get_card(const header_index_t* idx, int i, char* card)
+{
+  int n = 80;
+  memcpy(card, idx->cards + 80L*i, 80);
+  while (n > 0 && card[n-1] == ' ') {
+    --n;
+  }
+  card[n] = '\0';
+}
+
+/* Find distinct keyword NAME (ignoring case) in IDX.  Returns its index or -1
+   if not found. */
+static int
+find_key(const header_index_t* idx, const char* name)
+{
+  int k = idx->bucket[hash_name(name) & (idx->nbuckets - 1)];
+  while (k >= 0 && ! same_name(name, idx->names[k])) {
+    k = idx->chain[k];
+  }
+  return k;
+}
+
+static header_index_t*
+new_header_index(fitsfile* fptr, int* status)
+{
+  header_index_t* idx;
+  LONGLONG headstart, datastart, dataend;
+  char card[FLEN_CARD];
+  char name[FLEN_KEYWORD];
+  char* cards = NULL;
+  int* ints;
+  int* last;
+  size_t size;
+  unsigned int h;
+  int i, k, len, ncards, nbuckets, code;
+
+  if (fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         status) != 0 ||
+      fits_hdr2str(fptr, FALSE, NULL, 0, &cards, &ncards, status) != 0) {
+    return NULL;
+  }
+  nbuckets = 16;
+  while (nbuckets < 2*ncards) {
+    nbuckets *= 2;
+  }
+  size = sizeof(header_index_t) + (4*(size_t)ncards + nbuckets)*sizeof(int) +
+    (size_t)ncards*FLEN_KEYWORD;
+  if ((idx = (header_index_t*)malloc(size)) == NULL) {
+    code = 0;
+    fits_free_memory(cards, &code);
+    *status = MEMORY_ALLOCATION;
+    return NULL;
+  }
+  ints = (int*)(idx + 1);
+  idx->first = ints;
+  idx->next = ints + ncards;
+  idx->chain = ints + 2*ncards;
+  last = ints + 3*ncards;
+  idx->bucket = ints + 4*ncards;
+  idx->names = (char (*)[FLEN_KEYWORD])(idx->bucket + nbuckets);
+  idx->cards = cards;
+  idx->headstart = headstart;
+  idx->datastart = datastart;
+  idx->ncards = ncards;
+  idx->nkeys = 0;
+  idx->nbuckets = nbuckets;
+  idx->nrefs = 1;
+  for (k = 0; k < nbuckets; ++k) {
+    idx->bucket[k] = -1;
+  }
+
+  /* Chain the cards with the same keyword (blank keywords are not
+     indexed). */
+  for (i = 0; i < ncards; ++i) {
+    idx->next[i] = -1;
+    get_card(idx, i, card);
+    code = 0;
+    if (fits_get_keyname(card, name, &len, &code) != 0) {
+      fits_clear_errmsg();
+      continue;
+    }
+    if (name[0] == '\0') {
+      continue;
+    }
+    if ((k = find_key(idx, name)) < 0) {
+      h = hash_name(name) & (nbuckets - 1);
+      k = idx->nkeys++;
+      strcpy(idx->names[k], name);
+      idx->first[k] = i;
+      idx->chain[k] = idx->bucket[h];
+      idx->bucket[h] = k;
+    } else {
+      idx->next[last[k]] = i;
+    }
+    last[k] = i;
+  }
+  return idx;
+}
+
+static void
+unref_header_index(header_index_t* idx)
+{
+  if (idx != NULL && --idx->nrefs <= 0) {
+    int status = 0;
+    if (idx->cards != NULL) {
+      fits_free_memory(idx->cards, &status);
+    }
+    free(idx);
+  }
+}
+
+static void
+drop_header_index(yfits_object* obj)
+{
+  if (obj->header != NULL) {
+    unref_header_index(obj->header);
+    obj->header = NULL;
+  }
+}
+
+static header_index_t*
+get_header_index(yfits_object* obj, int* status)
+{
+  fitsfile* fptr = obj->fptr;
+  header_index_t* idx = obj->header;
+  double t0;
+
+  if (idx != NULL) {
+    /* Check that the index is for the current HDU and that its header has
+       not grown. */
+    LONGLONG headstart, datastart, dataend;
+    int nkeys, morekeys;
+    if (fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                           status) != 0 ||
+        fits_get_hdrspace(fptr, &nkeys, &morekeys, status) != 0) {
+      return NULL;
+    }
+    if (headstart == idx->headstart && nkeys == idx->ncards) {
+      count_cache(TRUE);
+      return idx;
+    }
+    drop_header_index(obj);
+  }
+  count_cache(FALSE);
+  t0 = stats_clock();
+  obj->header = idx = new_header_index(fptr, status);
+  if (idx != NULL) {
+    count_read(idx->datastart - idx->headstart, t0);
+  }
+  return idx;
+}
+
+/* Read the card of keyword KEYNAME in the current HDU of FITS handle OBJ.
+   Simple names of keywords which occur once in the header are looked up in
+   the index of the header.  Other names (with wildcards, long names of the
+   HIERARCH convention, etc.) and repeated keywords are searched by CFITSIO
+   which starts at its current position in the header, hence successive
+   calls walk through the repeated cards. */
+static int
+read_card(yfits_object* obj, const char* keyname, char* card, int* status)
+{
+  char name[FLEN_KEYWORD];
+  const header_index_t* idx;
+  int k;
+
+  if (*status != 0) {
+    return *status;
+  }
+  if (strlen(keyname) < FLEN_KEYWORD) {
+    int len = trim_string(name, keyname);
+    if (len >= 1 && len <= 8 && strpbrk(name, " ?*#") == NULL) {
+      if ((idx = get_header_index(obj, status)) == NULL) {
+        return *status;
+      }
+      if ((k = find_key(idx, name)) < 0) {
+        return (*status = KEY_NO_EXIST);
+      }
+      if (idx->next[idx->first[k]] < 0) {
+        get_card(idx, idx->first[k], card);
+        return *status;
+      }
+    }
+  }
+  return fits_read_card(obj->fptr, (char*)keyname, card, status);
+}
+
 void
 Y_fitsio_read_card(int argc)
 {
-  fitsfile* fptr;
+  yfits_object* obj;
   char* keystr;
   int status = 0, keynum, keytype;
   if (argc != 2) y_error("expecting exactly 2 arguments");
-  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
+  obj = yfits_fetch(argc - 1, NOT_CLOSED|CRITICAL);
   keytype = get_key(argc - 2, &keynum, &keystr);
   if (keytype == Y_STRING) {
     if (keystr == NULL || keystr[0] == '\0') {
       status = KEY_NO_EXIST;
     } else {
-      fits_read_card(fptr, keystr, buffer, &status);
+      read_card(obj, keystr, buffer, &status);
     }
   } else {
-    fits_read_record(fptr, keynum, buffer, &status);
+    fits_read_record(obj->fptr, keynum, buffer, &status);
     if (keynum == 0 && status == 0) {
       status = KEY_NO_EXIST;
     }
@@ -723,18 +1843,20 @@ Y_fitsio_split_card(int argc)
   }
 }
 
-static void
-push_key_value(const char* value, char* buffer)
+/* Parse the value part VALUE of a FITS card (using BUFFER, which can be
+   VALUE, as workspace) and return its Yorick type: Y_VOID if undefined, Y_INT
+   for a logical value stored in LPTR, Y_LONG for an integer stored in LPTR,
+   Y_DOUBLE or Y_COMPLEX for a real or complex value stored in Z, Y_STRING
+   for a string left in BUFFER. */
+static int
+parse_key_value(const char* value, char* buffer, long* lptr, double z[2])
 {
-  double re, im, dval;
-  long lval;
   char* end;
   char dummy;
   int i, c, len, real, status;
 
   if (value == NULL) {
-    push_string(NULL);
-    return;
+    return Y_VOID;
   }
 
   /* Trim leading and trailing spaces. */
@@ -743,20 +1865,19 @@ push_key_value(const char* value, char* buffer)
   /* Guess value type (see fits_get_keytype/ffdtyp in fitscore.c). */
   switch (buffer[0]) {
   case '\0':
-    push_string(NULL);
-    return;
+    return Y_VOID;
 
   case 'T':
   case 't':
     if (len != 1) break;
-    ypush_int(TRUE);
-    return;
+    *lptr = TRUE;
+    return Y_INT;
 
   case 'F':
   case 'f':
     if (len != 1) break;
-    ypush_int(FALSE);
-    return;
+    *lptr = FALSE;
+    return Y_INT;
 
   case '\'':
     /* String value. */
@@ -765,14 +1886,12 @@ push_key_value(const char* value, char* buffer)
     ffc2s(buffer, buffer, &status);
     if (status != 0) yfits_error(status);
     /* FIXME: do we need to trim trailing spaces? */
-    push_string(buffer);
-    return;
+    return Y_STRING;
 
   case '(':
     /* Complex value. */
-    if (sscanf(buffer + 1, "%lf ,%lf )%1c", &re, &im, &dummy) == 2) {
-      push_complex(re, im);
-      return;
+    if (sscanf(buffer + 1, "%lf ,%lf )%1c", &z[0], &z[1], &dummy) == 2) {
+      return Y_COMPLEX;
     }
     break;
 
@@ -789,21 +1908,48 @@ push_key_value(const char* value, char* buffer)
     }
     if (real) {
       /* Try to read a single real. */
-      dval = strtod(buffer, &end);
+      z[0] = strtod(buffer, &end);
       if (*end == '\0') {
-        ypush_double(dval);
-        return;
+        z[1] = 0.0;
+        return Y_DOUBLE;
       }
     } else {
       /* Try to read a single integer. */
-      lval = strtol(buffer, &end, 10);
+      *lptr = strtol(buffer, &end, 10);
       if (*end == '\0') {
-        ypush_long(lval);
-        return;
+        return Y_LONG;
       }
     }
   }
   y_error("invalid keyword value");
+  return -1;
+}
+
+static void
+push_key_value(const char* value, char* buffer)
+{
+  double z[2];
+  long lval;
+
+  switch (parse_key_value(value, buffer, &lval, z)) {
+  case Y_INT:
+    ypush_int(lval);
+    break;
+  case Y_LONG:
+    ypush_long(lval);
+    break;
+  case Y_DOUBLE:
+    ypush_double(z[0]);
+    break;
+  case Y_COMPLEX:
+    push_complex(z[0], z[1]);
+    break;
+  case Y_STRING:
+    push_string(buffer);
+    break;
+  default:
+    push_string(NULL);
+  }
 }
 
 /* Extract the units from the comment.
@@ -840,6 +1986,7 @@ parse_unit(const char* comment, int* iptr, int* jptr, int* kptr)
 void
 Y_fitsio_read_key(int argc)
 {
+  yfits_object* obj;
   fitsfile* fptr;
   char* keystr;
   char card[FLEN_CARD];
@@ -854,7 +2001,7 @@ Y_fitsio_read_key(int argc)
   comm_index = -1;
   unit_index = -1;
   def_iarg = -1;
-  fptr = NULL;
+  obj = NULL;
   pos = 0;
   keytype = -1;
   keystr = NULL;
@@ -865,7 +2012,7 @@ Y_fitsio_read_key(int argc)
       /* Positional argument. */
       ++pos;
       if (pos == 1) {
-        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
+        obj = yfits_fetch(iarg, NOT_CLOSED|CRITICAL);
       } else if (pos == 2) {
         keytype = get_key(iarg, &keynum, &keystr);
       } else if (pos == 3) {
@@ -895,12 +2042,13 @@ Y_fitsio_read_key(int argc)
   if (pos < 2) {
     y_error("too few arguments");
   }
+  fptr = obj->fptr;
 
   if (keytype == Y_STRING) {
     if (keystr == NULL || keystr[0] == '\0' /* FIXME: empty key possible? */) {
       status = KEY_NO_EXIST;
     } else {
-      fits_read_card(fptr, keystr, card, &status);
+      read_card(obj, keystr, card, &status);
       fits_get_keyname(card, keyword, &len, &status);
       fits_parse_value(card, value, comment, &status);
     }
@@ -1083,22 +2231,286 @@ Y_fitsio_get_comment(int argc)
   push_string(NULL);
 }
 
+/* FITS keywords instance: the parsed header of an HDU. */
+struct _yfits_keywords {
+  header_index_t* index; /* index of the header (shared with the handle) */
+  void* names;           /* reference to the array of keyword names */
+};
+
+static struct y_userobj_t yfits_keywords_type = {
+  "FITS keywords", yfits_keywords_free, yfits_keywords_print,
+  yfits_keywords_eval, yfits_keywords_extract, NULL
+};
+
 static void
-write_key(int argc, int update)
+yfits_keywords_free(void* ptr)
 {
-  fitsfile* fptr;
-  long lval; /* integer */
-  int ival; /* logical */
-  double dval; /* real */
-  void* valptr;
-  char *key;
-  char *comment;
-  int iarg, status, valtype, type, valok;
+  yfits_keywords* obj = (yfits_keywords*)ptr;
+  if (obj->index != NULL) {
+    unref_header_index(obj->index);
+    obj->index = NULL;
+  }
+  if (obj->names != NULL) {
+    ydrop_use(obj->names);
+    obj->names = NULL;
+  }
+}
 
-  if (argc != 3 && argc != 4) y_error("expecting 3 or 4 arguments");
-  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
+static void
+yfits_keywords_print(void* ptr)
+{
+  yfits_keywords* obj = (yfits_keywords*)ptr;
+  sprintf(buffer, "%s (%d keyword(s) in %d card(s))",
+          yfits_keywords_type.type_name, obj->index->nkeys,
+          obj->index->ncards);
+  y_print(buffer, TRUE);
+}
 
-  /* Get the key name. */
+/* Is distinct keyword K of IDX a commentary keyword (without value)? */
+static int
+is_commentary(const header_index_t* idx, int k)
+{
+  char card[FLEN_CARD];
+  char value[FLEN_VALUE];
+  char comment[FLEN_COMMENT];
+  int status = 0;
+  get_card(idx, idx->first[k], card);
+  if (fits_parse_value(card, value, comment, &status) != 0) {
+    yfits_error(status);
+  }
+  return (value[0] == '\0');
+}
+
+static void
+yfits_keywords_eval(void* ptr, int argc)
+{
+  yfits_keywords* obj = (yfits_keywords*)ptr;
+  const header_index_t* idx = obj->index;
+  char card[FLEN_CARD];
+  char value[FLEN_VALUE];
+  char comment[FLEN_COMMENT];
+  long dims[2];
+  double z[2];
+  void* arr;
+  char* str;
+  long lval, n, l;
+  int c, i, k, type, ytype, status = 0;
+
+  if (argc != 1 && argc != 2) {
+    y_error("expecting 1 or 2 arguments");
+  }
+  type = yarg_typeid(argc - 1);
+  if (type <= Y_LONG && yarg_rank(argc - 1) == 0) {
+    lval = ygets_l(argc - 1);
+    if (lval < 1 || lval > idx->nkeys) {
+      y_error("out of range keyword index");
+    }
+    k = lval - 1;
+  } else if (type == Y_STRING && yarg_rank(argc - 1) == 0) {
+    str = ygets_q(argc - 1);
+    if (str == NULL || (k = find_key(idx, str)) < 0) {
+      y_error("keyword not found");
+    }
+  } else {
+    y_error("expecting keyword index or name");
+    k = -1;
+  }
+  str = (argc == 2 ? ygets_q(0) : NULL);
+  if (str == NULL || strcmp(str, "value") == 0) {
+    c = 'v';
+  } else if (strcmp(str, "comment") == 0) {
+    c = 'c';
+  } else if (strcmp(str, "units") == 0) {
+    c = 'u';
+  } else {
+    y_error("part must be \"value\", \"comment\" or \"units\"");
+    c = 0;
+  }
+
+  /* Commentary keywords have no units nor comment, their value is the text
+     of their cards. */
+  if (is_commentary(idx, k)) {
+    if (c != 'v') {
+      ypush_nil();
+      return;
+    }
+    c = 't';
+  }
+
+  /* Count the cards and find the type of the result (like `grow` would
+     do). */
+  n = 0;
+  ytype = Y_STRING;
+  for (i = idx->first[k]; i >= 0; i = idx->next[i]) {
+    if (c == 'v') {
+      get_card(idx, i, card);
+      if (fits_parse_value(card, value, comment, &status) != 0) {
+        yfits_error(status);
+      }
+      type = parse_key_value(value, value, &lval, z);
+      if (type == Y_VOID) {
+        type = Y_STRING;
+      }
+      if (n > 0 && type != ytype &&
+          (type == Y_STRING || ytype == Y_STRING)) {
+        y_error("repeated keyword has values of incompatible types");
+      }
+      if (n == 0 || type > ytype) {
+        ytype = type;
+      }
+    }
+    ++n;
+  }
+
+  /* Push the result (a scalar for a single card, a vector otherwise) and
+     fill it. */
+  dims[0] = 1;
+  dims[1] = n;
+  arr = NULL;
+  l = 0;
+  for (i = idx->first[k]; i >= 0; i = idx->next[i], ++l) {
+    get_card(idx, i, card);
+    if (fits_parse_value(card, value, comment, &status) != 0) {
+      yfits_error(status);
+    }
+    if (c == 'v') {
+      if (n == 1) {
+        push_key_value(value, value);
+        return;
+      }
+      type = parse_key_value(value, value, &lval, z);
+      if (type == Y_INT || type == Y_LONG) {
+        z[0] = lval;
+        z[1] = 0.0;
+      }
+      switch (ytype) {
+      case Y_INT:
+        if (arr == NULL) arr = ypush_i(dims);
+        ((int*)arr)[l] = lval;
+        break;
+      case Y_LONG:
+        if (arr == NULL) arr = ypush_l(dims);
+        ((long*)arr)[l] = lval;
+        break;
+      case Y_DOUBLE:
+        if (arr == NULL) arr = ypush_d(dims);
+        ((double*)arr)[l] = z[0];
+        break;
+      case Y_COMPLEX:
+        if (arr == NULL) arr = ypush_z(dims);
+        ((double*)arr)[2*l] = z[0];
+        ((double*)arr)[2*l+1] = z[1];
+        break;
+      default:
+        if (arr == NULL) arr = ypush_q(dims);
+        ((char**)arr)[l] = (type == Y_STRING ? p_strcpy(value) : NULL);
+      }
+    } else {
+      if (c == 't') {
+        str = comment;
+      } else {
+        int i1, i2, i3;
+        parse_unit(comment, &i1, &i2, &i3);
+        if (c == 'c') {
+          str = &comment[i3];
+        } else if (i1 >= 1 && i2 >= i1) {
+          comment[i2+1] = '\0';
+          str = &comment[i1];
+        } else {
+          str = NULL;
+        }
+      }
+      if (n == 1) {
+        push_string(str);
+        return;
+      }
+      if (arr == NULL) arr = ypush_q(dims);
+      ((char**)arr)[l] = (str == NULL ? NULL : p_strcpy(str));
+    }
+  }
+}
+
+static void
+yfits_keywords_extract(void* ptr, char* name)
+{
+  yfits_keywords* obj = (yfits_keywords*)ptr;
+  const header_index_t* idx = obj->index;
+  if (strcmp(name, "nkeys") == 0) {
+    ypush_long(idx->nkeys);
+  } else if (strcmp(name, "ncards") == 0) {
+    ypush_long(idx->ncards);
+  } else if (strcmp(name, "names") == 0) {
+    if (obj->names != NULL) {
+      ypush_use(obj->names);
+    } else {
+      ypush_nil();
+    }
+  } else if (strcmp(name, "commentary") == 0) {
+    if (idx->nkeys > 0) {
+      long dims[2];
+      int* flags;
+      int k;
+      dims[0] = 1;
+      dims[1] = idx->nkeys;
+      flags = ypush_i(dims);
+      for (k = 0; k < idx->nkeys; ++k) {
+        flags[k] = is_commentary(idx, k);
+      }
+    } else {
+      ypush_nil();
+    }
+  } else {
+    y_error("invalid member of FITS keywords");
+  }
+}
+
+void
+Y_fitsio_read_keys(int argc)
+{
+  yfits_object* fh;
+  yfits_keywords* obj;
+  header_index_t* idx;
+  int k, status = 0;
+
+  if (argc != 1) y_error("expecting exactly one argument");
+  fh = yfits_fetch(0, NOT_CLOSED|CRITICAL);
+  if ((idx = get_header_index(fh, &status)) == NULL) {
+    yfits_error(status);
+  }
+  obj = (yfits_keywords*)ypush_obj(&yfits_keywords_type,
+                                   sizeof(yfits_keywords));
+  obj->index = idx;
+  ++idx->nrefs;
+  if (idx->nkeys > 0) {
+    long dims[2];
+    char** names;
+    dims[0] = 1;
+    dims[1] = idx->nkeys;
+    names = ypush_q(dims);
+    for (k = 0; k < idx->nkeys; ++k) {
+      names[k] = p_strcpy(idx->names[k]);
+    }
+    obj->names = yget_use(0);
+    yarg_drop(1);
+  }
+}
+
+static void
+write_key(int argc, int update)
+{
+  fitsfile* fptr;
+  long lval; /* integer */
+  int ival; /* logical */
+  double dval; /* real */
+  void* valptr;
+  char *key;
+  char *comment;
+  int iarg, status, valtype, type, valok;
+
+  if (argc != 3 && argc != 4) y_error("expecting 3 or 4 arguments");
+  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL|MODIFIED);
+
+  /* Get the key name. */
   iarg = argc - 2;
   if (yarg_typeid(iarg) != Y_STRING || yarg_rank(iarg) != 0) {
     y_error("illegal keyword name");
@@ -1204,7 +2616,7 @@ Y_fitsio_write_comment(int argc)
   char *comment;
   int status = 0;
   if (argc != 1 && argc != 2) y_error("expecting 1 or 2 arguments");
-  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
+  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL|MODIFIED);
   comment = (argc >= 2 ? ygets_q(argc - 2) : NULL);
   if (comment == NULL) comment = "";
   fits_write_comment(fptr, comment, &status);
@@ -1219,7 +2631,7 @@ Y_fitsio_write_history(int argc)
   char *history;
   int status = 0;
   if (argc != 1 && argc != 2) y_error("expecting 1 or 2 arguments");
-  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
+  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL|MODIFIED);
   history = (argc >= 2 ? ygets_q(argc - 2) : NULL);
   if (history == NULL) history = "";
   fits_write_history(fptr, history, &status);
@@ -1234,7 +2646,7 @@ Y_fitsio_delete_key(int argc)
   char* keystr;
   int status = 0, keynum, keytype;
   if (argc != 2) y_error("expecting exactly 2 arguments");
-  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
+  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL|MODIFIED);
   keytype = get_key(argc - 2, &keynum, &keystr);
   if (keytype == Y_STRING) {
     if ( /* FIXME: */ keystr == NULL || keystr[0] == '\0') {
@@ -1305,285 +2717,924 @@ Y_fitsio_get_img_size(int argc)
   }
 }
 
-void
-Y_fitsio_read_img(int argc)
+/* Check whether the values of the current (image) HDU can be converted to
+   DATATYPE by our own code, that is if the image is not compressed and the
+   conversion is supported by `convert_values`.  BITPIX and S are set with
+   the type and the scaling of the stored values; if RAW is true, the BSCALE
+   and BZERO keywords are ignored.  If NULLS is false, undefined values are
+   not checked (as by CFITSIO with a null value of 0).  Returns TRUE if the
+   conversion is possible, FALSE if the caller has to fall back to
+   CFITSIO. */
+static int
+image_conversion(fitsfile* fptr, int datatype, int raw, int nulls,
+                 int* bitpix, scaling_t* s, int* status)
 {
-  scalar_t null;
-  fitsfile* fptr;
-  long ntot, first, number;
-  long dims[Y_DIMSIZE];
-  long c[Y_DIMSIZE - 1];
-  long* fpix = NULL;
-  long* lpix = NULL;
-  long* ipix = NULL;
-  void* arr;
-  long null_index;
-  int naxis, bitpix, status, mode, datatype, anynull;
-  int iarg, first_iarg, last_iarg, incr_iarg, number_iarg;
-  int eltype;
-  size_t elsize;
+  if (*status != 0 || fits_is_compressed_image(fptr, status) ||
+      fits_get_img_type(fptr, bitpix, status) != 0 ||
+      get_image_scaling(fptr, s, status) != 0) {
+    return FALSE;
+  }
+  if (raw) {
+    s->scale = 1.0;
+    s->zero = 0.0;
+  }
+  if (! nulls) {
+    s->has_blank = FALSE;
+  }
+  return convertible(*bitpix, datatype, s);
+}
 
-  /* Parse arguments. */
-  null_index = -1;
-  first_iarg = -1;
-  last_iarg = -1;
-  incr_iarg = -1;
-  number_iarg = -1;
-  mode = 0;
-  fptr = NULL;
-  for (iarg = argc - 1; iarg >= 0; --iarg) {
-    long index = yarg_key(iarg);
-    if (index < 0) {
-      /* Positional argument. */
-      if (fptr == NULL) {
-        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
-      } else if (null_index < 0) {
-        null_index = yget_ref(iarg);
-        if (null_index < 0) {
-          y_error("argument NULL must be set with a simple variable");
-        }
-      } else {
-        y_error("too many arguments");
-      }
+/* Try to read NUMBER image values, starting at FIRST (1-based), by reading
+   the raw bytes in blocks of about BUFSIZE bytes and converting them with
+   NTHREADS threads while the next block is being read.  This is only
+   possible for uncompressed images; TRUE is returned if the values have
+   been read into ARR, FALSE if the caller has to fall back to CFITSIO.
+   RAW is as for `image_conversion`.  In case of success and if NULL is not
+   NULL, ANYNULL and NULL are set according to the undefined values;
+   otherwise undefined values are not checked.
+   If BYTES is not NULL, it contains the whole data part of the HDU (as read
+   ahead by `fitsio_prefetch`) and the values are converted from there.  If
+   SUM is not NULL, the whole image must be read and the checksum of the data
+   unit is computed on the raw bytes (SUM->done is set).  If FD is not -1,
+   it is the shared descriptor of the handle (see `shared_descriptor`) and
+   the bytes are read with `read_at` instead of the buffers of CFITSIO. */
+static int
+read_image_raw(fitsfile* fptr, int fd, int datatype, long first, long number,
+               void* arr, int raw, int nthreads, long bufsize,
+               scalar_t* null, int* anynull, const char* bytes,
+               chksum_t* sum, int* status)
+{
+  scaling_t s;
+  LONGLONG headstart, datastart, dataend;
+  size_t srcsize, dstsize;
+  LONGLONG pos;
+  char* workspace;
+  char* buf;
+  double t0;
+  long offset, blocklen, n;
+  int bitpix, inplace, busy, result;
+
+  if (! image_conversion(fptr, datatype, raw, null != NULL, &bitpix, &s,
+                         status)) {
+    return FALSE;
+  }
+  if (fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         status) != 0) {
+    return FALSE;
+  }
+  srcsize = (bitpix < 0 ? -bitpix : bitpix)/8;
+  dstsize = type_size(datatype);
+  blocklen = bufsize/srcsize;
+  if (bytes != NULL) {
+    if ((LONGLONG)((first - 1 + number)*srcsize) > dataend - datastart) {
+      return FALSE;
+    }
+    if (sum != NULL) {
+      start_checksum(bytes, (long)((dataend - datastart)/4), nthreads);
+      sum->sum = finish_checksum();
+      sum->done = TRUE;
+    }
+    t0 = stats_clock();
+    result = convert_values_parallel(arr, datatype,
+                                     bytes + (first - 1)*srcsize, bitpix,
+                                     number, &s, nthreads);
+    count_convert(t0);
+    goto done;
+  }
+
+  /* If source and destination have the same size, the raw bytes are directly
+     read into the destination array and converted in-place.  Otherwise, two
+     alternate buffers are needed. */
+  inplace = (srcsize == dstsize);
+  if (inplace) {
+    workspace = NULL;
+  } else if ((workspace = get_workspace(2*blocklen*srcsize)) == NULL) {
+    return FALSE;
+  }
+  count_seek();
+  pos = datastart + (first - 1)*srcsize;
+  if (fd == -1 && ffmbyt(fptr, pos, REPORT_EOF, status) != 0) {
+    return FALSE;
+  }
+  busy = FALSE;
+  result = FALSE;
+  for (offset = 0; offset < number; offset += n) {
+    n = number - offset;
+    if (n > blocklen) {
+      n = blocklen;
+    }
+    if (inplace) {
+      buf = (char*)arr + offset*dstsize;
     } else {
-      /* Keyword argument. */
-      --iarg;
-      if (index == index_of_first) {
-        first_iarg = iarg;
-        mode |= 1;
-      } else if (index == index_of_last) {
-        last_iarg = iarg;
-        mode |= 2;
-      } else if (index == index_of_incr) {
-        incr_iarg = iarg;
-        mode |= 4;
-     } else if (index == index_of_number) {
-        number_iarg = iarg;
-        mode |= 8;
-      } else {
-        y_error("unsupported keyword");
+      buf = workspace + ((offset/blocklen)&1)*blocklen*srcsize;
+    }
+    t0 = stats_clock();
+    if (fd == -1 ? ffgbyt(fptr, n*srcsize, buf, status) != 0 :
+        ! read_at(fd, buf, n*srcsize, pos)) {
+      if (*status == 0) {
+        *status = READ_ERROR;
       }
+      break;
     }
+    pos += n*srcsize;
+    count_read(n*srcsize, t0);
+    if (sum != NULL) {
+      /* Sum the raw bytes while the previous block is being converted. */
+      chksum_update(sum, buf, n*srcsize);
+    }
+    if (busy) {
+      t0 = stats_clock();
+      result |= pool_wait();
+      count_convert(t0);
+    }
+    start_conversion((char*)arr + offset*dstsize, datatype, buf, bitpix,
+                     n, &s, nthreads);
+    busy = TRUE;
+  }
+  if (busy) {
+    t0 = stats_clock();
+    result |= pool_wait();
+    count_convert(t0);
+  }
+  if (sum != NULL && *status == 0) {
+    /* Account for the padding of the data unit. */
+    char pad[2880];
+    LONGLONG rest = (dataend - datastart) - (LONGLONG)number*srcsize;
+    while (rest > 0) {
+      n = (rest > (LONGLONG)sizeof(pad) ? (long)sizeof(pad) : (long)rest);
+      t0 = stats_clock();
+      if (fd == -1 ? ffgbyt(fptr, n, pad, status) != 0 :
+          ! read_at(fd, pad, n, pos)) {
+        if (*status == 0) {
+          *status = READ_ERROR;
+        }
+        break;
+      }
+      pos += n;
+      count_read(n, t0);
+      chksum_update(sum, pad, n);
+      rest -= n;
+    }
+    sum->done = (*status == 0);
   }
-  if (fptr == NULL) {
-    y_error("too few arguments");
-  }
-
-  /* Get array dimensions and type. */
-  status = 0;
-  get_image_param(fptr, Y_DIMSIZE - 1, NULL, &naxis, &dims[1], &ntot, &status);
-  if (status != 0) yfits_error(status);
-  if (naxis <= 0) {
-    ypush_nil();
-    return;
+  if (*status != 0) {
+    return FALSE;
   }
-  if (fits_get_img_equivtype(fptr, &bitpix, &status)) {
-    yfits_error(status);
+ done:
+  if (null != NULL) {
+    *anynull = result;
+    set_null_value(null, datatype, &s);
   }
+  return TRUE;
+}
 
-  /* Parse sub-array options. */
-  fpix = NULL;
-  lpix = NULL;
-  ipix = NULL;
-  if (mode == 0) {
-    /* Read complete array. */
-    dims[0] = naxis;
-    first = 1;
-    number = ntot;
-  } else if (mode == 3 || mode == 7) {
-    /* Read rectangular sub-array. */
-    long d[Y_DIMSIZE], n;
-    int k;
-    fpix = ygeta_l(first_iarg, &n, d);
-    if ((d[0] != 0 && d[0] != 1) || n != naxis) {
-      y_error("bad number of coordinates for keyword FIRST");
+/* Alignment of file offsets, sizes and memory addresses for direct reads. */
+#define DIRECT_ALIGN 4096L
+
+/* Try to read NUMBER image values, starting at FIRST (1-based), directly from
+   the file, bypassing the buffers of CFITSIO and, if the system supports
+   it, the cache of the system.  The raw bytes are read by aligned blocks of
+   about BUFSIZE bytes which are converted with NTHREADS threads while the
+   next block is being read.  This is only possible for uncompressed images
+   stored in a regular file and is only attempted if there are at least
+   BUFSIZE bytes to read.  The other arguments and the returned value are as
+   for `read_image_raw`. */
+static int
+read_image_direct(fitsfile* fptr, int datatype, long first, long number,
+                  void* arr, int raw, int nthreads, long bufsize,
+                  scalar_t* null, int* anynull, int* status)
+{
+  char urltype[FLEN_FILENAME];
+  scaling_t s;
+  struct stat st;
+  LONGLONG headstart, datastart, dataend;
+  off_t pos, base;
+  size_t srcsize, dstsize, buflen, len, got;
+  ssize_t nr;
+  char* workspace;
+  char* buf;
+  double t0;
+  long offset, blocklen, n;
+  int bitpix, iomode, fd, busy, result;
+
+  if (! image_conversion(fptr, datatype, raw, null != NULL, &bitpix, &s,
+                         status)) {
+    return FALSE;
+  }
+  srcsize = (bitpix < 0 ? -bitpix : bitpix)/8;
+  dstsize = type_size(datatype);
+  if ((LONGLONG)number*(LONGLONG)srcsize < bufsize) {
+    return FALSE;
+  }
+  if (fits_url_type(fptr, urltype, status) != 0 ||
+      strcmp(urltype, "file://") != 0) {
+    return FALSE;
+  }
+  if (fits_file_mode(fptr, &iomode, status) != 0 ||
+      (iomode == READWRITE && fits_flush_file(fptr, status) != 0) ||
+      fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         status) != 0 ||
+      fits_file_name(fptr, buffer, status) != 0) {
+    return FALSE;
+  }
+  if (datastart + (first - 1 + number)*(LONGLONG)srcsize > dataend) {
+    return FALSE;
+  }
+
+  /* Open the file for direct access (some file systems do not support
+     O_DIRECT, the file is then read as usual). */
+  fd = -1;
+#if defined(O_DIRECT)
+  fd = open(buffer, O_RDONLY|O_DIRECT);
+#endif
+  if (fd == -1) {
+    fd = open(buffer, O_RDONLY);
+    if (fd == -1) {
+      return FALSE;
     }
-    lpix = ygeta_l(last_iarg, &n, d);
-    if ((d[0] != 0 && d[0] != 1) || n != naxis) {
-      y_error("bad number of coordinates for keyword LAST");
+#if defined(F_NOCACHE)
+    fcntl(fd, F_NOCACHE, 1);
+#endif
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < dataend) {
+    /* Not the expected file or truncated file. */
+    close(fd);
+    return FALSE;
+  }
+
+  /* Each block is read from an aligned offset and may thus span one more
+     aligned unit than needed.  Two alternate buffers are used. */
+  blocklen = bufsize/srcsize;
+  buflen = ((blocklen*srcsize + DIRECT_ALIGN - 1)/DIRECT_ALIGN + 1)*
+    DIRECT_ALIGN;
+  if (posix_memalign((void**)&workspace, DIRECT_ALIGN, 2*buflen) != 0) {
+    close(fd);
+    return FALSE;
+  }
+  busy = FALSE;
+  result = FALSE;
+  for (offset = 0; offset < number; offset += n) {
+    n = number - offset;
+    if (n > blocklen) {
+      n = blocklen;
     }
-    if (incr_iarg == -1) {
-      ipix = c;
-      for (k = 0; k < naxis; ++k) {
-        ipix[k] = 1;
-      }
-    } else {
-      ipix = ygeta_l(incr_iarg, &n, d);
-      if ((d[0] != 0 && d[0] != 1) || n != naxis) {
-        y_error("bad number of coordinates for keyword INCR");
+    buf = workspace + ((offset/blocklen)&1)*buflen;
+    pos = datastart + (first - 1 + offset)*srcsize;
+    base = pos - pos%DIRECT_ALIGN;
+    len = ((pos - base + n*srcsize + DIRECT_ALIGN - 1)/DIRECT_ALIGN)*
+      DIRECT_ALIGN;
+    t0 = stats_clock();
+    for (got = 0; got < len; got += nr) {
+      /* The last read may be short at the end of the file. */
+      nr = pread(fd, buf + got, len - got, base + got);
+      if (nr <= 0) {
+        break;
       }
     }
-    for (k = 0; k < naxis; ++k) {
-      if (fpix[k] < 1 || fpix[k] > lpix[k] || lpix[k] > dims[k+1] ||
-          ipix[k] < 1 || (lpix[k] - fpix[k] + 1)%ipix[k] != 0) {
-        y_error("bad sub-array parameters (FIRST, LAST, INCR)");
-      }
-      dims[k+1] = (lpix[k] - fpix[k] + 1)/ipix[k];
+    count_read(got, t0);
+    if (got < (pos - base) + n*srcsize) {
+      break;
     }
-    dims[0] = naxis;
-    first = number = 0; /* avoid warnings about uninitialized variables */
-  } else if (mode == 9) {
-    /* Read flat sub-array. */
-    first = ygets_l(first_iarg);
-    number = ygets_l(number_iarg);
-    if (first < 1 || number < 0 || first - 1 + number > ntot) {
-      y_error("bad range of array elements");
+    if (busy) {
+      t0 = stats_clock();
+      result |= pool_wait();
+      count_convert(t0);
     }
-    if (number == 0) {
-      ypush_nil();
-      return;
+    start_conversion((char*)arr + offset*dstsize, datatype,
+                     buf + (pos - base), bitpix, n, &s, nthreads);
+    busy = TRUE;
+  }
+  if (busy) {
+    t0 = stats_clock();
+    result |= pool_wait();
+    count_convert(t0);
+  }
+  close(fd);
+  free(workspace);
+  if (offset < number) {
+    return FALSE;
+  }
+  if (null != NULL) {
+    *anynull = result;
+    set_null_value(null, datatype, &s);
+  }
+  return TRUE;
+}
+
+/* Try to write NUMBER image values of type DATATYPE from SRC, starting at
+   FIRST (1-based), by converting them into raw bytes with NTHREADS threads
+   while the previous block is being written.  This is only possible for
+   uncompressed images; TRUE is returned if the values have been written,
+   FALSE if the caller has to fall back to CFITSIO (also when some values
+   cannot be represented, this is checked before writing anything and
+   CFITSIO then takes care of reporting the overflow). */
+static int
+write_image_raw(fitsfile* fptr, int datatype, long first, long number,
+                const void* src, int nthreads, int* status)
+{
+  scaling_t s;
+  LONGLONG headstart, datastart, dataend;
+  size_t srcsize, dstsize;
+  char* workspace;
+  double t0;
+  long offset, blocklen, n, m;
+  int bitpix, iomode;
+
+  if (*status != 0 || fits_file_mode(fptr, &iomode, status) != 0 ||
+      iomode != READWRITE || fits_is_compressed_image(fptr, status) ||
+      fits_get_img_type(fptr, &bitpix, status) != 0 ||
+      get_image_scaling(fptr, &s, status) != 0 ||
+      ! encodable(bitpix, datatype, &s)) {
+    return FALSE;
+  }
+  if (fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         status) != 0) {
+    return FALSE;
+  }
+  srcsize = type_size(datatype);
+  dstsize = (bitpix < 0 ? -bitpix : bitpix)/8;
+  blocklen = RAW_BLOCK_SIZE/dstsize;
+  if ((workspace = get_workspace(2*blocklen*dstsize)) == NULL) {
+    return FALSE;
+  }
+  t0 = stats_clock();
+  if (encoding_overflows(workspace, blocklen, bitpix, src, datatype, number,
+                         &s, nthreads)) {
+    count_convert(t0);
+    return FALSE;
+  }
+  count_convert(t0);
+  count_seek();
+  if (ffmbyt(fptr, datastart + (first - 1)*dstsize, IGNORE_EOF,
+             status) != 0) {
+    return FALSE;
+  }
+
+  /* Encode the first block, then write each block while the next one is
+     being encoded. */
+  n = (number < blocklen ? number : blocklen);
+  t0 = stats_clock();
+  encode_values_parallel(workspace, bitpix, src, datatype, n, &s, nthreads);
+  count_convert(t0);
+  for (offset = 0; offset < number; offset += n, n = m) {
+    char* raw = workspace + ((offset/blocklen)&1)*blocklen*dstsize;
+    m = number - (offset + n);
+    if (m > blocklen) {
+      m = blocklen;
+    }
+    if (m > 0) {
+      start_encoding(workspace + (((offset + n)/blocklen)&1)*blocklen*dstsize,
+                     bitpix, (const char*)src + (offset + n)*srcsize,
+                     datatype, m, &s, nthreads);
+    }
+    t0 = stats_clock();
+    ffpbyt(fptr, n*dstsize, raw, status);
+    count_write(n*dstsize, t0);
+    if (m > 0) {
+      t0 = stats_clock();
+      pool_wait();
+      count_convert(t0);
+    }
+    if (*status != 0) {
+      break;
     }
-    dims[0] = 1;
-    dims[1] = number;
-  } else {
-    y_error("bad combination of keywords FIRST, LAST, INCR, or NUMBER");
   }
+  return (*status == 0);
+}
 
-  /* Get the type of the elements and create the array. */
-  if (fits_get_img_equivtype(fptr, &bitpix, &status)) {
-    yfits_error(status);
+/* Write the values of type DATATYPE of SRC into the rectangular sub-array of
+   the image in the current HDU of FPTR whose first pixel is FPIX (1-based),
+   with increments IPIX and dimensions EXT, the image having NAXIS
+   dimensions DIMS.  If NULL is not NULL, elements of SRC equal to *NULL are
+   written as undefined values.  The sub-array is written by runs of
+   contiguous pixels (some leading axes may be merged): for uncompressed
+   images, each run is converted by the plug-in and written by `ffpbyt`;
+   otherwise, by CFITSIO. */
+static int
+write_image_subset(fitsfile* fptr, int datatype, int naxis, const long dims[],
+                   const long fpix[], const long ipix[], const long ext[],
+                   const void* src, void* null, int nthreads, int* status)
+{
+  scaling_t s;
+  LONGLONG headstart, datastart, dataend;
+  long stride[Y_DIMSIZE];
+  long cnt[Y_DIMSIZE];
+  long lpix[Y_DIMSIZE];
+  char* workspace = NULL;
+  size_t srcsize, dstsize = 0;
+  long run, blocklen = 0, offset, total, pos, n, k, j;
+  double t0;
+  int m, bitpix, iomode, raw, overflow = FALSE;
+
+  if (*status != 0) {
+    return *status;
+  }
+  srcsize = type_size(datatype);
+  raw = (null == NULL &&
+         fits_file_mode(fptr, &iomode, status) == 0 && iomode == READWRITE &&
+         ! fits_is_compressed_image(fptr, status) &&
+         fits_get_img_type(fptr, &bitpix, status) == 0 &&
+         get_image_scaling(fptr, &s, status) == 0 &&
+         encodable(bitpix, datatype, &s) &&
+         fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                            status) == 0);
+  if (*status != 0) {
+    return *status;
+  }
+  for (m = 0; m < naxis && ipix[m] == 1; ++m) {
+    /* Nothing to do. */
+  }
+  if (! raw && null == NULL && m == naxis) {
+    /* CFITSIO is as good for unit increments. */
+    for (k = 0; k < naxis; ++k) {
+      lpix[k] = fpix[k] + ext[k] - 1;
+    }
+    t0 = stats_clock();
+    fits_write_subset(fptr, datatype, (long*)fpix, lpix, (void*)src, status);
+    for (k = 0, total = 1; k < naxis; ++k) {
+      total *= ext[k];
+    }
+    count_write((double)srcsize*total, t0);
+    return *status;
   }
-  if (bitpix == BYTE_IMG) {
-    elsize = 1;
-    eltype = 0;
-  } else if (bitpix == SBYTE_IMG || bitpix == SHORT_IMG) {
-    elsize = 2;
-    eltype = 1;
-  } else if (bitpix == USHORT_IMG || bitpix == LONG_IMG) {
-    elsize = 4;
-    eltype = 1;
-  } else if (bitpix == ULONG_IMG || bitpix == LONGLONG_IMG) {
-    elsize = 8;
-    eltype = 1;
-  } else if (bitpix == FLOAT_IMG) {
-    elsize = sizeof(float);
-    eltype = 2;
-  } else if (bitpix == DOUBLE_IMG) {
-    elsize = sizeof(double);
-    eltype = 2;
-  } else {
-    eltype = 0;
-    elsize = 0;
+
+  /* Find the length of the runs of contiguous pixels: the leading axes are
+     merged as long as the previous ones are complete. */
+  run = 1;
+  for (m = 0; m < naxis && ipix[m] == 1; ) {
+    run *= ext[m];
+    if (fpix[m] != 1 || ext[m] != dims[m]) {
+      ++m;
+      break;
+    }
+    ++m;
   }
-  if (elsize <= sizeof(char) && eltype == 0) {
-    datatype = TBYTE;
-    null.type = Y_CHAR;
-    arr = ypush_c(dims);
-  } else if (elsize <= sizeof(short) && eltype == 1) {
-    datatype = TSHORT;
-    null.type = Y_SHORT;
-    arr = ypush_s(dims);
-  } else if (elsize <= sizeof(int) && eltype == 1) {
-    datatype = TINT;
-    null.type = Y_INT;
-    arr = ypush_i(dims);
-  } else if (elsize <= sizeof(long) && eltype == 1) {
-    datatype = TLONG;
-    null.type = Y_LONG;
-    arr = ypush_l(dims);
-  } else if (elsize <= sizeof(float) && eltype == 2) {
-    datatype = TFLOAT;
-    null.type = Y_FLOAT;
-    arr = ypush_f(dims);
-  } else if (elsize <= sizeof(double) && eltype == 2) {
-    datatype = TDOUBLE;
-    null.type = Y_DOUBLE;
-    arr = ypush_d(dims);
-  } else {
-    datatype = -1;
-    arr = NULL;
-    y_error("unsupported data type");
+  stride[0] = 1;
+  total = ext[0];
+  for (k = 1; k < naxis; ++k) {
+    stride[k] = stride[k-1]*dims[k-1];
+    total *= ext[k];
   }
-
-  /* Read the data. */
-  if (mode == 0 || mode == 9) {
-    fits_read_img(fptr, datatype, first, number,
-                  &null.value, arr, &anynull, &status);
-  } else {
-    fits_read_subset(fptr, datatype, fpix, lpix, ipix,
-                     &null.value, arr, &anynull, &status);
+  for (k = 0; k < naxis; ++k) {
+    cnt[k] = 0;
+  }
+  if (raw) {
+    dstsize = (bitpix < 0 ? -bitpix : bitpix)/8;
+    blocklen = RAW_BLOCK_SIZE/dstsize;
+    if ((workspace = get_workspace((run < blocklen ? run : blocklen)*
+                                   dstsize)) == NULL) {
+      return (*status = MEMORY_ALLOCATION);
+    }
   }
-  if (status != 0) {
-    yfits_error(status);
+
+  /* Write the runs in the order of the source. */
+  for (pos = 0; pos < total && *status == 0; pos += run) {
+    offset = 0;
+    for (k = m; k < naxis; ++k) {
+      offset += (fpix[k] - 1 + ipix[k]*cnt[k])*stride[k];
+    }
+    for (k = 0; k < m; ++k) {
+      offset += (fpix[k] - 1)*stride[k];
+    }
+    for (j = 0; j < run && *status == 0; j += n) {
+      const char* ptr = (const char*)src + (pos + j)*srcsize;
+      n = run - j;
+      if (raw && n > blocklen) {
+        n = blocklen;
+      }
+      if (raw) {
+        t0 = stats_clock();
+        overflow = encode_values_parallel(workspace, bitpix, ptr, datatype,
+                                          n, &s, nthreads);
+        count_convert(t0);
+      }
+      t0 = stats_clock();
+      if (raw && ! overflow) {
+        count_seek();
+        if (ffmbyt(fptr, datastart + (offset + j)*dstsize, IGNORE_EOF,
+                   status) == 0) {
+          ffpbyt(fptr, n*dstsize, workspace, status);
+        }
+        count_write(n*dstsize, t0);
+      } else if (null != NULL) {
+        fits_write_imgnull(fptr, datatype, offset + j + 1, n, (void*)ptr,
+                           null, status);
+        count_write(n*srcsize, t0);
+      } else {
+        /* CFITSIO takes care of reporting overflows. */
+        fits_write_img(fptr, datatype, offset + j + 1, n, (void*)ptr,
+                       status);
+        count_write(n*srcsize, t0);
+      }
+    }
+    for (k = m; k < naxis; ++k) {
+      if (++cnt[k] < ext[k]) {
+        break;
+      }
+      cnt[k] = 0;
+    }
   }
+  return *status;
+}
 
-  /* Save the 'null' value. */
-  if (null_index >= 0) {
-    if (anynull == 0) {
-      ypush_nil();
+/* Layout of the tiles of a compressed image.  The tiles are grouped in
+   layers along the last axis of the image; the pixels of a layer are
+   contiguous in memory and a layer is the unit of work when compressing or
+   decompressing with several threads. */
+typedef struct {
+  long npix;     /* number of pixels in the image */
+  long unit;     /* number of pixels in a (complete) layer of tiles */
+  long ntiles;   /* number of tiles per layer */
+} tile_layout_t;
+
+static int
+get_tile_layout(fitsfile* fptr, tile_layout_t* t, int* status)
+{
+  char keyword[FLEN_KEYWORD];
+  long naxes[MAXDIMS];
+  long tile;
+  int k, naxis;
+
+  if (fits_get_img_dim(fptr, &naxis, status) != 0 ||
+      naxis < 1 || naxis > MAXDIMS ||
+      fits_get_img_size(fptr, naxis, naxes, status) != 0) {
+    return FALSE;
+  }
+  t->npix = 1;
+  t->unit = 1;
+  t->ntiles = 1;
+  for (k = 0; k < naxis; ++k) {
+    /* By default, the tiles are the rows of the image. */
+    tile = (k == 0 ? naxes[0] : 1);
+    sprintf(keyword, "ZTILE%d", k + 1);
+    if (fits_read_key(fptr, TLONG, keyword, &tile, NULL,
+                      status) == KEY_NO_EXIST) {
+      *status = 0;
+      fits_clear_errmsg();
+    }
+    if (*status != 0 || tile < 1) {
+      return FALSE;
+    }
+    if (tile > naxes[k]) {
+      tile = naxes[k];
+    }
+    t->npix *= naxes[k];
+    if (k < naxis - 1) {
+      t->unit *= naxes[k];
+      t->ntiles *= (naxes[k] + tile - 1)/tile;
     } else {
-      push_scalar(&null);
+      t->unit *= tile;
     }
-    yput_global(null_index, 0);
-    yarg_drop(1);
   }
+  return TRUE;
 }
 
-void
-Y_fitsio_create_img(int argc)
+/* A range of pixels of a compressed image split into tasks, each task
+   processing a range of complete layers of tiles with its own FITS file. */
+typedef struct {
+  fitsfile* fptr[MAX_THREADS]; /* files used by the tasks */
+  int status[MAX_THREADS];     /* status of the tasks */
+  int anynull[MAX_THREADS];    /* undefined values found by the tasks? */
+  void* arr;                   /* values */
+  void* nulval;                /* value of undefined pixels */
+  size_t size;                 /* size of a value */
+  long first;                  /* first pixel (0-based) */
+  long last;                   /* last pixel + 1 (0-based) */
+  long base;                   /* first pixel (0-based) of first layer */
+  long chunk;                  /* number of pixels per task */
+  int datatype;                /* CFITSIO pixel type of the values */
+  int raw;                     /* disable scaling? */
+} tiles_job_t;
+
+/* Setup JOB for the range of NUMBER pixels starting at FIRST (1-based) and
+   return the number of tasks (0 if using several threads is not worth it). */
+static long
+split_tiles(tiles_job_t* job, const tile_layout_t* t, long first,
+            long number, int nthreads)
 {
-  fitsfile* fptr;
-  long dims[MAXDIMS + 1];
-  int bitpix, status = 0;
-  if (argc < 2) y_error("not enough arguments");
-  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
-  bitpix = fetch_int(argc - 2);
-  get_dimlist(argc - 3, 0, dims, MAXDIMS);
-  if (fits_create_img(fptr, bitpix, dims[0], &dims[1], &status) != 0) {
-    yfits_error(status);
+  long nlayers, per_task;
+  job->first = first - 1;
+  job->last = first - 1 + number;
+  job->base = (job->first/t->unit)*t->unit;
+  nlayers = (job->last - job->base + t->unit - 1)/t->unit;
+  if (nthreads > MAX_THREADS) {
+    nthreads = MAX_THREADS;
+  }
+  if (nthreads < 2 || nlayers < 2) {
+    return 0;
+  }
+  per_task = (nlayers + nthreads - 1)/nthreads;
+  job->chunk = per_task*t->unit;
+  return (nlayers + per_task - 1)/per_task;
+}
+
+/* Get the range [*A,*B) of pixels (0-based) of the I-th task of JOB. */
+static void
+tiles_range(const tiles_job_t* job, long i, long* a, long* b)
+{
+  *a = job->base + i*job->chunk;
+  *b = *a + job->chunk;
+  if (*a < job->first) {
+    *a = job->first;
+  }
+  if (*b > job->last) {
+    *b = job->last;
   }
-  yarg_drop(argc - 1);
 }
 
-void
-Y_fitsio_copy_cell2image(int argc)
+static int
+read_tiles_task(void* ctx, long i)
 {
-  fitsfile* inp;
-  fitsfile* out;
-  char* colname;
-  long rownum;
-  int status = 0;
+  tiles_job_t* job = (tiles_job_t*)ctx;
+  fitsfile* fptr = job->fptr[i];
+  int* status = &job->status[i];
+  long a, b;
+
+  tiles_range(job, i, &a, &b);
+  if (job->raw) {
+    fits_set_bscale(fptr, 1.0, 0.0, status);
+  }
+  fits_read_img(fptr, job->datatype, a + 1, b - a, job->nulval,
+                (char*)job->arr + (a - job->first)*job->size,
+                &job->anynull[i], status);
+  return (*status != 0);
+}
 
-  if (argc != 5) y_error("expecting exactly 4 arguments");
-  inp = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
-  out = fetch_fitsfile(argc - 2, NOT_CLOSED);
-  colname = ygets_q(argc - 3);
-  rownum = ygets_l(argc - 4);
-  if (colname == NULL || colname[0] == '\0') {
-    y_error("invalid column name");
+static int
+write_tiles_task(void* ctx, long i)
+{
+  tiles_job_t* job = (tiles_job_t*)ctx;
+  int* status = &job->status[i];
+  long a, b;
+
+  tiles_range(job, i, &a, &b);
+  fits_write_img(job->fptr[i], job->datatype, a + 1, b - a,
+                 (char*)job->arr + (a - job->first)*job->size, status);
+  return (*status != 0);
+}
+
+/* Close the files of the first N tasks of JOB. */
+static void
+close_tiles(tiles_job_t* job, long n)
+{
+  long i;
+  for (i = 0; i < n; ++i) {
+    if (job->fptr[i] != NULL) {
+      int code = 0;
+      fits_close_file(job->fptr[i], &code);
+      job->fptr[i] = NULL;
+    }
   }
-  fits_copy_cell2image(inp, out, colname, rownum, &status);
-  if (status != 0) yfits_error(status);
-  yarg_drop(2); /* left output object on top of stack */
+}
+
+/* Try to read NUMBER values of type DATATYPE from the compressed image in
+   the current HDU of FPTR, starting at FIRST (1-based), by decompressing the
+   tiles with NTHREADS threads (only if CFITSIO is reentrant).  Since a FITS
+   file cannot be shared between threads, the compressed HDU is copied in
+   memory (which costs as much memory as the compressed data) and each
+   thread opens its own handle on this read-only copy.  Arguments are the same as for
+   `fits_read_img` (with RAW to disable scaling).  TRUE is returned if the
+   values have been read, FALSE if the caller has to fall back to CFITSIO. */
+static int
+read_image_tiles(fitsfile* fptr, int datatype, long first, long number,
+                 void* arr, int raw, int nthreads, void* nulval,
+                 int* anynull, int* status)
+{
+  tiles_job_t job;
+  tile_layout_t t;
+  fitsfile* mem;
+  void* buf;
+  size_t bufsize;
+  long i, ntasks;
+  int type, code;
+
+  if (*status != 0 || nthreads < 2 || ! fits_is_reentrant() ||
+      ! fits_is_compressed_image(fptr, status) ||
+      ! get_tile_layout(fptr, &t, status) ||
+      (ntasks = split_tiles(&job, &t, first, number, nthreads)) < 2) {
+    return FALSE;
+  }
+  memset(job.fptr, 0, ntasks*sizeof(job.fptr[0]));
+
+  /* Copy the compressed HDU (after an empty primary HDU) in memory. */
+  buf = NULL;
+  bufsize = 0;
+  mem = NULL;
+  code = 0;
+  if (fits_create_memfile(&mem, &buf, &bufsize, 0, realloc, &code) != 0 ||
+      fits_create_img(mem, BYTE_IMG, 0, NULL, &code) != 0 ||
+      fits_copy_hdu(fptr, mem, 0, &code) != 0 ||
+      fits_flush_file(mem, &code) != 0) {
+    goto done;
+  }
+
+  /* Open a handle per task and decompress the layers of tiles. */
+  for (i = 0; i < ntasks; ++i) {
+    job.status[i] = 0;
+    job.anynull[i] = 0;
+    if (fits_open_memfile(&job.fptr[i], "tiles", READONLY, &buf, &bufsize,
+                          0, NULL, &code) != 0 ||
+        fits_movabs_hdu(job.fptr[i], 2, &type, &code) != 0) {
+      goto done;
+    }
+  }
+  job.arr = arr;
+  job.nulval = nulval;
+  job.size = type_size(datatype);
+  job.datatype = datatype;
+  job.raw = raw;
+  pool_start(read_tiles_task, &job, ntasks, nthreads);
+  pool_wait();
+  *anynull = 0;
+  for (i = 0; i < ntasks; ++i) {
+    if (job.status[i] != 0) {
+      /* Report the error of the first failing task. */
+      *status = job.status[i];
+      break;
+    }
+    *anynull |= job.anynull[i];
+  }
+
+ done:
+  close_tiles(&job, ntasks);
+  if (mem != NULL) {
+    int tmp = 0;
+    fits_close_file(mem, &tmp);
+  }
+  if (buf != NULL) {
+    free(buf);
+  }
+  return (code == 0);
+}
+
+/* Copy the cells of rows FIRSTROW to LASTROW of all the columns of the
+   binary table in the current HDU of SRC into the same columns of DST. */
+static int
+copy_rows(fitsfile* src, fitsfile* dst, long firstrow, long lastrow,
+          int* status)
+{
+  LONGLONG length, offset;
+  long row, repeat, width;
+  int col, ncols, type, anynull;
+  void* buf;
+
+  if (fits_get_num_cols(src, &ncols, status) != 0) {
+    return *status;
+  }
+  for (col = 1; col <= ncols; ++col) {
+    if (fits_get_coltype(src, col, &type, &repeat, &width, status) != 0) {
+      break;
+    }
+    for (row = firstrow; row <= lastrow; ++row) {
+      if (type < 0 && fits_read_descriptll(src, col, row, &length, &offset,
+                                           status) != 0) {
+        return *status;
+      }
+      if (type >= 0) {
+        length = repeat;
+      }
+      if (length <= 0) {
+        continue;
+      }
+      if ((buf = get_workspace(length*type_size(abs(type)))) == NULL) {
+        return (*status = MEMORY_ALLOCATION);
+      }
+      if (fits_read_col(src, abs(type), col, row, 1, length, NULL, buf,
+                        &anynull, status) != 0 ||
+          fits_write_col(dst, abs(type), col, row, 1, length, buf,
+                         status) != 0) {
+        return *status;
+      }
+    }
+  }
+  return *status;
+}
+
+/* Try to write NUMBER values of type DATATYPE from SRC into the compressed
+   image in the current HDU of FPTR, starting at FIRST (1-based), by
+   compressing the tiles with NTHREADS threads.  Each thread compresses
+   complete layers of tiles into its own memory file (with the same header as
+   the destination), then the compressed tiles are copied into the
+   destination.  This is only done for lossless compression (integer
+   images), for a freshly created HDU (with an empty heap) and for a range
+   of complete layers of tiles; TRUE is returned if the values have been
+   written, FALSE if the caller has to fall back to CFITSIO. */
+static int
+write_image_tiles(fitsfile* fptr, int datatype, long first, long number,
+                  const void* src, int nthreads, int* status)
+{
+  tiles_job_t job;
+  tile_layout_t t;
+  long i, a, b, ntasks, pcount;
+  int bitpix, iomode, nkeys, nmore, nexist, ncols, n, code;
+
+  if (*status != 0 || nthreads < 2 || ! fits_is_reentrant() ||
+      fits_file_mode(fptr, &iomode, status) != 0 || iomode != READWRITE ||
+      ! fits_is_compressed_image(fptr, status) ||
+      fits_get_img_type(fptr, &bitpix, status) != 0 || bitpix < 0 ||
+      fits_read_key(fptr, TLONG, "PCOUNT", &pcount, NULL, status) != 0 ||
+      pcount != 0 || ! get_tile_layout(fptr, &t, status) ||
+      (first - 1)%t.unit != 0 ||
+      ((first - 1 + number)%t.unit != 0 && first - 1 + number != t.npix) ||
+      (ntasks = split_tiles(&job, &t, first, number, nthreads)) < 2 ||
+      fits_get_hdrspace(fptr, &nkeys, &nmore, status) != 0 ||
+      fits_get_num_cols(fptr, &ncols, status) != 0) {
+    return FALSE;
+  }
+
+  /* Create a memory file per task with the same header as the destination
+     HDU (after an empty primary HDU) and compress the tiles. */
+  code = 0;
+  memset(job.fptr, 0, ntasks*sizeof(job.fptr[0]));
+  for (i = 0; i < ntasks; ++i) {
+    job.status[i] = 0;
+    if (fits_create_file(&job.fptr[i], "mem://", &code) != 0 ||
+        fits_create_img(job.fptr[i], BYTE_IMG, 0, NULL, &code) != 0 ||
+        fits_copy_header(fptr, job.fptr[i], &code) != 0) {
+      goto done;
+    }
+  }
+  job.arr = (void*)src;
+  job.size = type_size(datatype);
+  job.datatype = datatype;
+  pool_start(write_tiles_task, &job, ntasks, nthreads);
+  pool_wait();
+
+  /* Check that compressing the tiles did not change the structure of the
+     table (CFITSIO may add columns or keywords for some tiles), then copy
+     the compressed tiles. */
+  for (i = 0; i < ntasks; ++i) {
+    if ((code = job.status[i]) != 0 ||
+        fits_get_hdrspace(job.fptr[i], &nexist, &nmore, &code) != 0 ||
+        fits_get_num_cols(job.fptr[i], &n, &code) != 0 ||
+        nexist != nkeys || n != ncols) {
+      if (code == 0) {
+        code = -1;
+      }
+      goto done;
+    }
+  }
+  for (i = 0; i < ntasks && *status == 0; ++i) {
+    tiles_range(&job, i, &a, &b);
+    copy_rows(job.fptr[i], fptr, (a/t.unit)*t.ntiles + 1,
+              ((b + t.unit - 1)/t.unit)*t.ntiles, status);
+  }
+
+ done:
+  close_tiles(&job, ntasks);
+  return (code == 0);
 }
 
 void
-Y_fitsio_write_img(int argc)
+Y_fitsio_read_img(int argc)
 {
+  scalar_t null;
+  yfits_object* obj;
   fitsfile* fptr;
-  long src_number, dst_number, first, flen;
-  long src_dims[Y_DIMSIZE];
-  long dst_dims[Y_DIMSIZE];
-  long* fpix;
-  long  lpix[Y_DIMSIZE - 1];
-  void* src;
-  void* null;
-  int k, type, naxis, status;
-  int iarg, first_iarg, null_iarg, first_case;
+  long ntot, first, number;
+  long dims[Y_DIMSIZE];
+  long c[Y_DIMSIZE - 1];
+  long* fpix = NULL;
+  long* lpix = NULL;
+  long* ipix = NULL;
+  void* arr;
+  char* bytes = NULL;
+  long null_index, bufsize, slice;
+  scaling_t scl;
+  chksum_t cks;
+  chksum_t* sum;
+  unsigned long keysum = 0;
+  int naxis, bitpix, status, mode, datatype, anynull, raw, nthreads;
+  int iarg, first_iarg, last_iarg, incr_iarg, number_iarg, type_iarg;
+  int out_iarg;
 
   /* Parse arguments. */
-  null_iarg = -1;
+  null_index = -1;
   first_iarg = -1;
+  last_iarg = -1;
+  incr_iarg = -1;
+  number_iarg = -1;
+  type_iarg = -1;
+  out_iarg = -1;
+  slice = 0;
+  mode = 0;
+  raw = FALSE;
+  sum = NULL;
+  nthreads = yfits_nthreads;
+  obj = NULL;
   fptr = NULL;
-  src = NULL;
   for (iarg = argc - 1; iarg >= 0; --iarg) {
     long index = yarg_key(iarg);
     if (index < 0) {
       /* Positional argument. */
       if (fptr == NULL) {
-        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
-      } else if (src == NULL) {
-        src = ygeta_any(iarg, &src_number, src_dims, &type);
+        obj = yfits_fetch(iarg, NOT_CLOSED|CRITICAL);
+        fptr = obj->fptr;
+      } else if (null_index < 0) {
+        null_index = yget_ref(iarg);
+        if (null_index < 0) {
+          y_error("argument NULL must be set with a simple variable");
+        }
       } else {
         y_error("too many arguments");
       }
@@ -1592,630 +3643,928 @@ Y_fitsio_write_img(int argc)
       --iarg;
       if (index == index_of_first) {
         first_iarg = iarg;
-      } else if (index == index_of_null) {
-        null_iarg = iarg;
+        mode |= 1;
+      } else if (index == index_of_last) {
+        last_iarg = iarg;
+        mode |= 2;
+      } else if (index == index_of_incr) {
+        incr_iarg = iarg;
+        mode |= 4;
+     } else if (index == index_of_number) {
+        number_iarg = iarg;
+        mode |= 8;
+      } else if (index == index_of_raw) {
+        raw = yarg_true(iarg);
+      } else if (index == index_of_type) {
+        type_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
+      } else if (index == index_of_chksum) {
+        sum = (yarg_true(iarg) ? &cks : NULL);
+      } else if (index == index_of_out) {
+        out_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_slice) {
+        if (!yarg_nil(iarg) && (slice = ygets_l(iarg)) < 1) {
+          y_error("out of range SLICE");
+        }
       } else {
         y_error("unsupported keyword");
       }
     }
   }
-  if (src == NULL) {
+  if (fptr == NULL) {
     y_error("too few arguments");
   }
-  if (null_iarg == -1) {
-    null = NULL;
-  } else {
-    int id = yarg_typeid(null_iarg);
-    if (id == Y_VOID) {
-      null = NULL;
-    } else {
-      if (yarg_rank(null_iarg) != 0) {
-        y_error("null value must be a scalar");
-      }
-      if (id != type) {
-        y_error("null value must be of same type as the data");
-      }
-      null = ygeta_any(null_iarg, NULL, NULL, NULL);
-    }
+  if (slice > 0 && out_iarg < 0) {
+    y_error("keyword SLICE requires keyword OUT");
   }
-
-  /* Convert Yorick type to CFITSIO "pixel" type. */
-  switch (type) {
-  case Y_CHAR:
-    type = TBYTE;
-    break;
-  case Y_SHORT:
-    type = TSHORT;
-    break;
-  case Y_INT:
-    type = TINT;
-    break;
-  case Y_LONG:
-    type = (sizeof(long) == 8 ? TLONGLONG : TLONG);
-    break;
-  case Y_FLOAT:
-    type = TFLOAT;
-    break;
-  case Y_DOUBLE:
-    type = TDOUBLE;
-    break;
-  case Y_COMPLEX:
-    type = TDBLCOMPLEX;
-    break;
-  case Y_STRING:
-    type = TSTRING;
-    break;
-  default:
-    y_error("unsupported array type");
-    type = -1;
+  if (sum != NULL) {
+    if (mode != 0) {
+      y_error("keyword CHKSUM requires to read the complete image");
+    }
+    chksum_init(sum);
   }
 
-  /* Get FITS array dimensions and type. */
+  /* Get array dimensions and type. */
   status = 0;
-  get_image_param(fptr, Y_DIMSIZE - 1, NULL, &naxis, &dst_dims[1],
-                  &dst_number, &status);
+  if (sum != NULL && ! get_datasum_key(fptr, &keysum, &status)) {
+    if (status != 0) {
+      yfits_error(status);
+    }
+    y_error("no DATASUM keyword to verify the data checksum");
+  }
+  get_image_param(fptr, Y_DIMSIZE - 1, NULL, &naxis, &dims[1], &ntot, &status);
   if (status != 0) yfits_error(status);
-  dst_dims[0] = naxis; /* to mimic Yorick dimension list */
-  if (naxis < 0) y_error("bad number of dimensions");
-
-  /* Parse FIRST keyword to decide how to write. */
-  if (first_iarg == -1) {
-    first_case = 0;
-  } else {
-    int id = yarg_typeid(first_iarg);
-    first_case = -1;
-    if (id <= Y_LONG) {
-      int rank = yarg_rank(first_iarg);
-      if (rank == 0) {
-        first_case = 1;
-      } else if (rank == 1) {
-        first_case = 2;
-      }
-    } else if (id == Y_VOID) {
-      first_case = 0;
-    }
+  if (naxis <= 0) {
+    ypush_nil();
+    return;
   }
-  first = 1;
+  if (fits_get_img_equivtype(fptr, &bitpix, &status)) {
+    yfits_error(status);
+  }
+
+  /* Parse sub-array options. */
   fpix = NULL;
-  if (first_case == 0) {
-    /* Keyword FIRST unspecified or void, write the whole source array whose
-       dimensions must match those of the FITS array. */
-    for (k = 0; k <= naxis; ++k) {
-      if (src_dims[k] != dst_dims[k]) {
-        y_error("not same dimensions");
-      }
-    }
-  } else if (first_case == 1) {
-    /* Will write an interval of elements. */
-    first = ygets_l(first_iarg);
-    if (first < 1 || src_number + first - 1 > dst_number) {
-      y_error("out of range interval");
+  lpix = NULL;
+  ipix = NULL;
+  if (mode == 0) {
+    /* Read complete array. */
+    dims[0] = naxis;
+    first = 1;
+    number = ntot;
+  } else if (mode == 3 || mode == 7) {
+    /* Read rectangular sub-array. */
+    long d[Y_DIMSIZE], n;
+    int k;
+    fpix = ygeta_l(first_iarg, &n, d);
+    if ((d[0] != 0 && d[0] != 1) || n != naxis) {
+      y_error("bad number of coordinates for keyword FIRST");
     }
-  } else if (first_case == 2) {
-    /* Will write a subarray. */
-    fpix = ygeta_l(first_iarg, &flen, NULL);
-    if (flen != naxis) {
-      y_error("bad number of values in keyword FIRST");
+    lpix = ygeta_l(last_iarg, &n, d);
+    if ((d[0] != 0 && d[0] != 1) || n != naxis) {
+      y_error("bad number of coordinates for keyword LAST");
     }
-    if (src_dims[0] > dst_dims[0]) {
-      y_error("source array has too many dimensions");
+    if (incr_iarg == -1) {
+      ipix = c;
+      for (k = 0; k < naxis; ++k) {
+        ipix[k] = 1;
+      }
+    } else {
+      ipix = ygeta_l(incr_iarg, &n, d);
+      if ((d[0] != 0 && d[0] != 1) || n != naxis) {
+        y_error("bad number of coordinates for keyword INCR");
+      }
     }
     for (k = 0; k < naxis; ++k) {
-      lpix[k] = fpix[k] + (k < src_dims[0] ? src_dims[k+1] - 1 : 0);
-      if (fpix[k] < 1 || lpix[k] > dst_dims[k+1]) {
-        y_error("out of range subarray");
+      if (fpix[k] < 1 || fpix[k] > lpix[k] || lpix[k] > dims[k+1] ||
+          ipix[k] < 1 || (lpix[k] - fpix[k] + 1)%ipix[k] != 0) {
+        y_error("bad sub-array parameters (FIRST, LAST, INCR)");
       }
+      dims[k+1] = (lpix[k] - fpix[k] + 1)/ipix[k];
+    }
+    dims[0] = naxis;
+    first = number = 0; /* avoid warnings about uninitialized variables */
+  } else if (mode == 9) {
+    /* Read flat sub-array. */
+    first = ygets_l(first_iarg);
+    number = ygets_l(number_iarg);
+    if (first < 1 || number < 0 || first - 1 + number > ntot) {
+      y_error("bad range of array elements");
     }
-    if (null != NULL) {
-      y_error("NULL keyword forbidden when writing a rectangular subarray");
+    if (number == 0) {
+      ypush_nil();
+      return;
     }
+    dims[0] = 1;
+    dims[1] = number;
   } else {
-    y_error("invalid type/rank for keyword FIRST");
+    y_error("bad combination of keywords FIRST, LAST, INCR, or NUMBER");
   }
 
-  /* Write the values. */
-  if (fpix != NULL) {
-    fits_write_subset(fptr, type, fpix, lpix, src, &status);
-  } else if (null != NULL) {
-    fits_write_imgnull(fptr, type, first, src_number, src, null, &status);
-  } else {
-    fits_write_img(fptr, type, first, src_number, src, &status);
-  }
-  if (status != 0) {
+  /* Get the type of the elements and create the array.  Raw values are
+     stored in the type given by BITPIX, otherwise the type must be large
+     enough for the scaled values (unless the type is specified). */
+  if (type_iarg >= 0) {
+    bitpix = type_bitpix(ygets_q(type_iarg));
+    if (bitpix == 0) {
+      y_error("invalid TYPE (must be \"char\", \"short\", \"int\", "
+              "\"long\", \"float\" or \"double\")");
+    }
+  } else if ((raw ? fits_get_img_type(fptr, &bitpix, &status) :
+              fits_get_img_equivtype(fptr, &bitpix, &status)) != 0) {
     yfits_error(status);
   }
-  ypush_nil();
-}
-
-void
-Y_fitsio_copy_image2cell(int argc)
-{
-  fitsfile* inp;
-  fitsfile* out;
-  char* colname;
-  long rownum, longval;
-  int flag, status = 0;
+  datatype = image_datatype(bitpix, &null.type);
+  if (datatype == -1) {
+    y_error("unsupported data type");
+  }
+  if (out_iarg >= 0) {
+    arr = push_output(out_iarg, slice, null.type, dims);
+  } else {
+    arr = push_array(null.type, dims, 0);
+  }
 
-  if (argc != 5) y_error("expecting exactly 5 arguments");
-  inp = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
-  out = fetch_fitsfile(argc - 2, NOT_CLOSED);
-  colname = ygets_q(argc - 3);
-  rownum  = ygets_l(argc - 4);
-  longval = ygets_l(argc - 5);
-  if (longval < 0 || longval > 2) y_error("bad value for COPYKEYFLAG");
-  flag = (int)longval;
-  if (colname == NULL || colname[0] == '\0') {
-    y_error("invalid column name");
+  /* Use the prefetched data, if any. */
+  bufsize = (obj->bufsize > 0 ? obj->bufsize : yfits_bufsize);
+  if ((mode == 0 || mode == 9) && obj->prefetch != NULL) {
+    LONGLONG headstart, datastart, dataend;
+    int hdu;
+    fits_get_hdu_num(fptr, &hdu);
+    if (fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                           &status) != 0) {
+      yfits_error(status);
+    }
+    bytes = claim_prefetch(obj, hdu, datastart, dataend);
   }
-  fits_copy_image2cell(inp, out, colname, rownum, flag, &status);
-  if (status != 0) yfits_error(status);
-  yarg_drop(3); /* left output object on top of stack */
-}
 
-void
-Y_fitsio_copy_image_section(int argc)
-{
-  fitsfile* inp;
-  fitsfile* out;
-  char* section;
-  int status = 0;
-  if (argc != 3) y_error("expecting exactly 3 arguments");
-  inp = fetch_fitsfile(2, NOT_CLOSED|CRITICAL);
-  out = fetch_fitsfile(1, NOT_CLOSED);
-  section = ygets_q(0);
-  if (section == NULL || section[0] == '\0') {
-    y_error("invalid section string");
+  /* Read the data. */
+  if ((mode == 0 || mode == 9) &&
+      ((bytes != NULL &&
+        read_image_raw(fptr, shared_descriptor(obj, FALSE), datatype,
+                       first, number, arr, raw, nthreads,
+                       bufsize, (null_index >= 0 ? &null : NULL), &anynull,
+                       bytes, sum, &status)) ||
+       (obj->direct &&
+        read_image_direct(fptr, datatype, first, number, arr, raw, nthreads,
+                          bufsize, (null_index >= 0 ? &null : NULL),
+                          &anynull, &status)) ||
+       read_image_raw(fptr, shared_descriptor(obj, FALSE), datatype,
+                      first, number, arr, raw, nthreads,
+                      bufsize, (null_index >= 0 ? &null : NULL), &anynull,
+                      NULL, sum, &status) ||
+       read_image_tiles(fptr, datatype, first, number, arr, raw, nthreads,
+                        &null.value, &anynull, &status))) {
+    /* Values have been read and converted by our own code. */
+  } else {
+    double t0 = stats_clock();
+    /* Temporarily disable the scaling by CFITSIO to read raw values. */
+    if (raw && get_image_scaling(fptr, &scl, &status) == 0) {
+      fits_set_bscale(fptr, 1.0, 0.0, &status);
+    }
+    if (mode == 0 || mode == 9) {
+      fits_read_img(fptr, datatype, first, number,
+                    &null.value, arr, &anynull, &status);
+    } else {
+      fits_read_subset(fptr, datatype, fpix, lpix, ipix,
+                       &null.value, arr, &anynull, &status);
+    }
+    if (mode != 0 && mode != 9) {
+      int k;
+      for (k = 1, number = 1; k <= dims[0]; ++k) {
+        number *= dims[k];
+      }
+    }
+    count_read((double)type_size(datatype)*number, t0);
+    if (raw) {
+      int code = 0;
+      fits_set_bscale(fptr, scl.scale, scl.zero, &code);
+    }
+  }
+  if (bytes != NULL) {
+    free(bytes);
+  }
+  if (status != 0) {
+    yfits_error(status);
   }
-  fits_copy_image_section(inp, out, section, &status);
-  if (status != 0) yfits_error(status);
-  yarg_drop(1); /* left output on top of stack */
-}
 
-static void
-check_ncols(int* tfields, long ntot)
-{
-  if (*tfields > 0) {
-    if (*tfields != ntot) {
-      y_error("number of columns mismatch");
+  /* Verify the checksum of the data, by another pass if it has not been
+     computed while reading. */
+  if (sum != NULL) {
+    unsigned long datasum;
+    if (sum->done) {
+      datasum = chksum_value(sum);
+    } else {
+      data_checksum(fptr, nthreads, &datasum, &status);
     }
-  } else {
-    if ((*tfields = ntot) != ntot) {
-      y_error("too many columns (integer overflow)");
+    if (status != 0) {
+      yfits_error(status);
+    }
+    if (datasum != keysum) {
+      y_error("data checksum does not match DATASUM keyword");
     }
   }
-}
 
-/*---------------------------------------------------------------------------*/
-/* TABLES */
+  /* Save the 'null' value. */
+  if (null_index >= 0) {
+    if (anynull == 0) {
+      ypush_nil();
+    } else {
+      push_scalar(&null);
+    }
+    yput_global(null_index, 0);
+    yarg_drop(1);
+  }
+}
 
+/* Statistics of the values of an image or of a rectangular sub-array,
+   computed by blocks while the next block is being read. */
 void
-Y_fitsio_create_tbl(int argc)
+Y_fitsio_img_stats(int argc)
 {
+  summary_t sum;
+  yfits_object* obj;
   fitsfile* fptr;
-  long nrows, ntot;
+  double nan = NAN;
+  double* workspace;
+  double* buf;
+  double t0;
   long dims[Y_DIMSIZE];
-  char** ttype;
-  char** tform;
-  char** tunit;
-  char* extname;
-  int status, iarg, tbltype, tfields;
+  long fpix[Y_DIMSIZE], lpix[Y_DIMSIZE], ipix[Y_DIMSIZE];
+  long ntot, number, plane, bufsize, blocklen, offset, n, k, last, i;
+  int iarg, fh_iarg, first_iarg, last_iarg, update, nthreads, naxis, whole;
+  int anynull, busy, status;
 
-  tbltype = BINARY_TBL;
-  fptr = NULL;
-  extname = NULL;
-  ttype = NULL;
-  tform = NULL;
-  tunit = NULL;
-  tfields = -1;
-  nrows = 0;
+  /* Parse arguments. */
+  fh_iarg = -1;
+  first_iarg = -1;
+  last_iarg = -1;
+  update = FALSE;
+  nthreads = yfits_nthreads;
   for (iarg = argc - 1; iarg >= 0; --iarg) {
     long index = yarg_key(iarg);
     if (index < 0) {
       /* Positional argument. */
-      if (fptr == NULL) {
-        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
-      } else if (ttype == NULL) {
-        ttype = ygeta_q(iarg, &ntot, dims);
-        if (dims[0] > 1) y_error("too many dimensions for argument TTYPE");
-        check_ncols(&tfields, ntot);
-      } else if (tform == NULL) {
-        tform = ygeta_q(iarg, &ntot, dims);
-        if (dims[0] > 1) y_error("too many dimensions for argument TFORM");
-        check_ncols(&tfields, ntot);
+      if (fh_iarg < 0) {
+        fh_iarg = iarg;
       } else {
         y_error("too many arguments");
       }
     } else {
       /* Keyword argument. */
       --iarg;
-      if (index == index_of_extname) {
-        extname = ygets_q(iarg);
-      } else if (index == index_of_tunit) {
-        tunit = ygeta_q(iarg, &ntot, dims);
-        if (dims[0] > 1) y_error("too many dimensions for argument TUNIT");
-        check_ncols(&tfields, ntot);
-      } else if (index == index_of_ascii) {
-        tbltype = (yarg_true(iarg) ? ASCII_TBL : BINARY_TBL);
-        check_ncols(&tfields, ntot);
+      if (index == index_of_first) {
+        first_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_last) {
+        last_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_update) {
+        update = yarg_true(iarg);
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
       } else {
         y_error("unsupported keyword");
       }
     }
   }
-  if (tform == NULL) y_error("too few arguments");
+  if (fh_iarg < 0) {
+    y_error("too few arguments");
+  }
+  if ((first_iarg < 0) != (last_iarg < 0)) {
+    y_error("keywords FIRST and LAST must be specified together");
+  }
+  if (update && first_iarg >= 0) {
+    y_error("keyword UPDATE cannot be used for a sub-array");
+  }
+  obj = yfits_fetch(fh_iarg, NOT_CLOSED|CRITICAL);
+  fptr = obj->fptr;
+
+  /* Get the dimensions of the image and of the sub-array. */
   status = 0;
-  if (fits_create_tbl(fptr, tbltype, nrows, tfields, ttype,
-                      tform,  tunit, extname, &status) != 0) {
+  get_image_param(fptr, Y_DIMSIZE - 1, NULL, &naxis, dims, &ntot, &status);
+  if (status != 0) {
     yfits_error(status);
   }
-  ypush_nil();
-}
+  summary_init(&sum);
+  if (naxis <= 0) {
+    push_summary(&sum);
+    return;
+  }
+  whole = (first_iarg < 0);
+  if (whole && ! update &&
+      load_summary(fptr, "DATAMIN", "DATAMAX", "DATASTAT", &sum)) {
+    /* Statistics saved by a previous call. */
+    push_summary(&sum);
+    return;
+  }
+  for (k = 0; k < naxis; ++k) {
+    fpix[k] = 1;
+    lpix[k] = dims[k];
+    ipix[k] = 1;
+  }
+  if (! whole) {
+    long d[Y_DIMSIZE];
+    long* f = ygeta_l(first_iarg, &n, d);
+    long* l;
+    if ((d[0] != 0 && d[0] != 1) || n != naxis) {
+      y_error("bad number of coordinates for keyword FIRST");
+    }
+    l = ygeta_l(last_iarg, &n, d);
+    if ((d[0] != 0 && d[0] != 1) || n != naxis) {
+      y_error("bad number of coordinates for keyword LAST");
+    }
+    for (k = 0; k < naxis; ++k) {
+      if (f[k] < 1 || f[k] > l[k] || l[k] > dims[k]) {
+        y_error("bad sub-array parameters (FIRST, LAST)");
+      }
+      fpix[k] = f[k];
+      lpix[k] = l[k];
+    }
+  }
 
-void
-Y_fitsio_get_num_rows(int argc)
-{
-  long nrows;
-  int status = 0;
-  if (argc != 1) y_error("expecting exactly one argument");
-  fits_get_num_rows(fetch_fitsfile(0, NOT_CLOSED|CRITICAL), &nrows, &status);
-  if (status != 0) yfits_error(status);
-  ypush_long(nrows);
+  /* Read the values as doubles (undefined values being NaN's).  The whole
+     image is read by flat blocks, a sub-array by slabs of complete planes
+     along its last dimension. */
+  last = naxis - 1;
+  for (k = 0, plane = 1; k < last; ++k) {
+    plane *= lpix[k] - fpix[k] + 1;
+  }
+  number = plane*(lpix[last] - fpix[last] + 1);
+  bufsize = (obj->bufsize > 0 ? obj->bufsize : yfits_bufsize);
+  blocklen = bufsize/(long)sizeof(double);
+  if (! whole) {
+    blocklen = (blocklen/plane)*plane;
+    if (blocklen < plane) {
+      blocklen = plane;
+    }
+  }
+  if (blocklen > number) {
+    blocklen = number;
+  }
+  workspace = get_workspace(2*blocklen*sizeof(double));
+  if (workspace == NULL) {
+    y_error("insufficient memory");
+  }
+  busy = FALSE;
+  for (offset = 0, i = 0; offset < number; offset += n, ++i) {
+    n = number - offset;
+    if (n > blocklen) {
+      n = blocklen;
+    }
+    buf = workspace + (i&1)*blocklen;
+    t0 = stats_clock();
+    if (whole) {
+      fits_read_img(fptr, TDOUBLE, offset + 1, n, &nan, buf, &anynull,
+                    &status);
+    } else {
+      long f = fpix[last], l = lpix[last];
+      fpix[last] = f + offset/plane;
+      lpix[last] = fpix[last] + n/plane - 1;
+      fits_read_subset(fptr, TDOUBLE, fpix, lpix, ipix, &nan, buf,
+                       &anynull, &status);
+      fpix[last] = f;
+      lpix[last] = l;
+    }
+    if (status != 0) {
+      break;
+    }
+    count_read((double)n*sizeof(double), t0);
+    if (busy) {
+      finish_summary(&sum);
+    }
+    start_summary(buf, n, nthreads);
+    busy = TRUE;
+  }
+  if (busy) {
+    finish_summary(&sum);
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+
+  /* Save the statistics in the header (the handle is only marked as
+     modified if something is written). */
+  if (update && sum.count > 0) {
+    yfits_fetch(fh_iarg, NOT_CLOSED|MODIFIED);
+    if (save_summary(fptr, "DATAMIN", "DATAMAX", "DATASTAT", &sum,
+                     &status) != 0) {
+      yfits_error(status);
+    }
+  }
+  push_summary(&sum);
 }
 
-void
-Y_fitsio_get_num_cols(int argc)
+/* Job for reading images from many files in parallel (one task per file).
+   Each task opens its own handle, so this is only done in parallel if
+   CFITSIO is reentrant; the tasks never call Yorick. */
+#define DIMENSIONS_DIFFER (-1) /* status of a task if the image dimensions
+                                  differ from those of the first file */
+typedef struct {
+  char** paths;         /* names of the files */
+  const char* extname;  /* name of the HDU to read, NULL to use HDU */
+  void* arr;            /* destination */
+  long* fpix;           /* first pixel of sub-array, NULL to read all */
+  long* lpix;           /* last pixel of sub-array */
+  long* ipix;           /* increments of sub-array */
+  long dims[Y_DIMSIZE]; /* dimensions of the images */
+  long number;          /* number of values per file */
+  size_t size;          /* size of destination elements */
+  int* status;          /* status for each file */
+  int hdu;              /* number of the HDU to read, 0 for first HDU with
+                           significant data */
+  int naxis;            /* number of dimensions of the images */
+  int datatype;         /* type of destination elements */
+} many_job_t;
+
+/* Open file PATH and move to the image HDU to read.  The file is opened
+   without parsing its name and, by default, the HDU is the primary one or
+   the next one if the primary HDU is empty (as `fits_open_image`). */
+static int
+open_many(fitsfile** fptr, const char* path, int hdu, const char* extname,
+          int* status)
 {
-  int ncols;
-  int status = 0;
-  if (argc != 1) y_error("expecting exactly one argument");
-  fits_get_num_cols(fetch_fitsfile(0, NOT_CLOSED|CRITICAL), &ncols, &status);
-  if (status != 0) yfits_error(status);
-  ypush_long(ncols);
+  int type, naxis;
+  if (fits_open_diskfile(fptr, path, READONLY, status) != 0) {
+    return *status;
+  }
+  if (extname != NULL) {
+    fits_movnam_hdu(*fptr, IMAGE_HDU, (char*)extname, 0, status);
+  } else if (hdu > 0) {
+    if (fits_movabs_hdu(*fptr, hdu, &type, status) == 0 &&
+        type != IMAGE_HDU) {
+      *status = NOT_IMAGE;
+    }
+  } else if (fits_get_img_dim(*fptr, &naxis, status) == 0 && naxis == 0) {
+    if (fits_movrel_hdu(*fptr, 1, &type, status) == 0 &&
+        type != IMAGE_HDU) {
+      *status = NOT_IMAGE;
+    }
+  }
+  return *status;
+}
+
+static int
+read_many_task(void* ctx, long i)
+{
+  many_job_t* job = (many_job_t*)ctx;
+  fitsfile* fptr = NULL;
+  long dims[Y_DIMSIZE];
+  void* dst = (char*)job->arr + i*job->number*job->size;
+  int* status = &job->status[i];
+  int k, naxis, bitpix, anynull, code;
+
+  if (open_many(&fptr, job->paths[i], job->hdu, job->extname,
+                status) == 0 &&
+      fits_get_img_param(fptr, Y_DIMSIZE - 2, &bitpix, &naxis, dims,
+                         status) == 0) {
+    if (naxis != job->naxis) {
+      *status = DIMENSIONS_DIFFER;
+    }
+    for (k = 0; k < naxis && *status == 0; ++k) {
+      if (dims[k] != job->dims[k]) {
+        *status = DIMENSIONS_DIFFER;
+      }
+    }
+    if (*status == 0 && job->fpix == NULL) {
+      fits_read_img(fptr, job->datatype, 1, job->number, NULL, dst,
+                    &anynull, status);
+    } else if (*status == 0) {
+      fits_read_subset(fptr, job->datatype, job->fpix, job->lpix,
+                       job->ipix, NULL, dst, &anynull, status);
+    }
+  }
+  if (fptr != NULL) {
+    code = 0;
+    fits_close_file(fptr, (*status == 0 ? status : &code));
+  }
+  return (*status != 0);
 }
 
 void
-Y_fitsio_get_colnum(int argc)
+Y_fitsio_read_many(int argc)
 {
+  many_job_t job;
   fitsfile* fptr;
-  long  dims[2];
-  char* template;
-  long* result;
-  int   iarg, status, casesen, colnum, ncols, col;
+  char** names;
+  long dims[Y_DIMSIZE];
+  long c[Y_DIMSIZE - 2];
+  long i, n, nfiles;
+  int iarg, paths_iarg, hdu_iarg, first_iarg, last_iarg, incr_iarg,
+    type_iarg, k, bitpix, ytype, nthreads, status;
 
-  fptr = NULL;
-  template = NULL;
-  casesen = CASEINSEN;
+  /* Parse arguments. */
+  paths_iarg = -1;
+  hdu_iarg = -1;
+  first_iarg = -1;
+  last_iarg = -1;
+  incr_iarg = -1;
+  type_iarg = -1;
+  nthreads = yfits_nthreads;
   for (iarg = argc - 1; iarg >= 0; --iarg) {
     long index = yarg_key(iarg);
     if (index < 0) {
       /* Positional argument. */
-      if (fptr == NULL) {
-        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
-      } else if (template == NULL) {
-        template = ygets_q(iarg);
-        if (template == NULL || template[0] == 0) {
-          y_error("invalid TEMPLATE string");
-        }
+      if (paths_iarg < 0) {
+        paths_iarg = iarg;
       } else {
         y_error("too many arguments");
       }
     } else {
       /* Keyword argument. */
       --iarg;
-      if (index == index_of_case) {
-        casesen = (yarg_true(iarg) ? CASESEN : CASEINSEN);
+      if (index == index_of_hdu) {
+        hdu_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_first) {
+        first_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_last) {
+        last_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_incr) {
+        incr_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_type) {
+        type_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
       } else {
         y_error("unsupported keyword");
       }
     }
   }
-  if (template == NULL) y_error("too few arguments");
-
-  status = 0;
-  fits_get_colnum(fptr, casesen, template, &colnum, &status);
-  if (status == 0) {
-    ypush_long(colnum);
-    return;
+  if (paths_iarg < 0) {
+    y_error("too few arguments");
   }
-  if (status == COL_NOT_FOUND) {
+  if ((first_iarg < 0) != (last_iarg < 0) ||
+      (incr_iarg >= 0 && first_iarg < 0)) {
+    y_error("keywords FIRST and LAST must be both specified");
+  }
+  memset(&job, 0, sizeof(job));
+  names = ygeta_q(paths_iarg, &nfiles, NULL);
+  if (hdu_iarg >= 0) {
+    int type = yarg_typeid(hdu_iarg);
+    if (yarg_rank(hdu_iarg) != 0 || (type != Y_STRING && type > Y_LONG)) {
+      y_error("invalid HDU keyword");
+    }
+    if (type == Y_STRING) {
+      job.extname = ygets_q(hdu_iarg);
+    } else {
+      job.hdu = (int)ygets_l(hdu_iarg);
+      if (job.hdu < 1) {
+        y_error("invalid HDU number");
+      }
+    }
+  }
+
+  /* Expand the names of the files (the result is left on the stack, hence
+     the indexes of the arguments are shifted). */
+  if (nfiles == 0) {
     ypush_nil();
     return;
   }
-  ncols = 0;
-  while (status == COL_NOT_UNIQUE) {
-    ++ncols;
-    fits_get_colnum(fptr, casesen, template, &colnum, &status);
+  dims[0] = 1;
+  dims[1] = nfiles;
+  job.paths = ypush_q(dims);
+  for (i = 0; i < nfiles; ++i) {
+    if (names[i] == NULL || names[i][0] == '\0') {
+      y_error("invalid file name");
+    }
+    job.paths[i] = p_native(names[i]);
   }
-  if (status != COL_NOT_FOUND) {
+  if (first_iarg >= 0) ++first_iarg;
+  if (last_iarg >= 0) ++last_iarg;
+  if (incr_iarg >= 0) ++incr_iarg;
+  if (type_iarg >= 0) ++type_iarg;
+
+  /* Get the dimensions and the type from the first file. */
+  critical(TRUE);
+  status = 0;
+  fptr = NULL;
+  if (open_many(&fptr, job.paths[0], job.hdu, job.extname, &status) == 0 &&
+      fits_get_img_param(fptr, Y_DIMSIZE - 2, &bitpix, &job.naxis, job.dims,
+                         &status) == 0) {
+    if (type_iarg >= 0) {
+      bitpix = type_bitpix(ygets_q(type_iarg));
+      if (bitpix == 0) {
+        int code = 0;
+        fits_close_file(fptr, &code);
+        y_error("invalid TYPE (must be \"char\", \"short\", \"int\", "
+                "\"long\", \"float\" or \"double\")");
+      }
+    } else {
+      fits_get_img_equivtype(fptr, &bitpix, &status);
+    }
+  }
+  if (fptr != NULL) {
+    int code = 0;
+    fits_close_file(fptr, (status == 0 ? &status : &code));
+  }
+  if (status != 0) {
     yfits_error(status);
   }
+  if (job.naxis <= 0) {
+    y_error("no image data in first file");
+  }
+  if (job.naxis > Y_DIMSIZE - 2) {
+    y_error("too many dimensions");
+  }
+  job.number = 1;
+  for (k = 0; k < job.naxis; ++k) {
+    job.number *= job.dims[k];
+  }
+
+  /* Parse sub-array options. */
+  dims[0] = job.naxis + 1;
+  for (k = 0; k < job.naxis; ++k) {
+    dims[k+1] = job.dims[k];
+  }
+  if (first_iarg >= 0) {
+    long d[Y_DIMSIZE];
+    job.fpix = ygeta_l(first_iarg, &n, d);
+    if ((d[0] != 0 && d[0] != 1) || n != job.naxis) {
+      y_error("bad number of coordinates for keyword FIRST");
+    }
+    job.lpix = ygeta_l(last_iarg, &n, d);
+    if ((d[0] != 0 && d[0] != 1) || n != job.naxis) {
+      y_error("bad number of coordinates for keyword LAST");
+    }
+    if (incr_iarg >= 0) {
+      job.ipix = ygeta_l(incr_iarg, &n, d);
+      if ((d[0] != 0 && d[0] != 1) || n != job.naxis) {
+        y_error("bad number of coordinates for keyword INCR");
+      }
+    } else {
+      job.ipix = c;
+      for (k = 0; k < job.naxis; ++k) {
+        job.ipix[k] = 1;
+      }
+    }
+    job.number = 1;
+    for (k = 0; k < job.naxis; ++k) {
+      if (job.fpix[k] < 1 || job.fpix[k] > job.lpix[k] ||
+          job.lpix[k] > job.dims[k] || job.ipix[k] < 1 ||
+          (job.lpix[k] - job.fpix[k] + 1)%job.ipix[k] != 0) {
+        y_error("bad sub-array parameters (FIRST, LAST, INCR)");
+      }
+      dims[k+1] = (job.lpix[k] - job.fpix[k] + 1)/job.ipix[k];
+      job.number *= dims[k+1];
+    }
+  }
+  dims[job.naxis + 1] = nfiles;
+
+  /* Create the result and read the files. */
+  job.datatype = image_datatype(bitpix, &ytype);
+  if (job.datatype == -1) {
+    y_error("unsupported data type");
+  }
+  job.size = type_size(job.datatype);
+  job.arr = push_array(ytype, dims, 0);
   dims[0] = 1;
-  dims[1] = ncols;
-  result = ypush_l(dims);
-  status = 0;
-  for (col = 0; col < ncols; ++col) {
-    fits_get_colnum(fptr, casesen, template, &colnum, &status);
-    if (status != COL_NOT_UNIQUE) {
-      yfits_error(status);
+  dims[1] = nfiles;
+  job.status = ypush_i(dims);
+  if (! fits_is_reentrant()) {
+    /* Read the files one by one in the main thread. */
+    nthreads = 1;
+  }
+  pool_start(read_many_task, &job, nfiles, nthreads);
+  pool_wait();
+  fits_clear_errmsg();
+  for (i = 0; i < nfiles; ++i) {
+    status = job.status[i];
+    if (status == DIMENSIONS_DIFFER) {
+      snprintf(buffer, sizeof(buffer), "image in \"%s\" does not have the "
+               "same dimensions as the first one", job.paths[i]);
+      y_error(buffer);
+    } else if (status != 0) {
+      char msg[FLEN_ERRMSG];
+      fits_get_errstatus(status, msg);
+      snprintf(buffer, sizeof(buffer), "%s (while reading \"%s\")", msg,
+               job.paths[i]);
+      y_error(buffer);
     }
-    result[col] = colnum;
   }
+  yarg_drop(1);
 }
 
 void
-Y_fitsio_get_colname(int argc)
+Y_fitsio_get_img_scale(int argc)
 {
+  scaling_t s;
   fitsfile* fptr;
-  long   dims[2];
-  char   colname[80];
-  char*  template;
-  char** result;
-  int    iarg, status, casesen, colnum, ncols, col;
+  double* v;
+  long dims[2];
+  int bitpix, status = 0;
+
+  if (argc != 1) y_error("expecting exactly one argument");
+  fptr = fetch_fitsfile(0, NOT_CLOSED|CRITICAL);
+  if (fits_get_img_type(fptr, &bitpix, &status) != 0 ||
+      get_image_scaling(fptr, &s, &status) != 0) {
+    yfits_error(status);
+  }
+  dims[0] = 1;
+  dims[1] = 2;
+  v = ypush_d(dims);
+  v[0] = s.scale;
+  v[1] = s.zero;
+}
+
+void
+Y_fitsio_create_img(int argc)
+{
+  fitsfile* fptr;
+  long dims[MAXDIMS + 1];
+  long tile[MAX_COMPRESS_DIM];
+  float quantize;
+  int iarg, pos, dims_iarg, compress, ntile;
+  int bitpix = 0, status = 0;
 
+  /* Parse arguments. */
   fptr = NULL;
-  template = NULL;
-  casesen = CASEINSEN;
+  dims_iarg = -1;
+  compress = NOCOMPRESS - 1; /* means not specified */
+  ntile = 0;
+  quantize = 0.0f;
+  pos = 0;
   for (iarg = argc - 1; iarg >= 0; --iarg) {
     long index = yarg_key(iarg);
     if (index < 0) {
       /* Positional argument. */
-      if (fptr == NULL) {
-        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
-      } else if (template == NULL) {
-        template = ygets_q(iarg);
-        if (template == NULL || template[0] == 0) {
-          y_error("invalid TEMPLATE string");
-        }
-      } else {
-        y_error("too many arguments");
+      ++pos;
+      if (pos == 1) {
+        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL|MODIFIED);
+      } else if (pos == 2) {
+        bitpix = fetch_int(iarg);
+      } else if (pos == 3) {
+        dims_iarg = iarg;
       }
     } else {
       /* Keyword argument. */
       --iarg;
-      if (index == index_of_case) {
-        casesen = (yarg_true(iarg) ? CASESEN : CASEINSEN);
+      if (index == index_of_compress) {
+        compress = fetch_compression(iarg);
+      } else if (index == index_of_tile) {
+        ntile = fetch_tile(iarg, tile);
+      } else if (index == index_of_quantize) {
+        quantize = fetch_quantize(iarg);
       } else {
         y_error("unsupported keyword");
       }
     }
   }
-  if (template == NULL) y_error("too few arguments");
-
-  status = 0;
-  fits_get_colname(fptr, casesen, template, colname, &colnum, &status);
-  if (status == 0) {
-    push_string(colname);
-    return;
-  }
-  if (status == COL_NOT_FOUND) {
-    ypush_nil();
-    return;
+  if (pos < 2) y_error("not enough arguments");
+  if (dims_iarg >= 0) {
+    /* The dimension list is given by the remaining positional arguments
+       (keywords are skipped). */
+    get_dimlist(dims_iarg, 0, dims, MAXDIMS);
+  } else {
+    dims[0] = 0;
   }
-  ncols = 0;
-  while (status == COL_NOT_UNIQUE) {
-    ++ncols;
-    fits_get_colname(fptr, casesen, template, colname, &colnum, &status);
+  if (compress < NOCOMPRESS && (ntile > 0 || quantize != 0.0f)) {
+    y_error("keywords TILE and QUANTIZE require keyword COMPRESS");
   }
-  if (status != COL_NOT_FOUND) {
+  if (create_image(fptr, bitpix, dims, compress, ntile, tile, quantize,
+                   &status) != 0) {
     yfits_error(status);
   }
-  dims[0] = 1;
-  dims[1] = ncols;
-  result = ypush_q(dims);
-  status = 0;
-  for (col = 0; col < ncols; ++col) {
-    fits_get_colname(fptr, casesen, template, colname, &colnum, &status);
-    if (status != COL_NOT_UNIQUE) {
-      yfits_error(status);
+  yarg_drop(argc - 1);
+}
+
+static int
+fetch_tile(int iarg, long tile[])
+{
+  long k, n;
+  long* len;
+  if (yarg_nil(iarg)) {
+    return 0;
+  }
+  len = ygeta_l(iarg, &n, NULL);
+  if (n > MAX_COMPRESS_DIM) {
+    y_error("too many tile dimensions");
+  }
+  for (k = 0; k < n; ++k) {
+    if (len[k] < 1) {
+      y_error("invalid tile dimension");
     }
-    result[col] = p_strcpy(colname);
+    tile[k] = len[k];
   }
+  return n;
 }
 
-static int
-get_colnum(int iarg, fitsfile *fptr)
+static float
+fetch_quantize(int iarg)
 {
-  char* colname;
-  int type, rank, status, ncols, colnum;
+  float quantize;
+  if (yarg_nil(iarg)) {
+    return 0.0f;
+  }
+  quantize = (float)ygets_d(iarg);
+  if (quantize == 0.0f) {
+    y_error("invalid quantization level");
+  }
+  return quantize;
+}
 
-  type = yarg_typeid(iarg);
-  rank = yarg_rank(iarg);
-  if (type <= Y_LONG && rank == 0) {
-    status = 0;
-    if (fits_get_num_cols(fptr, &ncols, &status) != 0) {
-      yfits_error(status);
-    }
-    colnum = ygets_i(iarg);
-    if (colnum < 1 || colnum > ncols) {
-      y_error("out of range column number");
+static int
+create_image(fitsfile* fptr, int bitpix, const long dims[], int compress,
+             int ntile, const long tile[], float quantize, int* status)
+{
+  long old_tile[MAX_COMPRESS_DIM];
+  float old_quantize;
+  int old_compress, code;
+
+  /* Temporarily set the compression parameters for the new HDU (the
+     parameters may have been specified in the file name when it was
+     opened, so they are restored after creating the image). */
+  if (compress >= NOCOMPRESS) {
+    if (fits_get_compression_type(fptr, &old_compress, status) != 0 ||
+        fits_get_tile_dim(fptr, MAX_COMPRESS_DIM, old_tile, status) != 0 ||
+        fits_get_quantize_level(fptr, &old_quantize, status) != 0 ||
+        fits_set_compression_type(fptr, compress, status) != 0 ||
+        (ntile > 0 && fits_set_tile_dim(fptr, ntile, (long*)tile,
+                                        status) != 0) ||
+        (quantize != 0.0f &&
+         fits_set_quantize_level(fptr, quantize, status) != 0)) {
+      return *status;
     }
-    return colnum;
   }
-  if (type == Y_STRING && rank == 0) {
-    colname = ygets_q(iarg);
-    if (colname == NULL || colname[0] == '\0') {
-      status = COL_NOT_FOUND;
-    } else {
-      status = 0;
-      fits_get_colnum(fptr, CASEINSEN, colname, &colnum, &status);
-    }
-    if (status != 0) {
-      if (status == COL_NOT_FOUND) {
-        y_error("column name not found");
-      }
-      if (status != COL_NOT_UNIQUE) {
-        y_error("column name not unique");
-      }
-      yfits_error(status);
-    }
-    return colnum;
+  fits_create_img(fptr, bitpix, dims[0], (long*)&dims[1], status);
+  if (compress >= NOCOMPRESS) {
+    code = 0;
+    fits_set_compression_type(fptr, old_compress, &code);
+    fits_set_tile_dim(fptr, MAX_COMPRESS_DIM, old_tile, &code);
+    fits_set_quantize_level(fptr, old_quantize, &code);
   }
-  y_error("expecting column number or name");
-  return -1;
+  return *status;
 }
 
-static void
-get_coltype(int argc, int eqcoltype)
+void
+Y_fitsio_copy_cell2image(int argc)
 {
-  fitsfile* fptr;
-  long  dims[2];
-  long* result;
-  long  repeat, width;
-  int   status = 0, type, colnum;
-
-  if (argc != 2) y_error("expecting exactly 2 arguments");
-  fptr = fetch_fitsfile(1, NOT_CLOSED|CRITICAL);
-  colnum = get_colnum(0, fptr);
-  if (eqcoltype) {
-    fits_get_eqcoltype(fptr, colnum, &type, &repeat, &width, &status);
-  } else {
-    fits_get_coltype(fptr, colnum, &type, &repeat, &width, &status);
-  }
-  if (status != 0) {
-    yfits_error(status);
-  }
-  dims[0] = 1;
-  dims[1] = 3;
-  result = ypush_l(dims);
-  result[0] = type;
-  result[1] = repeat;
-  result[2] = width;
-}
-
-void
-Y_fitsio_get_coltype(int argc)
-{
-  get_coltype(argc, 0);
-}
-
-void
-Y_fitsio_get_eqcoltype(int argc)
-{
-  get_coltype(argc, 1);
-}
-
-static void
-push_tdim(int naxis, long naxes[])
-{
-  long  dims[2];
-  long* result;
-  int   k;
-
-  if (naxis == 1 && naxes[0] == 1) {
-    naxis = 0;
-  }
-  dims[0] = 1;
-  dims[1] = naxis + 1;
-  result = ypush_l(dims);
-  result[0] = naxis;
-  for (k = 0; k < naxis; ++k) {
-    result[k+1] = naxes[k];
-  }
-}
-
-void
-Y_fitsio_read_tdim(int argc)
-{
-  fitsfile* fptr;
-  long  naxes[Y_DIMSIZE - 1];
-  int   status = 0, colnum, naxis;
-
-  if (argc != 2) y_error("expecting exactly 2 arguments");
-  fptr = fetch_fitsfile(1, NOT_CLOSED|CRITICAL);
-  colnum = get_colnum(0, fptr);
-  if (fits_read_tdim(fptr, colnum,
-                     Y_DIMSIZE - 1, &naxis, naxes, &status) != 0) {
-    yfits_error(status);
-  }
-  push_tdim(naxis, naxes);
-}
-
-void
-Y_fitsio_decode_tdim(int argc)
-{
-  fitsfile* fptr;
-  long  naxes[Y_DIMSIZE - 1];
-  char* tdimstr;
-  int   status = 0, colnum, naxis;
-
-  if (argc != 3) y_error("expecting exactly 3 arguments");
-  fptr = fetch_fitsfile(2, NOT_CLOSED|CRITICAL);
-  tdimstr = ygets_q(1);
-  colnum = get_colnum(0, fptr);
-  if (fits_decode_tdim(fptr, tdimstr, colnum,
-                       Y_DIMSIZE - 1, &naxis, naxes, &status) != 0) {
-    yfits_error(status);
-  }
-  push_tdim(naxis, naxes);
-}
-
-void
-Y_fitsio_write_tdim(int argc)
-{
-  fitsfile* fptr;
-  long dims[Y_DIMSIZE];
-  int  status = 0, colnum;
+  fitsfile* inp;
+  fitsfile* out;
+  char* colname;
+  long rownum;
+  int status = 0;
 
-  if (argc < 2) y_error("expecting at least 2 arguments");
-  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
-  colnum = get_colnum(argc - 2, fptr);
-  get_dimlist(argc - 3, 0, dims, Y_DIMSIZE - 1);
-  if (dims[0] == 0) {
-    dims[0] = 1;
-    dims[1] = 1;
-  }
-  if (fits_write_tdim(fptr, colnum, dims[0], &dims[1], &status) != 0) {
-    yfits_error(status);
+  if (argc != 5) y_error("expecting exactly 4 arguments");
+  inp = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
+  out = fetch_fitsfile(argc - 2, NOT_CLOSED|MODIFIED);
+  colname = ygets_q(argc - 3);
+  rownum = ygets_l(argc - 4);
+  if (colname == NULL || colname[0] == '\0') {
+    y_error("invalid column name");
   }
-  ypush_nil();
+  fits_copy_cell2image(inp, out, colname, rownum, &status);
+  if (status != 0) yfits_error(status);
+  yarg_drop(2); /* left output object on top of stack */
 }
 
 void
-Y_fitsio_write_col(int argc)
+Y_fitsio_write_img(int argc)
 {
   fitsfile* fptr;
-  long number, firstrow, repeat, width;
-  long dims[Y_DIMSIZE];
-  long naxes[Y_DIMSIZE - 1];
-  void* arr;
+  long src_number, dst_number, first, flen;
+  long src_dims[Y_DIMSIZE];
+  long dst_dims[Y_DIMSIZE];
+  long* fpix;
+  long* ipix;
+  long  ext[Y_DIMSIZE - 1];
+  long  unit[Y_DIMSIZE - 1];
+  void* src;
   void* null;
-  int k, type, naxis, status, colnum, coltype;
-  int iarg, null_iarg, pos;
+  int k, type, naxis, status, nthreads;
+  int iarg, first_iarg, incr_iarg, null_iarg, first_case;
 
   /* Parse arguments. */
   null_iarg = -1;
-  firstrow = 1;
-  colnum = -1;
+  first_iarg = -1;
+  incr_iarg = -1;
+  nthreads = yfits_nthreads;
   fptr = NULL;
-  arr = NULL;
-  pos = 0;
+  src = NULL;
   for (iarg = argc - 1; iarg >= 0; --iarg) {
     long index = yarg_key(iarg);
     if (index < 0) {
       /* Positional argument. */
-      ++pos;
-      if (pos == 1) {
-        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
-      } else if (pos == 2) {
-        colnum = get_colnum(iarg, fptr);
-      } else if (pos == 3) {
-        arr = ygeta_any(iarg, &number, dims, &type);
-      } else if (pos == 4) {
-        firstrow = ygets_l(iarg);
+      if (fptr == NULL) {
+        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL|MODIFIED);
+      } else if (src == NULL) {
+        src = ygeta_any(iarg, &src_number, src_dims, &type);
       } else {
         y_error("too many arguments");
       }
     } else {
       /* Keyword argument. */
       --iarg;
-      if (index == index_of_null) {
+      if (index == index_of_first) {
+        first_iarg = iarg;
+      } else if (index == index_of_incr) {
+        incr_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_null) {
         null_iarg = iarg;
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
       } else {
         y_error("unsupported keyword");
       }
     }
   }
-  if (pos < 3) {
+  if (src == NULL) {
     y_error("too few arguments");
   }
   if (null_iarg == -1) {
@@ -2235,106 +4584,339 @@ Y_fitsio_write_col(int argc)
     }
   }
 
-  /* Get column dimensions and type, then check that types are compatible and
-     that dimensions (but the last one) are matching. */
+  /* Convert Yorick type to CFITSIO "pixel" type. */
+  switch (type) {
+  case Y_CHAR:
+    type = TBYTE;
+    break;
+  case Y_SHORT:
+    type = TSHORT;
+    break;
+  case Y_INT:
+    type = TINT;
+    break;
+  case Y_LONG:
+    type = (sizeof(long) == 8 ? TLONGLONG : TLONG);
+    break;
+  case Y_FLOAT:
+    type = TFLOAT;
+    break;
+  case Y_DOUBLE:
+    type = TDOUBLE;
+    break;
+  case Y_COMPLEX:
+    type = TDBLCOMPLEX;
+    break;
+  case Y_STRING:
+    type = TSTRING;
+    break;
+  default:
+    y_error("unsupported array type");
+    type = -1;
+  }
+
+  /* Get FITS array dimensions and type. */
   status = 0;
-  fits_get_eqcoltype(fptr, colnum, &coltype, &repeat, &width, &status);
-  fits_read_tdim(fptr, colnum, Y_DIMSIZE - 1, &naxis, naxes, &status);
-  if (status != 0) {
-    yfits_error(status);
+  get_image_param(fptr, Y_DIMSIZE - 1, NULL, &naxis, &dst_dims[1],
+                  &dst_number, &status);
+  if (status != 0) yfits_error(status);
+  dst_dims[0] = naxis; /* to mimic Yorick dimension list */
+  if (naxis < 0) y_error("bad number of dimensions");
+
+  /* Parse FIRST keyword to decide how to write. */
+  if (first_iarg == -1) {
+    first_case = 0;
+  } else {
+    int id = yarg_typeid(first_iarg);
+    first_case = -1;
+    if (id <= Y_LONG) {
+      int rank = yarg_rank(first_iarg);
+      if (rank == 0) {
+        first_case = 1;
+      } else if (rank == 1) {
+        first_case = 2;
+      }
+    } else if (id == Y_VOID) {
+      first_case = 0;
+    }
   }
-  if (coltype < 0) {
-    y_error("writing variable size arrays not yet implemented");
+  first = 1;
+  fpix = NULL;
+  ipix = NULL;
+  if (incr_iarg != -1 && first_case != 2) {
+    y_error("keyword INCR requires FIRST to be a list of coordinates");
   }
-  if (coltype == TSTRING) {
-    /* Column of strings is special. */
-    if (type != Y_STRING) {
-      y_error("expecting array of strings for this column");
-    } else {
-      type = TSTRING;
+  if (first_case == 0) {
+    /* Keyword FIRST unspecified or void, write the whole source array whose
+       dimensions must match those of the FITS array. */
+    for (k = 0; k <= naxis; ++k) {
+      if (src_dims[k] != dst_dims[k]) {
+        y_error("not same dimensions");
+      }
     }
-    if (naxis < 1 || naxes[0] != width) {
-      y_error("assumption failed!");
+  } else if (first_case == 1) {
+    /* Will write an interval of elements. */
+    first = ygets_l(first_iarg);
+    if (first < 1 || src_number + first - 1 > dst_number) {
+      y_error("out of range interval");
     }
-    --naxis;
-    for (k = 0; k < naxis; ++k) {
-      naxes[k] = naxes[k+1];
+  } else if (first_case == 2) {
+    /* Will write a subarray. */
+    fpix = ygeta_l(first_iarg, &flen, NULL);
+    if (flen != naxis) {
+      y_error("bad number of values in keyword FIRST");
     }
-  } else {
-    /* Non-string column. */
-    if (naxis == 1 && naxes[0] == 1) {
-      naxis = 0;
+    if (src_dims[0] > dst_dims[0]) {
+      y_error("source array has too many dimensions");
     }
-    switch (type) {
-    case Y_CHAR:
-      type = (coltype == TBIT || coltype == TLOGICAL ? coltype : TBYTE);
-      break;
-    case Y_SHORT:
-      type = TSHORT;
-      break;
-    case Y_INT:
-      type = TINT;
-      break;
-    case Y_LONG:
-      type = (sizeof(long) == 8 ? TLONGLONG : TLONG);
-      break;
-    case Y_FLOAT:
-      type = TFLOAT;
-      break;
-    case Y_DOUBLE:
-      type = TDOUBLE;
-      break;
-    case Y_COMPLEX:
-      type = TDBLCOMPLEX;
+    if (incr_iarg == -1) {
+      ipix = unit;
+      for (k = 0; k < naxis; ++k) {
+        ipix[k] = 1;
+      }
+    } else {
+      ipix = ygeta_l(incr_iarg, &flen, NULL);
+      if (flen != naxis) {
+        y_error("bad number of values in keyword INCR");
+      }
+    }
+    for (k = 0; k < naxis; ++k) {
+      ext[k] = (k < src_dims[0] ? src_dims[k+1] : 1);
+      if (fpix[k] < 1 || ipix[k] < 1 ||
+          fpix[k] + ipix[k]*(ext[k] - 1) > dst_dims[k+1]) {
+        y_error("out of range subarray");
+      }
+    }
+  } else {
+    y_error("invalid type/rank for keyword FIRST");
+  }
+
+  /* Write the values (the plug-in counts its own writes). */
+  if (fpix != NULL) {
+    write_image_subset(fptr, type, naxis, &dst_dims[1], fpix, ipix, ext, src,
+                       null, nthreads, &status);
+  } else if (null != NULL) {
+    double t0 = stats_clock();
+    fits_write_imgnull(fptr, type, first, src_number, src, null, &status);
+    count_write((double)type_size(type)*src_number, t0);
+  } else if (! write_image_raw(fptr, type, first, src_number, src, nthreads,
+                               &status)) {
+    double t0 = stats_clock();
+    if (! write_image_tiles(fptr, type, first, src_number, src,
+                            nthreads, &status)) {
+      fits_write_img(fptr, type, first, src_number, src, &status);
+    }
+    count_write((double)type_size(type)*src_number, t0);
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+  ypush_nil();
+}
+
+void
+Y_fitsio_copy_image2cell(int argc)
+{
+  fitsfile* inp;
+  fitsfile* out;
+  char* colname;
+  long rownum, longval;
+  int flag, status = 0;
+
+  if (argc != 5) y_error("expecting exactly 5 arguments");
+  inp = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL);
+  out = fetch_fitsfile(argc - 2, NOT_CLOSED|MODIFIED);
+  colname = ygets_q(argc - 3);
+  rownum  = ygets_l(argc - 4);
+  longval = ygets_l(argc - 5);
+  if (longval < 0 || longval > 2) y_error("bad value for COPYKEYFLAG");
+  flag = (int)longval;
+  if (colname == NULL || colname[0] == '\0') {
+    y_error("invalid column name");
+  }
+  fits_copy_image2cell(inp, out, colname, rownum, flag, &status);
+  if (status != 0) yfits_error(status);
+  yarg_drop(3); /* left output object on top of stack */
+}
+
+void
+Y_fitsio_copy_image_section(int argc)
+{
+  fitsfile* inp;
+  fitsfile* out;
+  char* section;
+  int status = 0;
+  if (argc != 3) y_error("expecting exactly 3 arguments");
+  inp = fetch_fitsfile(2, NOT_CLOSED|CRITICAL);
+  out = fetch_fitsfile(1, NOT_CLOSED|MODIFIED);
+  section = ygets_q(0);
+  if (section == NULL || section[0] == '\0') {
+    y_error("invalid section string");
+  }
+  fits_copy_image_section(inp, out, section, &status);
+  if (status != 0) yfits_error(status);
+  yarg_drop(1); /* left output on top of stack */
+}
+
+/* Copy the keywords of the current HDU of INP which do not describe the
+   structure of the HDU (nor its compression or its checksums) at the end of
+   the header of the current HDU of OUT. */
+static int
+copy_keywords(fitsfile* inp, fitsfile* out, int* status)
+{
+  char card[FLEN_CARD];
+  int k, nkeys, nmore, keyclass;
+
+  if (fits_get_hdrspace(inp, &nkeys, &nmore, status) != 0) {
+    return *status;
+  }
+  for (k = 1; k <= nkeys; ++k) {
+    if (fits_read_record(inp, k, card, status) != 0) {
       break;
-    case Y_STRING:
-      type = TSTRING;
+    }
+    keyclass = fits_get_keyclass(card);
+    if (keyclass == TYP_STRUC_KEY || keyclass == TYP_CMPRS_KEY ||
+        keyclass == TYP_CKSUM_KEY ||
+        strncmp(card, "EXTNAME = 'COMPRESSED_IMAGE'", 28) == 0) {
+      continue;
+    }
+    if (fits_write_record(out, card, status) != 0) {
       break;
-    default:
-      y_error("unsupported array type");
     }
   }
-  if (dims[0] != naxis + 1 && dims[0] != naxis) {
-    y_error("incompatible number of dimensions");
-  }
-  for (k = 0; k < naxis; ++k) {
-    if (dims[k+1] != naxes[k]) {
-      y_error("non matching dimension(s)");
+  return *status;
+}
+
+/* Copy the NPIX pixels of type BITPIX of the image in the current HDU of INP
+   into the freshly created image in the current HDU of OUT.  If none of the
+   images is compressed, the raw bytes are copied by large blocks.
+   Otherwise, the raw values (scaling is disabled) are read and written by
+   CFITSIO by blocks of complete layers of tiles of OUT, the whole image
+   being written at once if it can be compressed by NTHREADS threads (see
+   `write_image_tiles`). */
+static int
+copy_image_data(fitsfile* inp, fitsfile* out, int bitpix, long npix,
+                int nthreads, int* status)
+{
+  LONGLONG headstart, inpstart, outstart, dataend, nbytes, offset;
+  tile_layout_t t;
+  scaling_t si, so;
+  double t0;
+  char* buf;
+  long n, first, blocklen;
+  size_t size;
+  int datatype, ytype, anynull, code;
+
+  if (*status != 0 || npix < 1) {
+    return *status;
+  }
+  if (! fits_is_compressed_image(inp, status) &&
+      ! fits_is_compressed_image(out, status)) {
+    if (fits_get_hduaddrll(inp, &headstart, &inpstart, &dataend,
+                           status) != 0 ||
+        fits_get_hduaddrll(out, &headstart, &outstart, &dataend,
+                           status) != 0) {
+      return *status;
+    }
+    if ((buf = get_workspace(RAW_BLOCK_SIZE)) == NULL) {
+      return (*status = MEMORY_ALLOCATION);
+    }
+    nbytes = (LONGLONG)npix*((bitpix < 0 ? -bitpix : bitpix)/8);
+    for (offset = 0; offset < nbytes && *status == 0; offset += n) {
+      n = (nbytes - offset < RAW_BLOCK_SIZE ? nbytes - offset :
+           RAW_BLOCK_SIZE);
+      t0 = stats_clock();
+      if (ffmbyt(inp, inpstart + offset, REPORT_EOF, status) != 0 ||
+          ffgbyt(inp, n, buf, status) != 0) {
+        break;
+      }
+      count_read(n, t0);
+      t0 = stats_clock();
+      if (ffmbyt(out, outstart + offset, IGNORE_EOF, status) != 0 ||
+          ffpbyt(out, n, buf, status) != 0) {
+        break;
+      }
+      count_write(n, t0);
     }
+    return *status;
   }
 
-  /* Write the values. */
-  if (null == NULL) {
-    fits_write_col(fptr, type, colnum, firstrow, 1,
-                   number, arr, &status);
+  /* Read and write the raw values by CFITSIO. */
+  if (*status != 0 ||
+      (datatype = image_datatype(bitpix, &ytype)) == -1 ||
+      get_image_scaling(inp, &si, status) != 0 ||
+      get_image_scaling(out, &so, status) != 0) {
+    return (*status != 0 ? *status : (*status = BAD_BITPIX));
+  }
+  size = type_size(datatype);
+  if (fits_is_compressed_image(out, status)) {
+    if (! get_tile_layout(out, &t, status)) {
+      return (*status != 0 ? *status : (*status = BAD_NAXIS));
+    }
   } else {
-    fits_write_colnull(fptr, type, colnum, firstrow, 1,
-                       number, arr, null, &status);
+    t.unit = 1;
   }
-  if (status != 0) {
-    yfits_error(status);
+  if (nthreads > 1 && t.unit > 1 && bitpix > 0) {
+    blocklen = npix;
+  } else {
+    blocklen = (RAW_BLOCK_SIZE/size/t.unit)*t.unit;
+    if (blocklen < t.unit) {
+      blocklen = t.unit;
+    }
+    if (blocklen > npix) {
+      blocklen = npix;
+    }
   }
-  ypush_nil();
+  if ((buf = (char*)malloc(blocklen*size)) == NULL) {
+    return (*status = MEMORY_ALLOCATION);
+  }
+  fits_set_bscale(inp, 1.0, 0.0, status);
+  fits_set_bscale(out, 1.0, 0.0, status);
+  for (first = 1; first <= npix && *status == 0; first += n) {
+    n = npix - first + 1;
+    if (n > blocklen) {
+      n = blocklen;
+    }
+    t0 = stats_clock();
+    if (fits_read_img(inp, datatype, first, n, NULL, buf, &anynull,
+                      status) != 0) {
+      break;
+    }
+    count_read(n*size, t0);
+    t0 = stats_clock();
+    if (! write_image_tiles(out, datatype, first, n, buf, nthreads,
+                            status) && *status == 0) {
+      fits_write_img(out, datatype, first, n, buf, status);
+    }
+    count_write(n*size, t0);
+  }
+  free(buf);
+  code = 0;
+  fits_set_bscale(inp, si.scale, si.zero, &code);
+  fits_set_bscale(out, so.scale, so.zero, &code);
+  return *status;
 }
 
 void
-Y_fitsio_read_col(int argc)
+Y_fitsio_copy_img(int argc)
 {
-  scalar_t null;
-  fitsfile* fptr;
-  long number, firstrow, lastrow, nrows, null_index, repeat, width;
-  long dims[Y_DIMSIZE];
-  void* arr;
-  int k, coltype, type, naxis, status, colnum, anynull;
-  int iarg, pos;
+  fitsfile* inp;
+  fitsfile* out;
+  long dims[MAXDIMS + 1];
+  long tile[MAX_COMPRESS_DIM];
+  long k, npix;
+  float quantize;
+  int iarg, pos, out_iarg, compress, ntile, nthreads, bitpix, naxis;
+  int hdutype, status = 0;
 
   /* Parse arguments. */
-  null_index = -1;
-  firstrow = -1;
-  lastrow = -1;
-  colnum = -1;
-  fptr = NULL;
-  arr = NULL;
+  inp = NULL;
+  out = NULL;
+  out_iarg = -1;
+  compress = NOCOMPRESS - 1; /* means not specified */
+  ntile = 0;
+  quantize = 0.0f;
+  nthreads = yfits_nthreads;
   pos = 0;
   for (iarg = argc - 1; iarg >= 0; --iarg) {
     long index = yarg_key(iarg);
@@ -2342,585 +4924,7694 @@ Y_fitsio_read_col(int argc)
       /* Positional argument. */
       ++pos;
       if (pos == 1) {
-        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
+        inp = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
       } else if (pos == 2) {
-        colnum = get_colnum(iarg, fptr);
-      } else if (pos == 3) {
-        firstrow = ygets_l(iarg);
-      } else if (pos == 4) {
-        lastrow = ygets_l(iarg);
+        out = fetch_fitsfile(iarg, NOT_CLOSED|MODIFIED);
+        out_iarg = iarg;
       } else {
         y_error("too many arguments");
       }
     } else {
       /* Keyword argument. */
       --iarg;
-      if (index == index_of_null) {
-        null_index = yget_ref(iarg);
+      if (index == index_of_compress) {
+        compress = fetch_compression(iarg);
+      } else if (index == index_of_tile) {
+        ntile = fetch_tile(iarg, tile);
+      } else if (index == index_of_quantize) {
+        quantize = fetch_quantize(iarg);
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
       } else {
         y_error("unsupported keyword");
       }
     }
   }
-  if (pos < 2) {
-    y_error("too few arguments");
+  if (pos < 2) y_error("not enough arguments");
+  if (compress < NOCOMPRESS && (ntile > 0 || quantize != 0.0f)) {
+    y_error("keywords TILE and QUANTIZE require keyword COMPRESS");
   }
 
-  /* Get FITS column dimensions and type. */
-  status = 0;
-  fits_get_num_rows(fptr, &nrows, &status);
-  fits_get_eqcoltype(fptr, colnum, &coltype, &repeat, &width, &status);
-  fits_read_tdim(fptr, colnum, Y_DIMSIZE - 1, &naxis, &dims[1], &status);
-  if (coltype < 0) {
-    y_error("variable size arrays not yet supported");
+  /* Create the new image with the same type and dimensions, copy the
+     keywords and then the data. */
+  if (fits_get_hdu_type(inp, &hdutype, &status) != 0 ||
+      hdutype != IMAGE_HDU) {
+    if (status != 0) {
+      yfits_error(status);
+    }
+    y_error("current HDU is not an image");
   }
-  if (status != 0) {
+  if (fits_get_img_type(inp, &bitpix, &status) != 0 ||
+      fits_get_img_dim(inp, &naxis, &status) != 0) {
     yfits_error(status);
   }
-  if (pos < 3) {
-    firstrow = 1;
-  }
-  if (pos < 4) {
-    lastrow = nrows;
-  }
-  if (firstrow < 1 || firstrow > lastrow || lastrow > nrows) {
-    y_error("invalid range of rows");
+  dims[0] = naxis;
+  if (naxis > MAXDIMS ||
+      fits_get_img_size(inp, dims[0], &dims[1], &status) != 0) {
+    yfits_error(status != 0 ? status : BAD_NAXIS);
+  }
+  npix = 1;
+  for (k = 1; k <= dims[0]; ++k) {
+    npix *= dims[k];
+  }
+  if (create_image(out, bitpix, dims, compress, ntile, tile, quantize,
+                   &status) != 0 ||
+      copy_keywords(inp, out, &status) != 0 ||
+      fits_set_hdustruc(out, &status) != 0 ||
+      copy_image_data(inp, out, bitpix, (dims[0] > 0 ? npix : 0), nthreads,
+                      &status) != 0) {
+    yfits_error(status);
   }
+  ypush_use(yget_use(out_iarg)); /* left output object on top of stack */
+}
 
-  /* Figure out the dimensions of the result. */
-  if (coltype == TSTRING) {
-    /* Discard leading dimension for array of strings. */
-    if (naxis < 1 || dims[1] != width) {
-      y_error("assumption failed!");
-    }
-    --naxis;
-    for (k = 1; k <= naxis; ++k) {
-      dims[k] = dims[k+1];
+static void
+check_ncols(int* tfields, long ntot)
+{
+  if (*tfields > 0) {
+    if (*tfields != ntot) {
+      y_error("number of columns mismatch");
     }
-  } else if (naxis == 1 && dims[1] == 1) {
-    naxis = 0;
-  }
-  dims[0] = naxis;
-  if (firstrow < lastrow) {
-    /* Append a trailing dimension whose length is equal to the number of rows
-       to read. */
-    if (naxis >= Y_DIMSIZE - 1) {
-      y_error("too many dimensions");
+  } else {
+    if ((*tfields = ntot) != ntot) {
+      y_error("too many columns (integer overflow)");
     }
-    dims[0] = ++naxis;
-    dims[naxis] = lastrow - firstrow + 1;
-  }
-  number = 1;
-  for (k = 1; k <= naxis; ++k) {
-    number *= dims[k];
   }
+}
 
-  /* Create the destination array. */
-  switch (coltype) {
-  case TBIT:
-    /* Reading/writing bits with datatype = TBIT results in considering that
-       each bit is stored in a single char with value 0/1. */
-    type = TBIT;
-    arr = ypush_c(dims);
-    null.type = Y_CHAR;
-    break;
+/*---------------------------------------------------------------------------*/
+/* TABLES */
 
-  case TSTRING:
-    type = TSTRING;
-    {
-      char** str = ypush_q(dims);
-      size_t size = width + 1; /* enough bytes for the longuest string */
-      long i;
-      for (i = 0; i < number; ++i) {
-        str[i] = p_malloc(size);
+void
+Y_fitsio_create_tbl(int argc)
+{
+  fitsfile* fptr;
+  long nrows, ntot;
+  long dims[Y_DIMSIZE];
+  char** ttype;
+  char** tform;
+  char** tunit;
+  char* extname;
+  int status, iarg, tbltype, tfields;
+
+  tbltype = BINARY_TBL;
+  fptr = NULL;
+  extname = NULL;
+  ttype = NULL;
+  tform = NULL;
+  tunit = NULL;
+  tfields = -1;
+  nrows = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (fptr == NULL) {
+        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL|MODIFIED);
+      } else if (ttype == NULL) {
+        ttype = ygeta_q(iarg, &ntot, dims);
+        if (dims[0] > 1) y_error("too many dimensions for argument TTYPE");
+        check_ncols(&tfields, ntot);
+      } else if (tform == NULL) {
+        tform = ygeta_q(iarg, &ntot, dims);
+        if (dims[0] > 1) y_error("too many dimensions for argument TFORM");
+        check_ncols(&tfields, ntot);
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_extname) {
+        extname = ygets_q(iarg);
+      } else if (index == index_of_tunit) {
+        tunit = ygeta_q(iarg, &ntot, dims);
+        if (dims[0] > 1) y_error("too many dimensions for argument TUNIT");
+        check_ncols(&tfields, ntot);
+      } else if (index == index_of_ascii) {
+        tbltype = (yarg_true(iarg) ? ASCII_TBL : BINARY_TBL);
+        check_ncols(&tfields, ntot);
+      } else {
+        y_error("unsupported keyword");
       }
-      arr = str;
     }
-    null.type = Y_CHAR; /* FIXME: */
-    break;
-
-  case TBYTE:
+  }
+  if (tform == NULL) y_error("too few arguments");
+  status = 0;
+  if (fits_create_tbl(fptr, tbltype, nrows, tfields, ttype,
+                      tform,  tunit, extname, &status) != 0) {
+    yfits_error(status);
+  }
+  ypush_nil();
+}
+
+void
+Y_fitsio_get_num_rows(int argc)
+{
+  long nrows;
+  int status = 0;
+  if (argc != 1) y_error("expecting exactly one argument");
+  fits_get_num_rows(fetch_fitsfile(0, NOT_CLOSED|CRITICAL), &nrows, &status);
+  if (status != 0) yfits_error(status);
+  ypush_long(nrows);
+}
+
+void
+Y_fitsio_get_num_cols(int argc)
+{
+  int ncols;
+  int status = 0;
+  if (argc != 1) y_error("expecting exactly one argument");
+  fits_get_num_cols(fetch_fitsfile(0, NOT_CLOSED|CRITICAL), &ncols, &status);
+  if (status != 0) yfits_error(status);
+  ypush_long(ncols);
+}
+
+void
+Y_fitsio_get_colnum(int argc)
+{
+  fitsfile* fptr;
+  long  dims[2];
+  char* template;
+  long* result;
+  int   iarg, status, casesen, colnum, ncols, col;
+
+  fptr = NULL;
+  template = NULL;
+  casesen = CASEINSEN;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (fptr == NULL) {
+        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
+      } else if (template == NULL) {
+        template = ygets_q(iarg);
+        if (template == NULL || template[0] == 0) {
+          y_error("invalid TEMPLATE string");
+        }
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_case) {
+        casesen = (yarg_true(iarg) ? CASESEN : CASEINSEN);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (template == NULL) y_error("too few arguments");
+
+  status = 0;
+  fits_get_colnum(fptr, casesen, template, &colnum, &status);
+  if (status == 0) {
+    ypush_long(colnum);
+    return;
+  }
+  if (status == COL_NOT_FOUND) {
+    ypush_nil();
+    return;
+  }
+  ncols = 0;
+  while (status == COL_NOT_UNIQUE) {
+    ++ncols;
+    fits_get_colnum(fptr, casesen, template, &colnum, &status);
+  }
+  if (status != COL_NOT_FOUND) {
+    yfits_error(status);
+  }
+  dims[0] = 1;
+  dims[1] = ncols;
+  result = ypush_l(dims);
+  status = 0;
+  for (col = 0; col < ncols; ++col) {
+    fits_get_colnum(fptr, casesen, template, &colnum, &status);
+    if (status != COL_NOT_UNIQUE) {
+      yfits_error(status);
+    }
+    result[col] = colnum;
+  }
+}
+
+void
+Y_fitsio_get_colname(int argc)
+{
+  fitsfile* fptr;
+  long   dims[2];
+  char   colname[80];
+  char*  template;
+  char** result;
+  int    iarg, status, casesen, colnum, ncols, col;
+
+  fptr = NULL;
+  template = NULL;
+  casesen = CASEINSEN;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (fptr == NULL) {
+        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
+      } else if (template == NULL) {
+        template = ygets_q(iarg);
+        if (template == NULL || template[0] == 0) {
+          y_error("invalid TEMPLATE string");
+        }
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_case) {
+        casesen = (yarg_true(iarg) ? CASESEN : CASEINSEN);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (template == NULL) y_error("too few arguments");
+
+  status = 0;
+  fits_get_colname(fptr, casesen, template, colname, &colnum, &status);
+  if (status == 0) {
+    push_string(colname);
+    return;
+  }
+  if (status == COL_NOT_FOUND) {
+    ypush_nil();
+    return;
+  }
+  ncols = 0;
+  while (status == COL_NOT_UNIQUE) {
+    ++ncols;
+    fits_get_colname(fptr, casesen, template, colname, &colnum, &status);
+  }
+  if (status != COL_NOT_FOUND) {
+    yfits_error(status);
+  }
+  dims[0] = 1;
+  dims[1] = ncols;
+  result = ypush_q(dims);
+  status = 0;
+  for (col = 0; col < ncols; ++col) {
+    fits_get_colname(fptr, casesen, template, colname, &colnum, &status);
+    if (status != COL_NOT_UNIQUE) {
+      yfits_error(status);
+    }
+    result[col] = p_strcpy(colname);
+  }
+}
+
+static long
+get_cell_dims(fitsfile* fptr, int colnum, long nrows, int* coltype,
+              long* width, long dims[])
+{
+  long repeat, number;
+  int k, naxis, status = 0;
+
+  fits_get_eqcoltype(fptr, colnum, coltype, &repeat, width, &status);
+  fits_read_tdim(fptr, colnum, Y_DIMSIZE - 1, &naxis, &dims[1], &status);
+  if (*coltype < 0) {
+    y_error("variable length arrays are only supported by fitsio_read_col");
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+  if (*coltype == TSTRING) {
+    /* Discard leading dimension for array of strings. */
+    if (naxis < 1 || dims[1] != *width) {
+      y_error("assumption failed!");
+    }
+    --naxis;
+    for (k = 1; k <= naxis; ++k) {
+      dims[k] = dims[k+1];
+    }
+  } else if (naxis == 1 && dims[1] == 1) {
+    naxis = 0;
+  }
+  if (nrows > 1) {
+    /* Append a trailing dimension whose length is equal to the number of rows
+       to read. */
+    if (naxis >= Y_DIMSIZE - 1) {
+      y_error("too many dimensions");
+    }
+    dims[++naxis] = nrows;
+  }
+  dims[0] = naxis;
+  number = 1;
+  for (k = 1; k <= naxis; ++k) {
+    number *= dims[k];
+  }
+  return number;
+}
+
+static long
+get_column_list(int iarg, fitsfile* fptr, int ntotal, int colnum[])
+{
+  long k, ncols;
+  int status = 0;
+
+  if (iarg == -1) {
+    ncols = ntotal;
+    for (k = 0; k < ncols; ++k) {
+      colnum[k] = k + 1;
+    }
+  } else if (yarg_typeid(iarg) == Y_STRING) {
+    char** list = ygeta_q(iarg, &ncols, NULL);
+    if (ncols > MAX_COLUMNS) {
+      y_error("too many columns");
+    }
+    for (k = 0; k < ncols; ++k) {
+      if (list[k] == NULL || list[k][0] == '\0') {
+        y_error("invalid column name");
+      }
+      if (fits_get_colnum(fptr, CASEINSEN, list[k], &colnum[k],
+                          &status) == COL_NOT_FOUND) {
+        y_error("column name not found");
+      }
+      if (status == COL_NOT_UNIQUE) {
+        /* Use the first matching column. */
+        status = 0;
+      } else if (status != 0) {
+        yfits_error(status);
+      }
+    }
+  } else if (yarg_typeid(iarg) <= Y_LONG) {
+    long* list = ygeta_l(iarg, &ncols, NULL);
+    if (ncols > MAX_COLUMNS) {
+      y_error("too many columns");
+    }
+    for (k = 0; k < ncols; ++k) {
+      if (list[k] < 1 || list[k] > ntotal) {
+        y_error("out of range column number");
+      }
+      colnum[k] = list[k];
+    }
+  } else {
+    y_error("expecting column numbers or names");
+    ncols = 0;
+  }
+  if (ncols < 1) {
+    y_error("no columns specified");
+  }
+  for (k = 1; k < ncols; ++k) {
+    long j;
+    for (j = 0; j < k; ++j) {
+      if (colnum[j] == colnum[k]) {
+        y_error("duplicate column");
+      }
+    }
+  }
+  return ncols;
+}
+
+static int
+array_datatype(int type, int coltype)
+{
+  switch (type) {
+  case Y_CHAR:
+    return (coltype == TBIT || coltype == TLOGICAL ? coltype : TBYTE);
+  case Y_SHORT:
+    return TSHORT;
+  case Y_INT:
+    return TINT;
+  case Y_LONG:
+    return (sizeof(long) == 8 ? TLONGLONG : TLONG);
+  case Y_FLOAT:
+    return TFLOAT;
+  case Y_DOUBLE:
+    return TDOUBLE;
+  case Y_COMPLEX:
+    return TDBLCOMPLEX;
+  case Y_STRING:
+    return TSTRING;
+  }
+  y_error("unsupported array type");
+  return -1;
+}
+
+static int
+get_column_type(fitsfile* fptr, int colnum, int type, const long dims[],
+                long* nrows)
+{
+  long repeat, width;
+  long naxes[Y_DIMSIZE - 1];
+  int k, naxis, coltype, status = 0;
+
+  fits_get_eqcoltype(fptr, colnum, &coltype, &repeat, &width, &status);
+  fits_read_tdim(fptr, colnum, Y_DIMSIZE - 1, &naxis, naxes, &status);
+  if (status != 0) {
+    yfits_error(status);
+  }
+  if (coltype < 0) {
+    y_error("variable length arrays are only supported by fitsio_write_col");
+  }
+  if (coltype == TSTRING) {
+    /* Column of strings is special. */
+    if (type != Y_STRING) {
+      y_error("expecting array of strings for this column");
+    } else {
+      type = TSTRING;
+    }
+    if (naxis < 1 || naxes[0] != width) {
+      y_error("assumption failed!");
+    }
+    --naxis;
+    for (k = 0; k < naxis; ++k) {
+      naxes[k] = naxes[k+1];
+    }
+  } else {
+    /* Non-string column. */
+    if (naxis == 1 && naxes[0] == 1) {
+      naxis = 0;
+    }
+    type = array_datatype(type, coltype);
+  }
+  if (dims[0] != naxis + 1 && dims[0] != naxis) {
+    y_error("incompatible number of dimensions");
+  }
+  for (k = 0; k < naxis; ++k) {
+    if (dims[k+1] != naxes[k]) {
+      y_error("non matching dimension(s)");
+    }
+  }
+  if (nrows != NULL) {
+    *nrows = (dims[0] > naxis ? dims[dims[0]] : 1);
+  }
+  return type;
+}
+
+static int
+get_colnum(int iarg, fitsfile *fptr)
+{
+  char* colname;
+  int type, rank, status, ncols, colnum;
+
+  type = yarg_typeid(iarg);
+  rank = yarg_rank(iarg);
+  if (type <= Y_LONG && rank == 0) {
+    status = 0;
+    if (fits_get_num_cols(fptr, &ncols, &status) != 0) {
+      yfits_error(status);
+    }
+    colnum = ygets_i(iarg);
+    if (colnum < 1 || colnum > ncols) {
+      y_error("out of range column number");
+    }
+    return colnum;
+  }
+  if (type == Y_STRING && rank == 0) {
+    colname = ygets_q(iarg);
+    if (colname == NULL || colname[0] == '\0') {
+      status = COL_NOT_FOUND;
+    } else {
+      status = 0;
+      fits_get_colnum(fptr, CASEINSEN, colname, &colnum, &status);
+    }
+    if (status != 0) {
+      if (status == COL_NOT_FOUND) {
+        y_error("column name not found");
+      }
+      if (status != COL_NOT_UNIQUE) {
+        y_error("column name not unique");
+      }
+      yfits_error(status);
+    }
+    return colnum;
+  }
+  y_error("expecting column number or name");
+  return -1;
+}
+
+static void
+get_coltype(int argc, int eqcoltype)
+{
+  fitsfile* fptr;
+  long  dims[2];
+  long* result;
+  long  repeat, width;
+  int   status = 0, type, colnum;
+
+  if (argc != 2) y_error("expecting exactly 2 arguments");
+  fptr = fetch_fitsfile(1, NOT_CLOSED|CRITICAL);
+  colnum = get_colnum(0, fptr);
+  if (eqcoltype) {
+    fits_get_eqcoltype(fptr, colnum, &type, &repeat, &width, &status);
+  } else {
+    fits_get_coltype(fptr, colnum, &type, &repeat, &width, &status);
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+  dims[0] = 1;
+  dims[1] = 3;
+  result = ypush_l(dims);
+  result[0] = type;
+  result[1] = repeat;
+  result[2] = width;
+}
+
+void
+Y_fitsio_get_coltype(int argc)
+{
+  get_coltype(argc, 0);
+}
+
+void
+Y_fitsio_get_eqcoltype(int argc)
+{
+  get_coltype(argc, 1);
+}
+
+static void
+push_tdim(int naxis, long naxes[])
+{
+  long  dims[2];
+  long* result;
+  int   k;
+
+  if (naxis == 1 && naxes[0] == 1) {
+    naxis = 0;
+  }
+  dims[0] = 1;
+  dims[1] = naxis + 1;
+  result = ypush_l(dims);
+  result[0] = naxis;
+  for (k = 0; k < naxis; ++k) {
+    result[k+1] = naxes[k];
+  }
+}
+
+void
+Y_fitsio_read_tdim(int argc)
+{
+  fitsfile* fptr;
+  long  naxes[Y_DIMSIZE - 1];
+  int   status = 0, colnum, naxis;
+
+  if (argc != 2) y_error("expecting exactly 2 arguments");
+  fptr = fetch_fitsfile(1, NOT_CLOSED|CRITICAL);
+  colnum = get_colnum(0, fptr);
+  if (fits_read_tdim(fptr, colnum,
+                     Y_DIMSIZE - 1, &naxis, naxes, &status) != 0) {
+    yfits_error(status);
+  }
+  push_tdim(naxis, naxes);
+}
+
+void
+Y_fitsio_decode_tdim(int argc)
+{
+  fitsfile* fptr;
+  long  naxes[Y_DIMSIZE - 1];
+  char* tdimstr;
+  int   status = 0, colnum, naxis;
+
+  if (argc != 3) y_error("expecting exactly 3 arguments");
+  fptr = fetch_fitsfile(2, NOT_CLOSED|CRITICAL);
+  tdimstr = ygets_q(1);
+  colnum = get_colnum(0, fptr);
+  if (fits_decode_tdim(fptr, tdimstr, colnum,
+                       Y_DIMSIZE - 1, &naxis, naxes, &status) != 0) {
+    yfits_error(status);
+  }
+  push_tdim(naxis, naxes);
+}
+
+void
+Y_fitsio_write_tdim(int argc)
+{
+  fitsfile* fptr;
+  long dims[Y_DIMSIZE];
+  int  status = 0, colnum;
+
+  if (argc < 2) y_error("expecting at least 2 arguments");
+  fptr = fetch_fitsfile(argc - 1, NOT_CLOSED|CRITICAL|MODIFIED);
+  colnum = get_colnum(argc - 2, fptr);
+  get_dimlist(argc - 3, 0, dims, Y_DIMSIZE - 1);
+  if (dims[0] == 0) {
+    dims[0] = 1;
+    dims[1] = 1;
+  }
+  if (fits_write_tdim(fptr, colnum, dims[0], &dims[1], &status) != 0) {
+    yfits_error(status);
+  }
+  ypush_nil();
+}
+
+/* Try to write NUMBER values of type DATATYPE from SRC into the column
+   COLNUM of a binary table starting at row FIRSTROW.  The values are
+   converted into raw bytes with NTHREADS threads and written by blocks of
+   rows.  This is only possible for columns of fixed size numerical cells
+   without scaling; TRUE is returned if the values have been written, FALSE
+   if the caller has to fall back to CFITSIO (also when some values cannot
+   be represented, which is checked before writing anything). */
+static int
+write_column_raw(fitsfile* fptr, int datatype, int colnum, long firstrow,
+                 long number, const void* src, int nthreads, int* status)
+{
+  char tform[FLEN_VALUE], snull[FLEN_VALUE];
+  scaling_t s;
+  double scale, zero;
+  LONGLONG startpos, elemnum, repeat, rowlen, tnull;
+  size_t srcsize, dstsize, cellsize;
+  char* workspace;
+  long twidth, incre, nrows, blockrows, row, n, m, ncell;
+  int tcode, maxelem, hdutype, bitpix, iomode, count;
+
+  if (*status != 0 || fits_file_mode(fptr, &iomode, status) != 0 ||
+      iomode != READWRITE || number <= 0) {
+    return FALSE;
+  }
+  /* Get the location of the first element to write (this also extends the
+     table if needed, just as CFITSIO would do). */
+  if (ffgcprll(fptr, colnum, firstrow, 1, number, 1, &scale, &zero, tform,
+               &twidth, &tcode, &maxelem, &startpos, &elemnum, &incre,
+               &repeat, &rowlen, &hdutype, &tnull, snull, status) > 0) {
+    return FALSE;
+  }
+  if (hdutype != BINARY_TBL || scale != 1.0 || zero != 0.0 ||
+      repeat < 1 || number%repeat != 0) {
+    return FALSE;
+  }
+  if ((bitpix = column_bitpix(tcode, &count)) == 0) {
+    return FALSE;
+  }
+  if (count == 2) {
+    /* Complex values are written as pairs of doubles. */
+    if (datatype != TDBLCOMPLEX) {
+      return FALSE;
+    }
+    datatype = TDOUBLE;
+  }
+  s.scale = 1.0;
+  s.zero = 0.0;
+  s.blank = 0;
+  s.has_blank = FALSE;
+  if (! encodable(bitpix, datatype, &s)) {
+    return FALSE;
+  }
+  srcsize = type_size(datatype);
+  dstsize = (bitpix < 0 ? -bitpix : bitpix)/8;
+  cellsize = repeat*incre;
+  ncell = cellsize/dstsize; /* number of values per cell */
+  nrows = number/repeat;
+  blockrows = RAW_BLOCK_SIZE/cellsize;
+  if (blockrows < 1) {
+    blockrows = 1;
+  }
+  if ((workspace = get_workspace(2*blockrows*cellsize)) == NULL ||
+      encoding_overflows(workspace, blockrows*ncell, bitpix, src, datatype,
+                         number, &s, nthreads)) {
+    return FALSE;
+  }
+
+  /* Encode the first block of rows, then write each block while the next
+     one is being encoded. */
+  n = (nrows < blockrows ? nrows : blockrows);
+  encode_values_parallel(workspace, bitpix, src, datatype, n*ncell, &s,
+                         nthreads);
+  for (row = 0; row < nrows; row += n, n = m) {
+    char* raw = workspace + ((row/blockrows)&1)*blockrows*cellsize;
+    m = nrows - (row + n);
+    if (m > blockrows) {
+      m = blockrows;
+    }
+    if (m > 0) {
+      start_encoding(workspace + (((row + n)/blockrows)&1)*blockrows*cellsize,
+                     bitpix, (const char*)src + (row + n)*ncell*srcsize,
+                     datatype, m*ncell, &s, nthreads);
+    }
+    if (ffmbyt(fptr, startpos + row*rowlen, IGNORE_EOF, status) == 0) {
+      ffpbytoff(fptr, cellsize, n, rowlen - cellsize, raw, status);
+    }
+    if (m > 0) {
+      pool_wait();
+    }
+    if (*status != 0) {
+      break;
+    }
+  }
+  return (*status == 0);
+}
+
+/* Largest gap (in bytes) between two cells of a variable length array column
+   that is read rather than skipped when loading the heap. */
+#define MAX_HEAP_GAP (64L*1024L)
+
+static const long* heap_address = NULL;
+
+static int
+compare_heap_address(const void* a, const void* b)
+{
+  long ia = *(const long*)a, ib = *(const long*)b;
+  if (heap_address[ia] != heap_address[ib]) {
+    return (heap_address[ia] < heap_address[ib] ? -1 : 1);
+  }
+  return (ia < ib ? -1 : (ia > ib ? 1 : 0));
+}
+
+/* Get the offset HEAP of the heap relative to the data of the binary table
+   in the current HDU, given by THEAP or by the size of the rows. */
+static int
+get_heap_start(fitsfile* fptr, LONGLONG* heap, int* status)
+{
+  LONGLONG rowlen, nrows;
+  if (fits_read_key(fptr, TLONGLONG, "THEAP", heap, NULL,
+                    status) == KEY_NO_EXIST) {
+    *status = 0;
+    if (fits_read_key(fptr, TLONGLONG, "NAXIS1", &rowlen, NULL,
+                      status) == 0 &&
+        fits_get_num_rowsll(fptr, &nrows, status) == 0) {
+      *heap = rowlen*nrows;
+    }
+  }
+  return *status;
+}
+
+/* Read NROWS rows starting at FIRSTROW of the variable length array column
+   COLNUM (of equivalent type -COLTYPE) of the current HDU.  Two arrays are
+   left on top of the stack: the offsets (NROWS + 1 values, starting at 0) of
+   the rows in the values and, above, the values of all the rows (a flat
+   vector or nil if there are none, a vector of strings with one element per
+   row for a column of strings).  The descriptors of all the rows are read at
+   once and the heap is read by large contiguous blocks in increasing order of
+   addresses.  The null value is stored in NULL.  Returns whether there are
+   any undefined values. */
+static int
+read_vla_column(fitsfile* fptr, int colnum, int coltype, long firstrow,
+                long nrows, scalar_t* null, int* status)
+{
+  LONGLONG headstart, datastart, dataend, heap;
+  scaling_t s;
+  long dims[2];
+  long* offs;
+  long* addr;
+  long* order;
+  char* arr;
+  char* raw;
+  size_t size, esize, maxsize, wssize;
+  long r, i, j, n, total, width, start, end;
+  int type, ytype, bitpix, count, datatype, anynull, any, fast, rawtype;
+
+  /* Read all descriptors at once, the lengths are stored in OFFS[1:NROWS]
+     and then integrated to get the offsets. */
+  dims[0] = 1;
+  dims[1] = nrows + 1;
+  offs = ypush_l(dims);
+  dims[1] = nrows;
+  addr = ypush_l(dims);
+  order = ypush_l(dims);
+  if (fits_read_descripts(fptr, colnum, firstrow, nrows, offs + 1, addr,
+                          status) != 0) {
+    yfits_error(*status);
+  }
+  offs[0] = 0;
+  width = 0;
+  for (r = 0; r < nrows; ++r) {
+    if (offs[r+1] > width) {
+      width = offs[r+1];
+    }
+    offs[r+1] += offs[r];
+  }
+  total = offs[nrows];
+  type = column_datatype(-coltype, &ytype);
+  if (type == -1) {
+    y_error("unsupported array type");
+  }
+  memset(&null->value, 0, sizeof(null->value));
+  null->type = ytype;
+  anynull = FALSE;
+
+  if (type == TSTRING) {
+    /* A string per row, CFITSIO reads them one by one.  Undefined strings
+       are read as empty strings, there is no null value to report. */
+    null->type = Y_VOID;
+    dims[0] = (nrows > 1 ? 1 : 0);
+    arr = push_array(Y_STRING, dims, width);
+    for (r = 0; r < nrows && *status == 0; ++r) {
+      fits_read_col(fptr, TSTRING, colnum, firstrow + r, 1, 1, "",
+                    (char**)arr + r, &any, status);
+    }
+    goto done;
+  }
+  if (total <= 0) {
+    ypush_nil();
+    goto done;
+  }
+  dims[1] = total;
+  arr = push_array(ytype, dims, 0);
+
+  /* Get the scaling parameters and the type of the raw values from the
+     description of the column. */
+  if (fits_get_coltype(fptr, colnum, &rawtype, NULL, NULL, status) != 0 ||
+      fits_get_bcolparmsll(fptr, colnum, NULL, NULL, NULL, NULL, &s.scale,
+                           &s.zero, &s.blank, NULL, status) != 0) {
+    goto done;
+  }
+  bitpix = column_bitpix(-rawtype, &count);
+  s.has_blank = (bitpix > 0 && s.blank != NULL_UNDEFINED);
+  datatype = type;
+  fast = (bitpix != 0);
+  if (count == 2) {
+    /* Complex values are processed as pairs of doubles. */
+    fast = (datatype == TDBLCOMPLEX);
+    datatype = TDOUBLE;
+  }
+  fast = (fast && convertible(bitpix, datatype, &s));
+  set_null_value(null, datatype, &s);
+  if (count == 2) {
+    null->type = Y_DOUBLE;
+  }
+  size = (type == TBIT ? 1 : type_size(type));
+  if (! fast) {
+    /* Let CFITSIO read the rows. */
+    for (r = 0; r < nrows && *status == 0; ++r) {
+      if (offs[r+1] > offs[r]) {
+        fits_read_col(fptr, type, colnum, firstrow + r, 1,
+                      offs[r+1] - offs[r], &null->value, arr + offs[r]*size,
+                      &any, status);
+        anynull |= any;
+      }
+    }
+    goto done;
+  }
+
+  /* Sort the non-empty rows by heap address. */
+  esize = count*(bitpix < 0 ? -bitpix : bitpix)/8;
+  maxsize = width*esize;
+  n = 0;
+  for (r = 0; r < nrows; ++r) {
+    if (offs[r+1] > offs[r]) {
+      order[n++] = r;
+    }
+  }
+  heap_address = addr;
+  qsort(order, n, sizeof(order[0]), compare_heap_address);
+  heap_address = NULL;
+  wssize = (maxsize > RAW_BLOCK_SIZE ? maxsize : RAW_BLOCK_SIZE);
+  if ((raw = get_workspace(wssize)) == NULL) {
+    *status = MEMORY_ALLOCATION;
+    goto done;
+  }
+  if (fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         status) != 0) {
+    goto done;
+  }
+  if (get_heap_start(fptr, &heap, status) != 0) {
+    goto done;
+  }
+  heap += datastart;
+
+  /* Read groups of neighbor cells with a single read, then convert the
+     cells of the group. */
+  for (i = 0; i < n && *status == 0; i = j) {
+    r = order[i];
+    start = addr[r];
+    end = start + (offs[r+1] - offs[r])*esize;
+    for (j = i + 1; j < n; ++j) {
+      long next = addr[order[j]];
+      long last = next + (offs[order[j]+1] - offs[order[j]])*esize;
+      if (next > end + MAX_HEAP_GAP ||
+          (size_t)((last > end ? last : end) - start) > wssize) {
+        break;
+      }
+      if (last > end) {
+        end = last;
+      }
+    }
+    if (ffmbyt(fptr, heap + start, REPORT_EOF, status) != 0 ||
+        ffgbyt(fptr, end - start, raw, status) != 0) {
+      break;
+    }
+    for (; i < j; ++i) {
+      r = order[i];
+      anynull |= convert_values(arr + offs[r]*size, datatype,
+                                raw + (addr[r] - start), bitpix,
+                                (offs[r+1] - offs[r])*count, &s);
+    }
+  }
+
+ done:
+  /* Only keep the offsets and the values on the stack. */
+  yarg_swap(2, 0);
+  yarg_drop(2);
+  if (*status != 0) {
+    yfits_error(*status);
+  }
+  return anynull;
+}
+
+/* Write the values of type DATATYPE in ARR into the variable length array
+   column COLNUM (of equivalent type -COLTYPE) of the current HDU starting at
+   row FIRSTROW.  For a column of strings, there are NUMBER strings to write,
+   one per row.  Otherwise, the values of the row FIRSTROW + R are
+   ARR[OFFS[R]:OFFS[R+1]-1] for R = 0, ..., NROWS-1.  The rows are created
+   beforehand so that the heap is written sequentially by CFITSIO. */
+static int
+write_vla_column(fitsfile* fptr, int colnum, int coltype, long firstrow,
+                 int datatype, const void* arr, long number,
+                 const long* offs, long nrows, const void* null,
+                 int* status)
+{
+  long r, ntotal, last, size;
+
+  if (coltype == -TSTRING) {
+    nrows = number;
+  }
+  last = firstrow - 1 + nrows;
+  if (fits_get_num_rows(fptr, &ntotal, status) == 0 && last > ntotal) {
+    fits_insert_rows(fptr, ntotal, last - ntotal, status);
+  }
+  if (coltype == -TSTRING) {
+    char* empty = "";
+    char* const* q = (char* const*)arr;
+    for (r = 0; r < nrows && *status == 0; ++r) {
+      fits_write_col(fptr, TSTRING, colnum, firstrow + r, 1, 1,
+                     (q[r] != NULL ? (void*)&q[r] : (void*)&empty), status);
+    }
+    return *status;
+  }
+  size = (datatype == TBIT || datatype == TLOGICAL ? 1 : type_size(datatype));
+  for (r = 0; r < nrows && *status == 0; ++r) {
+    long n = offs[r+1] - offs[r];
+    void* ptr = (char*)arr + offs[r]*size;
+    if (n <= 0) {
+      fits_write_descript(fptr, colnum, firstrow + r, 0, 0, status);
+    } else if (null == NULL) {
+      fits_write_col(fptr, datatype, colnum, firstrow + r, 1, n, ptr,
+                     status);
+    } else {
+      fits_write_colnull(fptr, datatype, colnum, firstrow + r, 1, n, ptr,
+                         (void*)null, status);
+    }
+  }
+  return *status;
+}
+
+void
+Y_fitsio_write_col(int argc)
+{
+  fitsfile* fptr;
+  long number, firstrow, noffs, repeat, width;
+  long dims[Y_DIMSIZE];
+  long single[2];
+  long* offs;
+  double t0;
+  void* arr;
+  void* null;
+  int type, status, colnum, coltype, nthreads;
+  int iarg, null_iarg, offs_iarg, pos;
+
+  /* Parse arguments. */
+  null_iarg = -1;
+  offs_iarg = -1;
+  firstrow = 1;
+  nthreads = yfits_nthreads;
+  colnum = -1;
+  fptr = NULL;
+  arr = NULL;
+  pos = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      ++pos;
+      if (pos == 1) {
+        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL|MODIFIED);
+      } else if (pos == 2) {
+        colnum = get_colnum(iarg, fptr);
+      } else if (pos == 3) {
+        arr = ygeta_any(iarg, &number, dims, &type);
+      } else if (pos == 4) {
+        firstrow = ygets_l(iarg);
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_null) {
+        null_iarg = iarg;
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
+      } else if (index == index_of_offsets) {
+        offs_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (pos < 3) {
+    y_error("too few arguments");
+  }
+  if (null_iarg == -1) {
+    null = NULL;
+  } else {
+    int id = yarg_typeid(null_iarg);
+    if (id == Y_VOID) {
+      null = NULL;
+    } else {
+      if (yarg_rank(null_iarg) != 0) {
+        y_error("null value must be a scalar");
+      }
+      if (id != type) {
+        y_error("null value must be of same type as the data");
+      }
+      null = ygeta_any(null_iarg, NULL, NULL, NULL);
+    }
+  }
+
+  /* Variable length arrays are written row by row. */
+  status = 0;
+  if (fits_get_eqcoltype(fptr, colnum, &coltype, &repeat, &width,
+                         &status) != 0) {
+    yfits_error(status);
+  }
+  if (coltype < 0) {
+    if ((coltype == -TSTRING) != (type == Y_STRING)) {
+      y_error(type == Y_STRING ? "expecting numerical array for this column" :
+              "expecting array of strings for this column");
+    }
+    if (coltype == -TSTRING) {
+      if (offs_iarg != -1) {
+        y_error("keyword OFFSETS is not allowed for a column of strings");
+      }
+      offs = NULL;
+      noffs = 0;
+    } else if (offs_iarg == -1) {
+      /* All the values in a single row. */
+      single[0] = 0;
+      single[1] = number;
+      offs = single;
+      noffs = 2;
+    } else {
+      long k;
+      if (yarg_typeid(offs_iarg) > Y_LONG) {
+        y_error("offsets must be integers");
+      }
+      offs = ygeta_l(offs_iarg, &noffs, NULL);
+      if (noffs < 2 || offs[0] != 0 || offs[noffs-1] != number) {
+        y_error("offsets must start at 0 and end at the number of values");
+      }
+      for (k = 1; k < noffs; ++k) {
+        if (offs[k] < offs[k-1]) {
+          y_error("offsets must be non-decreasing");
+        }
+      }
+    }
+    type = array_datatype(type, -coltype);
+    if (write_vla_column(fptr, colnum, coltype, firstrow, type, arr, number,
+                         offs, noffs - 1, null, &status) != 0) {
+      yfits_error(status);
+    }
+    ypush_nil();
+    return;
+  }
+  if (offs_iarg != -1) {
+    y_error("keyword OFFSETS is only for variable length array columns");
+  }
+
+  /* Check that types are compatible and that dimensions (but the last one)
+     are matching. */
+  type = get_column_type(fptr, colnum, type, dims, NULL);
+
+  /* Write the values. */
+  status = 0;
+  t0 = stats_clock();
+  if (null == NULL) {
+    if (! write_column_raw(fptr, type, colnum, firstrow, number, arr,
+                           nthreads, &status)) {
+      fits_write_col(fptr, type, colnum, firstrow, 1,
+                     number, arr, &status);
+    }
+  } else {
+    fits_write_colnull(fptr, type, colnum, firstrow, 1,
+                       number, arr, null, &status);
+  }
+  count_write((double)number*(type == TSTRING ? width :
+                              (type == TBIT ? 1 : (long)type_size(type))), t0);
+  if (status != 0) {
+    yfits_error(status);
+  }
+  ypush_nil();
+}
+
+static long
+select_rows(fitsfile* fptr, const char* expr, long firstrow, long nrows,
+            char** flags)
+{
+  long dims[2], ngood;
+  int status = 0;
+
+  if (expr == NULL || expr[0] == '\0') {
+    *flags = NULL;
+    return nrows;
+  }
+  dims[0] = 1;
+  dims[1] = nrows;
+  *flags = ypush_c(dims);
+  if (fits_find_rows(fptr, (char*)expr, firstrow, nrows, &ngood, *flags,
+                     &status) != 0) {
+    yfits_error(status);
+  }
+  return ngood;
+}
+
+static long
+compact_rows(char* rows, long rowlen, long nrows, const char* flags)
+{
+  long r, n;
+  if (flags == NULL) {
+    return nrows;
+  }
+  for (r = n = 0; r < nrows; ++r) {
+    if (flags[r]) {
+      if (n < r) {
+        memcpy(rows + n*rowlen, rows + r*rowlen, rowlen);
+      }
+      ++n;
+    }
+  }
+  return n;
+}
+
+static int
+any_selected(const char* flags, long nrows)
+{
+  return (flags == NULL || memchr(flags, 1, nrows) != NULL);
+}
+
+static int
+read_selected(fitsfile* fptr, int datatype, int colnum, long firstrow,
+              long nrows, const char* flags, long nper, long width,
+              int chars, void* nulval, void* arr, int* anynull, int* status)
+{
+  size_t size;
+  long r, n, out;
+  int any;
+
+  if (datatype == TSTRING) {
+    size = (chars ? (size_t)width : sizeof(char*));
+  } else {
+    size = (datatype == TBIT ? 1 : type_size(datatype));
+  }
+  *anynull = FALSE;
+  out = 0;
+  for (r = 0; r < nrows && *status == 0; r += n) {
+    char* dst = (char*)arr + out*nper*size;
+    if (flags != NULL && ! flags[r]) {
+      n = 1;
+      continue;
+    }
+    for (n = 1; r + n < nrows && (flags == NULL || flags[r+n]); ++n)
+      ;
+    if (datatype == TSTRING) {
+      read_strings(fptr, colnum, firstrow + r, n, n*nper, width, dst, chars,
+                   status);
+    } else {
+      fits_read_col(fptr, datatype, colnum, firstrow + r, 1, n*nper, nulval,
+                    dst, &any, status);
+      *anynull |= any;
+    }
+    out += n;
+  }
+  return *status;
+}
+
+static int
+compare_rows(const void* a, const void* b)
+{
+  const long* p = (const long*)a;
+  const long* q = (const long*)b;
+  return (p[0] < q[0] ? -1 : (p[0] > q[0] ? 1 :
+                              (p[1] < q[1] ? -1 : (p[1] > q[1] ? 1 : 0))));
+}
+
+static int
+sort_rows(const long* rows, long n, long nrows, long* gather)
+{
+  long i;
+  int sorted = TRUE;
+  for (i = 0; i < n; ++i) {
+    if (rows[i] < 1 || rows[i] > nrows) {
+      y_error("out of range row index in ROWS");
+    }
+    if (i > 0 && rows[i] < rows[i-1]) {
+      sorted = FALSE;
+    }
+    gather[2*i] = rows[i];
+    gather[2*i+1] = i;
+  }
+  if (! sorted) {
+    qsort(gather, n, 2*sizeof(long), compare_rows);
+  }
+  return sorted;
+}
+
+static int
+read_gathered(fitsfile* fptr, int datatype, int colnum, const long* gather,
+              long n, long nper, long width, int chars, void* nulval,
+              void* arr, int* anynull, int* status)
+{
+  long dims[2];
+  size_t size, cellsize;
+  long rowlen, gap, maxrows, i, j, k, e, len, first, last;
+  char* tmp;
+  int any;
+
+  *anynull = FALSE;
+  if (n < 1 || fits_read_key(fptr, TLONG, "NAXIS1", &rowlen, NULL,
+                             status) != 0) {
+    return *status;
+  }
+  if (datatype == TSTRING) {
+    size = width;
+  } else {
+    size = (datatype == TBIT ? 1 : type_size(datatype));
+  }
+  cellsize = nper*size;
+  gap = GATHER_GAP/(rowlen > 0 ? rowlen : 1);
+  maxrows = RAW_BLOCK_SIZE/(cellsize > 0 ? (long)cellsize : 1);
+  if (maxrows < 1) {
+    maxrows = 1;
+  }
+  if (maxrows > gather[2*(n-1)] - gather[0] + 1) {
+    maxrows = gather[2*(n-1)] - gather[0] + 1;
+  }
+  dims[0] = 1;
+  dims[1] = maxrows*cellsize + 1;
+  tmp = ypush_c(dims);
+
+  /* Read each run of nearby rows at once (strings as arrays of chars) and
+     copy the needed cells at their positions. */
+  for (i = 0; i < n && *status == 0; i = j) {
+    first = last = gather[2*i];
+    for (j = i + 1; j < n && gather[2*j] - last <= gap + 1 &&
+           gather[2*j] - first < maxrows; ++j) {
+      last = gather[2*j];
+    }
+    if (datatype == TSTRING) {
+      read_strings(fptr, colnum, first, last - first + 1,
+                   (last - first + 1)*nper, width, tmp, TRUE, status);
+    } else {
+      fits_read_col(fptr, datatype, colnum, first, 1,
+                    (last - first + 1)*nper, nulval, tmp, &any, status);
+      *anynull |= any;
+    }
+    if (*status != 0) {
+      break;
+    }
+    for (k = i; k < j; ++k) {
+      const char* src = tmp + (gather[2*k] - first)*cellsize;
+      if (datatype == TSTRING && ! chars) {
+        char** dst = (char**)arr + gather[2*k+1]*nper;
+        for (e = 0; e < nper; ++e) {
+          len = string_length(src + e*width, width, NULL, -1);
+          dst[e] = p_malloc(len + 1);
+          memcpy(dst[e], src + e*width, len);
+          dst[e][len] = '\0';
+        }
+      } else {
+        memcpy((char*)arr + gather[2*k+1]*cellsize, src, cellsize);
+      }
+    }
+  }
+  yarg_drop(1);
+  return *status;
+}
+
+static void
+scatter_cells(void* arr, long n, size_t cellsize, const long* gather,
+              void* workspace)
+{
+  long k;
+  memcpy(workspace, arr, n*cellsize);
+  for (k = 0; k < n; ++k) {
+    memcpy((char*)arr + gather[2*k+1]*cellsize,
+           (const char*)workspace + k*cellsize, cellsize);
+  }
+}
+
+void
+Y_fitsio_read_col(int argc)
+{
+  scalar_t null;
+  fitsfile* fptr;
+  long number, firstrow, lastrow, nrows, null_index, offs_index, width;
+  long repeat, nsel, slice;
+  long* rows;
+  long* gather;
+  long dims[Y_DIMSIZE];
+  double t0;
+  void* arr;
+  char* where;
+  char* flags;
+  int coltype, type, status, colnum, anynull, chars;
+  int iarg, pos, out_iarg, rows_iarg, npushed;
+
+  /* Parse arguments. */
+  null_index = -1;
+  offs_index = -1;
+  chars = FALSE;
+  where = NULL;
+  firstrow = -1;
+  lastrow = -1;
+  colnum = -1;
+  fptr = NULL;
+  arr = NULL;
+  out_iarg = -1;
+  rows_iarg = -1;
+  slice = 0;
+  pos = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      ++pos;
+      if (pos == 1) {
+        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
+      } else if (pos == 2) {
+        colnum = get_colnum(iarg, fptr);
+      } else if (pos == 3) {
+        firstrow = ygets_l(iarg);
+      } else if (pos == 4) {
+        lastrow = ygets_l(iarg);
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_null) {
+        null_index = yget_ref(iarg);
+      } else if (index == index_of_offsets) {
+        offs_index = yget_ref(iarg);
+      } else if (index == index_of_chars) {
+        chars = yarg_true(iarg);
+      } else if (index == index_of_where) {
+        where = ygets_q(iarg);
+      } else if (index == index_of_rows) {
+        rows_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_out) {
+        out_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_slice) {
+        if (!yarg_nil(iarg) && (slice = ygets_l(iarg)) < 1) {
+          y_error("out of range SLICE");
+        }
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (pos < 2) {
+    y_error("too few arguments");
+  }
+  if (slice > 0 && out_iarg < 0) {
+    y_error("keyword SLICE requires keyword OUT");
+  }
+  if (rows_iarg >= 0 && (pos > 2 || (where != NULL && where[0] != '\0'))) {
+    y_error("keyword ROWS cannot be combined with FIRSTROW, LASTROW "
+            "or WHERE");
+  }
+
+  /* Get FITS column dimensions and type. */
+  status = 0;
+  if (fits_get_num_rows(fptr, &nrows, &status) != 0) {
+    yfits_error(status);
+  }
+  if (pos < 3) {
+    firstrow = 1;
+  }
+  if (pos < 4) {
+    lastrow = nrows;
+  }
+  if (firstrow < 1 || firstrow > lastrow || lastrow > nrows) {
+    y_error("invalid range of rows");
+  }
+  if (fits_get_eqcoltype(fptr, colnum, &coltype, &repeat, &width,
+                         &status) != 0) {
+    yfits_error(status);
+  }
+  if (coltype < 0) {
+    /* Variable length arrays: the values and their offsets. */
+    if (where != NULL && where[0] != '\0') {
+      y_error("keyword WHERE is not supported for variable length arrays");
+    }
+    if (out_iarg >= 0) {
+      y_error("keyword OUT is not supported for variable length arrays");
+    }
+    if (rows_iarg >= 0) {
+      y_error("keyword ROWS is not supported for variable length arrays");
+    }
+    anynull = read_vla_column(fptr, colnum, coltype, firstrow,
+                              lastrow - firstrow + 1, &null, &status);
+    if (offs_index != -1) {
+      yput_global(offs_index, 1);
+    }
+    goto save_null;
+  }
+  if (offs_index != -1) {
+    ypush_nil();
+    yput_global(offs_index, 0);
+    yarg_drop(1);
+  }
+  gather = NULL;
+  if (rows_iarg >= 0) {
+    /* Gather the rows in the order of their indices. */
+    long gdims[2];
+    rows = ygeta_l(rows_iarg, &nsel, NULL);
+    gdims[0] = 1;
+    gdims[1] = 2*nsel;
+    gather = ypush_l(gdims);
+    sort_rows(rows, nsel, nrows, gather);
+    flags = NULL;
+    npushed = 1;
+  } else {
+    nrows = lastrow - firstrow + 1;
+    nsel = select_rows(fptr, where, firstrow, nrows, &flags);
+    npushed = (flags != NULL ? 1 : 0);
+  }
+  if (nsel < 1) {
+    /* No matching rows. */
+    ypush_nil();
+    anynull = FALSE;
+    goto save_null;
+  }
+  number = get_cell_dims(fptr, colnum, nsel, &coltype, &width, dims);
+
+  /* Create the destination array and read the values (strings are never
+     undefined). */
+  type = column_datatype(coltype, &null.type);
+  if (type == -1) {
+    y_error("unsupported array type");
+  }
+  if (out_iarg >= 0) {
+    if (type == TSTRING) {
+      y_error("keyword OUT is not supported for columns of strings");
+    }
+    /* The row flags or the sorted rows have been pushed since OUT was
+       parsed. */
+    arr = push_output(out_iarg + npushed, slice, null.type, dims);
+  } else if (type == TSTRING) {
+    arr = push_strings(dims, width, chars);
+  } else {
+    arr = push_array(null.type, dims, width);
+  }
+  t0 = stats_clock();
+  if (gather != NULL) {
+    read_gathered(fptr, type, colnum, gather, nsel, number/nsel, width,
+                  chars, &null.value, arr, &anynull, &status);
+  } else {
+    read_selected(fptr, type, colnum, firstrow, nrows, flags, number/nsel,
+                  width, chars, &null.value, arr, &anynull, &status);
+  }
+  count_read((double)number*(type == TSTRING ? width :
+                             (type == TBIT ? 1 : (long)type_size(type))), t0);
+  if (status != 0) {
+    yfits_error(status);
+  }
+
+  /* Save the 'null' value. */
+ save_null:
+  if (null_index != -1) {
+    if (anynull == 0) {
+      ypush_nil();
+    } else {
+      push_scalar(&null);
+    }
+    yput_global(null_index, 0);
+    yarg_drop(1);
+  }
+}
+
+/* Statistics of the values of a column, computed by blocks of rows while
+   the next block is being read. */
+void
+Y_fitsio_col_stats(int argc)
+{
+  summary_t sum;
+  yfits_object* obj;
+  fitsfile* fptr;
+  double nan = NAN;
+  double* workspace;
+  double* buf;
+  double t0;
+  char kmin[FLEN_KEYWORD], kmax[FLEN_KEYWORD], kstat[FLEN_KEYWORD];
+  long firstrow, lastrow, nrows, repeat, width, bufsize, blockrows, row, n;
+  int iarg, pos, fh_iarg, col_iarg, update, nthreads, coltype, colnum;
+  int anynull, busy, status, whole;
+
+  /* Parse arguments. */
+  fh_iarg = -1;
+  col_iarg = -1;
+  firstrow = -1;
+  lastrow = -1;
+  update = FALSE;
+  nthreads = yfits_nthreads;
+  pos = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      ++pos;
+      if (pos == 1) {
+        fh_iarg = iarg;
+      } else if (pos == 2) {
+        col_iarg = iarg;
+      } else if (pos == 3) {
+        firstrow = ygets_l(iarg);
+      } else if (pos == 4) {
+        lastrow = ygets_l(iarg);
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_update) {
+        update = yarg_true(iarg);
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (pos < 2) {
+    y_error("too few arguments");
+  }
+  obj = yfits_fetch(fh_iarg, NOT_CLOSED|CRITICAL);
+  fptr = obj->fptr;
+  colnum = get_colnum(col_iarg, fptr);
+
+  /* Get the range of rows and the type of the column. */
+  status = 0;
+  if (fits_get_num_rows(fptr, &nrows, &status) != 0 ||
+      fits_get_eqcoltype(fptr, colnum, &coltype, &repeat, &width,
+                         &status) != 0) {
+    yfits_error(status);
+  }
+  if (pos < 3) {
+    firstrow = 1;
+  }
+  if (pos < 4) {
+    lastrow = nrows;
+  }
+  if (firstrow < 1 || firstrow > lastrow || lastrow > nrows) {
+    y_error("invalid range of rows");
+  }
+  if (coltype < 0 || coltype == TSTRING || coltype == TLOGICAL ||
+      coltype == TBIT || coltype == TCOMPLEX || coltype == TDBLCOMPLEX) {
+    y_error("statistics are only computed for real numerical columns");
+  }
+  whole = (firstrow == 1 && lastrow == nrows);
+  if (update && ! whole) {
+    y_error("keyword UPDATE cannot be used for a range of rows");
+  }
+  if (fits_make_keyn("TDMIN", colnum, kmin, &status) != 0 ||
+      fits_make_keyn("TDMAX", colnum, kmax, &status) != 0 ||
+      fits_make_keyn("TSTAT", colnum, kstat, &status) != 0) {
+    yfits_error(status);
+  }
+  if (whole && ! update && load_summary(fptr, kmin, kmax, kstat, &sum)) {
+    /* Statistics saved by a previous call. */
+    push_summary(&sum);
+    return;
+  }
+
+  /* Read the values as doubles (undefined values being NaN's) by blocks of
+     rows in two alternate buffers and summarize each block while the next
+     one is being read. */
+  summary_init(&sum);
+  if (repeat > 0) {
+    bufsize = (obj->bufsize > 0 ? obj->bufsize : yfits_bufsize);
+    blockrows = bufsize/(repeat*(long)sizeof(double));
+    if (blockrows < 1) {
+      blockrows = 1;
+    }
+    if (blockrows > lastrow - firstrow + 1) {
+      blockrows = lastrow - firstrow + 1;
+    }
+    workspace = get_workspace(2*blockrows*repeat*sizeof(double));
+    if (workspace == NULL) {
+      y_error("insufficient memory");
+    }
+    busy = FALSE;
+    for (row = firstrow; row <= lastrow; row += n) {
+      n = lastrow - row + 1;
+      if (n > blockrows) {
+        n = blockrows;
+      }
+      buf = workspace + (((row - firstrow)/blockrows)&1)*blockrows*repeat;
+      t0 = stats_clock();
+      if (fits_read_col(fptr, TDOUBLE, colnum, row, 1, n*repeat, &nan, buf,
+                        &anynull, &status) != 0) {
+        break;
+      }
+      count_read((double)n*repeat*sizeof(double), t0);
+      if (busy) {
+        finish_summary(&sum);
+      }
+      start_summary(buf, n*repeat, nthreads);
+      busy = TRUE;
+    }
+    if (busy) {
+      finish_summary(&sum);
+    }
+    if (status != 0) {
+      yfits_error(status);
+    }
+  }
+
+  /* Save the statistics in the header (the handle is only marked as
+     modified if something is written). */
+  if (update && sum.count > 0) {
+    yfits_fetch(fh_iarg, NOT_CLOSED|MODIFIED);
+    if (save_summary(fptr, kmin, kmax, kstat, &sum, &status) != 0) {
+      yfits_error(status);
+    }
+  }
+  push_summary(&sum);
+}
+
+/* FITS columns instance: the values of several columns read at once. */
+struct _yfits_columns {
+  void* names;   /* reference to the array of column names */
+  void* units;   /* reference to the array of column units */
+  long ncols;    /* number of columns */
+  void* data[1]; /* references to the arrays of values (actual size is
+                    NCOLS) */
+};
+
+static struct y_userobj_t yfits_columns_type = {
+  "FITS columns", yfits_columns_free, yfits_columns_print,
+  yfits_columns_eval, yfits_columns_extract, NULL
+};
+
+static void
+yfits_columns_free(void* ptr)
+{
+  yfits_columns* obj = (yfits_columns*)ptr;
+  long k;
+  for (k = 0; k < obj->ncols; ++k) {
+    if (obj->data[k] != NULL) {
+      ydrop_use(obj->data[k]);
+    }
+  }
+  obj->ncols = 0;
+  if (obj->names != NULL) {
+    ydrop_use(obj->names);
+    obj->names = NULL;
+  }
+  if (obj->units != NULL) {
+    ydrop_use(obj->units);
+    obj->units = NULL;
+  }
+}
+
+static void
+yfits_columns_print(void* ptr)
+{
+  yfits_columns* obj = (yfits_columns*)ptr;
+  sprintf(buffer, "%s (%ld column(s))", yfits_columns_type.type_name,
+          obj->ncols);
+  y_print(buffer, TRUE);
+}
+
+static void
+yfits_columns_eval(void* ptr, int argc)
+{
+  yfits_columns* obj = (yfits_columns*)ptr;
+  long k;
+  int type;
+
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  type = yarg_typeid(0);
+  if (type <= Y_LONG && yarg_rank(0) == 0) {
+    k = ygets_l(0);
+    if (k < 1 || k > obj->ncols) {
+      y_error("out of range column index");
+    }
+  } else if (type == Y_STRING && yarg_rank(0) == 0) {
+    /* Search a column by name (case insensitive). */
+    char* name = ygets_q(0);
+    char** names;
+    ypush_use(obj->names);
+    names = ygeta_q(0, NULL, NULL);
+    for (k = 1; k <= obj->ncols; ++k) {
+      if (same_name(name, names[k-1])) {
+        break;
+      }
+    }
+    yarg_drop(1);
+    if (k > obj->ncols) {
+      y_error("column name not found");
+    }
+  } else {
+    y_error("expecting column index or name");
+    k = 0;
+  }
+  ypush_use(obj->data[k-1]);
+}
+
+static void
+yfits_columns_extract(void* ptr, char* name)
+{
+  yfits_columns* obj = (yfits_columns*)ptr;
+  if (strcmp(name, "ncols") == 0) {
+    ypush_long(obj->ncols);
+  } else if (strcmp(name, "names") == 0) {
+    ypush_use(obj->names);
+  } else if (strcmp(name, "units") == 0) {
+    ypush_use(obj->units);
+  } else {
+    y_error("invalid member of FITS columns");
+  }
+}
+
+/* Description of a column extracted from (or inserted into) the raw bytes of
+   the rows. */
+typedef struct {
+  void* arr;        /* array of values */
+  scaling_t s;      /* scaling parameters and undefined value */
+  converter_t convert; /* function to convert (or encode) the values */
+  long number;      /* number of values in ARR */
+  long tbcol;       /* offset (in bytes) of the column in a row */
+  long cellsize;    /* size (in bytes) of a cell */
+  long ncell;       /* number of raw values per cell */
+  long nulllen;     /* length of SNULL, -1 if none */
+  char snull[20];   /* null string of a column of strings (as in CFITSIO) */
+  int type;         /* CFITSIO pixel type of the values in ARR */
+  int datatype;     /* CFITSIO pixel type for conversion (TDOUBLE for
+                       complexes) */
+  int bitpix;       /* type of the raw values */
+  int fast;         /* extracted from (inserted into) the raw bytes? */
+  int overflow;     /* overflow occurred when encoding the last block? */
+  int retry;        /* block to be rewritten by CFITSIO? */
+} column_t;
+
+/* A block of rows whose columns are extracted (or inserted) by
+   `columns_task`. */
+typedef struct {
+  column_t* col;    /* columns */
+  const int* index; /* indices of the columns to process */
+  char* rows;       /* raw bytes of the rows */
+  char* cols;       /* workspace to gather the raw values of the columns */
+  long rowlen;      /* size (in bytes) of a row */
+  long nrows;       /* number of rows in the block */
+  long offset;      /* index (0-based) of first row of block in ARR */
+  int encode;       /* encode the values of the columns into the rows? */
+  int scatter;      /* scatter the encoded values into the rows? */
+} columns_job_t;
+
+static int
+columns_task(void* ctx, long i)
+{
+  columns_job_t* job = (columns_job_t*)ctx;
+  column_t* c = job->col + job->index[i];
+  size_t size = type_size(c->datatype);
+  char* arr = (char*)c->arr + job->offset*c->ncell*size;
+  char* tmp;
+  long r;
+
+  if (job->encode) {
+    /* Encode the values of the column, then scatter them into the rows if
+       requested. */
+    tmp = job->cols + c->tbcol*job->nrows;
+    c->overflow = c->convert(tmp, arr, job->nrows*c->ncell, &c->s);
+    if (job->scatter) {
+      for (r = 0; r < job->nrows; ++r) {
+        memcpy(job->rows + r*job->rowlen + c->tbcol, tmp + r*c->cellsize,
+               c->cellsize);
+      }
+    }
+    return c->overflow;
+  }
+
+  /* Gather the raw values of the column (directly into the destination if
+     raw and converted values have the same size) and convert them. */
+  tmp = ((size_t)c->cellsize == c->ncell*size ? arr :
+         job->cols + c->tbcol*job->nrows);
+  for (r = 0; r < job->nrows; ++r) {
+    memcpy(tmp + r*c->cellsize, job->rows + r*job->rowlen + c->tbcol,
+           c->cellsize);
+  }
+  return c->convert(arr, tmp, job->nrows*c->ncell, &c->s);
+}
+
+/* Check whether column COLNUM of the current HDU can be extracted from (if
+   ENCODE is false) or inserted into (if ENCODE is true) the raw bytes of
+   NROWS rows starting at FIRSTROW and, if so, complete the description C
+   (whose members ARR, NUMBER and TYPE must have been set) and store the
+   length of a row in ROWLEN.  DATASTART is the address of the data part of
+   the HDU. */
+static int
+raw_column(fitsfile* fptr, int colnum, long firstrow, long nrows,
+           LONGLONG datastart, int encode, column_t* c, long* rowlen,
+           int* status)
+{
+  char tform[FLEN_VALUE], snull[FLEN_VALUE];
+  scaling_t s;
+  double scale, zero;
+  LONGLONG startpos, elemnum, repeat, rowsize, tnull;
+  long twidth, incre, cellsize, ncell;
+  int tcode, maxelem, hdutype, bitpix, datatype, count;
+
+  c->fast = FALSE;
+  c->datatype = c->type;
+  if (ffgcprll(fptr, colnum, firstrow, 1, 1, 0, &scale, &zero, tform,
+               &twidth, &tcode, &maxelem, &startpos, &elemnum, &incre,
+               &repeat, &rowsize, &hdutype, &tnull, snull, status) > 0 ||
+      hdutype != BINARY_TBL || (bitpix = column_bitpix(tcode, &count)) == 0) {
+    return FALSE;
+  }
+  datatype = c->type;
+  if (count == 2) {
+    /* Complex values are processed as pairs of doubles. */
+    if (datatype != TDBLCOMPLEX) {
+      return FALSE;
+    }
+    datatype = TDOUBLE;
+  }
+  cellsize = repeat*incre;
+  ncell = cellsize/((bitpix < 0 ? -bitpix : bitpix)/8);
+  s.scale = scale;
+  s.zero = zero;
+  s.blank = tnull;
+  s.has_blank = (! encode && bitpix > 0 && tnull != NULL_UNDEFINED);
+  c->convert = (encode ? select_encoder(bitpix, datatype, &s) :
+                select_converter(bitpix, datatype, &s));
+  if (ncell*nrows != count*c->number || c->convert == NULL) {
+    return FALSE;
+  }
+  c->s = s;
+  c->tbcol = startpos - datastart - (firstrow - 1)*rowsize;
+  c->cellsize = cellsize;
+  c->ncell = ncell;
+  c->datatype = datatype;
+  c->bitpix = bitpix;
+  c->fast = TRUE;
+  *rowlen = rowsize;
+  return TRUE;
+}
+
+/* Same as `raw_column` but for a column of strings of at most WIDTH
+   characters (which is only possible for binary tables and if the values
+   are read).  The null string of the column, if any, is stored in C. */
+static int
+raw_strings(fitsfile* fptr, int colnum, long firstrow, long nrows,
+            long width, LONGLONG datastart, column_t* c, long* rowlen,
+            int* status)
+{
+  char tform[FLEN_VALUE], snull[FLEN_VALUE];
+  double scale, zero;
+  LONGLONG startpos, elemnum, repeat, rowsize, tnull;
+  long twidth, incre, cellsize;
+  int tcode, maxelem, hdutype;
+
+  c->fast = FALSE;
+  if (width < 1 || nrows < 1 ||
+      ffgcprll(fptr, colnum, firstrow, 1, 1, 0, &scale, &zero, tform,
+               &twidth, &tcode, &maxelem, &startpos, &elemnum, &incre,
+               &repeat, &rowsize, &hdutype, &tnull, snull, status) > 0 ||
+      hdutype != BINARY_TBL || tcode != TSTRING) {
+    return FALSE;
+  }
+  cellsize = (c->number/nrows)*width;
+  if (cellsize > rowsize) {
+    return FALSE;
+  }
+  c->nulllen = (snull[0] != ASCII_NULL_UNDEFINED ? (long)strlen(snull) : -1);
+  if (c->nulllen >= (long)sizeof(c->snull)) {
+    return FALSE;
+  }
+  memcpy(c->snull, snull, (c->nulllen >= 0 ? c->nulllen + 1 : 1));
+  c->tbcol = startpos - datastart - (firstrow - 1)*rowsize;
+  c->cellsize = cellsize;
+  c->ncell = cellsize/width;
+  c->fast = TRUE;
+  *rowlen = rowsize;
+  return TRUE;
+}
+
+/* Extract the fast columns and the strings of JOB from the N rows listed in
+   GATHER (see `sort_rows`) in increasing order (duplicates included).  Runs
+   of nearby rows are read at once in the first BLOCKROWS rows of WORKSPACE
+   and the needed ones are copied in the next BLOCKROWS rows to be
+   processed as `Y_fitsio_read_cols` does for contiguous blocks. */
+static int
+gather_columns(fitsfile* fptr, const long* gather, long n, columns_job_t* job,
+               long blockrows, char* workspace, long nfast, const int* strs,
+               long nstrs, int chars, int nthreads, int* status)
+{
+  long rowlen = job->rowlen;
+  long gap = GATHER_GAP/(rowlen > 0 ? rowlen : 1);
+  long i, j, k, first, last, nkeep, offset;
+  char* run = workspace;
+
+  job->rows = workspace + blockrows*rowlen;
+  nkeep = 0;
+  offset = 0;
+  for (i = 0; i < n && *status == 0; i = j) {
+    first = last = gather[2*i];
+    for (j = i + 1; j < n && gather[2*j] - last <= gap + 1 &&
+           gather[2*j] - first < blockrows && j - i < blockrows - nkeep;
+         ++j) {
+      last = gather[2*j];
+    }
+    if (fits_read_tblbytes(fptr, first, 1, (last - first + 1)*rowlen,
+                           (unsigned char*)run, status) != 0) {
+      break;
+    }
+    for (k = i; k < j; ++k) {
+      memcpy(job->rows + (nkeep++)*rowlen,
+             run + (gather[2*k] - first)*rowlen, rowlen);
+    }
+    if (nkeep >= blockrows || j >= n) {
+      job->nrows = nkeep;
+      job->offset = offset;
+      if (nfast > 0) {
+        pool_start(columns_task, job, nfast, nthreads);
+      }
+      for (k = 0; k < nstrs; ++k) {
+        column_t* c = &job->col[strs[k]];
+        extract_strings(job->rows, rowlen, nkeep, c->tbcol, c->cellsize,
+                        c->cellsize/c->ncell, c->snull, c->nulllen, chars,
+                        c->arr, offset);
+      }
+      if (nfast > 0) {
+        pool_wait();
+      }
+      offset += nkeep;
+      nkeep = 0;
+    }
+  }
+  return *status;
+}
+
+void
+Y_fitsio_read_cols(int argc)
+{
+  column_t* col;
+  long* widths;
+  int* colnum;
+  int* fast;
+  int* strs;
+  columns_job_t job;
+  char* where;
+  char* flags;
+  long* gather;
+  yfits_columns* obj;
+  fitsfile* fptr;
+  LONGLONG headstart, datastart, dataend;
+  long dims[Y_DIMSIZE];
+  long firstrow, lastrow, nrows, nsel, ncols, nfast, nstrs, k, width,
+    rowlen;
+  char keyword[FLEN_KEYWORD];
+  char value[FLEN_VALUE];
+  char** names;
+  char** units;
+  int iarg, cols_iarg, rows_iarg, pos, status, hdutype, coltype, ytype;
+  int nthreads, ntotal, anynull, chars, sorted;
+
+  /* The tables of columns are too large for the stack, they are stored in a
+     scratch object pushed before parsing the arguments (which are then at
+     positions 1 to ARGC). */
+  col = (column_t*)ypush_scratch(MAX_COLUMNS*(sizeof(column_t) +
+                                              sizeof(long) +
+                                              3*sizeof(int)), NULL);
+  widths = (long*)(col + MAX_COLUMNS);
+  colnum = (int*)(widths + MAX_COLUMNS);
+  fast = colnum + MAX_COLUMNS;
+  strs = fast + MAX_COLUMNS;
+
+  /* Parse arguments. */
+  cols_iarg = -1;
+  rows_iarg = -1;
+  firstrow = -1;
+  lastrow = -1;
+  chars = FALSE;
+  where = NULL;
+  nthreads = yfits_nthreads;
+  fptr = NULL;
+  pos = 0;
+  for (iarg = argc; iarg >= 1; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      ++pos;
+      if (pos == 1) {
+        fptr = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
+      } else if (pos == 2) {
+        cols_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (pos == 3) {
+        if (! yarg_nil(iarg)) {
+          firstrow = ygets_l(iarg);
+        }
+      } else if (pos == 4) {
+        if (! yarg_nil(iarg)) {
+          lastrow = ygets_l(iarg);
+        }
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
+      } else if (index == index_of_chars) {
+        chars = yarg_true(iarg);
+      } else if (index == index_of_where) {
+        where = ygets_q(iarg);
+      } else if (index == index_of_rows) {
+        rows_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (pos < 1) {
+    y_error("too few arguments");
+  }
+  if (rows_iarg >= 0 && (firstrow != -1 || lastrow != -1 ||
+                         (where != NULL && where[0] != '\0'))) {
+    y_error("keyword ROWS cannot be combined with FIRSTROW, LASTROW "
+            "or WHERE");
+  }
+
+  /* Get the range of rows and the list of columns. */
+  status = 0;
+  if (fits_get_hdu_type(fptr, &hdutype, &status) != 0 ||
+      (hdutype != ASCII_TBL && hdutype != BINARY_TBL)) {
+    if (status != 0) {
+      yfits_error(status);
+    }
+    y_error("current HDU is not a table");
+  }
+  if (fits_get_num_rows(fptr, &nrows, &status) != 0 ||
+      fits_get_num_cols(fptr, &ntotal, &status) != 0) {
+    yfits_error(status);
+  }
+  if (firstrow == -1) {
+    firstrow = 1;
+  }
+  if (lastrow == -1) {
+    lastrow = nrows;
+  }
+  if (firstrow < 1 || firstrow > lastrow || lastrow > nrows) {
+    y_error("invalid range of rows");
+  }
+  ncols = get_column_list(cols_iarg, fptr, ntotal, colnum);
+  gather = NULL;
+  sorted = TRUE;
+  if (rows_iarg >= 0) {
+    /* Gather the rows in the order of their indices. */
+    long* rows = ygeta_l(rows_iarg, &nsel, NULL);
+    dims[0] = 1;
+    dims[1] = 2*nsel;
+    gather = ypush_l(dims);
+    sorted = sort_rows(rows, nsel, nrows, gather);
+    flags = NULL;
+  } else {
+    nrows = lastrow - firstrow + 1;
+    nsel = select_rows(fptr, where, firstrow, nrows, &flags);
+  }
+  if (hdutype == BINARY_TBL &&
+      fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         &status) != 0) {
+    yfits_error(status);
+  }
+
+  /* Create the object to store the result and the destination arrays and
+     figure out which columns can be extracted from the raw rows. */
+  obj = (yfits_columns*)ypush_obj(&yfits_columns_type,
+                                  sizeof(yfits_columns) +
+                                  (ncols - 1)*sizeof(void*));
+  obj->names = NULL;
+  obj->units = NULL;
+  obj->ncols = 0;
+
+  /* Store the names and units of the columns (before reading the data, so
+     that the header is still in the buffers of CFITSIO). */
+  dims[0] = 1;
+  dims[1] = ncols;
+  names = ypush_q(dims);
+  obj->names = yget_use(0);
+  yarg_drop(1);
+  units = ypush_q(dims);
+  obj->units = yget_use(0);
+  yarg_drop(1);
+  for (k = 0; k < ncols; ++k) {
+    sprintf(keyword, "TTYPE%d", colnum[k]);
+    value[0] = '\0';
+    if (fits_read_key(fptr, TSTRING, keyword, value, NULL,
+                      &status) == KEY_NO_EXIST) {
+      status = 0;
+    }
+    names[k] = p_strcpy(value);
+    sprintf(keyword, "TUNIT%d", colnum[k]);
+    value[0] = '\0';
+    if (fits_read_key(fptr, TSTRING, keyword, value, NULL,
+                      &status) == KEY_NO_EXIST) {
+      status = 0;
+    }
+    units[k] = p_strcpy(value);
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+
+  rowlen = 0;
+  nfast = 0;
+  nstrs = 0;
+  for (k = 0; k < ncols; ++k) {
+    column_t* c = &col[k];
+    if (nsel < 1) {
+      /* No matching rows. */
+      c->fast = FALSE;
+      ypush_nil();
+      obj->data[k] = yget_use(0);
+      obj->ncols = k + 1;
+      yarg_drop(1);
+      continue;
+    }
+    c->number = get_cell_dims(fptr, colnum[k], nsel, &coltype, &width,
+                              dims);
+    c->type = column_datatype(coltype, &ytype);
+    if (c->type == -1) {
+      y_error("unsupported array type");
+    }
+    widths[k] = width;
+    c->arr = (c->type == TSTRING ? push_strings(dims, width, chars) :
+              push_array(ytype, dims, width));
+    obj->data[k] = yget_use(0);
+    obj->ncols = k + 1;
+    yarg_drop(1);
+    c->fast = FALSE;
+    if (hdutype == BINARY_TBL && c->type == TSTRING &&
+        raw_strings(fptr, colnum[k], firstrow, nsel, width, datastart,
+                    c, &rowlen, &status)) {
+      strs[nstrs++] = k;
+    } else if (hdutype == BINARY_TBL && c->type != TSTRING &&
+               raw_column(fptr, colnum[k], firstrow, nsel, datastart, FALSE,
+                          c, &rowlen, &status)) {
+      fast[nfast++] = k;
+    } else if (status != 0) {
+      yfits_error(status);
+    }
+  }
+
+  /* Read the rows by large blocks (at least the number of rows which fit in
+     the buffers of CFITSIO) in a single pass and extract the columns of
+     each block in parallel while the next block is being read.  The
+     strings are extracted by the main thread meanwhile.  Only the selected
+     rows are kept (blocks without any are not read).  The rows given by
+     keyword ROWS are gathered in increasing order (see `gather_columns`)
+     and the cells moved to their positions afterwards. */
+  if (nfast + nstrs > 0) {
+    char* workspace;
+    long optimal, blockrows, row, n, m, nkeep, offset;
+    if (fits_get_rowsize(fptr, &optimal, &status) != 0) {
+      yfits_error(status);
+    }
+    blockrows = RAW_BLOCK_SIZE/(rowlen > 0 ? rowlen : 1);
+    if (blockrows < optimal) {
+      blockrows = optimal;
+    }
+    if (blockrows > (gather != NULL ? nsel : nrows)) {
+      blockrows = (gather != NULL ? nsel : nrows);
+    }
+    if ((workspace = get_workspace(3*blockrows*rowlen)) == NULL) {
+      y_error("insufficient memory");
+    }
+    job.col = col;
+    job.index = fast;
+    job.cols = workspace + 2*blockrows*rowlen;
+    job.rowlen = rowlen;
+    job.encode = FALSE;
+    job.scatter = FALSE;
+    if (gather != NULL) {
+      gather_columns(fptr, gather, nsel, &job, blockrows, workspace, nfast,
+                     strs, nstrs, chars, nthreads, &status);
+    } else {
+      n = blockrows;
+      if (any_selected(flags, n)) {
+        fits_read_tblbytes(fptr, firstrow, 1, n*rowlen,
+                           (unsigned char*)workspace, &status);
+      }
+      offset = 0;
+      for (row = 0; row < nrows && status == 0; row += n, n = m) {
+        job.rows = workspace + ((row/blockrows)&1)*blockrows*rowlen;
+        nkeep = compact_rows(job.rows, rowlen, n,
+                             (flags != NULL ? flags + row : NULL));
+        if (nkeep > 0) {
+          job.nrows = nkeep;
+          job.offset = offset;
+          if (nfast > 0) {
+            pool_start(columns_task, &job, nfast, nthreads);
+          }
+          for (k = 0; k < nstrs; ++k) {
+            column_t* c = &col[strs[k]];
+            extract_strings(job.rows, rowlen, nkeep, c->tbcol, c->cellsize,
+                            c->cellsize/c->ncell, c->snull, c->nulllen,
+                            chars, c->arr, offset);
+          }
+          offset += nkeep;
+        }
+        m = nrows - (row + n);
+        if (m > blockrows) {
+          m = blockrows;
+        }
+        if (m > 0 && any_selected((flags != NULL ? flags + row + n : NULL),
+                                  m)) {
+          fits_read_tblbytes(fptr, firstrow + row + n, 1, m*rowlen,
+                             (unsigned char*)workspace +
+                             (((row + n)/blockrows)&1)*blockrows*rowlen,
+                             &status);
+        }
+        if (nkeep > 0 && nfast > 0) {
+          pool_wait();
+        }
+      }
+    }
+    if (status != 0) {
+      yfits_error(status);
+    }
+    if (! sorted) {
+      for (k = 0; k < ncols; ++k) {
+        column_t* c = &col[k];
+        size_t cellsize;
+        if (! c->fast) {
+          continue;
+        }
+        if (c->type == TSTRING) {
+          cellsize = c->ncell*(chars ? (size_t)(c->cellsize/c->ncell) :
+                               sizeof(char*));
+        } else {
+          cellsize = c->ncell*type_size(c->datatype);
+        }
+        if ((workspace = get_workspace(nsel*cellsize)) == NULL) {
+          y_error("insufficient memory");
+        }
+        scatter_cells(c->arr, nsel, cellsize, gather, workspace);
+      }
+    }
+  }
+
+  /* Read the other columns with CFITSIO (but for strings). */
+  for (k = 0; k < ncols; ++k) {
+    if (col[k].fast) {
+      continue;
+    }
+    if (nsel > 0 && gather != NULL) {
+      read_gathered(fptr, col[k].type, colnum[k], gather, nsel,
+                    col[k].number/nsel, widths[k], chars, NULL, col[k].arr,
+                    &anynull, &status);
+    } else if (nsel > 0) {
+      read_selected(fptr, col[k].type, colnum[k], firstrow, nrows, flags,
+                    col[k].number/nsel, widths[k], chars, NULL, col[k].arr,
+                    &anynull, &status);
+    }
+    if (status != 0) {
+      yfits_error(status);
+    }
+  }
+
+}
+
+void
+Y_fitsio_write_cols(int argc)
+{
+  column_t* col;
+  int* colnum;
+  int* fast;
+  int* arr_iarg;
+  columns_job_t job;
+  yfits_object* obj;
+  yfits_columns* data;
+  fitsfile* fptr;
+  LONGLONG headstart, datastart, dataend;
+  long dims[Y_DIMSIZE];
+  long firstrow, lastrow, nrows, total, ncols, narrs, nfast, k, rowlen;
+  long cellsizes;
+  int iarg, cols_iarg, pos, status, hdutype, hdu, nthreads, append, type;
+  int ntotal, npushed, nhdus;
+
+  /* The tables of columns are too large for the stack, they are stored in a
+     scratch object pushed before parsing the arguments (which are then at
+     positions 1 to ARGC). */
+  col = (column_t*)ypush_scratch(MAX_COLUMNS*(sizeof(column_t) +
+                                              3*sizeof(int)), NULL);
+  colnum = (int*)(col + MAX_COLUMNS);
+  fast = colnum + MAX_COLUMNS;
+  arr_iarg = fast + MAX_COLUMNS;
+
+  /* Parse arguments. */
+  cols_iarg = -1;
+  firstrow = -1;
+  append = FALSE;
+  nthreads = yfits_nthreads;
+  narrs = 0;
+  obj = NULL;
+  pos = 0;
+  for (iarg = argc; iarg >= 1; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      ++pos;
+      if (pos == 1) {
+        obj = yfits_fetch(iarg, NOT_CLOSED|CRITICAL|MODIFIED|APPENDING);
+      } else if (pos == 2) {
+        cols_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (narrs < MAX_COLUMNS) {
+        arr_iarg[narrs++] = iarg;
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_first) {
+        if (! yarg_nil(iarg)) {
+          firstrow = ygets_l(iarg);
+        }
+      } else if (index == index_of_append) {
+        append = yarg_true(iarg);
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (pos < 3) {
+    y_error("too few arguments");
+  }
+  if (append && firstrow != -1) {
+    y_error("keywords FIRST and APPEND are exclusive");
+  }
+  fptr = obj->fptr;
+
+  /* Get the list of columns. */
+  status = 0;
+  if (fits_get_hdu_type(fptr, &hdutype, &status) != 0 ||
+      (hdutype != ASCII_TBL && hdutype != BINARY_TBL)) {
+    if (status != 0) {
+      yfits_error(status);
+    }
+    y_error("current HDU is not a table");
+  }
+  if (fits_get_num_cols(fptr, &ntotal, &status) != 0) {
+    yfits_error(status);
+  }
+  ncols = get_column_list(cols_iarg, fptr, ntotal, colnum);
+
+  /* Collect the arrays of values.  A single FITS columns object (as returned
+     by `fitsio_read_cols`) may be given instead of the arrays.  Its arrays
+     are pushed on top of the stack so that their addresses can be
+     retrieved. */
+  npushed = 0;
+  if (narrs == 1 && yarg_typeid(arr_iarg[0]) == Y_OPAQUE &&
+      strcmp(yget_obj(arr_iarg[0], NULL),
+             yfits_columns_type.type_name) == 0) {
+    data = (yfits_columns*)yget_obj(arr_iarg[0], &yfits_columns_type);
+    if (data->ncols > MAX_COLUMNS) {
+      y_error("too many columns");
+    }
+    for (k = 0; k < data->ncols; ++k) {
+      ypush_use(data->data[k]);
+    }
+    npushed = narrs = data->ncols;
+    for (k = 0; k < narrs; ++k) {
+      arr_iarg[k] = narrs - 1 - k;
+    }
+  }
+  if (narrs != ncols) {
+    y_error("the number of arrays must match the number of columns");
+  }
+  nrows = 0;
+  for (k = 0; k < ncols; ++k) {
+    column_t* c = &col[k];
+    long n;
+    c->arr = ygeta_any(arr_iarg[k], &c->number, dims, &type);
+    c->type = get_column_type(fptr, colnum[k], type, dims, &n);
+    if (k == 0) {
+      nrows = n;
+    } else if (n != nrows) {
+      y_error("all arrays must have the same number of rows");
+    }
+  }
+
+  /* Get the range of rows to write.  In append mode, extra rows are reserved
+     (by inserting rows in large steps) if the table is not at the end of the
+     file or has a heap.  They are removed as soon as the handle is used for
+     anything else than writing columns (see `yfits_fetch`), hence when the
+     file is closed. */
+  fits_get_hdu_num(fptr, &hdu);
+  if (fits_get_num_rows(fptr, &total, &status) != 0) {
+    yfits_error(status);
+  }
+  if (append) {
+    if (obj->append_hdu != hdu) {
+      if (release_rows(obj, &status) != 0) {
+        yfits_error(status);
+      }
+      obj->append_rows = total;
+    }
+    firstrow = obj->append_rows + 1;
+  } else if (firstrow == -1) {
+    firstrow = 1;
+  }
+  if (firstrow < 1) {
+    y_error("invalid first row");
+  }
+  lastrow = firstrow + nrows - 1;
+  if (lastrow > total) {
+    long naxis1 = 0, pcount = 0;
+    if (append &&
+        (fits_get_num_hdus(fptr, &nhdus, &status) != 0 ||
+         fits_read_key(fptr, TLONG, "NAXIS1", &naxis1, NULL, &status) != 0 ||
+         fits_read_key(fptr, TLONG, "PCOUNT", &pcount, NULL, &status) != 0)) {
+      yfits_error(status);
+    }
+    if (append && (hdu < nhdus || pcount > 0)) {
+      long step = RAW_BLOCK_SIZE/(naxis1 > 0 ? naxis1 : 1);
+      if (step < total) {
+        step = total;
+      }
+      if (step < lastrow - total) {
+        step = lastrow - total;
+      }
+      fits_insert_rows(fptr, total, step, &status);
+    } else {
+      /* Let CFITSIO extend the table. */
+      char tform[FLEN_VALUE], snull[FLEN_VALUE];
+      double scale, zero;
+      LONGLONG startpos, elemnum, repeat, rowsize, tnull;
+      long twidth, incre;
+      int tcode, maxelem;
+      ffgcprll(fptr, colnum[0], lastrow, 1, 1, 1, &scale, &zero, tform,
+               &twidth, &tcode, &maxelem, &startpos, &elemnum, &incre,
+               &repeat, &rowsize, &hdutype, &tnull, snull, &status);
+    }
+    if (status > 0 || fits_get_num_rows(fptr, &total, &status) != 0) {
+      yfits_error(status);
+    }
+  }
+  if (append || (obj->append_hdu == hdu && lastrow > obj->append_rows)) {
+    obj->append_rows = lastrow;
+    obj->append_hdu = (total > lastrow ? hdu : 0);
+  }
+
+  /* Figure out which columns can be inserted into the raw rows.  If the
+     arrays cover all the bytes of the rows, whole rows are written;
+     otherwise, the cells of each column are written separately. */
+  if (hdutype == BINARY_TBL &&
+      fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         &status) != 0) {
+    yfits_error(status);
+  }
+  rowlen = 0;
+  nfast = 0;
+  cellsizes = 0;
+  for (k = 0; k < ncols; ++k) {
+    column_t* c = &col[k];
+    if (hdutype == BINARY_TBL &&
+        raw_column(fptr, colnum[k], firstrow, nrows, datastart, TRUE,
+                   c, &rowlen, &status)) {
+      fast[nfast++] = k;
+      cellsizes += c->cellsize;
+    } else if (status != 0) {
+      yfits_error(status);
+    }
+  }
+
+  /* Write the rows by blocks in a single pass.  The values of the columns
+     of each block are encoded in parallel while the previous block is being
+     written. */
+  if (nfast > 0) {
+    char* workspace;
+    long optimal, blockrows, row, n, m, half;
+    job.scatter = (nfast == ncols && cellsizes == rowlen);
+    if (fits_get_rowsize(fptr, &optimal, &status) != 0) {
+      yfits_error(status);
+    }
+    if (job.scatter) {
+      blockrows = RAW_BLOCK_SIZE/(rowlen > 0 ? rowlen : 1);
+      if (blockrows < optimal) {
+        blockrows = optimal;
+      }
+    } else {
+      /* Keep the block in the buffers of CFITSIO. */
+      blockrows = optimal;
+    }
+    if (blockrows > nrows) {
+      blockrows = nrows;
+    }
+    if (blockrows < 1) {
+      blockrows = 1;
+    }
+    half = (job.scatter ? 2 : 1)*blockrows*rowlen;
+    if ((workspace = get_workspace(2*half)) == NULL) {
+      y_error("insufficient memory");
+    }
+    job.col = col;
+    job.index = fast;
+    job.rowlen = rowlen;
+    job.encode = TRUE;
+    n = (nrows < blockrows ? nrows : blockrows);
+    job.cols = workspace;
+    job.rows = workspace + blockrows*rowlen;
+    job.nrows = n;
+    job.offset = 0;
+    pool_start(columns_task, &job, nfast, nthreads);
+    for (row = 0; row < nrows; row += n, n = m) {
+      char* cols = job.cols;
+      char* rows = job.rows;
+      pool_wait();
+      for (k = 0; k < nfast; ++k) {
+        col[fast[k]].retry = col[fast[k]].overflow;
+      }
+      m = nrows - (row + n);
+      if (m > blockrows) {
+        m = blockrows;
+      }
+      if (m > 0) {
+        job.cols = workspace + (((row + n)/blockrows)&1)*half;
+        job.rows = job.cols + blockrows*rowlen;
+        job.nrows = m;
+        job.offset = row + n;
+        pool_start(columns_task, &job, nfast, nthreads);
+      }
+      if (job.scatter) {
+        if (ffmbyt(fptr, datastart + (firstrow - 1 + row)*rowlen,
+                   IGNORE_EOF, &status) == 0) {
+          ffpbyt(fptr, n*rowlen, rows, &status);
+        }
+      } else {
+        for (k = 0; k < nfast && status == 0; ++k) {
+          column_t* c = &col[fast[k]];
+          if (ffmbyt(fptr, datastart + (firstrow - 1 + row)*rowlen + c->tbcol,
+                     IGNORE_EOF, &status) == 0) {
+            ffpbytoff(fptr, c->cellsize, n, rowlen - c->cellsize,
+                      cols + c->tbcol*n, &status);
+          }
+        }
+      }
+      for (k = 0; k < nfast && status == 0; ++k) {
+        /* Let CFITSIO deal with overflows. */
+        column_t* c = &col[fast[k]];
+        if (c->retry) {
+          long number = c->number/nrows;
+          fits_write_col(fptr, c->type, colnum[fast[k]], firstrow + row, 1,
+                         n*number, (char*)c->arr +
+                         row*number*type_size(c->type), &status);
+        }
+      }
+      if (status != 0) {
+        if (m > 0) {
+          pool_wait();
+        }
+        yfits_error(status);
+      }
+    }
+  }
+
+  /* Write the other columns with CFITSIO. */
+  for (k = 0; k < ncols; ++k) {
+    if (! col[k].fast &&
+        fits_write_col(fptr, col[k].type, colnum[k], firstrow, 1,
+                       col[k].number, col[k].arr, &status) != 0) {
+      yfits_error(status);
+    }
+  }
+  if (npushed > 0) {
+    yarg_drop(npushed);
+  }
+  ypush_nil();
+}
+
+/* Get the layout of the rows of the table in the current HDU: the offsets
+   TBCOL (in bytes from the start of a row) and, if WIDTH is not NULL, the
+   sizes WIDTH of the cells of the columns 1 to NCOLS (-1 for the variable
+   length array columns), and the length ROWLEN of the rows.  Only public
+   routines and keywords are used. */
+static int
+get_row_layout(fitsfile* fptr, int hdutype, int ncols, LONGLONG tbcol[],
+               LONGLONG width[], long* rowlen, int* status)
+{
+  char key[FLEN_KEYWORD], tform[FLEN_VALUE];
+  LONGLONG offset, repeat, size;
+  long col;
+  int c, typecode;
+
+  if (fits_read_key(fptr, TLONG, "NAXIS1", rowlen, NULL, status) != 0) {
+    return *status;
+  }
+  offset = 0;
+  for (c = 1; c <= ncols; ++c) {
+    if (fits_get_coltypell(fptr, c, &typecode, &repeat, &size,
+                           status) != 0) {
+      break;
+    }
+    if (hdutype == ASCII_TBL) {
+      /* The size given for ASCII tables is the width of the field. */
+      if (fits_make_keyn("TBCOL", c, key, status) != 0 ||
+          fits_read_key(fptr, TLONG, key, &col, NULL, status) != 0) {
+        break;
+      }
+      tbcol[c-1] = col - 1;
+    } else {
+      /* Cells are contiguous in a binary table. */
+      if (typecode < 0) {
+        /* Descriptor of a variable length array ("P" or "Q" format). */
+        if (fits_make_keyn("TFORM", c, key, status) != 0 ||
+            fits_read_key(fptr, TSTRING, key, tform, NULL, status) != 0) {
+          break;
+        }
+        size = (strpbrk(tform, "Qq") != NULL ? 16 : 8);
+      } else if (typecode == TBIT) {
+        size = (repeat + 7)/8;
+      } else if (typecode == TSTRING) {
+        size = repeat;
+      } else {
+        size *= repeat;
+      }
+      tbcol[c-1] = offset;
+      offset += size;
+    }
+    if (width != NULL) {
+      width[c-1] = (typecode < 0 ? -1 : size);
+    }
+  }
+  return *status;
+}
+
+void
+Y_fitsio_copy_tbl(int argc)
+{
+  LONGLONG inpoff[MAX_COLUMNS], outoff[MAX_COLUMNS], width[MAX_COLUMNS];
+  int colnum[MAX_COLUMNS];
+  char select[MAX_COLUMNS + 1];
+  fitsfile* inp;
+  fitsfile* out;
+  char* flags;
+  char* where;
+  char* inpbuf;
+  char* outbuf;
+  double t0;
+  long firstrow, lastrow, nrows, nsel, ncols, k, zero, blockrows, row, n;
+  long nkeep, outrow, inplen, outlen;
+  int iarg, pos, out_iarg, cols_iarg, status, hdutype, ntotal, nhdus, c;
+  int whole;
+
+  /* Parse arguments. */
+  inp = NULL;
+  out = NULL;
+  out_iarg = -1;
+  cols_iarg = -1;
+  firstrow = -1;
+  lastrow = -1;
+  where = NULL;
+  flags = NULL;
+  pos = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      ++pos;
+      if (pos == 1) {
+        inp = fetch_fitsfile(iarg, NOT_CLOSED|CRITICAL);
+      } else if (pos == 2) {
+        out = fetch_fitsfile(iarg, NOT_CLOSED|MODIFIED);
+        out_iarg = iarg;
+      } else if (pos == 3) {
+        cols_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (pos == 4) {
+        if (! yarg_nil(iarg)) {
+          firstrow = ygets_l(iarg);
+        }
+      } else if (pos == 5) {
+        if (! yarg_nil(iarg)) {
+          lastrow = ygets_l(iarg);
+        }
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_where) {
+        where = ygets_q(iarg);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (pos < 2) {
+    y_error("too few arguments");
+  }
+
+  /* Get the range of rows and the columns to copy (in their order in the
+     table). */
+  status = 0;
+  if (fits_get_hdu_type(inp, &hdutype, &status) != 0 ||
+      (hdutype != ASCII_TBL && hdutype != BINARY_TBL)) {
+    if (status != 0) {
+      yfits_error(status);
+    }
+    y_error("current HDU is not a table");
+  }
+  if (fits_get_num_rows(inp, &nrows, &status) != 0 ||
+      fits_get_num_cols(inp, &ntotal, &status) != 0) {
+    yfits_error(status);
+  }
+  if (firstrow == -1) {
+    firstrow = 1;
+  }
+  if (lastrow == -1) {
+    lastrow = nrows;
+  }
+  if (firstrow < 1 || firstrow > lastrow + 1 || lastrow > nrows) {
+    y_error("invalid range of rows");
+  }
+  nrows = lastrow - firstrow + 1;
+  ncols = get_column_list(cols_iarg, inp, ntotal, colnum);
+  memset(select, 0, sizeof(select));
+  for (k = 0; k < ncols; ++k) {
+    select[colnum[k]] = 1;
+  }
+
+  /* Get the layout of the rows of the input table and keep the selected
+     columns. */
+  if (get_row_layout(inp, hdutype, ntotal, inpoff, width, &inplen,
+                     &status) != 0) {
+    yfits_error(status);
+  }
+  ncols = 0;
+  for (c = 1; c <= ntotal; ++c) {
+    if (! select[c]) {
+      continue;
+    }
+    if (width[c-1] < 0) {
+      y_error("cannot copy columns of variable length arrays");
+    }
+    inpoff[ncols] = inpoff[c-1];
+    width[ncols] = width[c-1];
+    colnum[ncols++] = c;
+  }
+  whole = (ncols == ntotal);
+  nsel = (nrows > 0 ? select_rows(inp, where, firstrow, nrows, &flags) : 0);
+  if (flags != NULL) {
+    ++out_iarg;
+  }
+
+  /* Create the output table with the same header but no rows, no heap and
+     only the selected columns. */
+  zero = 0;
+  if (fits_get_num_hdus(out, &nhdus, &status) == 0 && nhdus == 0) {
+    fits_create_img(out, BYTE_IMG, 0, NULL, &status);
+  }
+  if (fits_copy_header(inp, out, &status) != 0 ||
+      fits_update_key(out, TLONG, "NAXIS2", &zero, NULL, &status) != 0 ||
+      (hdutype == BINARY_TBL &&
+       fits_update_key(out, TLONG, "PCOUNT", &zero, NULL, &status) != 0)) {
+    yfits_error(status);
+  }
+  fits_delete_key(out, "THEAP", &status);
+  if (status == KEY_NO_EXIST) status = 0;
+  fits_delete_key(out, "CHECKSUM", &status);
+  if (status == KEY_NO_EXIST) status = 0;
+  fits_delete_key(out, "DATASUM", &status);
+  if (status == KEY_NO_EXIST) status = 0;
+  fits_clear_errmsg();
+  fits_set_hdustruc(out, &status);
+  for (c = ntotal; c >= 1 && status == 0; --c) {
+    if (! select[c]) {
+      fits_delete_col(out, c, &status);
+    }
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+  if (get_row_layout(out, hdutype, ncols, outoff, NULL, &outlen,
+                     &status) != 0) {
+    yfits_error(status);
+  }
+
+  /* Read the rows by large blocks, keep the selected ones, gather the
+     selected cells (unless all columns are copied) and append them to the
+     output table.  The bytes are not converted.  Gaps between the columns
+     of an ASCII table are filled with spaces. */
+  if (nsel > 0 && inplen > 0 && outlen > 0) {
+    blockrows = RAW_BLOCK_SIZE/inplen;
+    if (blockrows < 1) {
+      blockrows = 1;
+    }
+    if (blockrows > nrows) {
+      blockrows = nrows;
+    }
+    if ((inpbuf = get_workspace(blockrows*(inplen + outlen))) == NULL) {
+      y_error("insufficient memory");
+    }
+    outbuf = inpbuf + blockrows*inplen;
+    memset(outbuf, (hdutype == ASCII_TBL ? ' ' : 0), blockrows*outlen);
+    outrow = 1;
+    for (row = 0; row < nrows && status == 0; row += n) {
+      n = nrows - row;
+      if (n > blockrows) {
+        n = blockrows;
+      }
+      if (! any_selected((flags != NULL ? flags + row : NULL), n)) {
+        continue;
+      }
+      t0 = stats_clock();
+      if (fits_read_tblbytes(inp, firstrow + row, 1, n*inplen,
+                             (unsigned char*)inpbuf, &status) != 0) {
+        break;
+      }
+      count_read(n*inplen, t0);
+      nkeep = compact_rows(inpbuf, inplen, n,
+                           (flags != NULL ? flags + row : NULL));
+      if (! whole) {
+        long r;
+        for (r = 0; r < nkeep; ++r) {
+          for (k = 0; k < ncols; ++k) {
+            memcpy(outbuf + r*outlen + outoff[k], inpbuf + r*inplen +
+                   inpoff[k], width[k]);
+          }
+        }
+      }
+      t0 = stats_clock();
+      fits_write_tblbytes(out, outrow, 1, nkeep*outlen,
+                          (unsigned char*)(whole ? inpbuf : outbuf),
+                          &status);
+      count_write(nkeep*outlen, t0);
+      outrow += nkeep;
+    }
+    if (status == 0) {
+      fits_set_hdustruc(out, &status);
+    }
+    if (status != 0) {
+      yfits_error(status);
+    }
+  }
+  ypush_use(yget_use(out_iarg)); /* left output object on top of stack */
+}
+
+#if 0
+void
+Y_fitsio_insert_rows(int argc)
+{
+  fitsfile* fptr;
+  long firstrow, nrows;
+  int status = 0;
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+/* ITERATORS */
+
+/* FITS iterator instance.  An iterator delivers successive chunks of planes
+   (along the last dimension) of an image or of rows of a table column. */
+struct _yfits_iterator {
+  void* handle;         /* reference to the FITS handle object */
+  void* buffer;         /* reference to the reusable array (or NULL) */
+  yfits_object* obj;    /* FITS handle */
+  long dims[Y_DIMSIZE]; /* dimensions of a complete chunk */
+  long size;            /* number of values per plane or per row */
+  long width;           /* maximum length of strings */
+  long total;           /* number of planes or rows */
+  long chunk;           /* number of planes or rows per chunk */
+  long next;            /* index (0-based) of next plane or row */
+  long first;           /* index (1-based) of first plane or row of the last
+                           delivered chunk */
+  long number;          /* number of planes or rows of the last delivered
+                           chunk */
+  int hdu;              /* HDU number */
+  int colnum;           /* column number, 0 for an image */
+  int datatype;         /* CFITSIO pixel type */
+  int ytype;            /* Yorick type of values */
+  int nthreads;         /* number of threads for conversion */
+  int reuse;            /* reuse the array of complete chunks? */
+};
+
+static struct y_userobj_t yfits_iterator_type = {
+  "FITS iterator", yfits_iterator_free, yfits_iterator_print,
+  yfits_iterator_eval, yfits_iterator_extract, NULL
+};
+
+static void
+yfits_iterator_free(void* ptr)
+{
+  yfits_iterator* it = (yfits_iterator*)ptr;
+  if (it->buffer != NULL) {
+    ydrop_use(it->buffer);
+    it->buffer = NULL;
+  }
+  if (it->handle != NULL) {
+    ydrop_use(it->handle);
+    it->handle = NULL;
+  }
+}
+
+static void
+yfits_iterator_print(void* ptr)
+{
+  yfits_iterator* it = (yfits_iterator*)ptr;
+  sprintf(buffer, "%s over %ld %s of HDU[%d] (chunk=%ld, next=%ld)",
+          yfits_iterator_type.type_name, it->total,
+          (it->colnum > 0 ? "row(s)" : "plane(s)"), it->hdu,
+          it->chunk, it->next + 1);
+  y_print(buffer, TRUE);
+}
+
+static void
+yfits_iterator_eval(void* ptr, int argc)
+{
+  yfits_iterator* it = (yfits_iterator*)ptr;
+  fitsfile* fptr;
+  long dims[Y_DIMSIZE];
+  long m, bufsize;
+  void* arr;
+  int k, hdu, type, anynull, status;
+
+  if (argc > 1) {
+    y_error("too many arguments");
+  }
+  if (argc == 1 && ! yarg_nil(0)) {
+    /* Restart at a given plane or row. */
+    long first = ygets_l(0);
+    if (first < 1 || first > it->total + 1) {
+      y_error("out of range index");
+    }
+    it->next = first - 1;
+  }
+  if (it->next >= it->total) {
+    it->number = 0;
+    ypush_nil();
+    return;
+  }
+  fptr = it->obj->fptr;
+  if (fptr == NULL) {
+    y_error("FITS handle has been closed");
+  }
+  stats_obj = it->obj;
+  bufsize = (it->obj->bufsize > 0 ? it->obj->bufsize : yfits_bufsize);
+
+  /* Get an array for the result, reusing the buffer of the previous chunk if
+     requested and possible (never for strings whose elements may have been
+     replaced). */
+  m = it->total - it->next;
+  if (m > it->chunk) {
+    m = it->chunk;
+  }
+  if (m == it->chunk && it->buffer != NULL) {
+    ypush_use(it->buffer);
+    arr = ygeta_any(0, NULL, NULL, NULL);
+  } else {
+    for (k = 0; k <= it->dims[0]; ++k) {
+      dims[k] = it->dims[k];
+    }
+    if (it->chunk > 1) {
+      dims[dims[0]] = m;
+    }
+    arr = (it->ytype == Y_STRING ? push_strings(dims, it->width, FALSE) :
+           push_array(it->ytype, dims, it->width));
+    if (it->reuse && m == it->chunk && it->ytype != Y_STRING) {
+      it->buffer = yget_use(0);
+    }
+  }
+
+  /* Read the values in the HDU of the iterator and restore the current HDU
+     of the FITS handle. */
+  status = 0;
+  fits_get_hdu_num(fptr, &hdu);
+  if (hdu != it->hdu && fits_movabs_hdu(fptr, it->hdu, &type,
+                                        &status) != 0) {
+    yfits_error(status);
+  }
+  if (it->colnum > 0 && it->datatype == TSTRING) {
+    read_strings(fptr, it->colnum, it->next + 1, m, m*it->size, it->width,
+                 arr, FALSE, &status);
+  } else if (it->colnum > 0) {
+    fits_read_col(fptr, it->datatype, it->colnum, it->next + 1, 1,
+                  m*it->size, NULL, arr, &anynull, &status);
+  } else if (! (it->obj->direct &&
+                 read_image_direct(fptr, it->datatype,
+                                   it->next*it->size + 1, m*it->size, arr,
+                                   FALSE, it->nthreads, bufsize, NULL,
+                                   &anynull, &status)) &&
+             ! read_image_raw(fptr, shared_descriptor(it->obj, FALSE),
+                              it->datatype, it->next*it->size + 1,
+                              m*it->size, arr, FALSE, it->nthreads, bufsize,
+                              NULL, &anynull, NULL, NULL, &status)) {
+    fits_read_img(fptr, it->datatype, it->next*it->size + 1, m*it->size,
+                  NULL, arr, &anynull, &status);
+  }
+  if (hdu != it->hdu) {
+    int code = 0;
+    fits_movabs_hdu(fptr, hdu, &type, (status == 0 ? &status : &code));
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+  it->first = it->next + 1;
+  it->number = m;
+  it->next += m;
+}
+
+static void
+yfits_iterator_extract(void* ptr, char* name)
+{
+  yfits_iterator* it = (yfits_iterator*)ptr;
+  if (strcmp(name, "first") == 0) {
+    ypush_long(it->first);
+  } else if (strcmp(name, "number") == 0) {
+    ypush_long(it->number);
+  } else if (strcmp(name, "next") == 0) {
+    ypush_long(it->next + 1);
+  } else if (strcmp(name, "total") == 0) {
+    ypush_long(it->total);
+  } else if (strcmp(name, "chunk") == 0) {
+    ypush_long(it->chunk);
+  } else if (strcmp(name, "handle") == 0) {
+    ypush_use(it->handle);
+  } else {
+    y_error("invalid member of FITS iterator");
+  }
+}
+
+void
+Y_fitsio_iterator(int argc)
+{
+  yfits_iterator* it;
+  yfits_object* obj;
+  fitsfile* fptr;
+  long dims[Y_DIMSIZE];
+  long chunk, width, ntot, size;
+  int k, iarg, handle_iarg, col_iarg, colnum, coltype, naxis, hdu, hdutype,
+    nthreads, datatype, ytype, pos, reuse, status;
+
+  /* Parse arguments. */
+  handle_iarg = -1;
+  col_iarg = -1;
+  chunk = 0;
+  nthreads = yfits_nthreads;
+  reuse = FALSE;
+  obj = NULL;
+  pos = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      ++pos;
+      if (pos == 1) {
+        obj = yfits_fetch(iarg, NOT_CLOSED|CRITICAL);
+        handle_iarg = iarg;
+      } else if (pos == 2) {
+        col_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_chunk) {
+        if (! yarg_nil(iarg) && (chunk = ygets_l(iarg)) < 1) {
+          y_error("invalid value for keyword CHUNK");
+        }
+      } else if (index == index_of_nthreads) {
+        nthreads = fetch_nthreads(iarg);
+      } else if (index == index_of_reuse) {
+        reuse = yarg_true(iarg);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (obj == NULL) {
+    y_error("too few arguments");
+  }
+  fptr = obj->fptr;
+  colnum = (col_iarg >= 0 ? get_colnum(col_iarg, fptr) : 0);
+
+  /* Get the dimensions and type of a plane or of a cell. */
+  status = 0;
+  fits_get_hdu_num(fptr, &hdu);
+  if (fits_get_hdu_type(fptr, &hdutype, &status) != 0) {
+    yfits_error(status);
+  }
+  width = 0;
+  if (colnum > 0) {
+    long nrows;
+    if (hdutype != ASCII_TBL && hdutype != BINARY_TBL) {
+      y_error("current HDU is not a table");
+    }
+    if (fits_get_num_rows(fptr, &nrows, &status) != 0) {
+      yfits_error(status);
+    }
+    size = get_cell_dims(fptr, colnum, 1, &coltype, &width, dims);
+    naxis = dims[0];
+    datatype = column_datatype(coltype, &ytype);
+    if (datatype == -1) {
+      y_error("unsupported array type");
+    }
+    ntot = nrows;
+    if (chunk == 0) {
+      /* By default, read about RAW_BLOCK_SIZE bytes per chunk. */
+      long rowsize = size*(ytype == Y_STRING ? width + 1 :
+                           (long)type_size(datatype));
+      chunk = RAW_BLOCK_SIZE/(rowsize > 0 ? rowsize : 1);
+      if (chunk < 1) {
+        chunk = 1;
+      }
+    }
+  } else {
+    int bitpix;
+    if (hdutype != IMAGE_HDU) {
+      y_error("current HDU is not an image");
+    }
+    get_image_param(fptr, Y_DIMSIZE - 1, NULL, &naxis, &dims[1], &ntot,
+                    &status);
+    if (status == 0) {
+      fits_get_img_equivtype(fptr, &bitpix, &status);
+    }
+    if (status != 0) {
+      yfits_error(status);
+    }
+    if (naxis < 1) {
+      y_error("image has no data");
+    }
+    datatype = image_datatype(bitpix, &ytype);
+    if (datatype == -1) {
+      y_error("unsupported data type");
+    }
+    ntot = dims[naxis];
+    size = 1;
+    for (k = 1; k < naxis; ++k) {
+      size *= dims[k];
+    }
+    --naxis;
+    if (chunk == 0) {
+      /* By default, deliver planes one by one, or about RAW_BLOCK_SIZE bytes
+         per chunk for a mono-dimensional image. */
+      chunk = (naxis > 0 ? 1 : RAW_BLOCK_SIZE/(long)type_size(datatype));
+    }
+  }
+  if (chunk > ntot && ntot > 0) {
+    chunk = ntot;
+  }
+  if (chunk > 1) {
+    /* Append a trailing dimension for the planes or rows of a chunk. */
+    if (naxis >= Y_DIMSIZE - 1) {
+      y_error("too many dimensions");
+    }
+    dims[++naxis] = chunk;
+  }
+  dims[0] = naxis;
+
+  /* Create the iterator. */
+  it = (yfits_iterator*)ypush_obj(&yfits_iterator_type,
+                                  sizeof(yfits_iterator));
+  it->handle = yget_use(handle_iarg + 1);
+  it->buffer = NULL;
+  it->obj = obj;
+  for (k = 0; k <= naxis; ++k) {
+    it->dims[k] = dims[k];
+  }
+  it->size = size;
+  it->width = width;
+  it->total = ntot;
+  it->chunk = chunk;
+  it->next = 0;
+  it->first = 0;
+  it->number = 0;
+  it->hdu = hdu;
+  it->colnum = colnum;
+  it->datatype = datatype;
+  it->ytype = ytype;
+  it->nthreads = nthreads;
+  it->reuse = reuse;
+}
+
+/*---------------------------------------------------------------------------*/
+/* IMAGE VIEWS */
+
+/* FITS image view instance.  A view records a rectangular section (possibly
+   with increments) of an image HDU whose pixels are only read when the view
+   is indexed.  The segments of the image rows spanned by the section are
+   read as a whole and the most recently used ones are cached. */
+struct _yfits_view {
+  void* handle;          /* reference to the FITS handle object */
+  yfits_object* obj;     /* FITS handle */
+  char* cache;           /* cached row segments (or NULL) */
+  long* rows;            /* image row of each slot of the cache, -1 if
+                            unused */
+  unsigned long* stamps; /* time of last use of each slot */
+  unsigned long clock;   /* current time */
+  unsigned long generation; /* generation of the file for the cache */
+  long dims[Y_DIMSIZE];  /* dimensions of the view */
+  long size[Y_DIMSIZE - 1]; /* dimensions of the image */
+  long fpix[Y_DIMSIZE - 1]; /* first pixel (0-based) of the section */
+  long ipix[Y_DIMSIZE - 1]; /* increments of the section */
+  long seglen;           /* number of pixels of a row segment */
+  long nslots;           /* number of slots of the cache */
+  size_t elsize;         /* size of pixel values */
+  int hdu;               /* HDU number */
+  int datatype;          /* CFITSIO pixel type */
+  int ytype;             /* Yorick type of values */
+};
+
+static struct y_userobj_t yfits_view_type = {
+  "FITS image view", yfits_view_free, yfits_view_print,
+  yfits_view_eval, yfits_view_extract, NULL
+};
+
+static void
+yfits_view_free(void* ptr)
+{
+  yfits_view* view = (yfits_view*)ptr;
+  if (view->cache != NULL) {
+    free(view->cache);
+    view->cache = NULL;
+  }
+  if (view->handle != NULL) {
+    ydrop_use(view->handle);
+    view->handle = NULL;
+  }
+}
+
+static void
+yfits_view_print(void* ptr)
+{
+  yfits_view* view = (yfits_view*)ptr;
+  char* str = buffer;
+  int k;
+  str += sprintf(str, "%s", yfits_view_type.type_name);
+  for (k = 1; k <= view->dims[0]; ++k) {
+    str += sprintf(str, "%c%ld", (k == 1 ? ' ' : 'x'), view->dims[k]);
+  }
+  sprintf(str, " of HDU[%d] (cache=%ld rows)", view->hdu, view->nslots);
+  y_print(buffer, TRUE);
+}
+
+/* Get the segment of row ROW (0-based) of the image of VIEW, reading it if
+   not in the cache.  The least recently used slot is recycled. */
+static const char*
+get_view_row(yfits_view* view, long row)
+{
+  fitsfile* fptr = view->obj->fptr;
+  char* seg;
+  double t0;
+  long i, slot;
+  int hdu, type, anynull, status;
+
+  if (fptr == NULL) {
+    y_error("FITS handle has been closed");
+  }
+  stats_obj = view->obj;
+  if (view->cache == NULL) {
+    size_t seglen = view->seglen*view->elsize;
+    view->cache = (char*)malloc(view->nslots*(seglen + sizeof(long) +
+                                              sizeof(unsigned long)));
+    if (view->cache == NULL) {
+      y_error("insufficient memory for the cache");
+    }
+    view->rows = (long*)(view->cache + view->nslots*seglen);
+    view->stamps = (unsigned long*)(view->rows + view->nslots);
+    view->generation = view->obj->generation - 1;
+  }
+  if (view->generation != view->obj->generation) {
+    /* The file has been modified, flush the cache. */
+    for (i = 0; i < view->nslots; ++i) {
+      view->rows[i] = -1;
+      view->stamps[i] = 0;
+    }
+    view->generation = view->obj->generation;
+  }
+  slot = 0;
+  for (i = 0; i < view->nslots; ++i) {
+    if (view->rows[i] == row) {
+      view->stamps[i] = ++view->clock;
+      count_cache(TRUE);
+      return view->cache + i*view->seglen*view->elsize;
+    }
+    if (view->stamps[i] < view->stamps[slot]) {
+      slot = i;
+    }
+  }
+
+  /* Read the segment in the HDU of the view and restore the current HDU of
+     the FITS handle. */
+  seg = view->cache + slot*view->seglen*view->elsize;
+  view->rows[slot] = -1;
+  status = 0;
+  count_cache(FALSE);
+  fits_get_hdu_num(fptr, &hdu);
+  if (hdu == view->hdu ||
+      fits_movabs_hdu(fptr, view->hdu, &type, &status) == 0) {
+    t0 = stats_clock();
+    fits_read_img(fptr, view->datatype, row*view->size[0] + view->fpix[0] + 1,
+                  view->seglen, NULL, seg, &anynull, &status);
+    count_read((double)view->seglen*view->elsize, t0);
+  }
+  if (hdu != view->hdu) {
+    int code = 0;
+    fits_movabs_hdu(fptr, hdu, &type, (status == 0 ? &status : &code));
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+  view->rows[slot] = row;
+  view->stamps[slot] = ++view->clock;
+  return seg;
+}
+
+/* Indexing a view: `view(i1, i2, ...)` where each index is a scalar, a
+   range, a vector or nil (for all) along the corresponding dimension of the
+   view; missing trailing indices are the same as nil. */
+static void
+yfits_view_eval(void* ptr, int argc)
+{
+  yfits_view* view = (yfits_view*)ptr;
+  long dims[Y_DIMSIZE];
+  long cnt[Y_DIMSIZE - 1];
+  long pos[Y_DIMSIZE - 1];
+  long* list[Y_DIMSIZE - 1];
+  long* idx;
+  char* dst;
+  long k, i, n, total, row, mms[3];
+  int naxis = view->dims[0];
+  int iarg, type, flags;
+
+  if (argc > naxis) {
+    y_error("too many indices");
+  }
+
+  /* Count the number of indices along each dimension. */
+  total = 0;
+  dims[0] = 0;
+  for (k = 0; k < naxis; ++k) {
+    long dim = view->dims[k+1];
+    iarg = argc - 1 - k;
+    type = (iarg >= 0 ? yarg_typeid(iarg) : Y_VOID);
+    if (type == Y_VOID || type == Y_RANGE) {
+      if (type == Y_VOID) {
+        mms[0] = 1;
+        mms[1] = dim;
+        mms[2] = 1;
+      } else {
+        flags = yget_range(iarg, mms);
+        if ((flags & (Y_PSEUDO|Y_RUBBER|Y_RUBBER1|Y_NULLER)) != 0) {
+          y_error("unsupported range index");
+        }
+        if ((flags & Y_MIN_DFLT) != 0) {
+          mms[0] = (mms[2] > 0 ? 1 : dim);
+        } else if (mms[0] <= 0) {
+          mms[0] += dim;
+        }
+        if ((flags & Y_MAX_DFLT) != 0) {
+          mms[1] = (mms[2] > 0 ? dim : 1);
+        } else if (mms[1] <= 0) {
+          mms[1] += dim;
+        }
+      }
+      n = (mms[1] - mms[0])/mms[2] + 1;
+      if (n < 1 || mms[0] < 1 || mms[0] > dim ||
+          mms[0] + (n - 1)*mms[2] < 1 || mms[0] + (n - 1)*mms[2] > dim) {
+        y_error("out of range index");
+      }
+      dims[++dims[0]] = n;
+    } else if (type <= Y_LONG && yarg_rank(iarg) <= 1) {
+      ygeta_l(iarg, &n, NULL);
+      if (yarg_rank(iarg) == 1) {
+        dims[++dims[0]] = n;
+      }
+    } else {
+      y_error("invalid index");
+    }
+    cnt[k] = n;
+    total += n;
+  }
+
+  /* Store the 0-based coordinates in the image. */
+  if ((idx = (long*)get_workspace(total*sizeof(long))) == NULL) {
+    y_error("insufficient memory");
+  }
+  for (k = 0; k < naxis; ++k) {
+    long dim = view->dims[k+1];
+    list[k] = idx;
+    iarg = argc - 1 - k;
+    type = (iarg >= 0 ? yarg_typeid(iarg) : Y_VOID);
+    if (type == Y_VOID || type == Y_RANGE) {
+      long first = 1, step = 1;
+      if (type == Y_RANGE) {
+        flags = yget_range(iarg, mms);
+        step = mms[2];
+        if ((flags & Y_MIN_DFLT) != 0) {
+          first = (step > 0 ? 1 : dim);
+        } else {
+          first = (mms[0] <= 0 ? mms[0] + dim : mms[0]);
+        }
+      }
+      for (i = 0; i < cnt[k]; ++i) {
+        idx[i] = first - 1 + i*step;
+      }
+    } else {
+      const long* v = ygeta_l(iarg, NULL, NULL);
+      for (i = 0; i < cnt[k]; ++i) {
+        long j = (v[i] <= 0 ? v[i] + dim : v[i]);
+        if (j < 1 || j > dim) {
+          y_error("out of range index");
+        }
+        idx[i] = j - 1;
+      }
+    }
+    for (i = 0; i < cnt[k]; ++i) {
+      if (k == 0) {
+        idx[i] *= view->ipix[0];
+      } else {
+        idx[i] = view->fpix[k] + idx[i]*view->ipix[k];
+      }
+    }
+    idx += cnt[k];
+  }
+
+  /* Copy the values row by row. */
+  dst = (char*)push_array(view->ytype, dims, 0);
+  n = 1;
+  for (k = 1; k < naxis; ++k) {
+    n *= cnt[k];
+    pos[k] = 0;
+  }
+  while (n-- > 0) {
+    const char* seg;
+    long stride = 1;
+    row = 0;
+    for (k = 1; k < naxis; ++k) {
+      row += list[k][pos[k]]*stride;
+      stride *= view->size[k];
+    }
+    seg = get_view_row(view, row);
+    for (i = 0; i < cnt[0]; ++i) {
+      memcpy(dst, seg + list[0][i]*view->elsize, view->elsize);
+      dst += view->elsize;
+    }
+    for (k = 1; k < naxis; ++k) {
+      if (++pos[k] < cnt[k]) {
+        break;
+      }
+      pos[k] = 0;
+    }
+  }
+}
+
+static void
+yfits_view_extract(void* ptr, char* name)
+{
+  yfits_view* view = (yfits_view*)ptr;
+  long dims[2];
+  long* arr;
+  int k, naxis = view->dims[0];
+  if (strcmp(name, "dims") == 0) {
+    dims[0] = 1;
+    dims[1] = naxis + 1;
+    arr = ypush_l(dims);
+    for (k = 0; k <= naxis; ++k) {
+      arr[k] = view->dims[k];
+    }
+  } else if (strcmp(name, "first") == 0 || strcmp(name, "incr") == 0) {
+    int first = (name[0] == 'f');
+    dims[0] = 1;
+    dims[1] = naxis;
+    arr = ypush_l(dims);
+    for (k = 0; k < naxis; ++k) {
+      arr[k] = (first ? view->fpix[k] + 1 : view->ipix[k]);
+    }
+  } else if (strcmp(name, "hdu") == 0) {
+    ypush_long(view->hdu);
+  } else if (strcmp(name, "cache") == 0) {
+    ypush_long(view->nslots);
+  } else if (strcmp(name, "handle") == 0) {
+    ypush_use(view->handle);
+  } else {
+    y_error("invalid member of FITS image view");
+  }
+}
+
+/* Push a view of the section of the image in the current HDU of FITS handle
+   OBJ (at position IARG in the stack), with first and last pixels FPIX and
+   LPIX (1-based, NULL for the whole image), increments IPIX (NULL for unit
+   increments) and a cache of NSLOTS row segments. */
+static void
+push_view(int iarg, yfits_object* obj, const long* fpix, const long* lpix,
+          const long* ipix, long nslots)
+{
+  yfits_view* view;
+  fitsfile* fptr = obj->fptr;
+  long size[Y_DIMSIZE];
+  long ntot;
+  int k, naxis, bitpix, type, ytype, hdu, status = 0;
+
+  if (fptr == NULL) {
+    y_error("FITS handle has been closed");
+  }
+  fits_get_hdu_num(fptr, &hdu);
+  if (fits_get_hdu_type(fptr, &type, &status) != 0) {
+    yfits_error(status);
+  }
+  if (type != IMAGE_HDU) {
+    y_error("current HDU is not an image");
+  }
+  get_image_param(fptr, Y_DIMSIZE - 1, NULL, &naxis, size, &ntot, &status);
+  if (status == 0) {
+    fits_get_img_equivtype(fptr, &bitpix, &status);
+  }
+  if (status != 0) {
+    yfits_error(status);
+  }
+  if (naxis < 1) {
+    y_error("image has no data");
+  }
+  type = image_datatype(bitpix, &ytype);
+  if (type == -1) {
+    y_error("unsupported data type");
+  }
+  view = (yfits_view*)ypush_obj(&yfits_view_type, sizeof(yfits_view));
+  view->dims[0] = naxis;
+  for (k = 0; k < naxis; ++k) {
+    long first = (fpix != NULL ? fpix[k] : 1);
+    long last = (lpix != NULL ? lpix[k] : size[k]);
+    long step = (ipix != NULL ? ipix[k] : 1);
+    if (first < 1 || first > last || last > size[k] || step < 1) {
+      y_error("bad sub-array parameters (FIRST, LAST, INCR)");
+    }
+    view->size[k] = size[k];
+    view->fpix[k] = first - 1;
+    view->ipix[k] = step;
+    view->dims[k+1] = (last - first)/step + 1;
+  }
+  view->seglen = (view->dims[1] - 1)*view->ipix[0] + 1;
+  view->elsize = type_size(type);
+  view->nslots = (nslots > 0 ? nslots : 1);
+  view->hdu = hdu;
+  view->datatype = type;
+  view->ytype = ytype;
+  view->obj = obj;
+  view->handle = yget_use(iarg + 1);
+}
+
+void
+Y_fitsio_view_img(int argc)
+{
+  yfits_object* obj;
+  long* fpix = NULL;
+  long* lpix = NULL;
+  long* ipix = NULL;
+  long nslots = VIEW_CACHE_SIZE;
+  int iarg, handle_iarg, first_iarg, last_iarg, incr_iarg, naxis, k;
+  int status = 0;
+
+  /* Parse arguments. */
+  handle_iarg = -1;
+  first_iarg = -1;
+  last_iarg = -1;
+  incr_iarg = -1;
+  obj = NULL;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (obj == NULL) {
+        obj = yfits_fetch(iarg, NOT_CLOSED|CRITICAL);
+        handle_iarg = iarg;
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == index_of_first) {
+        first_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_last) {
+        last_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_incr) {
+        incr_iarg = (yarg_nil(iarg) ? -1 : iarg);
+      } else if (index == index_of_cache) {
+        if (! yarg_nil(iarg) && (nslots = ygets_l(iarg)) < 1) {
+          y_error("invalid value for keyword CACHE");
+        }
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (obj == NULL) {
+    y_error("too few arguments");
+  }
+  if (fits_get_img_dim(obj->fptr, &naxis, &status) != 0) {
+    yfits_error(status);
+  }
+  if (first_iarg >= 0 || last_iarg >= 0 || incr_iarg >= 0) {
+    long d[Y_DIMSIZE], n;
+    if (first_iarg < 0 || last_iarg < 0) {
+      y_error("keywords FIRST and LAST must be both specified");
+    }
+    fpix = ygeta_l(first_iarg, &n, d);
+    if ((d[0] != 0 && d[0] != 1) || n != naxis) {
+      y_error("bad number of coordinates for keyword FIRST");
+    }
+    lpix = ygeta_l(last_iarg, &n, d);
+    if ((d[0] != 0 && d[0] != 1) || n != naxis) {
+      y_error("bad number of coordinates for keyword LAST");
+    }
+    if (incr_iarg >= 0) {
+      ipix = ygeta_l(incr_iarg, &n, d);
+      if ((d[0] != 0 && d[0] != 1) || n != naxis) {
+        y_error("bad number of coordinates for keyword INCR");
+      }
+    }
+  }
+  for (k = 0; fpix != NULL && k < naxis; ++k) {
+    if (ipix != NULL && ipix[k] >= 1 &&
+        (lpix[k] - fpix[k] + 1)%ipix[k] != 0) {
+      y_error("bad sub-array parameters (FIRST, LAST, INCR)");
+    }
+  }
+  push_view(handle_iarg, obj, fpix, lpix, ipix, nslots);
+}
+
+/*---------------------------------------------------------------------------*/
+/* UTILITY ROUTINES */
+
+/* Parse the arguments of the checksum functions: a FITS handle and keyword
+   NTHREADS. */
+static yfits_object*
+fetch_chksum_args(int argc, unsigned int flags, int* nthreads)
+{
+  yfits_object* obj = NULL;
+  int iarg;
+  *nthreads = yfits_nthreads;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      if (obj != NULL) y_error("too many arguments");
+      obj = yfits_fetch(iarg, flags);
+    } else {
+      --iarg;
+      if (index == index_of_nthreads) {
+        *nthreads = fetch_nthreads(iarg);
+      } else {
+        y_error("unsupported keyword");
+      }
+    }
+  }
+  if (obj == NULL) y_error("too few arguments");
+  return obj;
+}
+
+static int
+get_datasum_key(fitsfile* fptr, unsigned long* value, int* status)
+{
+  char str[FLEN_VALUE];
+  if (*status != 0) {
+    return FALSE;
+  }
+  if (fits_read_key(fptr, TSTRING, "DATASUM", str, NULL, status) != 0) {
+    if (*status == KEY_NO_EXIST) {
+      *status = 0;
+    }
+    return FALSE;
+  }
+  *value = strtoul(str, NULL, 10);
+  return TRUE;
+}
+
+/* Compute the sums of the data unit and of the whole current HDU as
+   `fits_get_chksum` but with the data summed by NTHREADS threads.  Only the
+   header is summed by CFITSIO. */
+static int
+hdu_checksums(fitsfile* fptr, int nthreads, unsigned long* datasum,
+              unsigned long* hdusum, int* status)
+{
+  LONGLONG headstart, datastart, dataend;
+  if (data_checksum(fptr, nthreads, datasum, status) != 0 ||
+      fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         status) != 0 ||
+      ffmbyt(fptr, headstart, REPORT_EOF, status) != 0) {
+    return *status;
+  }
+  *hdusum = *datasum;
+  return ffcsum(fptr, (long)((datastart - headstart)/2880), hdusum, status);
+}
+
+/* Whether the current HDU is a binary table with a heap (after `ffrdef`
+   which updates PCOUNT). */
+static int
+has_heap(fitsfile* fptr, int* status)
+{
+  LONGLONG pcount;
+  int hdutype;
+  if (fits_get_hdu_type(fptr, &hdutype, status) != 0 ||
+      hdutype != BINARY_TBL ||
+      fits_read_key(fptr, TLONGLONG, "PCOUNT", &pcount, NULL,
+                    status) != 0) {
+    return FALSE;
+  }
+  return (pcount > 0);
+}
+
+void
+Y_fitsio_write_chksum(int argc)
+{
+  char date[20], value[FLEN_VALUE], comment[FLEN_COMMENT];
+  fitsfile* fptr;
+  unsigned long datasum, keysum;
+  int nthreads, timeref, exists, code, status = 0;
+
+  fptr = fetch_chksum_args(argc, NOT_CLOSED|CRITICAL|MODIFIED,
+                           &nthreads)->fptr;
+
+  /* As `fits_write_chksum`, first make sure that the keywords exist (this
+     may move the data) and that the data unit is complete, then update
+     DATASUM if needed and finally let CFITSIO update CHECKSUM which only
+     requires to sum the header. */
+  fits_get_system_time(date, &timeref, &status);
+  code = 0;
+  if (fits_read_keyword(fptr, "CHECKSUM", value, NULL, &code) != 0) {
+    if (code != KEY_NO_EXIST) yfits_error(code);
+    sprintf(comment, "HDU checksum updated %s", date);
+    fits_write_key(fptr, TSTRING, "CHECKSUM", "0000000000000000", comment,
+                   &status);
+  }
+  sprintf(comment, "data unit checksum updated %s", date);
+  exists = get_datasum_key(fptr, &keysum, &status);
+  if (! exists) {
+    fits_write_key(fptr, TSTRING, "DATASUM", "0", comment, &status);
+  }
+  /* Close the header (this updates the structure of the HDU and its END
+     keyword) and write the fill of the data unit which may be missing for
+     a freshly written HDU. */
+  if (ffrdef(fptr, &status) == 0 && has_heap(fptr, &status)) {
+    ffuptf(fptr, &status);
+  }
+  ffpdfl(fptr, &status);
+  data_checksum(fptr, nthreads, &datasum, &status);
+  if (status == 0 && (! exists || keysum != datasum)) {
+    sprintf(value, "%lu", datasum);
+    fits_update_key(fptr, TSTRING, "DATASUM", value, comment, &status);
+  }
+  fits_update_chksum(fptr, &status);
+  if (status != 0) yfits_error(status);
+  ypush_nil();
+}
+
+void
+Y_fitsio_update_chksum(int argc)
+{
+  int status = 0;
+  if (argc != 1) y_error("expecting exactly one argument");
+  fits_update_chksum(yfits_fetch(0, NOT_CLOSED|CRITICAL|MODIFIED)->fptr,
+                     &status);
+  if (status != 0) yfits_error(status);
+  ypush_nil();
+}
+
+void
+Y_fitsio_verify_chksum(int argc)
+{
+  long dims[] = {1, 2};
+  char value[FLEN_VALUE];
+  fitsfile* fptr;
+  unsigned long datasum = 0, hdusum = 0, keysum = 0;
+  int* result;
+  int nthreads, hasdata, hashdu, status = 0;
+
+  fptr = fetch_chksum_args(argc, NOT_CLOSED|CRITICAL, &nthreads)->fptr;
+  hasdata = get_datasum_key(fptr, &keysum, &status);
+  hashdu = (fits_read_keyword(fptr, "CHECKSUM", value, NULL,
+                              &status) == 0);
+  if (status == KEY_NO_EXIST) {
+    status = 0;
+  }
+  if (hasdata || hashdu) {
+    hdu_checksums(fptr, nthreads, &datasum, &hdusum, &status);
+  }
+  if (status != 0) yfits_error(status);
+  result = ypush_i(dims);
+  result[0] = (hasdata ? (keysum == datasum ? 1 : -1) : 0);
+  result[1] = (hashdu ? (hdusum == 0 || hdusum == 0xffffffffUL ? 1 : -1) : 0);
+}
+
+void
+Y_fitsio_get_chksum(int argc)
+{
+  long dims[] = {1, 2};
+  fitsfile* fptr;
+  unsigned long* result;
+  int nthreads, status = 0;
+  fptr = fetch_chksum_args(argc, NOT_CLOSED|CRITICAL, &nthreads)->fptr;
+  result = (unsigned long*)ypush_l(dims);
+  hdu_checksums(fptr, nthreads, &result[0], &result[1], &status);
+  if (status != 0) yfits_error(status);
+}
+
+void
+Y_fitsio_encode_chksum(int argc)
+{
+  char ascii[17];
+  unsigned long sum;
+  int compl;
+
+  if (argc == 1) {
+    sum = ygets_l(0);
+    compl = FALSE;
+  } else if (argc == 2) {
+    sum = ygets_l(1);
+    compl = yarg_true(0);
+  } else {
+    y_error("expecting 1 or 2 argument");
+  }
+  fits_encode_chksum(sum, compl, ascii);
+  push_string(ascii);
+}
+
+void
+Y_fitsio_decode_chksum(int argc)
+{
+  char* ascii;
+  unsigned long sum;
+  int compl;
+
+  if (argc == 1) {
+    ascii = ygets_q(0);
+    compl = FALSE;
+  } else if (argc == 2) {
+    ascii = ygets_q(1);
+    compl = yarg_true(0);
+  } else {
+    y_error("expecting 1 or 2 argument");
+  }
+  if (ascii == NULL || strlen(ascii) != 16) {
+    y_error("length of checksum string should be exactly 16 characters");
+  }
+  ypush_long(fits_decode_chksum(ascii, compl, &sum));
+}
+
+/*---------------------------------------------------------------------------*/
+/* MISCELLANEOUS */
+
+void
+Y_fitsio_get_version(int argc)
+{
+  float version;
+  fits_get_version(&version);
+  ypush_double((double)version);
+}
+
+void
+Y_fitsio_debug(int argc)
+{
+  int new_value, old_value;
+  if (argc != 1) y_error("expecting exactly one argument");
+  new_value = yarg_true(0);
+  old_value = yfits_debug;
+  yfits_debug = new_value;
+  ypush_int(old_value);
+}
+
+void
+Y_fitsio_setup(int argc)
+{
+  int iarg;
+
+  /* Define constants. */
+#define DEFINE_INT_CONST(c)    define_int_const("FITSIO_"#c, c)
+  DEFINE_INT_CONST(IMAGE_HDU);
+  DEFINE_INT_CONST(ASCII_TBL);
+  DEFINE_INT_CONST(BINARY_TBL);
+  DEFINE_INT_CONST(ANY_HDU);
+  DEFINE_INT_CONST(BYTE_IMG);
+  DEFINE_INT_CONST(SHORT_IMG);
+  DEFINE_INT_CONST(LONG_IMG);
+  DEFINE_INT_CONST(LONGLONG_IMG);
+  DEFINE_INT_CONST(FLOAT_IMG);
+  DEFINE_INT_CONST(DOUBLE_IMG);
+  DEFINE_INT_CONST(SBYTE_IMG);
+  DEFINE_INT_CONST(USHORT_IMG);
+  DEFINE_INT_CONST(ULONG_IMG);
+  DEFINE_INT_CONST(NOCOMPRESS);
+  DEFINE_INT_CONST(RICE_1);
+  DEFINE_INT_CONST(GZIP_1);
+  DEFINE_INT_CONST(GZIP_2);
+  DEFINE_INT_CONST(PLIO_1);
+  DEFINE_INT_CONST(HCOMPRESS_1);
+#undef DEFINE_INT_CONST
+
+  /* Define fast keyword/member indexes. */
+#define INIT(s) if (index_of_##s == -1L) index_of_##s = yget_global(#s, 0)
+  INIT(append);
+  INIT(ascii);
+  INIT(basic);
+  INIT(bufsize);
+  INIT(cache);
+  INIT(case);
+  INIT(chars);
+  INIT(chksum);
+  INIT(chunk);
+  INIT(compress);
+  INIT(direct);
+  INIT(extname);
+  INIT(first);
+  INIT(gzcache);
+  INIT(hdu);
+  INIT(header);
+  INIT(incr);
+  INIT(inflate);
+  INIT(last);
+  INIT(null);
+  INIT(nthreads);
+  INIT(number);
+  INIT(offsets);
+  INIT(out);
+  INIT(prefetch);
+  INIT(quantize);
+  INIT(raw);
+  INIT(reuse);
+  INIT(rows);
+  INIT(slice);
+  INIT(tile);
+  INIT(trace);
+  INIT(tunit);
+  INIT(type);
+  INIT(update);
+  INIT(where);
+  INIT(def);
+#undef INIT
+
+  /* Select the conversion kernels. */
+  init_kernels();
+
+  /* Parse global settings. */
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      y_error("too many arguments");
+    }
+    --iarg;
+    if (index == index_of_nthreads) {
+      yfits_nthreads = fetch_nthreads(iarg);
+    } else if (index == index_of_bufsize) {
+      yfits_bufsize = (yarg_nil(iarg) ? RAW_BLOCK_SIZE : fetch_bufsize(iarg));
+    } else if (index == index_of_trace) {
+      set_trace(yarg_nil(iarg) ? NULL : ygets_q(iarg));
+    } else if (index == index_of_gzcache) {
+      set_gzcache(yarg_nil(iarg) ? 0 : ygets_l(iarg));
+    } else {
+      y_error("unsupported keyword");
+    }
+  }
+  ypush_nil();
+}
+
+/*---------------------------------------------------------------------------*/
+/* STATISTICS */
+
+static FILE* trace_file = NULL;
+static double trace_origin = 0.0;
+
+static double
+stats_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1E-9*ts.tv_nsec;
+}
+
+/* The current handle is no longer valid. */
+static void
+forget_stats(yfits_object* obj)
+{
+  if (stats_obj == obj) {
+    stats_obj = NULL;
+  }
+}
+
+static void
+set_trace(const char* path)
+{
+  if (trace_file != NULL && trace_file != stderr) {
+    fclose(trace_file);
+  }
+  trace_file = NULL;
+  if (path == NULL || path[0] == '\0') {
+    return;
+  }
+  if (strcmp(path, "-") == 0) {
+    trace_file = stderr;
+  } else {
+    char* name = p_native(path);
+    trace_file = (name != NULL ? fopen(name, "a") : NULL);
+    if (name != NULL) p_free(name);
+    if (trace_file == NULL) {
+      y_error("cannot open trace file");
+    }
+  }
+  trace_origin = stats_clock();
+}
+
+/* Write a line in the trace log: time since tracing started, event, file
+   name, HDU number, number of bytes and duration. */
+static void
+trace_event(const char* event, double nbytes, double secs)
+{
+  char name[FLEN_FILENAME];
+  int hdu = 0, status = 0;
+  name[0] = '\0';
+  if (stats_obj != NULL && stats_obj->fptr != NULL) {
+    fits_file_name(stats_obj->fptr, name, &status);
+    fits_get_hdu_num(stats_obj->fptr, &hdu);
+  }
+  fprintf(trace_file, "%.6f\t%s\t%s\t%d\t%.0f\t%.6f\n",
+          stats_clock() - trace_origin, event, name, hdu, nbytes, secs);
+  fflush(trace_file);
+}
+
+#define COUNT(member, value)                    \
+  do {                                          \
+    global_stats.member += (value);             \
+    if (stats_obj != NULL) {                    \
+      stats_obj->stats.member += (value);       \
+    }                                           \
+  } while (FALSE)
+
+static void
+count_read(double nbytes, double t0)
+{
+  double secs = stats_clock() - t0;
+  COUNT(reads, 1);
+  COUNT(bytes_read, nbytes);
+  COUNT(io_time, secs);
+  if (trace_file != NULL) trace_event("read", nbytes, secs);
+}
+
+static void
+count_write(double nbytes, double t0)
+{
+  double secs = stats_clock() - t0;
+  COUNT(writes, 1);
+  COUNT(bytes_written, nbytes);
+  COUNT(io_time, secs);
+  if (trace_file != NULL) trace_event("write", nbytes, secs);
+}
+
+static void
+count_convert(double t0)
+{
+  double secs = stats_clock() - t0;
+  COUNT(convert_time, secs);
+  if (trace_file != NULL) trace_event("convert", 0, secs);
+}
+
+static void
+count_seek(void)
+{
+  COUNT(seeks, 1);
+}
+
+static void
+count_move(void)
+{
+  COUNT(moves, 1);
+  if (trace_file != NULL) trace_event("move", 0, 0);
+}
+
+static void
+count_cache(int hit)
+{
+  if (hit) {
+    COUNT(hits, 1);
+  } else {
+    COUNT(misses, 1);
+  }
+  if (trace_file != NULL) trace_event((hit ? "hit" : "miss"), 0, 0);
+}
+
+#undef COUNT
+
+void
+Y_fitsio_get_stats(int argc)
+{
+  long dims[] = {1, 10};
+  const yfits_stats_t* st;
+  double* result;
+  if (argc > 1) y_error("too many arguments");
+  if (argc == 0 || yarg_nil(0)) {
+    st = &global_stats;
+  } else {
+    st = &yfits_fetch(0, MAY_BE_CLOSED)->stats;
+  }
+  result = ypush_d(dims);
+  result[0] = st->bytes_read;
+  result[1] = st->bytes_written;
+  result[2] = st->reads;
+  result[3] = st->writes;
+  result[4] = st->seeks;
+  result[5] = st->moves;
+  result[6] = st->io_time;
+  result[7] = st->convert_time;
+  result[8] = st->hits;
+  result[9] = st->misses;
+}
+
+void
+Y_fitsio_reset_stats(int argc)
+{
+  if (argc > 1) y_error("too many arguments");
+  if (argc == 0 || yarg_nil(0)) {
+    memset(&global_stats, 0, sizeof(global_stats));
+  } else {
+    yfits_object* obj = yfits_fetch(0, MAY_BE_CLOSED);
+    memset(&obj->stats, 0, sizeof(obj->stats));
+  }
+  ypush_nil();
+}
+
+/*---------------------------------------------------------------------------*/
+/* METHODS */
+
+static yfits_object*
+yfits_push(void)
+{
+  return (yfits_object*)ypush_obj(&yfits_type, sizeof(yfits_object));
+}
+
+static yfits_object*
+yfits_fetch(int iarg, unsigned int flags)
+{
+  yfits_object* obj = (yfits_object*)yget_obj(iarg, &yfits_type);
+  if ((flags & (NOT_CLOSED|MAY_BE_CLOSED)) == NOT_CLOSED
+      && obj->fptr == NULL) {
+    y_error("FITS file has been closed");
+  }
+  stats_obj = obj;
+  if ((flags & CRITICAL) == CRITICAL) {
+    critical(TRUE);
+  }
+  if ((flags & APPENDING) == 0 && obj->append_hdu > 0) {
+    /* The reserved rows are only kept between consecutive writings of
+       columns, any other use of the handle sees the exact number of rows. */
+    int status = 0;
+    if (release_rows(obj, &status) != 0) {
+      yfits_error(status);
+    }
+  }
+  if ((flags & MODIFIED) == MODIFIED) {
+    ++obj->generation;
+    drop_hdu_index(obj);
+    drop_header_index(obj);
+    drop_prefetch(obj);
+  }
+  return obj;
+}
+
+static const char*
+hdu_type_name(int type)
+{
+  switch (type) {
+  case IMAGE_HDU:  return "image";
+  case BINARY_TBL: return "binary table";
+  case ASCII_TBL:  return "ascii table";
+  default:         return "unknown HDU type";
+  }
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* UTILITIES */
+
+static int
+same_name(const char* a, const char* b)
+{
+  if (a == NULL || b == NULL) {
+    return FALSE;
+  }
+  while (toupper((unsigned char)*a) == toupper((unsigned char)*b)) {
+    if (*a == '\0') {
+      return TRUE;
+    }
+    ++a;
+    ++b;
+  }
+  return FALSE;
+}
+
+static int
+trim_string(char* dst, const char* src)
+{
+  int c, i, copy = FALSE;
+  int j = 0; /* index to write in dst */
+  int k = 0; /* length, last non space in dst + 1 */
+
+  for (i = 0; (c = src[i]) != '\0'; ++i) {
+    if (c == ' ' || IS_WHITE(c)) {
+      if (copy) {
+        dst[j++] = c;
+      }
+    } else {
+      copy = TRUE;
+      dst[j++] = c;
+      k = j;
+    }
+  }
+  dst[k] = '\0';
+  return k;
+}
+
+static void
+critical(int clear_errmsg)
+{
+  if (p_signalling) {
+    p_abort();
+  }
+  if (clear_errmsg) {
+    fits_clear_errmsg();
+  }
+}
+
+static void
+define_int_const(const char* name, int value)
+{
+  ypush_int(value);
+  yput_global(yget_global(name, 0), 0);
+  yarg_drop(1);
+}
+
+static int
+fetch_int(int iarg)
+{
+  long lval = ygets_l(iarg);
+  int ival = (int)lval;
+  if (ival != lval) y_error("integer overflow");
+  return ival;
+}
+
+static void
+push_string(const char* str)
+{
+  ypush_q(NULL)[0] = p_strcpy(str);
+}
+
+static void
+define_string(long index, const char* str)
+{
+  push_string(str);
+  yput_global(index, 0);
+  yarg_drop(1);
+}
+
+static void
+push_complex(double re, double im)
+{
+  double* z = ypush_z(NULL);
+  z[0] = re;
+  z[1] = im;
+}
+
+static void
+push_scalar(const scalar_t* s)
+{
+  switch (s->type) {
+  case Y_CHAR:
+    *ypush_c(NULL) = s->value.c;
+    break;
+  case Y_SHORT:
+    *ypush_s(NULL) = s->value.s;
+    break;
+  case Y_INT:
+     ypush_int(s->value.i);
+    break;
+  case Y_LONG:
+    ypush_long(s->value.l);
+    break;
+  case Y_FLOAT:
+    *ypush_f(NULL) = s->value.f;
+    break;
+  case Y_DOUBLE:
+     ypush_double(s->value.d);
+    break;
+  case Y_VOID:
+    ypush_nil();
+    break;
+  default:
+    y_error("unknown scalar type");
+  }
+}
+
+static char*
+fetch_path(int iarg)
+{
+  char** arr = ypush_q(NULL);
+  char* arg = ygets_q(iarg + 1);
+  if (arg != NULL) arr[0] = p_native(arg);
+  yarg_swap(iarg + 1, 0);
+  yarg_drop(1);
+  return arr[0];
+}
+
+static void
+get_dimlist(int iarg_first, int iarg_last,
+            long* dims, int maxdims)
+{
+  int iarg, rank, type, ndims = 0, k;
+  for (iarg = iarg_first; iarg >= iarg_last; --iarg) {
+    if (yarg_key(iarg) >= 0) {
+      /* Skip keyword and its value. */
+      --iarg;
+      continue;
+    }
+    type = yarg_typeid(iarg);
+    if (type == Y_VOID) {
+      continue;
+    }
+    if (type > Y_LONG) {
+      y_error("bad type for dimension");
+    }
+    rank = yarg_rank(iarg);
+    if (rank == 0) {
+      /* scalar */
+      if (ndims >= maxdims) {
+         y_error("too many dimensions");
+      }
+      dims[++ndims] = ygets_l(iarg);
+    } else if (rank == 1) {
+      /* vector */
+      long i, ntot;
+      long* dimlist = ygeta_l(iarg, &ntot, NULL);
+      if (ntot < 1 || dimlist[0] != ntot - 1) {
+        y_error("bad dimension list");
+      }
+      if (ndims +  ntot - 1 > maxdims) {
+         y_error("too many dimensions");
+      }
+      for (i = 1; i < ntot; ++i) {
+        dims[++ndims] = dimlist[i];
+      }
+    } else {
+      y_error("bad dimension list");
+    }
+  }
+  for (k = 1; k <= ndims; ++k) {
+    if (dims[k] < 1) {
+      y_error("bad dimension");
+    }
+  }
+  dims[0] = ndims;
+}
+
+static int
+get_image_param(fitsfile* fptr, int maxdims, int* bitpix_ptr,
+                int* naxis_ptr, long dims[], long* number_ptr,
+                int* status)
+{
+  int k, naxis, bitpix;
+
+  if (*status == 0) {
+    if (fits_get_img_param(fptr, maxdims, &bitpix, &naxis,
+                           dims, status) != 0) {
+      /* An error occured, set values to avoid warnings about uninitialized
+         varaibles. */
+      if (bitpix_ptr != NULL) {
+        *bitpix_ptr = 0;
+      }
+      if (naxis_ptr != NULL) {
+        *naxis_ptr = 0;
+      }
+      if (number_ptr != NULL) {
+        *number_ptr = 0;
+      }
+    } else {
+      if (naxis > maxdims) {
+        y_error("too many dimensions");
+      }
+      if (bitpix_ptr != NULL) {
+        *bitpix_ptr = bitpix;
+      }
+      if (naxis_ptr != NULL) {
+        *naxis_ptr = naxis;
+      }
+      if (number_ptr != NULL) {
+        long number = 1;
+        for (k = 0; k < naxis; ++k) {
+          number *= dims[k];
+        }
+        *number_ptr = number;
+      }
+    }
+  }
+  return *status;
+}
+
+static int
+get_image_scaling(fitsfile* fptr, scaling_t* s, int* status)
+{
+  s->scale = 1.0;
+  s->zero = 0.0;
+  s->blank = 0;
+  s->has_blank = FALSE;
+  if (*status == 0) {
+    if (fits_read_key(fptr, TDOUBLE, "BSCALE", &s->scale,
+                      NULL, status) == KEY_NO_EXIST) {
+      s->scale = 1.0;
+      *status = 0;
+    }
+    if (fits_read_key(fptr, TDOUBLE, "BZERO", &s->zero,
+                      NULL, status) == KEY_NO_EXIST) {
+      s->zero = 0.0;
+      *status = 0;
+    }
+    if (fits_read_key(fptr, TLONGLONG, "BLANK", &s->blank,
+                      NULL, status) == KEY_NO_EXIST) {
+      s->blank = 0;
+      *status = 0;
+    } else if (*status == 0) {
+      s->has_blank = TRUE;
+    }
+  }
+  return *status;
+}
+
+static int
+image_datatype(int bitpix, int* ytype)
+{
+  size_t elsize;
+  int eltype;
+
+  if (bitpix == BYTE_IMG) {
+    elsize = 1;
+    eltype = 0;
+  } else if (bitpix == SBYTE_IMG || bitpix == SHORT_IMG) {
+    elsize = 2;
+    eltype = 1;
+  } else if (bitpix == USHORT_IMG || bitpix == LONG_IMG) {
+    elsize = 4;
+    eltype = 1;
+  } else if (bitpix == ULONG_IMG || bitpix == LONGLONG_IMG) {
+    elsize = 8;
+    eltype = 1;
+  } else if (bitpix == FLOAT_IMG) {
+    elsize = sizeof(float);
+    eltype = 2;
+  } else if (bitpix == DOUBLE_IMG) {
+    elsize = sizeof(double);
+    eltype = 2;
+  } else {
+    eltype = 0;
+    elsize = 0;
+  }
+  if (elsize <= sizeof(char) && eltype == 0) {
+    *ytype = Y_CHAR;
+    return TBYTE;
+  } else if (elsize <= sizeof(short) && eltype == 1) {
+    *ytype = Y_SHORT;
+    return TSHORT;
+  } else if (elsize <= sizeof(int) && eltype == 1) {
+    *ytype = Y_INT;
+    return TINT;
+  } else if (elsize <= sizeof(long) && eltype == 1) {
+    *ytype = Y_LONG;
+    return TLONG;
+  } else if (elsize <= sizeof(float) && eltype == 2) {
+    *ytype = Y_FLOAT;
+    return TFLOAT;
+  } else if (elsize <= sizeof(double) && eltype == 2) {
+    *ytype = Y_DOUBLE;
+    return TDOUBLE;
+  }
+  *ytype = -1;
+  return -1;
+}
+
+static int
+column_datatype(int coltype, int* ytype)
+{
+  switch (coltype) {
+  case TBIT:
+    /* Reading/writing bits with datatype = TBIT results in considering that
+       each bit is stored in a single char with value 0/1. */
+    *ytype = Y_CHAR;
+    return TBIT;
+
+  case TSTRING:
+    *ytype = Y_STRING;
+    return TSTRING;
+
+  case TBYTE:
   case TLOGICAL:
-    type = TBYTE;
-    arr = ypush_c(dims);
-    null.type = Y_CHAR;
+    *ytype = Y_CHAR;
+    return TBYTE;
+
+  case TSBYTE:
+  case TSHORT:
+    *ytype = Y_SHORT;
+    return TSHORT;
+
+  case TUSHORT:
+  case TINT:
+    *ytype = Y_INT;
+    return TINT;
+
+#if TINT32BIT != TLONG
+  case TINT32BIT:
+    if (sizeof(int) >= 4) {
+      *ytype = Y_INT;
+      return TINT;
+    }
+    *ytype = Y_LONG;
+    return TLONG;
+#endif
+
+  case TUINT:
+  case TULONG:
+  case TLONG:
+  case TLONGLONG:
+    *ytype = Y_LONG;
+    return TLONG;
+
+  case TFLOAT:
+    *ytype = Y_FLOAT;
+    return TFLOAT;
+
+  case TDOUBLE:
+    *ytype = Y_DOUBLE;
+    return TDOUBLE;
+
+  case TCOMPLEX:
+  case TDBLCOMPLEX:
+    *ytype = Y_COMPLEX;
+    return TDBLCOMPLEX;
+
+  default:
+    *ytype = -1;
+    return -1;
+  }
+}
+
+static void*
+push_strings(long dims[], long width, int chars)
+{
+  if (chars) {
+    long cdims[Y_DIMSIZE];
+    int k;
+    if (dims[0] >= Y_DIMSIZE - 1) {
+      y_error("too many dimensions");
+    }
+    cdims[0] = dims[0] + 1;
+    cdims[1] = width;
+    for (k = 1; k <= dims[0]; ++k) {
+      cdims[k+1] = dims[k];
+    }
+    return ypush_c(cdims);
+  }
+  return ypush_q(dims);
+}
+
+static int
+read_strings(fitsfile* fptr, int colnum, long firstrow, long nrows,
+             long number, long width, void* arr, int chars, int* status)
+{
+  char tform[FLEN_VALUE], snull[FLEN_VALUE];
+  double scale, zero;
+  LONGLONG startpos, elemnum, repeat, rowlen, tnull;
+  long twidth, incre, cellsize, blockrows, row, n, i, k, len, nulllen;
+  int tcode, maxelem, hdutype;
+  char* raw;
+
+  if (*status != 0 || nrows < 1 || number < 1) {
+    return *status;
+  }
+  if (ffgcprll(fptr, colnum, firstrow, 1, 1, 0, &scale, &zero, tform,
+               &twidth, &tcode, &maxelem, &startpos, &elemnum, &incre,
+               &repeat, &rowlen, &hdutype, &tnull, snull, status) > 0) {
+    return *status;
+  }
+  cellsize = (number/nrows)*width;
+  if (cellsize > rowlen) {
+    y_error("assumption failed!");
+  }
+  /* Only ASCII tables have null strings (given by TNULL). */
+  nulllen = (hdutype == ASCII_TBL && snull[0] != ASCII_NULL_UNDEFINED ?
+             (long)strlen(snull) : -1);
+
+  if (chars) {
+    /* Read the bytes directly into the destination, then replace trailing
+       spaces by nulls. */
+    raw = (char*)arr;
+    if (ffmbyt(fptr, startpos, REPORT_EOF, status) != 0 ||
+        ffgbytoff(fptr, cellsize, nrows, rowlen - cellsize, raw,
+                  status) != 0) {
+      return *status;
+    }
+    for (i = 0; i < number; ++i) {
+      char* str = raw + i*width;
+      len = string_length(str, width, snull, nulllen);
+      memset(str + len, 0, width - len);
+    }
+    return *status;
+  }
+
+  /* Read the bytes of blocks of rows in a single arena and allocate each
+     string with its actual length. */
+  blockrows = RAW_BLOCK_SIZE/cellsize;
+  if (blockrows < 1) {
+    blockrows = 1;
+  }
+  if (blockrows > nrows) {
+    blockrows = nrows;
+  }
+  if ((raw = get_workspace(blockrows*cellsize)) == NULL) {
+    return (*status = MEMORY_ALLOCATION);
+  }
+  k = 0;
+  for (row = 0; row < nrows; row += n) {
+    n = nrows - row;
+    if (n > blockrows) {
+      n = blockrows;
+    }
+    if (ffmbyt(fptr, startpos + row*rowlen, REPORT_EOF, status) != 0 ||
+        ffgbytoff(fptr, cellsize, n, rowlen - cellsize, raw,
+                  status) != 0) {
+      break;
+    }
+    for (i = 0; i < n*(cellsize/width); ++i, ++k) {
+      const char* str = raw + i*width;
+      char* dst;
+      len = string_length(str, width, snull, nulllen);
+      dst = p_malloc(len + 1);
+      memcpy(dst, str, len);
+      dst[len] = '\0';
+      ((char**)arr)[k] = dst;
+    }
+  }
+  return *status;
+}
+
+static long
+string_length(const char* str, long width, const char* snull, long nulllen)
+{
+  long len;
+  for (len = 0; len < width && str[len] != '\0'; ++len)
+    ;
+  while (len > 0 && str[len-1] == ' ') {
+    --len;
+  }
+  if (len == nulllen && strncmp(str, snull, len) == 0) {
+    len = 0;
+  }
+  return len;
+}
+
+static void
+extract_strings(const char* rows, long rowlen, long nrows, long tbcol,
+                long cellsize, long width, const char* snull, long nulllen,
+                int chars, void* arr, long offset)
+{
+  long ncell = cellsize/width;
+  long r, i, k, len;
+  for (r = 0; r < nrows; ++r) {
+    const char* cell = rows + r*rowlen + tbcol;
+    for (i = 0; i < ncell; ++i) {
+      const char* str = cell + i*width;
+      k = (offset + r)*ncell + i;
+      len = string_length(str, width, snull, nulllen);
+      if (chars) {
+        char* dst = (char*)arr + k*width;
+        memcpy(dst, str, len);
+        memset(dst + len, 0, width - len);
+      } else {
+        char* dst = p_malloc(len + 1);
+        memcpy(dst, str, len);
+        dst[len] = '\0';
+        ((char**)arr)[k] = dst;
+      }
+    }
+  }
+}
+
+static void*
+push_array(int ytype, long dims[], long width)
+{
+  switch (ytype) {
+  case Y_CHAR:
+    return ypush_c(dims);
+  case Y_SHORT:
+    return ypush_s(dims);
+  case Y_INT:
+    return ypush_i(dims);
+  case Y_LONG:
+    return ypush_l(dims);
+  case Y_FLOAT:
+    return ypush_f(dims);
+  case Y_DOUBLE:
+    return ypush_d(dims);
+  case Y_COMPLEX:
+    return ypush_z(dims);
+  case Y_STRING:
+    {
+      char** str = ypush_q(dims);
+      size_t size = width + 1; /* enough bytes for the longuest string */
+      long i, number = 1;
+      int k;
+      for (k = 1; k <= dims[0]; ++k) {
+        number *= dims[k];
+      }
+      for (i = 0; i < number; ++i) {
+        str[i] = p_malloc(size);
+      }
+      return str;
+    }
+  }
+  y_error("unsupported array type");
+  return NULL;
+}
+
+static void*
+push_output(int out_iarg, long slice, int ytype, long dims[])
+{
+  long odims[Y_DIMSIZE];
+  long k, number, ntot;
+  char* arr;
+  int type;
+
+  if (yget_ref(out_iarg) < 0) {
+    y_error("keyword OUT must be set with a simple variable");
+  }
+  arr = ygeta_any(out_iarg, &ntot, odims, &type);
+  if (type != ytype) {
+    y_error("bad data type for keyword OUT");
+  }
+  if (odims[0] != dims[0] + (slice > 0 ? 1 : 0)) {
+    y_error("bad number of dimensions for keyword OUT");
+  }
+  for (k = 1, number = 1; k <= dims[0]; ++k) {
+    if (odims[k] != dims[k]) {
+      y_error("bad dimensions for keyword OUT");
+    }
+    number *= dims[k];
+  }
+  if (slice > 0) {
+    if (slice > odims[odims[0]]) {
+      y_error("out of range SLICE");
+    }
+    arr += (slice - 1)*number*(type == Y_CHAR ? sizeof(char) :
+                               type == Y_SHORT ? sizeof(short) :
+                               type == Y_INT ? sizeof(int) :
+                               type == Y_LONG ? sizeof(long) :
+                               type == Y_FLOAT ? sizeof(float) :
+                               type == Y_DOUBLE ? sizeof(double) :
+                               2*sizeof(double));
+  }
+  ypush_use(yget_use(out_iarg));
+  return arr;
+}
+
+static int
+fetch_compression(int iarg)
+{
+  static const struct { const char* name; int code; } table[] = {
+    {"none",      NOCOMPRESS},
+    {"rice",      RICE_1},
+    {"gzip",      GZIP_1},
+    {"gzip2",     GZIP_2},
+    {"plio",      PLIO_1},
+    {"hcompress", HCOMPRESS_1},
+    {NULL,        0}
+  };
+  int k, code;
+  if (yarg_nil(iarg)) {
+    return NOCOMPRESS;
+  }
+  if (yarg_typeid(iarg) == Y_STRING && yarg_rank(iarg) == 0) {
+    const char* name = ygets_q(iarg);
+    for (k = 0; table[k].name != NULL; ++k) {
+      if (same_name(name, table[k].name)) {
+        return table[k].code;
+      }
+    }
+    y_error("unknown compression (must be \"none\", \"rice\", \"gzip\", "
+            "\"gzip2\", \"plio\" or \"hcompress\")");
+  }
+  code = fetch_int(iarg);
+  for (k = 0; table[k].name != NULL; ++k) {
+    if (code == table[k].code) {
+      return code;
+    }
+  }
+  y_error("invalid compression code");
+  return NOCOMPRESS;
+}
+
+static int
+type_bitpix(const char* name)
+{
+  if (name != NULL) {
+    if (strcmp(name, "char") == 0) return BYTE_IMG;
+    if (strcmp(name, "short") == 0) return SHORT_IMG;
+    if (strcmp(name, "int") == 0) return LONG_IMG;
+    if (strcmp(name, "long") == 0) return LONGLONG_IMG;
+    if (strcmp(name, "float") == 0) return FLOAT_IMG;
+    if (strcmp(name, "double") == 0) return DOUBLE_IMG;
+  }
+  return 0;
+}
+
+static int
+column_bitpix(int tcode, int* count)
+{
+  *count = 1;
+  switch (tcode) {
+  case TBYTE:       return BYTE_IMG;
+  case TSHORT:      return SHORT_IMG;
+  case TLONG:       return LONG_IMG;
+  case TLONGLONG:   return LONGLONG_IMG;
+  case TFLOAT:      return FLOAT_IMG;
+  case TDOUBLE:     return DOUBLE_IMG;
+  case TCOMPLEX:    *count = 2; return FLOAT_IMG;
+  case TDBLCOMPLEX: *count = 2; return DOUBLE_IMG;
+  }
+  return 0;
+}
+
+static size_t
+type_size(int datatype)
+{
+  switch (datatype) {
+  case TBYTE:
+  case TSBYTE:
+  case TLOGICAL:    return 1;
+  case TSHORT:
+  case TUSHORT:     return sizeof(short);
+  case TINT:
+  case TUINT:       return sizeof(int);
+  case TLONG:
+  case TULONG:      return sizeof(long);
+  case TLONGLONG:   return sizeof(LONGLONG);
+  case TFLOAT:      return sizeof(float);
+  case TDOUBLE:     return sizeof(double);
+  case TCOMPLEX:    return 2*sizeof(float);
+  case TDBLCOMPLEX: return 2*sizeof(double);
+  default:          return 0;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* CONVERSION OF VALUES */
+
+#ifndef NAN
+#  define NAN (0.0/0.0)
+#endif
+
+static __inline__ uint16_t
+swap16(uint16_t x)
+{
+  return (x << 8) | (x >> 8);
+}
+
+static __inline__ uint32_t
+swap32(uint32_t x)
+{
+  return ((x << 24) | ((x & 0x0000ff00U) <<  8) |
+          ((x >> 8) & 0x0000ff00U) | (x >> 24));
+}
+
+static __inline__ uint64_t
+swap64(uint64_t x)
+{
+  x = ((x << 32) | (x >> 32));
+  x = (((x & 0x0000ffff0000ffffULL) << 16) |
+       ((x >> 16) & 0x0000ffff0000ffffULL));
+  return (((x & 0x00ff00ff00ff00ffULL) << 8) |
+          ((x >> 8) & 0x00ff00ff00ff00ffULL));
+}
+
+/* Macros to convert big-endian values to native byte order. */
+#if BYTESWAPPED
+#  define BE16(x) swap16(x)
+#  define BE32(x) swap32(x)
+#  define BE64(x) swap64(x)
+#else
+#  define BE16(x) (x)
+#  define BE32(x) (x)
+#  define BE64(x) (x)
+#endif
+
+static __inline__ float
+get_f32(const void* src, long i)
+{
+  union { uint32_t u; float f; } v;
+  v.u = BE32(((const uint32_t*)src)[i]);
+  return v.f;
+}
+
+static __inline__ double
+get_f64(const void* src, long i)
+{
+  union { uint64_t u; double f; } v;
+  v.u = BE64(((const uint64_t*)src)[i]);
+  return v.f;
+}
+
+/* Macros to fetch the I-th raw FITS value in SRC. */
+#define GET_U8(i)  (((const uint8_t*)src)[i])
+#define GET_I16(i) ((int16_t)BE16(((const uint16_t*)src)[i]))
+#define GET_I32(i) ((int32_t)BE32(((const uint32_t*)src)[i]))
+#define GET_I64(i) ((int64_t)BE64(((const uint64_t*)src)[i]))
+#define GET_F32(i) get_f32(src, i)
+#define GET_F64(i) get_f64(src, i)
+
+/* Conversion kernels.  BE16, BE32 and BE64 copy N integers of the given size
+   between big-endian and native byte order (DST and SRC may be the same).
+   F32 and F64 do the same for floating-point values and return whether there
+   are any NaN's.  I16_F32 converts big-endian 16-bit integers into scaled
+   float values, I16_I32 into int values with an offset.  SUM32 yields the
+   sum of N big-endian 32-bit words (N must be less than 2^32).  STATS yields
+   the number of the N doubles which are not NaN and stores their sum, their
+   minimum and their maximum, SUMSQ yields the sum of their squared
+   deviations from a given mean (NaN's being skipped). */
+typedef struct {
+  void (*be16)(void* dst, const void* src, long n);
+  void (*be32)(void* dst, const void* src, long n);
+  void (*be64)(void* dst, const void* src, long n);
+  int  (*f32)(void* dst, const void* src, long n);
+  int  (*f64)(void* dst, const void* src, long n);
+  void (*i16_f32)(void* dst, const void* src, long n,
+                  double scale, double zero);
+  void (*i16_i32)(void* dst, const void* src, long n, int zero);
+  uint64_t (*sum32)(const void* src, long n);
+  long (*stats)(const double* src, long n, double* sum, double* min,
+                double* max);
+  double (*sumsq)(const double* src, long n, double mean);
+} kernel_table_t;
+
+static void
+generic_be16(void* dst, const void* src, long n)
+{
+  long i;
+  for (i = 0; i < n; ++i) {
+    ((uint16_t*)dst)[i] = BE16(((const uint16_t*)src)[i]);
+  }
+}
+
+static void
+generic_be32(void* dst, const void* src, long n)
+{
+  long i;
+  for (i = 0; i < n; ++i) {
+    ((uint32_t*)dst)[i] = BE32(((const uint32_t*)src)[i]);
+  }
+}
+
+static void
+generic_be64(void* dst, const void* src, long n)
+{
+  long i;
+  for (i = 0; i < n; ++i) {
+    ((uint64_t*)dst)[i] = BE64(((const uint64_t*)src)[i]);
+  }
+}
+
+static int
+generic_f32(void* dst, const void* src, long n)
+{
+  float* out = (float*)dst;
+  long i;
+  int anynull = FALSE;
+  for (i = 0; i < n; ++i) {
+    float y = GET_F32(i);
+    anynull |= (y != y);
+    out[i] = y;
+  }
+  return anynull;
+}
+
+static int
+generic_f64(void* dst, const void* src, long n)
+{
+  double* out = (double*)dst;
+  long i;
+  int anynull = FALSE;
+  for (i = 0; i < n; ++i) {
+    double y = GET_F64(i);
+    anynull |= (y != y);
+    out[i] = y;
+  }
+  return anynull;
+}
+
+static void
+generic_i16_f32(void* dst, const void* src, long n, double scale, double zero)
+{
+  float* out = (float*)dst;
+  long i;
+  for (i = 0; i < n; ++i) {
+    out[i] = (float)(GET_I16(i)*scale + zero);
+  }
+}
+
+static void
+generic_i16_i32(void* dst, const void* src, long n, int zero)
+{
+  int* out = (int*)dst;
+  long i;
+  for (i = 0; i < n; ++i) {
+    out[i] = GET_I16(i) + zero;
+  }
+}
+
+static uint64_t
+generic_sum32(const void* src, long n)
+{
+  const unsigned char* p = (const unsigned char*)src;
+  uint64_t sum = 0;
+  uint32_t w;
+  long i;
+  for (i = 0; i < n; ++i) {
+    memcpy(&w, p + 4*i, 4); /* SRC may not be aligned on 4 bytes */
+    sum += BE32(w);
+  }
+  return sum;
+}
+
+static long
+generic_stats(const double* src, long n, double* sum, double* min,
+              double* max)
+{
+  double s = 0.0, lo = HUGE_VAL, hi = -HUGE_VAL;
+  long i, count = 0;
+  for (i = 0; i < n; ++i) {
+    double v = src[i];
+    if (v == v) {
+      ++count;
+      s += v;
+      lo = (v < lo ? v : lo);
+      hi = (v > hi ? v : hi);
+    }
+  }
+  *sum = s;
+  *min = lo;
+  *max = hi;
+  return count;
+}
+
+static double
+generic_sumsq(const double* src, long n, double mean)
+{
+  double s = 0.0;
+  long i;
+  for (i = 0; i < n; ++i) {
+    double d = src[i] - mean;
+    if (d == d) {
+      s += d*d;
+    }
+  }
+  return s;
+}
+
+#if USE_X86_KERNELS || USE_NEON_KERNELS
+/* Merge the NLANES partial results of a vectorized STATS kernel (counts,
+   sums, minima and maxima) with those of the N remaining values in SRC. */
+static long
+reduce_stats(long nlanes, const int64_t* cnt, const double* s,
+             const double* lo, const double* hi, const double* src, long n,
+             double* sum, double* min, double* max)
+{
+  long j, count = generic_stats(src, n, sum, min, max);
+  for (j = 0; j < nlanes; ++j) {
+    count += cnt[j];
+    *sum += s[j];
+    *min = (lo[j] < *min ? lo[j] : *min);
+    *max = (hi[j] > *max ? hi[j] : *max);
+  }
+  return count;
+}
+#endif
+
+/* The vectorized kernels process as many values as possible by packets and
+   call the generic kernels for the remaining ones.  Scaled values are
+   computed in double precision as by the generic kernels, so all kernels
+   yield the same results (but for the rounding errors of the sums of STATS
+   and SUMSQ which are accumulated in another order).  MIN and MAX
+   instructions yield their second operand if any is NaN, so NaN's are
+   skipped without branches. */
+#define REMAINDER(kernel, dstsize, srcsize, ...)                        \
+  kernel((char*)dst + (dstsize)*m, (const char*)src + (srcsize)*m,      \
+         n - m, ##__VA_ARGS__)
+
+#if USE_X86_KERNELS
+
+#define SSSE3 __attribute__((target("ssse3")))
+#define AVX2  __attribute__((target("avx2")))
+
+/* Byte shuffling masks for 16, 32 and 64-bit values in 128-bit vectors. */
+#define MASK16 _mm_set_epi8(14,15,12,13,10,11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1)
+#define MASK32 _mm_set_epi8(12,13,14,15, 8, 9,10,11, 4, 5, 6, 7, 0, 1, 2, 3)
+#define MASK64 _mm_set_epi8( 8, 9,10,11,12,13,14,15, 0, 1, 2, 3, 4, 5, 6, 7)
+
+/* Load and store unaligned 128-bit and 256-bit vectors. */
+#define LOAD128(p, i)      _mm_loadu_si128((const __m128i*)(p) + (i))
+#define STORE128(p, i, v)  _mm_storeu_si128((__m128i*)(p) + (i), v)
+#define LOAD256(p, i)      _mm256_loadu_si256((const __m256i*)(p) + (i))
+#define STORE256(p, i, v)  _mm256_storeu_si256((__m256i*)(p) + (i), v)
+#define BROADCAST256(v)    _mm256_inserti128_si256(_mm256_castsi128_si256(v), \
+                                                   v, 1)
+
+#define X86_BE(name, target, bits, mask, load, store, nbytes)   \
+  target static void                                            \
+  name(void* dst, const void* src, long n)                      \
+  {                                                             \
+    const long step = (nbytes)/((bits)/8);                      \
+    long k, m = n - n%step;                                     \
+    mask;                                                       \
+    for (k = 0; k < m/step; ++k) {                              \
+      store(dst, k, SHUFFLE(load(src, k)));                     \
+    }                                                           \
+    REMAINDER(generic_be##bits, (bits)/8, (bits)/8);            \
+  }
+
+#define SHUFFLE(v) _mm_shuffle_epi8(v, msk)
+X86_BE(ssse3_be16, SSSE3, 16, const __m128i msk = MASK16,
+       LOAD128, STORE128, 16)
+X86_BE(ssse3_be32, SSSE3, 32, const __m128i msk = MASK32,
+       LOAD128, STORE128, 16)
+X86_BE(ssse3_be64, SSSE3, 64, const __m128i msk = MASK64,
+       LOAD128, STORE128, 16)
+#undef SHUFFLE
+#define SHUFFLE(v) _mm256_shuffle_epi8(v, msk)
+X86_BE(avx2_be16, AVX2, 16, const __m256i msk = BROADCAST256(MASK16),
+       LOAD256, STORE256, 32)
+X86_BE(avx2_be32, AVX2, 32, const __m256i msk = BROADCAST256(MASK32),
+       LOAD256, STORE256, 32)
+X86_BE(avx2_be64, AVX2, 64, const __m256i msk = BROADCAST256(MASK64),
+       LOAD256, STORE256, 32)
+#undef SHUFFLE
+#undef X86_BE
+
+SSSE3 static int
+ssse3_f32(void* dst, const void* src, long n)
+{
+  const __m128i msk = MASK32;
+  __m128 bad = _mm_setzero_ps();
+  long k, m = n - n%4;
+  for (k = 0; k < m/4; ++k) {
+    __m128 v = _mm_castsi128_ps(_mm_shuffle_epi8(LOAD128(src, k), msk));
+    bad = _mm_or_ps(bad, _mm_cmpunord_ps(v, v));
+    _mm_storeu_ps((float*)dst + 4*k, v);
+  }
+  return ((_mm_movemask_ps(bad) != 0) |
+          REMAINDER(generic_f32, sizeof(float), 4));
+}
+
+SSSE3 static int
+ssse3_f64(void* dst, const void* src, long n)
+{
+  const __m128i msk = MASK64;
+  __m128d bad = _mm_setzero_pd();
+  long k, m = n - n%2;
+  for (k = 0; k < m/2; ++k) {
+    __m128d v = _mm_castsi128_pd(_mm_shuffle_epi8(LOAD128(src, k), msk));
+    bad = _mm_or_pd(bad, _mm_cmpunord_pd(v, v));
+    _mm_storeu_pd((double*)dst + 2*k, v);
+  }
+  return ((_mm_movemask_pd(bad) != 0) |
+          REMAINDER(generic_f64, sizeof(double), 8));
+}
+
+SSSE3 static void
+ssse3_i16_f32(void* dst, const void* src, long n, double scale, double zero)
+{
+  const __m128i msk = MASK16;
+  const __m128d a = _mm_set1_pd(scale);
+  const __m128d b = _mm_set1_pd(zero);
+  float* out = (float*)dst;
+  long k, m = n - n%8;
+  for (k = 0; k < m/8; ++k) {
+    __m128i v = _mm_shuffle_epi8(LOAD128(src, k), msk);
+    /* Sign-extend to 32-bit integers. */
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+#define SCALE(x) _mm_cvtpd_ps(_mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(x), a), b))
+#define UPPER(x) _mm_shuffle_epi32(x, _MM_SHUFFLE(1,0,3,2))
+    _mm_storeu_ps(out + 8*k,     _mm_movelh_ps(SCALE(lo), SCALE(UPPER(lo))));
+    _mm_storeu_ps(out + 8*k + 4, _mm_movelh_ps(SCALE(hi), SCALE(UPPER(hi))));
+#undef SCALE
+#undef UPPER
+  }
+  REMAINDER(generic_i16_f32, sizeof(float), 2, scale, zero);
+}
+
+SSSE3 static void
+ssse3_i16_i32(void* dst, const void* src, long n, int zero)
+{
+  const __m128i msk = MASK16;
+  const __m128i b = _mm_set1_epi32(zero);
+  long k, m = n - n%8;
+  for (k = 0; k < m/8; ++k) {
+    __m128i v = _mm_shuffle_epi8(LOAD128(src, k), msk);
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    STORE128(dst, 2*k,     _mm_add_epi32(lo, b));
+    STORE128(dst, 2*k + 1, _mm_add_epi32(hi, b));
+  }
+  REMAINDER(generic_i16_i32, sizeof(int), 2, zero);
+}
+
+SSSE3 static uint64_t
+ssse3_sum32(const void* src, long n)
+{
+  const __m128i msk = MASK32;
+  const __m128i z = _mm_setzero_si128();
+  __m128i acc = z;
+  uint64_t lane[2];
+  long k, m = n - n%4;
+  for (k = 0; k < m/4; ++k) {
+    __m128i v = _mm_shuffle_epi8(LOAD128(src, k), msk);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, z));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, z));
+  }
+  _mm_storeu_si128((__m128i*)lane, acc);
+  return lane[0] + lane[1] + generic_sum32((const char*)src + 4*m, n - m);
+}
+
+SSSE3 static long
+ssse3_stats(const double* src, long n, double* sum, double* min,
+            double* max)
+{
+  __m128d s = _mm_setzero_pd();
+  __m128d lo = _mm_set1_pd(HUGE_VAL);
+  __m128d hi = _mm_set1_pd(-HUGE_VAL);
+  __m128i c = _mm_setzero_si128();
+  double vs[2], vlo[2], vhi[2];
+  int64_t vc[2];
+  long k, m = n - n%2;
+  for (k = 0; k < m; k += 2) {
+    __m128d v = _mm_loadu_pd(src + k);
+    __m128d ok = _mm_cmpord_pd(v, v);
+    s = _mm_add_pd(s, _mm_and_pd(v, ok));
+    lo = _mm_min_pd(v, lo);
+    hi = _mm_max_pd(v, hi);
+    c = _mm_sub_epi64(c, _mm_castpd_si128(ok));
+  }
+  _mm_storeu_pd(vs, s);
+  _mm_storeu_pd(vlo, lo);
+  _mm_storeu_pd(vhi, hi);
+  _mm_storeu_si128((__m128i*)vc, c);
+  return reduce_stats(2, vc, vs, vlo, vhi, src + m, n - m, sum, min, max);
+}
+
+SSSE3 static double
+ssse3_sumsq(const double* src, long n, double mean)
+{
+  const __m128d mu = _mm_set1_pd(mean);
+  __m128d s = _mm_setzero_pd();
+  double vs[2];
+  long k, m = n - n%2;
+  for (k = 0; k < m; k += 2) {
+    __m128d d = _mm_sub_pd(_mm_loadu_pd(src + k), mu);
+    s = _mm_add_pd(s, _mm_and_pd(_mm_mul_pd(d, d), _mm_cmpord_pd(d, d)));
+  }
+  _mm_storeu_pd(vs, s);
+  return vs[0] + vs[1] + generic_sumsq(src + m, n - m, mean);
+}
+
+AVX2 static int
+avx2_f32(void* dst, const void* src, long n)
+{
+  const __m256i msk = BROADCAST256(MASK32);
+  __m256 bad = _mm256_setzero_ps();
+  long k, m = n - n%8;
+  for (k = 0; k < m/8; ++k) {
+    __m256 v = _mm256_castsi256_ps(_mm256_shuffle_epi8(LOAD256(src, k), msk));
+    bad = _mm256_or_ps(bad, _mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+    _mm256_storeu_ps((float*)dst + 8*k, v);
+  }
+  return ((_mm256_movemask_ps(bad) != 0) |
+          REMAINDER(generic_f32, sizeof(float), 4));
+}
+
+AVX2 static int
+avx2_f64(void* dst, const void* src, long n)
+{
+  const __m256i msk = BROADCAST256(MASK64);
+  __m256d bad = _mm256_setzero_pd();
+  long k, m = n - n%4;
+  for (k = 0; k < m/4; ++k) {
+    __m256d v = _mm256_castsi256_pd(_mm256_shuffle_epi8(LOAD256(src, k), msk));
+    bad = _mm256_or_pd(bad, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+    _mm256_storeu_pd((double*)dst + 4*k, v);
+  }
+  return ((_mm256_movemask_pd(bad) != 0) |
+          REMAINDER(generic_f64, sizeof(double), 8));
+}
+
+AVX2 static void
+avx2_i16_f32(void* dst, const void* src, long n, double scale, double zero)
+{
+  const __m128i msk = MASK16;
+  const __m256d a = _mm256_set1_pd(scale);
+  const __m256d b = _mm256_set1_pd(zero);
+  float* out = (float*)dst;
+  long k, m = n - n%8;
+  for (k = 0; k < m/8; ++k) {
+    __m256i v = _mm256_cvtepi16_epi32(_mm_shuffle_epi8(LOAD128(src, k), msk));
+#define SCALE(x) _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(           \
+                   _mm256_cvtepi32_pd(x), a), b))
+    __m128 lo = SCALE(_mm256_castsi256_si128(v));
+    __m128 hi = SCALE(_mm256_extracti128_si256(v, 1));
+#undef SCALE
+    _mm256_storeu_ps(out + 8*k,
+                     _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+  }
+  REMAINDER(generic_i16_f32, sizeof(float), 2, scale, zero);
+}
+
+AVX2 static void
+avx2_i16_i32(void* dst, const void* src, long n, int zero)
+{
+  const __m128i msk = MASK16;
+  const __m256i b = _mm256_set1_epi32(zero);
+  long k, m = n - n%8;
+  for (k = 0; k < m/8; ++k) {
+    __m256i v = _mm256_cvtepi16_epi32(_mm_shuffle_epi8(LOAD128(src, k), msk));
+    STORE256(dst, k, _mm256_add_epi32(v, b));
+  }
+  REMAINDER(generic_i16_i32, sizeof(int), 2, zero);
+}
+
+AVX2 static uint64_t
+avx2_sum32(const void* src, long n)
+{
+  const __m256i msk = BROADCAST256(MASK32);
+  const __m256i z = _mm256_setzero_si256();
+  __m256i acc = z;
+  uint64_t lane[4];
+  long k, m = n - n%8;
+  for (k = 0; k < m/8; ++k) {
+    __m256i v = _mm256_shuffle_epi8(LOAD256(src, k), msk);
+    acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, z));
+    acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, z));
+  }
+  _mm256_storeu_si256((__m256i*)lane, acc);
+  return (lane[0] + lane[1] + lane[2] + lane[3] +
+          generic_sum32((const char*)src + 4*m, n - m));
+}
+
+AVX2 static long
+avx2_stats(const double* src, long n, double* sum, double* min,
+           double* max)
+{
+  __m256d s = _mm256_setzero_pd();
+  __m256d lo = _mm256_set1_pd(HUGE_VAL);
+  __m256d hi = _mm256_set1_pd(-HUGE_VAL);
+  __m256i c = _mm256_setzero_si256();
+  double vs[4], vlo[4], vhi[4];
+  int64_t vc[4];
+  long k, m = n - n%4;
+  for (k = 0; k < m; k += 4) {
+    __m256d v = _mm256_loadu_pd(src + k);
+    __m256d ok = _mm256_cmp_pd(v, v, _CMP_ORD_Q);
+    s = _mm256_add_pd(s, _mm256_and_pd(v, ok));
+    lo = _mm256_min_pd(v, lo);
+    hi = _mm256_max_pd(v, hi);
+    c = _mm256_sub_epi64(c, _mm256_castpd_si256(ok));
+  }
+  _mm256_storeu_pd(vs, s);
+  _mm256_storeu_pd(vlo, lo);
+  _mm256_storeu_pd(vhi, hi);
+  _mm256_storeu_si256((__m256i*)vc, c);
+  return reduce_stats(4, vc, vs, vlo, vhi, src + m, n - m, sum, min, max);
+}
+
+AVX2 static double
+avx2_sumsq(const double* src, long n, double mean)
+{
+  const __m256d mu = _mm256_set1_pd(mean);
+  __m256d s = _mm256_setzero_pd();
+  double vs[4];
+  long k, m = n - n%4;
+  for (k = 0; k < m; k += 4) {
+    __m256d d = _mm256_sub_pd(_mm256_loadu_pd(src + k), mu);
+    s = _mm256_add_pd(s, _mm256_and_pd(_mm256_mul_pd(d, d),
+                                       _mm256_cmp_pd(d, d, _CMP_ORD_Q)));
+  }
+  _mm256_storeu_pd(vs, s);
+  return (vs[0] + vs[1] + vs[2] + vs[3] +
+          generic_sumsq(src + m, n - m, mean));
+}
+
+#undef SSSE3
+#undef AVX2
+#undef MASK16
+#undef MASK32
+#undef MASK64
+#undef LOAD128
+#undef STORE128
+#undef LOAD256
+#undef STORE256
+#undef BROADCAST256
+
+#endif /* USE_X86_KERNELS */
+
+#if USE_NEON_KERNELS
+
+#define NEON_BE(name, bits, rev)                                        \
+  static void                                                           \
+  name(void* dst, const void* src, long n)                              \
+  {                                                                     \
+    const long step = 128/(bits);                                       \
+    long k, m = n - n%step;                                             \
+    for (k = 0; k < m/step; ++k) {                                      \
+      vst1q_u8((uint8_t*)dst + 16*k,                                    \
+               rev(vld1q_u8((const uint8_t*)src + 16*k)));              \
+    }                                                                   \
+    REMAINDER(generic_be##bits, (bits)/8, (bits)/8);                    \
+  }
+NEON_BE(neon_be16, 16, vrev16q_u8)
+NEON_BE(neon_be32, 32, vrev32q_u8)
+NEON_BE(neon_be64, 64, vrev64q_u8)
+#undef NEON_BE
+
+static int
+neon_f32(void* dst, const void* src, long n)
+{
+  /* Lanes of GOOD remain all ones as long as no NaN's are found. */
+  uint32x4_t good = vdupq_n_u32(0xffffffffU);
+  long k, m = n - n%4;
+  for (k = 0; k < m/4; ++k) {
+    float32x4_t v = vreinterpretq_f32_u8(
+        vrev32q_u8(vld1q_u8((const uint8_t*)src + 16*k)));
+    good = vandq_u32(good, vceqq_f32(v, v));
+    vst1q_f32((float*)dst + 4*k, v);
+  }
+  return ((vminvq_u32(good) == 0) |
+          REMAINDER(generic_f32, sizeof(float), 4));
+}
+
+static int
+neon_f64(void* dst, const void* src, long n)
+{
+  uint64x2_t good = vdupq_n_u64(~(uint64_t)0);
+  long k, m = n - n%2;
+  for (k = 0; k < m/2; ++k) {
+    float64x2_t v = vreinterpretq_f64_u8(
+        vrev64q_u8(vld1q_u8((const uint8_t*)src + 16*k)));
+    good = vandq_u64(good, vceqq_f64(v, v));
+    vst1q_f64((double*)dst + 2*k, v);
+  }
+  return (((vgetq_lane_u64(good, 0) & vgetq_lane_u64(good, 1)) == 0) |
+          REMAINDER(generic_f64, sizeof(double), 8));
+}
+
+static void
+neon_i16_f32(void* dst, const void* src, long n, double scale, double zero)
+{
+  const float64x2_t a = vdupq_n_f64(scale);
+  const float64x2_t b = vdupq_n_f64(zero);
+  float* out = (float*)dst;
+  long k, m = n - n%8;
+  for (k = 0; k < m/8; ++k) {
+    int16x8_t v = vreinterpretq_s16_u8(
+        vrev16q_u8(vld1q_u8((const uint8_t*)src + 16*k)));
+    int32x4_t lo = vmovl_s16(vget_low_s16(v));
+    int32x4_t hi = vmovl_s16(vget_high_s16(v));
+#define SCALE(x) vcvt_f32_f64(vaddq_f64(vmulq_f64(vcvtq_f64_s64(vmovl_s32(x)), \
+                                                  a), b))
+    vst1q_f32(out + 8*k,     vcombine_f32(SCALE(vget_low_s32(lo)),
+                                          SCALE(vget_high_s32(lo))));
+    vst1q_f32(out + 8*k + 4, vcombine_f32(SCALE(vget_low_s32(hi)),
+                                          SCALE(vget_high_s32(hi))));
+#undef SCALE
+  }
+  REMAINDER(generic_i16_f32, sizeof(float), 2, scale, zero);
+}
+
+static void
+neon_i16_i32(void* dst, const void* src, long n, int zero)
+{
+  const int32x4_t b = vdupq_n_s32(zero);
+  int32_t* out = (int32_t*)dst;
+  long k, m = n - n%8;
+  for (k = 0; k < m/8; ++k) {
+    int16x8_t v = vreinterpretq_s16_u8(
+        vrev16q_u8(vld1q_u8((const uint8_t*)src + 16*k)));
+    vst1q_s32(out + 8*k,     vaddq_s32(vmovl_s16(vget_low_s16(v)), b));
+    vst1q_s32(out + 8*k + 4, vaddq_s32(vmovl_s16(vget_high_s16(v)), b));
+  }
+  REMAINDER(generic_i16_i32, sizeof(int), 2, zero);
+}
+
+static uint64_t
+neon_sum32(const void* src, long n)
+{
+  uint64x2_t acc = vdupq_n_u64(0);
+  long k, m = n - n%4;
+  for (k = 0; k < m/4; ++k) {
+    acc = vpadalq_u32(acc, vreinterpretq_u32_u8(
+                          vrev32q_u8(vld1q_u8((const uint8_t*)src + 16*k))));
+  }
+  return (vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1) +
+          generic_sum32((const char*)src + 4*m, n - m));
+}
+
+/* FMINNM and FMAXNM yield the number if an operand is NaN. */
+static long
+neon_stats(const double* src, long n, double* sum, double* min,
+           double* max)
+{
+  float64x2_t s = vdupq_n_f64(0.0);
+  float64x2_t lo = vdupq_n_f64(HUGE_VAL);
+  float64x2_t hi = vdupq_n_f64(-HUGE_VAL);
+  int64x2_t c = vdupq_n_s64(0);
+  double vs[2], vlo[2], vhi[2];
+  int64_t vc[2];
+  long k, m = n - n%2;
+  for (k = 0; k < m; k += 2) {
+    float64x2_t v = vld1q_f64(src + k);
+    uint64x2_t ok = vceqq_f64(v, v);
+    s = vaddq_f64(s, vreinterpretq_f64_u64(
+                    vandq_u64(vreinterpretq_u64_f64(v), ok)));
+    lo = vminnmq_f64(lo, v);
+    hi = vmaxnmq_f64(hi, v);
+    c = vsubq_s64(c, vreinterpretq_s64_u64(ok));
+  }
+  vst1q_f64(vs, s);
+  vst1q_f64(vlo, lo);
+  vst1q_f64(vhi, hi);
+  vst1q_s64(vc, c);
+  return reduce_stats(2, vc, vs, vlo, vhi, src + m, n - m, sum, min, max);
+}
+
+static double
+neon_sumsq(const double* src, long n, double mean)
+{
+  const float64x2_t mu = vdupq_n_f64(mean);
+  float64x2_t s = vdupq_n_f64(0.0);
+  long k, m = n - n%2;
+  for (k = 0; k < m; k += 2) {
+    float64x2_t d = vsubq_f64(vld1q_f64(src + k), mu);
+    s = vaddq_f64(s, vreinterpretq_f64_u64(
+                    vandq_u64(vreinterpretq_u64_f64(vmulq_f64(d, d)),
+                              vceqq_f64(d, d))));
+  }
+  return (vgetq_lane_f64(s, 0) + vgetq_lane_f64(s, 1) +
+          generic_sumsq(src + m, n - m, mean));
+}
+
+#endif /* USE_NEON_KERNELS */
+
+#undef REMAINDER
+
+/* The kernels in use, the generic ones until `init_kernels` is called. */
+static kernel_table_t kernels = {
+  generic_be16, generic_be32, generic_be64, generic_f32, generic_f64,
+  generic_i16_f32, generic_i16_i32, generic_sum32, generic_stats,
+  generic_sumsq
+};
+
+static void
+init_kernels(void)
+{
+  static int initialized = FALSE;
+  if (initialized) {
+    return;
+  }
+  initialized = TRUE;
+#if USE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernel_table_t avx2 = {
+      avx2_be16, avx2_be32, avx2_be64, avx2_f32, avx2_f64,
+      avx2_i16_f32, avx2_i16_i32, avx2_sum32, avx2_stats, avx2_sumsq
+    };
+    kernels = avx2;
+  } else if (__builtin_cpu_supports("ssse3")) {
+    kernel_table_t ssse3 = {
+      ssse3_be16, ssse3_be32, ssse3_be64, ssse3_f32, ssse3_f64,
+      ssse3_i16_f32, ssse3_i16_i32, ssse3_sum32, ssse3_stats, ssse3_sumsq
+    };
+    kernels = ssse3;
+  }
+#elif USE_NEON_KERNELS
+  {
+    kernel_table_t neon = {
+      neon_be16, neon_be32, neon_be64, neon_f32, neon_f64,
+      neon_i16_f32, neon_i16_i32, neon_sum32, neon_stats, neon_sumsq
+    };
+    kernels = neon;
+  }
+#endif
+}
+
+/* Type-specialized conversion functions.  The macros below generate one
+   function per combination of raw FITS type, destination type and variant:
+   RAW for unscaled values, SCALED for scaled values and BLANK for scaled
+   values with detection of the BLANK (or TNULL) value.  The BLANK variants
+   are only used when such a value is defined.  `select_converter` chooses
+   the function once per call (the vectorized kernels being preferred) so
+   that the loops have no other tests. */
+#define CONVERT_INT_TO_INT(SRC, DST, GET, D)                            \
+  static int                                                            \
+  convert_##SRC##_##DST(void* dst, const void* src, long n,             \
+                        const scaling_t* s)                             \
+  {                                                                     \
+    D* out = (D*)dst;                                                   \
+    long i;                                                             \
+    for (i = 0; i < n; ++i) {                                           \
+      out[i] = (D)GET(i);                                               \
+    }                                                                   \
+    return FALSE;                                                       \
+  }                                                                     \
+  static int                                                            \
+  convert_##SRC##_##DST##_scaled(void* dst, const void* src, long n,    \
+                                 const scaling_t* s)                    \
+  {                                                                     \
+    LONGLONG iscale = (LONGLONG)s->scale, izero = (LONGLONG)s->zero;    \
+    D* out = (D*)dst;                                                   \
+    long i;                                                             \
+    for (i = 0; i < n; ++i) {                                           \
+      out[i] = (D)(GET(i)*iscale + izero);                              \
+    }                                                                   \
+    return FALSE;                                                       \
+  }                                                                     \
+  static int                                                            \
+  convert_##SRC##_##DST##_blank(void* dst, const void* src, long n,     \
+                                const scaling_t* s)                     \
+  {                                                                     \
+    LONGLONG iscale = (LONGLONG)s->scale, izero = (LONGLONG)s->zero;    \
+    LONGLONG blank = s->blank;                                          \
+    D* out = (D*)dst;                                                   \
+    long i;                                                             \
+    int anynull = FALSE;                                                \
+    for (i = 0; i < n; ++i) {                                           \
+      LONGLONG x = GET(i);                                              \
+      anynull |= (x == blank);                                          \
+      out[i] = (D)(x*iscale + izero);                                   \
+    }                                                                   \
+    return anynull;                                                     \
+  }
+
+#define CONVERT_INT_TO_FLT(SRC, DST, GET, D)                            \
+  static int                                                            \
+  convert_##SRC##_##DST(void* dst, const void* src, long n,             \
+                        const scaling_t* s)                             \
+  {                                                                     \
+    D* out = (D*)dst;                                                   \
+    long i;                                                             \
+    for (i = 0; i < n; ++i) {                                           \
+      out[i] = (D)GET(i);                                               \
+    }                                                                   \
+    return FALSE;                                                       \
+  }                                                                     \
+  static int                                                            \
+  convert_##SRC##_##DST##_scaled(void* dst, const void* src, long n,    \
+                                 const scaling_t* s)                    \
+  {                                                                     \
+    double scale = s->scale, zero = s->zero;                            \
+    D* out = (D*)dst;                                                   \
+    long i;                                                             \
+    for (i = 0; i < n; ++i) {                                           \
+      out[i] = (D)(GET(i)*scale + zero);                                \
+    }                                                                   \
+    return FALSE;                                                       \
+  }                                                                     \
+  static int                                                            \
+  convert_##SRC##_##DST##_blank(void* dst, const void* src, long n,     \
+                                const scaling_t* s)                     \
+  {                                                                     \
+    double scale = s->scale, zero = s->zero;                            \
+    LONGLONG blank = s->blank;                                          \
+    D* out = (D*)dst;                                                   \
+    long i;                                                             \
+    int anynull = FALSE;                                                \
+    for (i = 0; i < n; ++i) {                                           \
+      LONGLONG x = GET(i);                                              \
+      anynull |= (x == blank);                                          \
+      out[i] = (x == blank ? (D)NAN : (D)(x*scale + zero));             \
+    }                                                                   \
+    return anynull;                                                     \
+  }
+
+/* Undefined floating-point values are NaN's, so there is no BLANK
+   variant. */
+#define CONVERT_FLT_TO_FLT(SRC, DST, GET, D)                            \
+  static int                                                            \
+  convert_##SRC##_##DST(void* dst, const void* src, long n,             \
+                        const scaling_t* s)                             \
+  {                                                                     \
+    D* out = (D*)dst;                                                   \
+    long i;                                                             \
+    int anynull = FALSE;                                                \
+    for (i = 0; i < n; ++i) {                                           \
+      D y = (D)GET(i);                                                  \
+      anynull |= (y != y);                                              \
+      out[i] = y;                                                       \
+    }                                                                   \
+    return anynull;                                                     \
+  }                                                                     \
+  static int                                                            \
+  convert_##SRC##_##DST##_scaled(void* dst, const void* src, long n,    \
+                                 const scaling_t* s)                    \
+  {                                                                     \
+    double scale = s->scale, zero = s->zero;                            \
+    D* out = (D*)dst;                                                   \
+    long i;                                                             \
+    int anynull = FALSE;                                                \
+    for (i = 0; i < n; ++i) {                                           \
+      D y = (D)(GET(i)*scale + zero);                                   \
+      anynull |= (y != y);                                              \
+      out[i] = y;                                                       \
+    }                                                                   \
+    return anynull;                                                     \
+  }
+
+#define INT_CONVERTERS(SRC, GET)                                \
+  CONVERT_INT_TO_INT(SRC, char,   GET, unsigned char)           \
+  CONVERT_INT_TO_INT(SRC, short,  GET, short)                   \
+  CONVERT_INT_TO_INT(SRC, int,    GET, int)                     \
+  CONVERT_INT_TO_INT(SRC, long,   GET, long)                    \
+  CONVERT_INT_TO_FLT(SRC, float,  GET, float)                   \
+  CONVERT_INT_TO_FLT(SRC, double, GET, double)
+
+#define FLT_CONVERTERS(SRC, GET)                                \
+  CONVERT_FLT_TO_FLT(SRC, float,  GET, float)                   \
+  CONVERT_FLT_TO_FLT(SRC, double, GET, double)
+
+INT_CONVERTERS(u8,  GET_U8)
+INT_CONVERTERS(i16, GET_I16)
+INT_CONVERTERS(i32, GET_I32)
+INT_CONVERTERS(i64, GET_I64)
+FLT_CONVERTERS(f32, GET_F32)
+FLT_CONVERTERS(f64, GET_F64)
+
+/* The table of converters indexed by the raw type (unsigned 8-bit, 16-bit,
+   32-bit and 64-bit integers, 32-bit and 64-bit floating-point), the
+   destination type (TBYTE, TSHORT, TINT, TLONG, TFLOAT and TDOUBLE) and the
+   variant (RAW, SCALED and BLANK). */
+#define INT_ROW(SRC, D)                                                 \
+  {convert_##SRC##_##D, convert_##SRC##_##D##_scaled,                   \
+   convert_##SRC##_##D##_blank}
+#define FLT_ROW(SRC, D)                                                 \
+  {convert_##SRC##_##D, convert_##SRC##_##D##_scaled,                   \
+   convert_##SRC##_##D##_scaled}
+#define INT_TABLE(SRC)                                                  \
+  {INT_ROW(SRC, char), INT_ROW(SRC, short), INT_ROW(SRC, int),          \
+   INT_ROW(SRC, long), INT_ROW(SRC, float), INT_ROW(SRC, double)}
+#define FLT_TABLE(SRC)                                                  \
+  {{NULL, NULL, NULL}, {NULL, NULL, NULL}, {NULL, NULL, NULL},          \
+   {NULL, NULL, NULL}, FLT_ROW(SRC, float), FLT_ROW(SRC, double)}
+
+static const converter_t converters[6][6][3] = {
+  INT_TABLE(u8), INT_TABLE(i16), INT_TABLE(i32), INT_TABLE(i64),
+  FLT_TABLE(f32), FLT_TABLE(f64)
+};
+
+#undef CONVERT_INT_TO_INT
+#undef CONVERT_INT_TO_FLT
+#undef CONVERT_FLT_TO_FLT
+#undef INT_CONVERTERS
+#undef FLT_CONVERTERS
+#undef INT_ROW
+#undef FLT_ROW
+#undef INT_TABLE
+#undef FLT_TABLE
+
+/* Converters calling the (vectorized) kernels for the most common
+   cases. */
+static int
+kernel_copy(void* dst, const void* src, long n, const scaling_t* s)
+{
+  if (dst != src) {
+    memcpy(dst, src, n);
+  }
+  return FALSE;
+}
+
+static int
+kernel_be16(void* dst, const void* src, long n, const scaling_t* s)
+{
+  kernels.be16(dst, src, n);
+  return FALSE;
+}
+
+static int
+kernel_be32(void* dst, const void* src, long n, const scaling_t* s)
+{
+  kernels.be32(dst, src, n);
+  return FALSE;
+}
+
+static int
+kernel_be64(void* dst, const void* src, long n, const scaling_t* s)
+{
+  kernels.be64(dst, src, n);
+  return FALSE;
+}
+
+static int
+kernel_f32(void* dst, const void* src, long n, const scaling_t* s)
+{
+  return kernels.f32(dst, src, n);
+}
+
+static int
+kernel_f64(void* dst, const void* src, long n, const scaling_t* s)
+{
+  return kernels.f64(dst, src, n);
+}
+
+static int
+kernel_i16_f32(void* dst, const void* src, long n, const scaling_t* s)
+{
+  kernels.i16_f32(dst, src, n, s->scale, s->zero);
+  return FALSE;
+}
+
+static int
+kernel_i16_i32(void* dst, const void* src, long n, const scaling_t* s)
+{
+  kernels.i16_i32(dst, src, n, (int)s->zero);
+  return FALSE;
+}
+
+/* The ranges of the raw FITS types and of the destination types, in the
+   order of the table of converters. */
+static const double raw_min[6] = {
+  0.0, -32768.0, -2147483648.0, -9223372036854775808.0, -FLT_MAX, -DBL_MAX
+};
+static const double raw_max[6] = {
+  255.0, 32767.0, 2147483647.0, 9223372036854775807.0, FLT_MAX, DBL_MAX
+};
+static const double dst_min[6] = {
+  0.0, SHRT_MIN, INT_MIN, LONG_MIN, -FLT_MAX, -DBL_MAX
+};
+static const double dst_max[6] = {
+  UCHAR_MAX, SHRT_MAX, INT_MAX, LONG_MAX, FLT_MAX, DBL_MAX
+};
+
+/* The converters do not check overflows: if the scaled raw values may not
+   fit in the destination type, NULL is returned so that the caller falls
+   back to CFITSIO which reports NUM_OVERFLOW. */
+static converter_t
+select_converter(int bitpix, int datatype, const scaling_t* s)
+{
+  double scale = s->scale, zero = s->zero, a, b;
+  int unscaled = (scale == 1.0 && zero == 0.0);
+  int src, dst;
+
+  switch (bitpix) {
+  case BYTE_IMG:     src = 0; break;
+  case SHORT_IMG:    src = 1; break;
+  case LONG_IMG:     src = 2; break;
+  case LONGLONG_IMG: src = 3; break;
+  case FLOAT_IMG:    src = 4; break;
+  case DOUBLE_IMG:   src = 5; break;
+  default: return NULL;
+  }
+  switch (datatype) {
+  case TBYTE:   dst = 0; break;
+  case TSHORT:  dst = 1; break;
+  case TINT:    dst = 2; break;
+  case TLONG:   dst = 3; break;
+  case TFLOAT:  dst = 4; break;
+  case TDOUBLE: dst = 5; break;
+  default: return NULL;
+  }
+  if (dst < 4 && ! (bitpix > 0 && scale == floor(scale) &&
+                    zero == floor(zero) && fabs(scale) < 2147483648.0 &&
+                    fabs(zero) < 4611686018427387904.0)) {
+    /* Integer results are only possible for integer values with integer
+       scaling parameters (as assumed by fits_get_img_equivtype). */
+    return NULL;
+  }
+  if (dst < 5) {
+    a = raw_min[src]*scale + zero;
+    b = raw_max[src]*scale + zero;
+    if ((a < b ? a : b) < dst_min[dst] || (a < b ? b : a) > dst_max[dst]) {
+      return NULL;
+    }
+  }
+  if (bitpix > 0 && s->has_blank) {
+    return converters[src][dst][2];
+  }
+  if (unscaled && (bitpix < 0) == (dst >= 4) &&
+      (bitpix < 0 ? -bitpix : bitpix)/8 == type_size(datatype)) {
+    switch (bitpix) {
+    case BYTE_IMG:     return kernel_copy;
+    case SHORT_IMG:    return kernel_be16;
+    case LONG_IMG:     return kernel_be32;
+    case LONGLONG_IMG: return kernel_be64;
+    case FLOAT_IMG:    return kernel_f32;
+    case DOUBLE_IMG:   return kernel_f64;
+    }
+  }
+  if (bitpix == SHORT_IMG && datatype == TFLOAT) {
+    return kernel_i16_f32;
+  }
+  if (bitpix == SHORT_IMG && datatype == TINT && sizeof(int) == 4 &&
+      scale == 1.0 && zero > INT_MIN + 32768 && zero < INT_MAX - 32767) {
+    return kernel_i16_i32;
+  }
+  return converters[src][dst][unscaled ? 0 : 1];
+}
+
+static int
+convertible(int bitpix, int datatype, const scaling_t* s)
+{
+  return (select_converter(bitpix, datatype, s) != NULL);
+}
+
+static int
+convert_values(void* dst, int datatype, const void* src, int bitpix, long n,
+               const scaling_t* s)
+{
+  converter_t convert = select_converter(bitpix, datatype, s);
+  return (convert != NULL ? convert(dst, src, n, s) : FALSE);
+}
+
+/* Type-specialized encoding functions, one per combination of source type
+   and raw integer type.  Integer values are stored with an integer offset
+   (as for unsigned integers) and overflows are detected. */
+#define ENCODE_INT(SRC, S, DST, U, PUT, MIN, MAX)                       \
+  static int                                                            \
+  encode_##SRC##_##DST(void* dst, const void* src, long n,              \
+                       const scaling_t* s)                              \
+  {                                                                     \
+    LONGLONG izero = (LONGLONG)s->zero;                                 \
+    const S* inp = (const S*)src;                                       \
+    U* out = (U*)dst;                                                   \
+    long i;                                                             \
+    int overflow = FALSE;                                               \
+    for (i = 0; i < n; ++i) {                                           \
+      LONGLONG x = (LONGLONG)inp[i] - izero;                            \
+      overflow |= (x < (MIN) || x > (MAX));                             \
+      out[i] = PUT((U)x);                                               \
+    }                                                                   \
+    return overflow;                                                    \
+  }
+
+#define ENCODE_I64(SRC, S)                                              \
+  static int                                                            \
+  encode_##SRC##_i64(void* dst, const void* src, long n,                \
+                     const scaling_t* s)                                \
+  {                                                                     \
+    LONGLONG izero = (LONGLONG)s->zero;                                 \
+    const S* inp = (const S*)src;                                       \
+    uint64_t* out = (uint64_t*)dst;                                     \
+    long i;                                                             \
+    for (i = 0; i < n; ++i) {                                           \
+      out[i] = BE64((uint64_t)((LONGLONG)inp[i] - izero));              \
+    }                                                                   \
+    return FALSE;                                                       \
+  }
+
+#define ENCODERS(SRC, S)                                                \
+  ENCODE_INT(SRC, S, u8, uint8_t, , 0, 255)                             \
+  ENCODE_INT(SRC, S, i16, uint16_t, BE16, -32768, 32767)                \
+  ENCODE_INT(SRC, S, i32, uint32_t, BE32, -2147483647 - 1, 2147483647)  \
+  ENCODE_I64(SRC, S)
+
+ENCODERS(char,     unsigned char)
+ENCODERS(short,    short)
+ENCODERS(int,      int)
+ENCODERS(long,     long)
+ENCODERS(longlong, LONGLONG)
+
+/* The table of encoders indexed by the source type (TBYTE, TSHORT, TINT,
+   TLONG and TLONGLONG) and the raw type (unsigned 8-bit, 16-bit, 32-bit and
+   64-bit integers). */
+#define ENCODER_ROW(SRC)                                                \
+  {encode_##SRC##_u8, encode_##SRC##_i16, encode_##SRC##_i32,           \
+   encode_##SRC##_i64}
+
+static const converter_t encoders[5][4] = {
+  ENCODER_ROW(char), ENCODER_ROW(short), ENCODER_ROW(int),
+  ENCODER_ROW(long), ENCODER_ROW(longlong)
+};
+
+#undef ENCODE_INT
+#undef ENCODE_I64
+#undef ENCODERS
+#undef ENCODER_ROW
+
+static converter_t
+select_encoder(int bitpix, int datatype, const scaling_t* s)
+{
+  size_t size = (bitpix < 0 ? -bitpix : bitpix)/8;
+  int src, dst, flt;
+
+  switch (bitpix) {
+  case BYTE_IMG:     dst = 0; break;
+  case SHORT_IMG:    dst = 1; break;
+  case LONG_IMG:     dst = 2; break;
+  case LONGLONG_IMG: dst = 3; break;
+  case FLOAT_IMG:
+  case DOUBLE_IMG:   dst = -1; break;
+  default: return NULL;
+  }
+  switch (datatype) {
+  case TBYTE:     src = 0; break;
+  case TSHORT:    src = 1; break;
+  case TINT:      src = 2; break;
+  case TLONG:     src = 3; break;
+  case TLONGLONG: src = 4; break;
+  case TFLOAT:
+  case TDOUBLE:   src = -1; break;
+  default: return NULL;
+  }
+  flt = (src < 0);
+  if (flt ? (bitpix > 0 || s->scale != 1.0 || s->zero != 0.0 ||
+             size != type_size(datatype)) :
+      (bitpix < 0 || s->scale != 1.0 || s->zero != floor(s->zero) ||
+       fabs(s->zero) >= 4611686018427387904.0)) {
+    /* Floating-point values can only be copied (with byte swapping),
+       integer values only be stored with an integer offset. */
+    return NULL;
+  }
+  if (s->zero == 0.0 && size == type_size(datatype)) {
+    /* Just copy the values with byte swapping. */
+    switch (size) {
+    case 1: return kernel_copy;
+    case 2: return kernel_be16;
+    case 4: return kernel_be32;
+    case 8: return kernel_be64;
+    }
+  }
+  return encoders[src][dst];
+}
+
+static int
+encodable(int bitpix, int datatype, const scaling_t* s)
+{
+  return (select_encoder(bitpix, datatype, s) != NULL);
+}
+
+static int
+encode_values(void* dst, int bitpix, const void* src, int datatype, long n,
+              const scaling_t* s)
+{
+  converter_t encode = select_encoder(bitpix, datatype, s);
+  return (encode != NULL ? encode(dst, src, n, s) : FALSE);
+}
+
+static int
+encoding_overflows(void* workspace, long blocklen, int bitpix,
+                   const void* src, int datatype, long n,
+                   const scaling_t* s, int nthreads)
+{
+  double smin, smax, dmin, dmax;
+  size_t srcsize = type_size(datatype);
+  long offset, m;
+  int overflow;
+
+  switch (bitpix) {
+  case BYTE_IMG:  dmin = 0.0;           dmax = 255.0;         break;
+  case SHORT_IMG: dmin = -32768.0;      dmax = 32767.0;       break;
+  case LONG_IMG:  dmin = -2147483648.0; dmax = 2147483647.0;  break;
+  default: return FALSE; /* 64-bit integers or floating-point values */
+  }
+  switch (datatype) {
+  case TBYTE:     smin = 0.0;        smax = UCHAR_MAX; break;
+  case TSHORT:    smin = SHRT_MIN;   smax = SHRT_MAX;  break;
+  case TINT:      smin = INT_MIN;    smax = INT_MAX;   break;
+  case TLONG:     smin = LONG_MIN;   smax = LONG_MAX;  break;
+  case TLONGLONG: smin = LLONG_MIN;  smax = LLONG_MAX; break;
+  default: return FALSE; /* floating-point values are only copied */
+  }
+  if (smin - s->zero >= dmin && smax - s->zero <= dmax) {
+    return FALSE;
+  }
+  overflow = FALSE;
+  for (offset = 0; offset < n && ! overflow; offset += m) {
+    m = (n - offset < blocklen ? n - offset : blocklen);
+    overflow = encode_values_parallel(workspace, bitpix,
+                                      (const char*)src + offset*srcsize,
+                                      datatype, m, s, nthreads);
+  }
+  return overflow;
+}
+
+static void
+set_null_value(scalar_t* null, int datatype, const scaling_t* s)
+{
+  LONGLONG value = s->blank*(LONGLONG)s->scale + (LONGLONG)s->zero;
+  switch (datatype) {
+  case TBYTE:
+    null->value.c = (unsigned char)value;
+    break;
+  case TSHORT:
+    null->value.s = (short)value;
+    break;
+  case TINT:
+    null->value.i = (int)value;
+    break;
+  case TLONG:
+    null->value.l = (long)value;
     break;
+  case TFLOAT:
+    null->value.f = (float)NAN;
+    break;
+  case TDOUBLE:
+    null->value.d = NAN;
+    break;
+  }
+}
+
+/* Minimum number of values converted by a single task. */
+#define MIN_CHUNK 16384L
+
+typedef struct {
+  void* dst;
+  const void* src;
+  const scaling_t* s;
+  converter_t convert; /* selected once for all the tasks */
+  long number;
+  long chunk;
+  int datatype;
+  int bitpix;
+  int encode; /* convert native values into raw FITS values? */
+} conversion_job_t;
+
+/* There can be at most one running job. */
+static conversion_job_t conversion_job;
+
+static int
+conversion_task(void* ctx, long i)
+{
+  conversion_job_t* job = (conversion_job_t*)ctx;
+  long offset = i*job->chunk;
+  long n = job->number - offset;
+  size_t rawsize = (job->bitpix < 0 ? -job->bitpix : job->bitpix)/8;
+  size_t typesize = type_size(job->datatype);
+  if (n > job->chunk) {
+    n = job->chunk;
+  }
+  if (job->encode) {
+    return job->convert((char*)job->dst + offset*rawsize,
+                        (const char*)job->src + offset*typesize, n, job->s);
+  }
+  return job->convert((char*)job->dst + offset*typesize,
+                      (const char*)job->src + offset*rawsize, n, job->s);
+}
+
+static void
+start_job(int encode, void* dst, const void* src, int datatype, int bitpix,
+          long n, const scaling_t* s, int nthreads)
+{
+  conversion_job_t* job = &conversion_job;
+  long chunk, ntasks;
+
+  /* Split the work in more tasks than threads for a better balance. */
+  if (nthreads < 1) {
+    nthreads = 1;
+  }
+  chunk = (n + 4*nthreads - 1)/(4*nthreads);
+  if (chunk < MIN_CHUNK) {
+    chunk = MIN_CHUNK;
+  }
+  ntasks = (n + chunk - 1)/chunk;
+  job->dst = dst;
+  job->src = src;
+  job->s = s;
+  job->convert = (encode ? select_encoder(bitpix, datatype, s) :
+                  select_converter(bitpix, datatype, s));
+  job->number = n;
+  job->chunk = chunk;
+  job->datatype = datatype;
+  job->bitpix = bitpix;
+  job->encode = encode;
+  pool_start(conversion_task, job, ntasks, nthreads);
+}
+
+static void
+start_conversion(void* dst, int datatype, const void* src, int bitpix,
+                 long n, const scaling_t* s, int nthreads)
+{
+  start_job(FALSE, dst, src, datatype, bitpix, n, s, nthreads);
+}
+
+static void
+start_encoding(void* dst, int bitpix, const void* src, int datatype,
+               long n, const scaling_t* s, int nthreads)
+{
+  start_job(TRUE, dst, src, datatype, bitpix, n, s, nthreads);
+}
+
+static int
+convert_values_parallel(void* dst, int datatype, const void* src, int bitpix,
+                        long n, const scaling_t* s, int nthreads)
+{
+  if (nthreads <= 1 || n < 2*MIN_CHUNK) {
+    return convert_values(dst, datatype, src, bitpix, n, s);
+  }
+  start_conversion(dst, datatype, src, bitpix, n, s, nthreads);
+  return pool_wait();
+}
+
+static int
+encode_values_parallel(void* dst, int bitpix, const void* src, int datatype,
+                       long n, const scaling_t* s, int nthreads)
+{
+  if (nthreads <= 1 || n < 2*MIN_CHUNK) {
+    return encode_values(dst, bitpix, src, datatype, n, s);
+  }
+  start_encoding(dst, bitpix, src, datatype, n, s, nthreads);
+  return pool_wait();
+}
+
+/*---------------------------------------------------------------------------*/
+/* CHECKSUMS */
+
+/* Reduce a 64-bit sum of 32-bit words to a 32-bit ones' complement sum by
+   adding the carries back (twice is sufficient).  Sums of parts of the data
+   combine in the same way, which is what makes their parallel computation
+   possible. */
+static uint32_t
+fold_sum(uint64_t sum)
+{
+  sum = (sum & 0xffffffffU) + (sum >> 32);
+  sum = (sum & 0xffffffffU) + (sum >> 32);
+  return (uint32_t)sum;
+}
+
+static uint32_t
+add_sum(uint32_t a, uint32_t b)
+{
+  return fold_sum((uint64_t)a + b);
+}
+
+static void
+chksum_init(chksum_t* c)
+{
+  memset(c, 0, sizeof(*c));
+}
+
+static void
+chksum_update(chksum_t* c, const void* src, size_t nbytes)
+{
+  /* Maximum number of words for a single call to the kernel. */
+  const size_t maxwords = (size_t)1 << 30;
+  const uint8_t* p = (const uint8_t*)src;
+  size_t n;
+
+  if (c->npart > 0) {
+    while (c->npart < 4 && nbytes > 0) {
+      c->part[c->npart++] = *p++;
+      --nbytes;
+    }
+    if (c->npart < 4) {
+      return;
+    }
+    c->sum += (((uint32_t)c->part[0] << 24) | ((uint32_t)c->part[1] << 16) |
+               ((uint32_t)c->part[2] <<  8) |  (uint32_t)c->part[3]);
+    c->npart = 0;
+  }
+  while (nbytes >= 4) {
+    n = nbytes/4;
+    if (n > maxwords) {
+      n = maxwords;
+    }
+    c->sum = (uint64_t)fold_sum(c->sum) + fold_sum(kernels.sum32(p, n));
+    p += 4*n;
+    nbytes -= 4*n;
+  }
+  while (nbytes-- > 0) {
+    c->part[c->npart++] = *p++;
+  }
+}
+
+static uint32_t
+chksum_value(const chksum_t* c)
+{
+  uint64_t sum = c->sum;
+  int i;
+  if (c->npart > 0) {
+    /* The incomplete word is padded with zeros. */
+    uint32_t word = 0;
+    for (i = 0; i < c->npart; ++i) {
+      word |= (uint32_t)c->part[i] << (24 - 8*i);
+    }
+    sum += word;
+  }
+  return fold_sum(sum);
+}
+
+typedef struct {
+  const char* src;
+  long number;      /* number of words */
+  long chunk;       /* number of words per task */
+  long ntasks;
+  uint32_t sum[4*MAX_THREADS];
+} checksum_job_t;
+
+/* As for conversions, there can be at most one running job. */
+static checksum_job_t checksum_job;
+
+static int
+checksum_task(void* ctx, long i)
+{
+  checksum_job_t* job = (checksum_job_t*)ctx;
+  long offset = i*job->chunk;
+  long n = job->number - offset;
+  if (n > job->chunk) {
+    n = job->chunk;
+  }
+  job->sum[i] = fold_sum(kernels.sum32(job->src + 4*offset, n));
+  return 0;
+}
+
+static void
+start_checksum(const void* src, long n, int nthreads)
+{
+  checksum_job_t* job = &checksum_job;
+  long chunk;
+
+  if (nthreads < 1) {
+    nthreads = 1;
+  } else if (nthreads > MAX_THREADS) {
+    nthreads = MAX_THREADS;
+  }
+  chunk = (n + 4*nthreads - 1)/(4*nthreads);
+  if (chunk < MIN_CHUNK) {
+    chunk = MIN_CHUNK;
+  }
+  job->src = (const char*)src;
+  job->number = n;
+  job->chunk = chunk;
+  job->ntasks = (n + chunk - 1)/chunk;
+  pool_start(checksum_task, job, job->ntasks, nthreads);
+}
+
+static uint32_t
+finish_checksum(void)
+{
+  checksum_job_t* job = &checksum_job;
+  uint32_t sum = 0;
+  long i;
+  pool_wait();
+  for (i = 0; i < job->ntasks; ++i) {
+    sum = add_sum(sum, job->sum[i]);
+  }
+  return sum;
+}
+
+static int
+data_checksum(fitsfile* fptr, int nthreads, unsigned long* sum, int* status)
+{
+  /* The size of the blocks must be a multiple of 4, so must be the size of
+     the data unit (a multiple of 2880). */
+  const long blocklen = RAW_BLOCK_SIZE;
+  LONGLONG headstart, datastart, dataend, offset, nbytes;
+  char* workspace;
+  char* buf;
+  uint32_t result = 0;
+  long n;
+  int busy = FALSE;
+
+  if (fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+                         status) != 0) {
+    return *status;
+  }
+  nbytes = dataend - datastart;
+  if (nbytes > 0) {
+    /* The next block is read while the threads sum the previous one. */
+    if ((workspace = get_workspace(2*blocklen)) == NULL) {
+      return (*status = MEMORY_ALLOCATION);
+    }
+    count_seek();
+    ffmbyt(fptr, datastart, REPORT_EOF, status);
+    for (offset = 0; offset < nbytes && *status == 0; offset += n) {
+      double t0 = stats_clock();
+      n = (nbytes - offset > blocklen ? blocklen : (long)(nbytes - offset));
+      buf = workspace + ((offset/blocklen)&1)*blocklen;
+      if (ffgbyt(fptr, n, buf, status) != 0) {
+        break;
+      }
+      count_read(n, t0);
+      if (busy) {
+        result = add_sum(result, finish_checksum());
+      }
+      start_checksum(buf, n/4, nthreads);
+      busy = TRUE;
+    }
+    if (busy) {
+      result = add_sum(result, finish_checksum());
+    }
+  }
+  *sum = result;
+  return *status;
+}
+
+/*---------------------------------------------------------------------------*/
+/* SUMMARY STATISTICS */
+
+static void
+summary_init(summary_t* s)
+{
+  s->count = 0;
+  s->nulls = 0;
+  s->min = HUGE_VAL;
+  s->max = -HUGE_VAL;
+  s->mean = 0.0;
+  s->m2 = 0.0;
+}
+
+/* Merge the statistics B into A (Chan et al. formula for the sum of squared
+   deviations). */
+static void
+summary_merge(summary_t* a, const summary_t* b)
+{
+  double n, delta;
+  a->nulls += b->nulls;
+  if (b->count < 1) {
+    return;
+  }
+  if (a->count < 1) {
+    a->count = b->count;
+    a->min = b->min;
+    a->max = b->max;
+    a->mean = b->mean;
+    a->m2 = b->m2;
+    return;
+  }
+  n = (double)a->count + (double)b->count;
+  delta = b->mean - a->mean;
+  a->m2 += b->m2 + delta*delta*((double)a->count*(double)b->count/n);
+  a->mean += delta*((double)b->count/n);
+  a->count += b->count;
+  a->min = (b->min < a->min ? b->min : a->min);
+  a->max = (b->max > a->max ? b->max : a->max);
+}
+
+typedef struct {
+  const double* src;
+  long number;      /* number of values */
+  long chunk;       /* number of values per task */
+  long ntasks;
+  summary_t part[4*MAX_THREADS];
+} summary_job_t;
+
+/* As for conversions, there can be at most one running job. */
+static summary_job_t summary_job;
+
+/* Compute the statistics of a chunk in two passes over the values (which
+   are in the cache for the second pass) with the STATS and SUMSQ kernels
+   (see `init_kernels`). */
+static int
+summary_task(void* ctx, long i)
+{
+  summary_job_t* job = (summary_job_t*)ctx;
+  summary_t* p = &job->part[i];
+  const double* x = job->src + i*job->chunk;
+  double sum;
+  long n = job->number - i*job->chunk;
+  if (n > job->chunk) {
+    n = job->chunk;
+  }
+  p->count = kernels.stats(x, n, &sum, &p->min, &p->max);
+  p->nulls = n - p->count;
+  p->mean = (p->count > 0 ? sum/p->count : 0.0);
+  p->m2 = kernels.sumsq(x, n, p->mean);
+  return 0;
+}
+
+static void
+start_summary(const double* src, long n, int nthreads)
+{
+  summary_job_t* job = &summary_job;
+  long chunk;
+
+  if (nthreads < 1) {
+    nthreads = 1;
+  } else if (nthreads > MAX_THREADS) {
+    nthreads = MAX_THREADS;
+  }
+  chunk = (n + 4*nthreads - 1)/(4*nthreads);
+  if (chunk < MIN_CHUNK) {
+    chunk = MIN_CHUNK;
+  }
+  job->src = src;
+  job->number = n;
+  job->chunk = chunk;
+  job->ntasks = (n + chunk - 1)/chunk;
+  pool_start(summary_task, job, job->ntasks, nthreads);
+}
+
+static void
+finish_summary(summary_t* s)
+{
+  summary_job_t* job = &summary_job;
+  long i;
+  pool_wait();
+  for (i = 0; i < job->ntasks; ++i) {
+    summary_merge(s, &job->part[i]);
+  }
+}
+
+static void
+push_summary(const summary_t* s)
+{
+  long dims[] = {1, 6};
+  double* result = ypush_d(dims);
+  result[0] = s->count;
+  result[1] = s->nulls;
+  if (s->count > 0) {
+    result[2] = s->min;
+    result[3] = s->max;
+    result[4] = s->mean;
+    result[5] = (s->count > 1 ? sqrt(s->m2/(s->count - 1)) : 0.0);
+  } else {
+    result[2] = result[3] = result[4] = result[5] = NAN;
+  }
+}
+
+static int
+save_summary(fitsfile* fptr, const char* min, const char* max,
+             const char* stat, const summary_t* s, int* status)
+{
+  char value[FLEN_VALUE];
+  double stddev = (s->count > 1 ? sqrt(s->m2/(s->count - 1)) : 0.0);
+  int len = snprintf(value, sizeof(value), "%ld %ld %.17g %.17g",
+                     s->count, s->nulls, s->mean, stddev);
+  if (fits_update_key_dbl(fptr, min, s->min, -17, "minimum data value",
+                          status) != 0 ||
+      fits_update_key_dbl(fptr, max, s->max, -17, "maximum data value",
+                          status) != 0) {
+    return *status;
+  }
+  if (len > 0 && len <= 68) {
+    fits_update_key(fptr, TSTRING, stat, value,
+                    "count, nulls, mean and std. dev. of the data", status);
+  }
+  return *status;
+}
 
-  case TSBYTE:
-  case TSHORT:
-    type = TSHORT;
-    arr = ypush_s(dims);
-    null.type = Y_SHORT;
-    break;
+static int
+load_summary(fitsfile* fptr, const char* min, const char* max,
+             const char* stat, summary_t* s)
+{
+  char value[FLEN_VALUE];
+  double stddev;
+  int code = 0;
+  if (fits_read_key(fptr, TDOUBLE, min, &s->min, NULL, &code) != 0 ||
+      fits_read_key(fptr, TDOUBLE, max, &s->max, NULL, &code) != 0 ||
+      fits_read_key(fptr, TSTRING, stat, value, NULL, &code) != 0 ||
+      sscanf(value, "%ld %ld %lf %lf", &s->count, &s->nulls, &s->mean,
+             &stddev) != 4 || s->count < 1 || s->nulls < 0) {
+    fits_clear_errmsg();
+    summary_init(s);
+    return FALSE;
+  }
+  s->m2 = stddev*stddev*(s->count - 1);
+  return TRUE;
+}
 
-  case TUSHORT:
-  case TINT:
-    type = TINT;
-    arr = ypush_i(dims);
-    null.type = Y_INT;
-    break;
+/*---------------------------------------------------------------------------*/
+/* PREFETCHING */
 
-#if TINT32BIT != TLONG
-  case TINT32BIT:
-    if (sizeof(int) >= 4) {
-      type = TINT;
-      arr = ypush_i(dims);
-      null.type = Y_INT;
-    } else {
-      type = TLONG;
-      arr = ypush_l(dims);
-      null.type = Y_LONG;
-    }
-    break;
-#endif
+/* The data are read ahead by a detached thread which only uses its own file
+   descriptors (never CFITSIO nor Yorick).  The shared members of a prefetch
+   request are protected by `prefetch_mutex`. */
 
-  case TUINT:
-  case TULONG:
-  case TLONG:
-  case TLONGLONG:
-    type = TLONG;
-    arr = ypush_l(dims);
-    null.type = Y_LONG;
-    break;
+#define PREFETCH_PENDING 0
+#define PREFETCH_READY   1
+#define PREFETCH_FAILED  2
 
-  case TFLOAT:
-    type = TFLOAT;
-    arr = ypush_f(dims);
-    null.type = Y_FLOAT;
-    break;
+typedef struct {
+  char* path;       /* name of the file */
+  char* data;       /* bytes read, NULL if not kept or already claimed */
+  LONGLONG offset;  /* address of the first byte */
+  LONGLONG size;    /* number of bytes, -1 for the rest of the file */
+  int hdu;          /* HDU number, 0 for a whole file (bytes not kept) */
+  int state;        /* PREFETCH_PENDING, PREFETCH_READY or PREFETCH_FAILED */
+} prefetch_entry_t;
+
+struct _prefetch {
+  int nrefs;        /* number of references (owner and reader thread) */
+  int cancel;       /* reader thread must stop? */
+  int count;        /* number of entries */
+  prefetch_entry_t entry[1];
+};
 
-  case TDOUBLE:
-    type = TDOUBLE;
-    arr = ypush_d(dims);
-    null.type = Y_DOUBLE;
-    break;
+static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
 
-  case TCOMPLEX:
-  case TDBLCOMPLEX:
-    type = TDBLCOMPLEX;
-    arr = ypush_z(dims);
-    null.type = Y_COMPLEX;
-    break;
+/* Prefetching of whole files, not attached to any FITS handle. */
+static prefetch_t* file_prefetch = NULL;
 
-  default:
-    arr = NULL;
-    y_error("unsupported array type");
-  }
+static prefetch_t*
+new_prefetch(int count)
+{
+  size_t size = sizeof(prefetch_t) +
+    (count > 1 ? count - 1 : 0)*sizeof(prefetch_entry_t);
+  prefetch_t* p = (prefetch_t*)malloc(size);
+  if (p != NULL) {
+    memset(p, 0, size);
+    p->nrefs = 1;
+  }
+  return p;
+}
 
-  /* Read the values. */
-  fits_read_col(fptr, type, colnum, firstrow, 1, number,
-                &null.value, arr, &anynull, &status);
-  if (status != 0) {
-    yfits_error(status);
+static void
+free_prefetch(prefetch_t* p)
+{
+  int i;
+  for (i = 0; i < p->count; ++i) {
+    free(p->entry[i].path);
+    free(p->entry[i].data);
   }
+  free(p);
+}
 
-  /* Save the 'null' value. */
-  if (null_index != -1) {
-    if (anynull == 0) {
-      ypush_nil();
-    } else {
-      push_scalar(&null);
+/* Add an entry to prefetch request P, returns FALSE if out of memory. */
+static int
+add_prefetch(prefetch_t* p, const char* path, LONGLONG offset,
+             LONGLONG size, int hdu)
+{
+  prefetch_entry_t* e = &p->entry[p->count];
+  size_t len = strlen(path);
+  if ((e->path = (char*)malloc(len + 1)) == NULL) {
+    return FALSE;
+  }
+  memcpy(e->path, path, len + 1);
+  e->data = NULL;
+  e->offset = offset;
+  e->size = size;
+  e->hdu = hdu;
+  e->state = PREFETCH_PENDING;
+  ++p->count;
+  return TRUE;
+}
+
+static void
+release_prefetch(prefetch_t* p)
+{
+  int last;
+  if (p != NULL) {
+    pthread_mutex_lock(&prefetch_mutex);
+    p->cancel = TRUE;
+    last = (--p->nrefs == 0);
+    pthread_mutex_unlock(&prefetch_mutex);
+    if (last) {
+      free_prefetch(p);
     }
-    yput_global(null_index, 0);
-    yarg_drop(1);
   }
 }
 
-#if 0
-void
-Y_fitsio_insert_rows(int argc)
+static void
+drop_prefetch(yfits_object* obj)
 {
-  fitsfile* fptr;
-  long firstrow, nrows;
-  int status = 0;
+  prefetch_t* p = obj->prefetch;
+  if (p != NULL) {
+    obj->prefetch = NULL;
+    release_prefetch(p);
+  }
 }
-#endif
-
-/*---------------------------------------------------------------------------*/
-/* UTILITY ROUTINES */
 
-void
-Y_fitsio_write_chksum(int argc)
+static int
+prefetch_cancelled(prefetch_t* p)
 {
-  int status = 0;
-  if (argc != 1) y_error("expecting exactly one argument");
-  fits_write_chksum(yfits_fetch(0, NOT_CLOSED|CRITICAL)->fptr, &status);
-  if (status != 0) yfits_error(status);
-  ypush_nil();
+  int cancel;
+  pthread_mutex_lock(&prefetch_mutex);
+  cancel = p->cancel;
+  pthread_mutex_unlock(&prefetch_mutex);
+  return cancel;
 }
 
-void
-Y_fitsio_update_chksum(int argc)
+/* Read the bytes of entry E of prefetch request P (called by the reader
+   thread).  Bytes are read by blocks of RAW_BLOCK_SIZE to check for
+   cancellation; if they are not kept, the same block is reused (the purpose
+   is then to have the file in the page cache of the system). */
+static void
+prefetch_entry(prefetch_t* p, prefetch_entry_t* e)
 {
-  int status = 0;
-  if (argc != 1) y_error("expecting exactly one argument");
-  fits_update_chksum(yfits_fetch(0, NOT_CLOSED|CRITICAL)->fptr, &status);
-  if (status != 0) yfits_error(status);
-  ypush_nil();
+  struct stat st;
+  LONGLONG size, offset, n;
+  ssize_t nr;
+  char* buf = NULL;
+  int fd, keep, state;
+
+  state = PREFETCH_FAILED;
+  keep = (e->hdu > 0);
+  fd = open(e->path, O_RDONLY);
+  if (fd == -1) {
+    goto done;
+  }
+  size = e->size;
+  if (fstat(fd, &st) != 0) {
+    goto done;
+  }
+  if (size < 0) {
+    size = st.st_size - e->offset;
+  }
+  if (size < 0 || e->offset + size > st.st_size) {
+    /* Not the expected file or truncated file. */
+    goto done;
+  }
+  buf = (char*)malloc(keep ? (size > 0 ? size : 1) : RAW_BLOCK_SIZE);
+  if (buf == NULL) {
+    goto done;
+  }
+  for (offset = 0; offset < size; offset += nr) {
+    if (prefetch_cancelled(p)) {
+      goto done;
+    }
+    n = size - offset;
+    if (n > RAW_BLOCK_SIZE) {
+      n = RAW_BLOCK_SIZE;
+    }
+    /* All signals are blocked in this thread, so there is no EINTR. */
+    nr = pread(fd, (keep ? buf + offset : buf), n, e->offset + offset);
+    if (nr <= 0) {
+      goto done;
+    }
+  }
+  state = PREFETCH_READY;
+ done:
+  if (fd != -1) {
+    close(fd);
+  }
+  pthread_mutex_lock(&prefetch_mutex);
+  if (state == PREFETCH_READY && keep && ! p->cancel) {
+    e->data = buf;
+    buf = NULL;
+  }
+  e->state = state;
+  pthread_cond_broadcast(&prefetch_cond);
+  pthread_mutex_unlock(&prefetch_mutex);
+  free(buf);
 }
 
-void
-Y_fitsio_verify_chksum(int argc)
+static void*
+prefetch_worker(void* arg)
 {
-  long dims[] = {1, 2};
-  int* result;
-  int status = 0;
-  if (argc != 1) y_error("expecting exactly one argument");
-  result = ypush_i(dims);
-  fits_verify_chksum(yfits_fetch(1, NOT_CLOSED|CRITICAL)->fptr,
-                     &result[0], &result[1], &status);
-  if (status != 0) yfits_error(status);
+  prefetch_t* p = (prefetch_t*)arg;
+  int i;
+  for (i = 0; i < p->count; ++i) {
+    prefetch_entry(p, &p->entry[i]);
+  }
+  release_prefetch(p);
+  return NULL;
 }
 
-void
-Y_fitsio_get_chksum(int argc)
+/* Start the reader thread of prefetch request P.  In case of failure, P is
+   freed and an error is thrown. */
+static void
+start_prefetch(prefetch_t* p)
 {
-  long dims[] = {1, 2};
-  unsigned long* result;
-  int status = 0;
-  if (argc != 1) y_error("expecting exactly one argument");
-  result = (unsigned long*)ypush_l(dims);
-  fits_get_chksum(yfits_fetch(1, NOT_CLOSED|CRITICAL)->fptr,
-                  &result[0], &result[1], &status);
-  if (status != 0) yfits_error(status);
+  pthread_t thread;
+  sigset_t all, old;
+  int code;
+
+  /* The reader thread holds its own reference and is started with all
+     signals blocked so that they are delivered to the main thread. */
+  p->nrefs = 2;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  code = pthread_create(&thread, NULL, prefetch_worker, p);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (code != 0) {
+    free_prefetch(p);
+    y_error("failed to start prefetching thread");
+  }
+  pthread_detach(thread);
 }
 
-void
-Y_fitsio_encode_chksum(int argc)
+/* Claim the prefetched data part of HDU number HDU of FITS handle OBJ,
+   waiting for the reader thread if needed.  The data part must start at
+   DATASTART and end at DATAEND (to detect changes in the file).  Returns
+   NULL if the bytes are not available; otherwise, the caller owns the
+   returned buffer and shall free it with `free`. */
+static char*
+claim_prefetch(yfits_object* obj, int hdu, LONGLONG datastart,
+               LONGLONG dataend)
 {
-  char ascii[17];
-  unsigned long sum;
-  int compl;
+  prefetch_t* p = obj->prefetch;
+  char* data = NULL;
+  double t0;
+  int i;
+
+  if (p == NULL) {
+    return NULL;
+  }
+  t0 = stats_clock();
+  pthread_mutex_lock(&prefetch_mutex);
+  for (i = 0; i < p->count; ++i) {
+    prefetch_entry_t* e = &p->entry[i];
+    if (e->hdu == hdu) {
+      if (e->offset == datastart && e->size == dataend - datastart) {
+        while (e->state == PREFETCH_PENDING) {
+          pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+        }
+        data = e->data;
+        e->data = NULL;
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&prefetch_mutex);
 
-  if (argc == 1) {
-    sum = ygets_l(0);
-    compl = FALSE;
-  } else if (argc == 2) {
-    sum = ygets_l(1);
-    compl = yarg_true(0);
+  /* The time spent waiting for the reader thread is accounted as reading. */
+  count_cache(data != NULL);
+  if (data != NULL) {
+    count_read(dataend - datastart, t0);
+  }
+  return data;
+}
+
+/* Start reading ahead the data parts of the N image HDUs listed in HDUS for
+   FITS handle OBJ.  If HDUS is NULL, the N HDUs starting at the current one
+   are considered (fewer if the file has less HDUs).  Non-image HDUs and
+   HDUs without data are ignored.  Nothing is done if the file is not a
+   regular file. */
+static void
+prefetch_hdus(yfits_object* obj, const long* hdus, long n)
+{
+  fitsfile* fptr = obj->fptr;
+  char urltype[FLEN_FILENAME];
+  const hdu_entry_t* index;
+  prefetch_t* p;
+  long k, count;
+  int hdu, first, iomode, status = 0;
+
+  drop_prefetch(obj);
+  if (fits_url_type(fptr, urltype, &status) != 0) {
+    yfits_error(status);
+  }
+  if (n <= 0 || strcmp(urltype, "file://") != 0) {
+    return;
+  }
+  if ((index = get_hdu_index(obj, &status)) == NULL ||
+      fits_file_mode(fptr, &iomode, &status) != 0 ||
+      (iomode == READWRITE && fits_flush_file(fptr, &status) != 0) ||
+      fits_file_name(fptr, buffer, &status) != 0) {
+    yfits_error(status);
+  }
+  fits_get_hdu_num(fptr, &first);
+  if (hdus == NULL) {
+    if (n > obj->nhdus - first + 1) {
+      n = obj->nhdus - first + 1;
+    }
   } else {
-    y_error("expecting 1 or 2 argument");
+    for (k = 0; k < n; ++k) {
+      if (hdus[k] < 1 || hdus[k] > obj->nhdus) {
+        y_error("out of range HDU number");
+      }
+    }
   }
-  fits_encode_chksum(sum, compl, ascii);
-  push_string(ascii);
+  count = 0;
+  for (k = 0; k < n; ++k) {
+    const hdu_entry_t* e;
+    hdu = (hdus == NULL ? first + k : hdus[k]);
+    e = &index[hdu-1];
+    if (e->type == IMAGE_HDU && e->dataend > e->datastart) {
+      ++count;
+    }
+  }
+  if (count == 0) {
+    return;
+  }
+  if ((p = new_prefetch(count)) == NULL) {
+    y_error("insufficient memory");
+  }
+  for (k = 0; k < n; ++k) {
+    const hdu_entry_t* e;
+    hdu = (hdus == NULL ? first + k : hdus[k]);
+    e = &index[hdu-1];
+    if (e->type == IMAGE_HDU && e->dataend > e->datastart &&
+        ! add_prefetch(p, buffer, e->datastart, e->dataend - e->datastart,
+                       hdu)) {
+      free_prefetch(p);
+      y_error("insufficient memory");
+    }
+  }
+  start_prefetch(p);
+  obj->prefetch = p;
 }
 
 void
-Y_fitsio_decode_chksum(int argc)
+Y_fitsio_prefetch(int argc)
 {
-  char* ascii;
-  unsigned long sum;
-  int compl;
-
-  if (argc == 1) {
-    ascii = ygets_q(0);
-    compl = FALSE;
-  } else if (argc == 2) {
-    ascii = ygets_q(1);
-    compl = yarg_true(0);
+  if (argc > 2) {
+    y_error("too many arguments");
+  }
+  if (argc == 0 || yarg_string(argc - 1)) {
+    /* Read ahead whole files. */
+    char** names = NULL;
+    prefetch_t* p;
+    long k, n = 0, count = 0;
+    release_prefetch(file_prefetch);
+    file_prefetch = NULL;
+    if (argc == 2) {
+      y_error("too many arguments");
+    }
+    if (argc == 1) {
+      names = ygeta_q(0, &n, NULL);
+      for (k = 0; k < n; ++k) {
+        if (names[k] != NULL && names[k][0] != '\0') {
+          ++count;
+        }
+      }
+    }
+    if (count == 0) {
+      return;
+    }
+    if ((p = new_prefetch(count)) == NULL) {
+      y_error("insufficient memory");
+    }
+    for (k = 0; k < n; ++k) {
+      if (names[k] != NULL && names[k][0] != '\0') {
+        char* path = p_native(names[k]);
+        int ok = (path != NULL && add_prefetch(p, path, 0, -1, 0));
+        if (path != NULL) p_free(path);
+        if (! ok) {
+          free_prefetch(p);
+          y_error("insufficient memory");
+        }
+      }
+    }
+    start_prefetch(p);
+    file_prefetch = p;
   } else {
-    y_error("expecting 1 or 2 argument");
-  }
-  if (ascii == NULL || strlen(ascii) != 16) {
-    y_error("length of checksum string should be exactly 16 characters");
+    /* Read ahead HDUs of a FITS file. */
+    yfits_object* obj = yfits_fetch(argc - 1, NOT_CLOSED|CRITICAL);
+    if (argc == 1) {
+      drop_prefetch(obj);
+    } else {
+      long n;
+      long* hdus = ygeta_l(0, &n, NULL);
+      prefetch_hdus(obj, hdus, n);
+    }
   }
-  ypush_long(fits_decode_chksum(ascii, compl, &sum));
 }
 
 /*---------------------------------------------------------------------------*/
-/* MISCELLANEOUS */
+/* COMPRESSED FILES */
+
+/* Decompressed contents of a gzip'd file.  The bytes are given to CFITSIO
+   as a read-only memory file.  If the cache of decompressed files is
+   enabled (see `fitsio_setup`), the entry is shared by all the handles
+   opened on the same file (identified by its name, size and modification
+   time) and kept, in least recently used order, until evicted. */
+struct _inflated {
+  inflated_t* prev;  /* previous (more recently used) entry in the cache */
+  inflated_t* next;  /* next (less recently used) entry in the cache */
+  char* path;        /* name of the file */
+  off_t size;        /* size of the compressed file */
+  time_t mtime;      /* modification time of the compressed file */
+  void* data;        /* decompressed bytes */
+  size_t datasize;   /* number of decompressed bytes */
+  long nrefs;        /* number of handles using the entry */
+  int cached;        /* entry is in the cache? */
+};
 
-void
-Y_fitsio_get_version(int argc)
+static inflated_t* gzcache_first = NULL; /* most recently used entry */
+static inflated_t* gzcache_last = NULL;  /* least recently used entry */
+static size_t gzcache_used = 0;          /* bytes in the cache */
+static size_t gzcache_size = 0;          /* maximum bytes in the cache */
+
+/* A gzip member inflated by `inflate_task`. */
+typedef struct {
+  const unsigned char* src; /* deflated data */
+  size_t srcsize;           /* number of deflated bytes */
+  unsigned char* dst;       /* destination of the inflated bytes */
+  size_t dstsize;           /* number of inflated bytes (ISIZE) */
+  uLong crc;                /* expected CRC-32 of the inflated bytes */
+} gzip_member_t;
+
+static void
+free_inflated(inflated_t* e)
 {
-  float version;
-  fits_get_version(&version);
-  ypush_double((double)version);
+  if (e->data != NULL) {
+    free(e->data);
+  }
+  if (e->path != NULL) {
+    free(e->path);
+  }
+  free(e);
 }
 
-void
-Y_fitsio_debug(int argc)
+static void
+unlink_inflated(inflated_t* e)
 {
-  int new_value, old_value;
-  if (argc != 1) y_error("expecting exactly one argument");
-  new_value = yarg_true(0);
-  old_value = yfits_debug;
-  yfits_debug = new_value;
-  ypush_int(old_value);
+  if (e->prev != NULL) {
+    e->prev->next = e->next;
+  } else {
+    gzcache_first = e->next;
+  }
+  if (e->next != NULL) {
+    e->next->prev = e->prev;
+  } else {
+    gzcache_last = e->prev;
+  }
+  e->prev = NULL;
+  e->next = NULL;
 }
 
-void
-Y_fitsio_setup(int argc)
+/* Evict the least recently used entries until the cache has at most SIZE
+   bytes.  Entries still in use are freed by their last handle. */
+static void
+evict_inflated(size_t size)
 {
-  /* Define constants. */
-#define DEFINE_INT_CONST(c)    define_int_const("FITSIO_"#c, c)
-  DEFINE_INT_CONST(IMAGE_HDU);
-  DEFINE_INT_CONST(ASCII_TBL);
-  DEFINE_INT_CONST(BINARY_TBL);
-  DEFINE_INT_CONST(ANY_HDU);
-  DEFINE_INT_CONST(BYTE_IMG);
-  DEFINE_INT_CONST(SHORT_IMG);
-  DEFINE_INT_CONST(LONG_IMG);
-  DEFINE_INT_CONST(LONGLONG_IMG);
-  DEFINE_INT_CONST(FLOAT_IMG);
-  DEFINE_INT_CONST(DOUBLE_IMG);
-  DEFINE_INT_CONST(SBYTE_IMG);
-  DEFINE_INT_CONST(USHORT_IMG);
-  DEFINE_INT_CONST(ULONG_IMG);
-#undef DEFINE_INT_CONST
-  ypush_nil();
+  while (gzcache_used > size && gzcache_last != NULL) {
+    inflated_t* e = gzcache_last;
+    unlink_inflated(e);
+    e->cached = FALSE;
+    gzcache_used -= e->datasize;
+    if (e->nrefs < 1) {
+      free_inflated(e);
+    }
+  }
+}
 
-  /* Define fast keyword/member indexes. */
-#define INIT(s) if (index_of_##s == -1L) index_of_##s = yget_global(#s, 0)
-  INIT(ascii);
-  INIT(basic);
-  INIT(case);
-  INIT(extname);
-  INIT(first);
-  INIT(incr);
-  INIT(last);
-  INIT(null);
-  INIT(number);
-  INIT(tunit);
-  INIT(def);
-#undef INIT
+static void
+set_gzcache(long size)
+{
+  if (size < 0) {
+    y_error("GZCACHE must be nonnegative");
+  }
+  gzcache_size = size;
+  evict_inflated(gzcache_size);
+}
+
+static void
+drop_inflated(yfits_object* obj)
+{
+  inflated_t* e = obj->inflated;
+  if (e != NULL) {
+    obj->inflated = NULL;
+    if (--e->nrefs < 1 && ! e->cached) {
+      free_inflated(e);
+    }
+  }
+}
+
+static uint32_t
+get_le32(const unsigned char* p)
+{
+  return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+          ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
 }
 
-/*---------------------------------------------------------------------------*/
-/* METHODS */
+/* Parse the header of the gzip member at OFFSET in the SIZE bytes of BUF.
+   Returns the offset of the deflated data (-1 if the header is invalid)
+   and stores in BSIZE the size of the member given by a BGZF extra field
+   ("BC" subfield written by bgzip), 0 if there is none. */
+static long
+gzip_header(const unsigned char* buf, size_t size, size_t offset,
+            size_t* bsize)
+{
+  const unsigned char* p = buf + offset;
+  size_t n = size - offset, pos, xlen, len, k;
+  int flg;
+
+  *bsize = 0;
+  if (offset + 18 > size || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8) {
+    return -1;
+  }
+  flg = p[3];
+  pos = 10;
+  if ((flg & 4) != 0) {
+    /* FEXTRA: look for the BGZF subfield. */
+    xlen = p[10] | (p[11] << 8);
+    pos = 12;
+    if (pos + xlen > n) {
+      return -1;
+    }
+    for (k = 0; k + 4 <= xlen; k += 4 + len) {
+      len = p[pos+k+2] | (p[pos+k+3] << 8);
+      if (p[pos+k] == 'B' && p[pos+k+1] == 'C' && len == 2 &&
+          k + 6 <= xlen) {
+        *bsize = (p[pos+k+4] | (p[pos+k+5] << 8)) + 1;
+      }
+    }
+    pos += xlen;
+  }
+  if ((flg & 8) != 0) {
+    /* FNAME */
+    while (pos < n && p[pos] != 0) ++pos;
+    ++pos;
+  }
+  if ((flg & 16) != 0) {
+    /* FCOMMENT */
+    while (pos < n && p[pos] != 0) ++pos;
+    ++pos;
+  }
+  if ((flg & 2) != 0) {
+    /* FHCRC */
+    pos += 2;
+  }
+  return (pos + 8 <= n ? (long)(offset + pos) : -1);
+}
 
-static yfits_object*
-yfits_push(void)
+static int
+inflate_task(void* ctx, long i)
 {
-  return (yfits_object*)ypush_obj(&yfits_type, sizeof(yfits_object));
+  gzip_member_t* m = (gzip_member_t*)ctx + i;
+  z_stream z;
+  int code;
+
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, -MAX_WBITS) != Z_OK) {
+    return 1;
+  }
+  z.next_in = (Bytef*)m->src;
+  z.avail_in = m->srcsize;
+  z.next_out = m->dst;
+  z.avail_out = m->dstsize;
+  code = inflate(&z, Z_FINISH);
+  inflateEnd(&z);
+  return (code != Z_STREAM_END || z.avail_out != 0 ||
+          crc32(crc32(0L, Z_NULL, 0), m->dst, m->dstsize) != m->crc);
 }
 
-static yfits_object*
-yfits_fetch(int iarg, unsigned int flags)
+/* Inflate the gzip members of SRC in parallel if they all have a BGZF extra
+   field (each member has then its compressed and inflated sizes), return
+   FALSE if this is not the case. */
+static int
+inflate_members(const unsigned char* src, size_t srcsize, int nthreads,
+                void** data, size_t* datasize, int* status)
 {
-  yfits_object* obj = (yfits_object*)yget_obj(iarg, &yfits_type);
-  if ((flags & (NOT_CLOSED|MAY_BE_CLOSED)) == NOT_CLOSED
-      && obj->fptr == NULL) {
-    y_error("FITS file has been closed");
+  gzip_member_t* m;
+  unsigned char* dst;
+  size_t offset, bsize, total;
+  long pos, k, n;
+
+  /* Scan the headers of the members. */
+  n = 0;
+  total = 0;
+  for (offset = 0; offset < srcsize; offset += bsize) {
+    pos = gzip_header(src, srcsize, offset, &bsize);
+    if (pos < 0 && offset > 0) {
+      break; /* trailing garbage */
+    }
+    if (pos < 0 || bsize < (pos - offset) + 8 ||
+        offset + bsize > srcsize) {
+      return FALSE;
+    }
+    total += get_le32(src + offset + bsize - 4);
+    ++n;
   }
-  if ((flags & CRITICAL) == CRITICAL) {
-    critical(TRUE);
+  if ((m = (gzip_member_t*)malloc(n*sizeof(gzip_member_t))) == NULL ||
+      (dst = (unsigned char*)malloc(total > 0 ? total : 1)) == NULL) {
+    if (m != NULL) {
+      free(m);
+    }
+    *status = MEMORY_ALLOCATION;
+    return TRUE;
+  }
+  total = 0;
+  offset = 0;
+  for (k = 0; k < n; ++k) {
+    pos = gzip_header(src, srcsize, offset, &bsize);
+    m[k].src = src + pos;
+    m[k].srcsize = offset + bsize - 8 - pos;
+    m[k].dst = dst + total;
+    m[k].dstsize = get_le32(src + offset + bsize - 4);
+    m[k].crc = get_le32(src + offset + bsize - 8);
+    total += m[k].dstsize;
+    offset += bsize;
+  }
+  pool_start(inflate_task, m, n, nthreads);
+  if (pool_wait() != 0) {
+    free(dst);
+    *status = DATA_DECOMPRESSION_ERR;
+  } else {
+    *data = dst;
+    *datasize = total;
   }
-  return obj;
+  free(m);
+  return TRUE;
 }
 
-static const char*
-hdu_type_name(int type)
+/* Inflate the gzip stream (possibly made of several members) in SRC by a
+   single thread.  The size of the result is first guessed from the ISIZE
+   field of the last member (the size modulo 2^32). */
+static int
+inflate_stream(const unsigned char* src, size_t srcsize, void** data,
+               size_t* datasize, int* status)
 {
-  switch (type) {
-  case IMAGE_HDU:  return "image";
-  case BINARY_TBL: return "binary table";
-  case ASCII_TBL:  return "ascii table";
-  default:         return "unknown HDU type";
+  z_stream z;
+  unsigned char* dst;
+  unsigned char* ptr;
+  size_t size, used, offset, chunk;
+  int code;
+
+  size = get_le32(src + srcsize - 4);
+  if (size < 2*srcsize) {
+    size = 2*srcsize;
+  }
+  if ((dst = (unsigned char*)malloc(size)) == NULL) {
+    return (*status = MEMORY_ALLOCATION);
+  }
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) {
+    free(dst);
+    return (*status = MEMORY_ALLOCATION);
+  }
+  used = 0;
+  offset = 0;
+  code = Z_OK;
+  while (*status == 0) {
+    if (used == size) {
+      if ((ptr = (unsigned char*)realloc(dst, 2*size)) == NULL) {
+        *status = MEMORY_ALLOCATION;
+        break;
+      }
+      dst = ptr;
+      size *= 2;
+    }
+    /* Feed the input and collect the output by chunks which fit in the
+       32-bit counters of zlib. */
+    chunk = srcsize - offset;
+    z.next_in = (Bytef*)src + offset;
+    z.avail_in = (chunk > 0x40000000 ? 0x40000000 : chunk);
+    chunk = size - used;
+    z.next_out = dst + used;
+    z.avail_out = (chunk > 0x40000000 ? 0x40000000 : chunk);
+    chunk = z.avail_in;
+    code = inflate(&z, Z_NO_FLUSH);
+    offset += chunk - z.avail_in;
+    used = (unsigned char*)z.next_out - dst;
+    if (code == Z_STREAM_END) {
+      /* Continue with the next member, if any (trailing garbage, e.g.
+         zeros, is ignored). */
+      if (offset + 18 > srcsize || src[offset] != 0x1f ||
+          src[offset+1] != 0x8b) {
+        break;
+      }
+      inflateReset(&z);
+    } else if (code != Z_OK && code != Z_BUF_ERROR) {
+      *status = DATA_DECOMPRESSION_ERR;
+    } else if (code == Z_BUF_ERROR && offset >= srcsize) {
+      *status = DATA_DECOMPRESSION_ERR; /* truncated file */
+    }
+  }
+  inflateEnd(&z);
+  if (*status != 0) {
+    free(dst);
+  } else {
+    *data = dst;
+    *datasize = used;
   }
+  return *status;
 }
 
-
-/*---------------------------------------------------------------------------*/
-/* UTILITIES */
-
+/* Open file PATH in inflate mode: if the file is gzip'd, it is decompressed
+   in memory by the plug-in (with NTHREADS threads for BGZF files) or taken
+   from the cache, and CFITSIO sees the decompressed bytes as a read-only
+   memory file; otherwise, the file is opened as a disk file. */
 static int
-trim_string(char* dst, const char* src)
+open_inflated(yfits_object* obj, const char* path, int nthreads,
+              int* status)
 {
-  int c, i, copy = FALSE;
-  int j = 0; /* index to write in dst */
-  int k = 0; /* length, last non space in dst + 1 */
-
-  for (i = 0; (c = src[i]) != '\0'; ++i) {
-    if (c == ' ' || IS_WHITE(c)) {
-      if (copy) {
-        dst[j++] = c;
+  struct stat st;
+  unsigned char* src;
+  inflated_t* e;
+  double t0;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    return (*status = FILE_NOT_OPENED);
+  }
+  if (fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode) || st.st_size < 18 ||
+      (src = (unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+                                  fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return fits_open_diskfile(&obj->fptr, path, READONLY, status);
+  }
+  close(fd);
+  if (src[0] != 0x1f || src[1] != 0x8b) {
+    munmap(src, st.st_size);
+    return fits_open_diskfile(&obj->fptr, path, READONLY, status);
+  }
+  stats_obj = obj;
+
+  /* Search the cache. */
+  for (e = gzcache_first; e != NULL; e = e->next) {
+    if (e->size == st.st_size && e->mtime == st.st_mtime &&
+        strcmp(e->path, path) == 0) {
+      break;
+    }
+  }
+  if (gzcache_size > 0) {
+    count_cache(e != NULL);
+  }
+  if (e != NULL) {
+    munmap(src, st.st_size);
+    unlink_inflated(e);
+  } else {
+    /* Decompress the file. */
+    if ((e = (inflated_t*)calloc(1, sizeof(inflated_t))) == NULL ||
+        (e->path = strdup(path)) == NULL) {
+      if (e != NULL) {
+        free(e);
       }
+      munmap(src, st.st_size);
+      return (*status = MEMORY_ALLOCATION);
+    }
+    e->size = st.st_size;
+    e->mtime = st.st_mtime;
+    madvise(src, st.st_size, MADV_SEQUENTIAL);
+    /* The compressed bytes are read (through the mapping) while they are
+       decompressed, the whole time is counted as a read. */
+    t0 = stats_clock();
+    if (! inflate_members(src, st.st_size, nthreads, &e->data,
+                          &e->datasize, status)) {
+      inflate_stream(src, st.st_size, &e->data, &e->datasize, status);
+    }
+    munmap(src, st.st_size);
+    count_read(st.st_size, t0);
+    if (*status != 0) {
+      free_inflated(e);
+      return *status;
+    }
+    if (e->datasize <= gzcache_size) {
+      evict_inflated(gzcache_size - e->datasize);
+      e->cached = TRUE;
+      gzcache_used += e->datasize;
+    }
+  }
+  if (e->cached) {
+    /* Move (or insert) the entry at the head of the cache. */
+    e->next = gzcache_first;
+    if (gzcache_first != NULL) {
+      gzcache_first->prev = e;
     } else {
-      copy = TRUE;
-      dst[j++] = c;
-      k = j;
+      gzcache_last = e;
     }
+    gzcache_first = e;
   }
-  dst[k] = '\0';
-  return k;
+  obj->inflated = e;
+  ++e->nrefs;
+  /* PATH must not be parsed as an extended file name (see `open_header`). */
+  if (fits_open_memfile(&obj->fptr, "mem://", READONLY, &e->data,
+                        &e->datasize, 0, NULL, status) != 0) {
+    obj->fptr = NULL;
+    drop_inflated(obj);
+  }
+  return *status;
 }
 
-static void
-critical(int clear_errmsg)
+/*---------------------------------------------------------------------------*/
+/* REOPENED HANDLES */
+
+/* Thread-safety.  A CFITSIO file (and thus a FITS handle and the handles
+   reopened from it, which share the buffers of CFITSIO) must only be used by
+   the main thread.  The data of a read-only regular file can however be read
+   by any number of threads at the same time with `read_at` on the shared
+   descriptor, which is plain `pread` on a descriptor that stays open as
+   long as any of the handles sharing it.  Typical use is to get the
+   addresses of the HDUs to read (e.g. with `fits_get_hduaddrll`) in the
+   main thread, then to let the workers read and convert the bytes. */
+struct _shared_fd {
+  int fd;    /* file descriptor */
+  int nrefs; /* number of handles sharing the descriptor (only modified by
+                the main thread) */
+};
+
+static int
+shared_descriptor(yfits_object* obj, int create)
 {
-  if (p_signalling) {
-    p_abort();
-  }
-  if (clear_errmsg) {
-    fits_clear_errmsg();
-  }
+  shared_fd_t* sfd;
+  char urltype[FLEN_FILENAME];
+  int fd, iomode, status = 0;
+
+  if (obj->sfd != NULL) {
+    return obj->sfd->fd;
+  }
+  if (! create || obj->fptr == NULL || obj->membuf != NULL ||
+      obj->inflated != NULL ||
+      fits_url_type(obj->fptr, urltype, &status) != 0 ||
+      strcmp(urltype, "file://") != 0 ||
+      fits_file_mode(obj->fptr, &iomode, &status) != 0 ||
+      iomode != READONLY ||
+      fits_file_name(obj->fptr, buffer, &status) != 0) {
+    return -1;
+  }
+  sfd = (shared_fd_t*)malloc(sizeof(shared_fd_t));
+  if (sfd == NULL) {
+    return -1;
+  }
+  fd = open(buffer, O_RDONLY);
+  if (fd == -1) {
+    free(sfd);
+    return -1;
+  }
+  sfd->fd = fd;
+  sfd->nrefs = 1;
+  obj->sfd = sfd;
+  return fd;
 }
 
 static void
-define_int_const(const char* name, int value)
+drop_descriptor(yfits_object* obj)
 {
-  ypush_int(value);
-  yput_global(yget_global(name, 0), 0);
-  yarg_drop(1);
+  shared_fd_t* sfd = obj->sfd;
+  if (sfd != NULL) {
+    obj->sfd = NULL;
+    if (--sfd->nrefs < 1) {
+      close(sfd->fd);
+      free(sfd);
+    }
+  }
 }
 
 static int
-fetch_int(int iarg)
+read_at(int fd, void* buf, size_t n, LONGLONG offset)
 {
-  long lval = ygets_l(iarg);
-  int ival = (int)lval;
-  if (ival != lval) y_error("integer overflow");
-  return ival;
+  ssize_t nr;
+  size_t got;
+  for (got = 0; got < n; got += nr) {
+    nr = pread(fd, (char*)buf + got, n - got, offset + got);
+    if (nr <= 0) {
+      return FALSE;
+    }
+  }
+  return TRUE;
 }
 
-static void
-push_string(const char* str)
+/* Open another handle on the file of a read-only FITS handle.  The new
+   handle shares the CFITSIO file and the descriptor for `read_at` but has
+   its own current HDU. */
+void
+Y_fitsio_reopen_file(int argc)
 {
-  ypush_q(NULL)[0] = p_strcpy(str);
+  yfits_object* obj;
+  yfits_object* clone;
+  int hdu, type, iomode, status = 0;
+
+  if (argc != 1) y_error("expecting exactly one argument");
+  obj = yfits_fetch(0, NOT_CLOSED|CRITICAL);
+  if (obj->membuf != NULL) {
+    y_error("cannot reopen a file opened in header-only mode");
+  }
+  if (fits_file_mode(obj->fptr, &iomode, &status) != 0) {
+    yfits_error(status);
+  }
+  if (iomode != READONLY) {
+    y_error("only files opened for reading can be reopened");
+  }
+  shared_descriptor(obj, TRUE);
+  clone = yfits_push();
+  clone->bufsize = obj->bufsize;
+  clone->direct = obj->direct;
+  if (obj->inflated != NULL) {
+    clone->inflated = obj->inflated;
+    ++clone->inflated->nrefs;
+  }
+  if (obj->sfd != NULL) {
+    clone->sfd = obj->sfd;
+    ++clone->sfd->nrefs;
+  }
+  fits_get_hdu_num(obj->fptr, &hdu);
+  if (fits_reopen_file(obj->fptr, &clone->fptr, &status) == 0) {
+    fits_movabs_hdu(clone->fptr, hdu, &type, &status);
+  }
+  if (status != 0) yfits_error(status);
 }
 
-static void
-define_string(long index, const char* str)
+/*---------------------------------------------------------------------------*/
+/* MULTI-THREADING */
+
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup;   /* signaled when a new job is available */
+  pthread_cond_t finished; /* signaled when all tasks of a job are done */
+  task_function* func;
+  void* ctx;
+  long ntasks;  /* number of tasks of the current job */
+  long next;    /* next task to perform */
+  long pending; /* number of unfinished tasks */
+  int result;   /* bitwise-or of the results of the finished tasks */
+  int limit;    /* maximum number of busy workers for the current job */
+  int nbusy;    /* number of busy workers */
+  int nworkers; /* number of started workers */
+} pool = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+  PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, 0, 0, 0, 0
+};
+
+static void*
+pool_worker(void* arg)
 {
-  push_string(str);
-  yput_global(index, 0);
-  yarg_drop(1);
+  task_function* func;
+  void* ctx;
+  long i;
+  int result;
+
+  pthread_mutex_lock(&pool.mutex);
+  for (;;) {
+    while (pool.next >= pool.ntasks || pool.nbusy >= pool.limit) {
+      pthread_cond_wait(&pool.wakeup, &pool.mutex);
+    }
+    i = pool.next++;
+    func = pool.func;
+    ctx = pool.ctx;
+    ++pool.nbusy;
+    pthread_mutex_unlock(&pool.mutex);
+    result = func(ctx, i);
+    pthread_mutex_lock(&pool.mutex);
+    --pool.nbusy;
+    pool.result |= result;
+    if (--pool.pending == 0) {
+      pthread_cond_broadcast(&pool.finished);
+    }
+  }
+  return NULL;
 }
 
 static void
-push_complex(double re, double im)
+pool_start(task_function* func, void* ctx, long ntasks, int nthreads)
 {
-  double* z = ypush_z(NULL);
-  z[0] = re;
-  z[1] = im;
+  /* The caller is one of the threads. */
+  int nworkers = (nthreads > MAX_THREADS ? MAX_THREADS : nthreads) - 1;
+  if (nworkers > ntasks - 1) {
+    nworkers = (ntasks > 1 ? ntasks - 1 : 0);
+  }
+  pthread_mutex_lock(&pool.mutex);
+  while (pool.nworkers < nworkers) {
+    /* Start a new worker with all signals blocked so that they are delivered
+       to the main thread. */
+    pthread_t thread;
+    sigset_t all, old;
+    int code;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    code = pthread_create(&thread, NULL, pool_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (code != 0) {
+      /* Just use fewer threads. */
+      break;
+    }
+    pthread_detach(thread);
+    ++pool.nworkers;
+  }
+  pool.func = func;
+  pool.ctx = ctx;
+  pool.ntasks = ntasks;
+  pool.next = 0;
+  pool.pending = ntasks;
+  pool.result = 0;
+  pool.limit = nworkers;
+  pthread_cond_broadcast(&pool.wakeup);
+  pthread_mutex_unlock(&pool.mutex);
 }
 
-static void
-push_scalar(const scalar_t* s)
+static int
+pool_wait(void)
 {
-  switch (s->type) {
-  case Y_CHAR:
-    *ypush_c(NULL) = s->value.c;
-    break;
-  case Y_SHORT:
-    *ypush_s(NULL) = s->value.s;
-    break;
-  case Y_INT:
-     ypush_int(s->value.i);
-    break;
-  case Y_LONG:
-    ypush_long(s->value.l);
-    break;
-  case Y_FLOAT:
-    *ypush_f(NULL) = s->value.f;
-    break;
-  case Y_DOUBLE:
-     ypush_double(s->value.d);
-    break;
-  case Y_VOID:
-    ypush_nil();
-    break;
-  default:
-    y_error("unknown scalar type");
-  }
+  task_function* func;
+  void* ctx;
+  long i;
+  int result;
+
+  /* The caller performs the remaining tasks, if any, then waits for the
+     workers to finish theirs. */
+  pthread_mutex_lock(&pool.mutex);
+  while (pool.next < pool.ntasks) {
+    i = pool.next++;
+    func = pool.func;
+    ctx = pool.ctx;
+    pthread_mutex_unlock(&pool.mutex);
+    result = func(ctx, i);
+    pthread_mutex_lock(&pool.mutex);
+    pool.result |= result;
+    --pool.pending;
+  }
+  while (pool.pending > 0) {
+    pthread_cond_wait(&pool.finished, &pool.mutex);
+  }
+  result = pool.result;
+  pool.func = NULL;
+  pool.ctx = NULL;
+  pool.ntasks = 0;
+  pool.next = 0;
+  pthread_mutex_unlock(&pool.mutex);
+  return result;
 }
 
-static char*
-fetch_path(int iarg)
+static int
+fetch_nthreads(int iarg)
 {
-  char** arr = ypush_q(NULL);
-  char* arg = ygets_q(iarg + 1);
-  if (arg != NULL) arr[0] = p_native(arg);
-  yarg_swap(iarg + 1, 0);
-  yarg_drop(1);
-  return arr[0];
+  long n;
+  if (yarg_nil(iarg)) {
+    return yfits_nthreads;
+  }
+  n = ygets_l(iarg);
+  if (n <= 0) {
+    /* Use all available processors. */
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) {
+      n = 1;
+    }
+  }
+  return (n > MAX_THREADS ? MAX_THREADS : (int)n);
 }
 
-static void
-get_dimlist(int iarg_first, int iarg_last,
-            long* dims, int maxdims)
+static long
+fetch_bufsize(int iarg)
 {
-  int iarg, rank, type, ndims = 0, k;
-  for (iarg = iarg_first; iarg >= iarg_last; --iarg) {
-    type = yarg_typeid(iarg);
-    if (type == Y_VOID) {
-      continue;
-    }
-    if (type > Y_LONG) {
-      y_error("bad type for dimension");
-    }
-    rank = yarg_rank(iarg);
-    if (rank == 0) {
-      /* scalar */
-      if (ndims >= maxdims) {
-         y_error("too many dimensions");
-      }
-      dims[++ndims] = ygets_l(iarg);
-    } else if (rank == 1) {
-      /* vector */
-      long i, ntot;
-      long* dimlist = ygeta_l(iarg, &ntot, NULL);
-      if (ntot < 1 || dimlist[0] != ntot - 1) {
-        y_error("bad dimension list");
-      }
-      if (ndims +  ntot - 1 > maxdims) {
-         y_error("too many dimensions");
-      }
-      for (i = 1; i < ntot; ++i) {
-        dims[++ndims] = dimlist[i];
-      }
-    } else {
-      y_error("bad dimension list");
-    }
+  long n;
+  if (yarg_nil(iarg)) {
+    return yfits_bufsize;
   }
-  for (k = 1; k <= ndims; ++k) {
-    if (dims[k] < 1) {
-      y_error("bad dimension");
-    }
+  n = ygets_l(iarg);
+  if (n < 2880) {
+    y_error("BUFSIZE must be at least 2880 bytes");
   }
-  dims[0] = ndims;
+  return n;
 }
 
-static int
-get_image_param(fitsfile* fptr, int maxdims, int* bitpix_ptr,
-                int* naxis_ptr, long dims[], long* number_ptr,
-                int* status)
-{
-  int k, naxis, bitpix;
+static void* workspace = NULL;
+static size_t workspace_size = 0;
 
-  if (*status == 0) {
-    if (fits_get_img_param(fptr, maxdims, &bitpix, &naxis,
-                           dims, status) != 0) {
-      /* An error occured, set values to avoid warnings about uninitialized
-         varaibles. */
-      if (bitpix_ptr != NULL) {
-        *bitpix_ptr = 0;
-      }
-      if (naxis_ptr != NULL) {
-        *naxis_ptr = 0;
-      }
-      if (number_ptr != NULL) {
-        *number_ptr = 0;
-      }
-    } else {
-      if (naxis > maxdims) {
-        y_error("too many dimensions");
-      }
-      if (bitpix_ptr != NULL) {
-        *bitpix_ptr = bitpix;
-      }
-      if (naxis_ptr != NULL) {
-        *naxis_ptr = naxis;
-      }
-      if (number_ptr != NULL) {
-        long number = 1;
-        for (k = 0; k < naxis; ++k) {
-          number *= dims[k];
-        }
-        *number_ptr = number;
-      }
+static void*
+get_workspace(size_t size)
+{
+  if (size > workspace_size) {
+    if (workspace != NULL) {
+      free(workspace);
     }
+    workspace = malloc(size);
+    workspace_size = (workspace != NULL ? size : 0);
   }
-  return *status;
+  return workspace;
 }